@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _ASYNCIO_H_
+#define _ASYNCIO_H_
+
+#include "btype.h"
+
+#ifdef UNIX
+#include <sys/uio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Asynchronous I/O engine. io_uring is used on Linux when the kernel supports it,
+   otherwise a pool of worker threads executes the requests with blocking syscalls,
+   and the socket requests getting EAGAIN are parked on an epoll instance until
+   the socket is ready. Requests are queued by asyncio_prep and submitted in batch
+   by asyncio_submit. Completion callbacks are invoked by asyncio_poll in the thread
+   calling it. The eventfd returned by asyncio_eventfd turns readable when some
+   requests complete, it can be added to an event loop to drive asyncio_poll. */
+
+#define ASYNCIO_NONE      0
+#define ASYNCIO_URING     1
+#define ASYNCIO_THREAD    2
+
+#define ASYNCIO_OP_NOP     0
+#define ASYNCIO_OP_READ    1
+#define ASYNCIO_OP_WRITE   2
+#define ASYNCIO_OP_READV   3
+#define ASYNCIO_OP_WRITEV  4
+#define ASYNCIO_OP_RECV    5
+#define ASYNCIO_OP_SEND    6
+#define ASYNCIO_OP_SPLICE  7   //from fd at offset to fdout, at most len bytes
+#define ASYNCIO_OP_FSYNC   8
+
+#define ASYNCIO_F_LINK       0x01  //next request starts after this one completes successfully
+#define ASYNCIO_F_FIXEDFILE  0x02  //fd is the index of files registered
+#define ASYNCIO_F_FIXEDBUF   0x04  //buf is within the buffer registered at bufindex
+
+/* result is the number of bytes transferred, or negative errno on failure.
+   the requests following a failed or short linked request get -ECANCELED.
+   a socket request of a chain getting EAGAIN is retried with the rest of the
+   chain once the socket is ready, the chain keeps its order on both engines */
+typedef void (AsyncIOCB) (void * cbpara, int64 result);
+
+typedef struct async_req_s {
+    int            opcode;
+    int            flags;
+
+    int            fd;
+    int            fdout;      //output fd of ASYNCIO_OP_SPLICE
+    int64          offset;     //-1 means current file position
+
+    void         * buf;
+    int            len;
+    struct iovec * iov;        //must be kept valid until completion
+    int            iovcnt;
+
+    int            bufindex;
+    int            msgflags;   //flags of recv/send
+
+    AsyncIOCB    * cb;
+    void         * cbpara;
+} AsyncReq;
+
+/* entries is the depth of the submission queue, threads is the number of workers
+   if io_uring is not available. engine ASYNCIO_THREAD forces the fallback engine */
+void * asyncio_init  (int entries, int threads, int engine);
+int    asyncio_clean (void * vaio);
+
+int    asyncio_engine  (void * vaio);
+int    asyncio_eventfd (void * vaio);
+int    asyncio_inflight (void * vaio);
+
+int    asyncio_register_buffers   (void * vaio, struct iovec * iov, int num);
+int    asyncio_unregister_buffers (void * vaio);
+int    asyncio_register_files     (void * vaio, int * fds, int num);
+int    asyncio_unregister_files   (void * vaio);
+
+/* queue the request without submitting, return 0 or negative on failure */
+int    asyncio_prep   (void * vaio, AsyncReq * req);
+
+/* submit all queued requests with one syscall, return the number submitted */
+int    asyncio_submit (void * vaio);
+
+/* reap the completed requests and invoke their callbacks, waiting at most
+   waitms milliseconds if none completed. return the number reaped */
+int    asyncio_poll   (void * vaio, int waitms);
+
+/* convenient wrappers of asyncio_prep + asyncio_submit */
+int    asyncio_read   (void * vaio, int fd, void * buf, int len, int64 offset, void * cb, void * cbpara);
+int    asyncio_write  (void * vaio, int fd, void * buf, int len, int64 offset, void * cb, void * cbpara);
+int    asyncio_readv  (void * vaio, int fd, struct iovec * iov, int iovcnt, int64 offset, void * cb, void * cbpara);
+int    asyncio_writev (void * vaio, int fd, struct iovec * iov, int iovcnt, int64 offset, void * cb, void * cbpara);
+int    asyncio_recv   (void * vaio, int fd, void * buf, int len, void * cb, void * cbpara);
+int    asyncio_send   (void * vaio, int fd, void * buf, int len, void * cb, void * cbpara);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -48,6 +48,12 @@ int       bpool_clean (bpool_t * pool);
 void    * bpool_fetch   (bpool_t * pool);
 int       bpool_recycle (bpool_t * pool, void * unit);
 
+/* switch the pool into lock-free mode, in which idle units are kept in ABA-safe
+   lock-free stacks and counters are updated by relaxed atomics. it must be set
+   before any unit is allocated. the rbtree check against recycling a unit twice
+   is skipped in this mode. */
+int       bpool_set_lockfree    (bpool_t * pool, int lockfree);
+
 int       bpool_set_initfunc    (bpool_t * pool, void * init);
 int       bpool_set_freefunc    (bpool_t * pool, void * free);
 int       bpool_set_getsizefunc (bpool_t * pool, void * getsize);
@@ -63,6 +69,16 @@ int       bpool_remaining (bpool_t * mp);
 int       bpool_status (bpool_t * pool, int * allocated, int * remaining,
                         int * consumed, int * fifonum, int * refifonum);
 
+/* pre-allocate units until at least unitnum units are available. flags are
+   KMEM_PREFAULT and KMEM_MLOCK. pms returns the elapsed milliseconds.
+   return the number of units pre-allocated. */
+int       bpool_warmup (bpool_t * pool, int unitnum, int flags, int threads, long * pms);
+
+/* return the pages of idle units to OS, return the bytes trimmed. when trimtime
+   is set, it's done in recycling after the pool stays idle for trimtime seconds */
+long      bpool_trim (bpool_t * pool);
+int       bpool_set_trimtime (bpool_t * pool, int idlesec);
+
 #ifdef __cplusplus
 }
 #endif
@@ -81,6 +81,10 @@ typedef char                int8;
 #define ADF_ALIGNMENT sizeof(ulong)
 #endif
 
+#ifndef ADF_CACHELINE
+#define ADF_CACHELINE 64
+#endif
+
 #define align_size(d, a) (((d) + (a - 1)) & ~(a - 1))
 #define align_ptr(p, a)  (uint8 *) (((uintptr_t) (p) + ((uintptr_t) a - 1)) & ~((uintptr_t) a - 1))
 
@@ -187,6 +187,9 @@ typedef struct chunk_ {
     void          * procnotifypara;
     uint64          procnotifycbval;
 
+    void          * zcopy;  //zero-copy send tracker of the destination socket
+
+
 } chunk_t, *chunk_p;
 
 void * chunk_alloc (int buflen, int alloctype, void * mpool);
@@ -225,6 +228,13 @@ int64  chunk_write_file   (void * vck, int fd, int64 offset, int64 length, int h
 int    chunk_go_ahead (void * vck, void * msg, int64 offset, int64 step);
 
 int    chunk_add_buffer       (void * vck, void * pbuf, int64 len);
+
+/* buffer entity filled in place: memory from chunk_buffer_alloc, which has one
+   more byte than size for the NUL, is written by the caller and then handed
+   over by chunk_add_buffer_own without copying. chunk frees it afterwards */
+void * chunk_buffer_alloc     (void * vck, int64 size);
+void   chunk_buffer_free      (void * vck, void * pbuf);
+int    chunk_add_buffer_own   (void * vck, void * pbuf, int64 len);
 int64  chunk_prepend_strip_buffer (void * vck, void * pbuf, int64 len, char * escch, int chlen, uint8 isheader);
 int64  chunk_add_strip_buffer     (void * vck, void * pbuf, int64 len, char * escch, int chlen);
 int64  chunk_append_strip_buffer  (void * vck, void * pbuf, int64 len, char * escch, int chlen);
@@ -278,6 +288,72 @@ int    chunk_vec_get (void * vck, int64 pos, chunk_vec_t * pvec, int httpchunk);
 
 int    chunk_writev (void * vck, int fd, int64 offset, int64 * actnum, int httpchunk);
 
+/* send plan: consecutive memory entities are gathered into one iovec run of up to
+   CHUNK_PLAN_IOVS, file entities become sendfile segments placed between them. The
+   plan is built in one pass over the entities and kept across partial writes, so
+   the next flush resumes from where the socket became full without rescanning. */
+
+#define CHUNK_PLAN_IOVS   1024   //IOV_MAX of Linux and BSD
+#define CHUNK_PLAN_SEGS   64
+
+typedef struct chunk_plan_seg {
+    uint8         segtype;   //1-mem buffer  2-file  3-mem buffer by zero-copy
+    int           iovbgn;    //first iovec of mem run
+    int           iovcnt;
+    int           filefd;
+    int64         fpos;
+    int64         size;      //bytes remaining in this segment
+} ckplanseg_t;
+
+typedef struct chunk_plan {
+    void        * ck;
+    int           httpchunk;
+    int64         offset;    //chunk offset where the plan begins
+    int64         size;      //bytes covered by the plan
+    int64         sent;      //bytes of the plan already sent
+
+    int           segind;    //current segment
+    int           iovind;    //current iovec of the mem segment
+    int           segnum;
+    int           iovnum;
+    ckplanseg_t   segs[CHUNK_PLAN_SEGS];
+    struct iovec  iovs[CHUNK_PLAN_IOVS];
+
+    int64         flushbytes; //bytes sent by the last flush
+    int           flushcalls; //writev/sendfile system calls of the last flush
+    int           builds;     //plans built by the last flush
+    uint64        totalbytes;
+    uint64        totalcalls;
+    uint64        flushnum;
+} chunk_plan_t;
+
+chunk_plan_t * chunk_plan_new (void);
+void   chunk_plan_free  (chunk_plan_t * plan);
+
+/* drop the cached plan. must be called after the unsent part of the chunk is removed
+   or modified. appending entities to the chunk does not require it */
+void   chunk_plan_reset (chunk_plan_t * plan);
+
+/* send the chunk data from offset to non-blocking fd using the plan. return value and
+   actnum are same as chunk_writev. flushbytes and flushcalls of plan are refreshed */
+int    chunk_writev_plan (void * vck, int fd, int64 offset, chunk_plan_t * plan,
+                          int64 * actnum, int httpchunk);
+
+/* set the zcopy tracker of destination socket. chunk_writev_plan then sends the
+   bufptr entities not smaller than its threshold with MSG_ZEROCOPY, and chunk_remove
+   hands their porig to zcopy_hold instead of calling freefunc directly. bufptr added
+   without freefunc must not be reused by caller until zcopy_inflight drops to 0 */
+int    chunk_set_zerocopy (void * vck, void * zcopy);
+
+#ifdef _LINUX_
+/* send the chunk data from offset to fd asynchronously through the asyncio engine.
+   memory buffers are written via writev, file data is spliced through a pipe.
+   cb is AsyncIOCB, called with the total bytes sent when all available data are
+   sent, or negative errno on failure. the chunk must be kept unchanged until then.
+   return 1 if started, 0 if nothing to send */
+int    chunk_writev_async (void * vck, int fd, int64 offset, int httpchunk, void * aio, void * cb, void * cbpara);
+#endif
+
 /* access the contents of the chunk by specifying an offset or using pattern matching */
 
 typedef struct ckpos_vec {
@@ -65,6 +65,44 @@ int     conf_set_double   (void * conf, char * sect, char * key, double value);
 int     conf_set_bool     (void * conf, char * sect, char * key, uint8 value);
 
 
+/* Compiled config snapshot. Section and key are resolved through a minimal perfect
+   hash built when the snapshot is compiled, and every value is parsed into its
+   integer, double and bool forms at the same time, so the getters do no string
+   work. A snapshot is immutable once built and freed with its last reference.
+   The getters return the same defaults as conf_get_xxx for a missing key.
+   Items placed before the first section belong to the section NULL. */
+
+void  * conf_snap_build   (void * conf);
+void  * conf_snap_load    (char * file);
+void  * conf_snap_hold    (void * snap);
+void    conf_snap_release (void * snap);
+int     conf_snap_num     (void * snap);
+uint32  conf_snap_version (void * snap);
+
+char  * conf_snap_string  (void * snap, char * sect, char * key);
+int     conf_snap_int     (void * snap, char * sect, char * key);
+uint32  conf_snap_ulong   (void * snap, char * sect, char * key);
+long    conf_snap_hexlong (void * snap, char * sect, char * key);
+double  conf_snap_double  (void * snap, char * sect, char * key);
+uint8   conf_snap_bool    (void * snap, char * sect, char * key);
+
+/* Live config of a file: the current snapshot is replaced as a whole when the file
+   is reloaded, a snapshot already taken by a reader stays valid until released.
+   conf_live_get takes a reference to the current snapshot without any lock.
+   conf_live_update returns snap itself while it is still current, otherwise it
+   releases snap and takes the current one, so a worker keeping its snapshot
+   across requests pays one pointer compare per check.
+   With watch set, a thread reloads the file on inotify events (Linux only).
+   A file that fails to load leaves the current snapshot in place. */
+
+void  * conf_live_open    (char * file, int watch);
+int     conf_live_close   (void * live);
+int     conf_live_reload  (void * live);
+
+void  * conf_live_get     (void * live);
+void  * conf_live_update  (void * live, void * snap);
+
+
 #ifdef __cplusplus
 }
 #endif
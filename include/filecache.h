@@ -44,6 +44,25 @@ void * file_cache_init (int packnum, int packsize);
 int    file_cache_clean(void * vcache);
 
 int file_cache_set_prefix_ratio (void * vcache, float ratio);
+
+/* keep 'ahead' packs after the read position loaded by a background thread once
+   sequential reading is detected, and advise the kernel to read ahead the data beyond
+   them. file_cache_read/at then block only when the prefetch lags. ahead is limited
+   by packnum minus the prefix packs, 0 stops the thread. it is UNIX only */
+int file_cache_prefetch (void * vcache, int ahead);
+
+/* return prefetch ahead, the packs loaded by prefetch and the reads waiting for it */
+int file_cache_prefetch_stat (void * vcache, uint64 * loaded, uint64 * lagged);
+
+/* map the local file from the setting offset into memory and bypass the packs.
+   file_cache_ptr/len then expose the content without copying, and the skip functions
+   scan the mapping directly. flags are FBUF_MAP_POPULATE and FBUF_MAP_SEQUENTIAL
+   defined in fileop.h. enable 0 unmaps it. UNIX only, call it after setfile */
+int file_cache_mmap (void * vcache, int enable, int flags);
+
+int    file_cache_len (void * vcache, int * successive);
+void * file_cache_ptr (void * vcache);
+
 int file_cache_setbuf  (void * vcache, void * pbuf, int buflen, int packsize);
 
 int file_cache_setfile (void * vcache, char * file, int64 offset);
@@ -56,6 +56,11 @@ int filefd_write  (int fd, void * pbuf, int size);
 int filefd_writev (int fd, void * piov, int iovcnt, int64 * actnum);
 int filefd_copy   (int fdin, int64 offset, int64 length, int fdout, int64 * actnum);
 
+/* move file data from fdin at offset to fdout through a pipe by splice, without copying
+   into user space. fdout can be a socket or another file. filefd_copy falls back to it
+   when sendfile is not supported for the descriptors */
+int filefd_splice (int fdin, int64 offset, int64 length, int fdout, int64 * actnum);
+
 long  file_read  (FILE * fp, void * buf, long readlen);
 long  file_write (FILE * fp, void * buf, long writelen);
 int64 file_seek  (FILE * fp, int64 pos, int whence);
@@ -112,6 +117,14 @@ int64  fbuf_size (void * vfb);
 
 int    fbuf_mmap (void * vfb, int64 pos);
 
+#define FBUF_MAP_POPULATE    0x01  //prefault the pages of each window via MAP_POPULATE
+#define FBUF_MAP_SEQUENTIAL  0x02  //advise the kernel of sequential access for read-ahead
+
+/* set the size of the sliding mapping window, 0 or a size not less than file size
+   maps the whole file at once. fbuf_ptr then returns the file content directly
+   without copying, and the skip functions scan the mapped memory window by window */
+int    fbuf_mapmode (void * vfb, int64 winsize, int flags);
+
 int    fbuf_at   (void * vfb, int64 pos);
 void * fbuf_ptr  (void * vfb, int64 pos, void ** ppbuf, int * plen);
 int    fbuf_read (void * vfb, int64 pos, void * pbuf, int len);
@@ -32,14 +32,20 @@
 
 #include "btype.h"
 
+#ifdef UNIX
+#include <sys/uio.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct FrameST_ {
 
-    unsigned   allocnum  : 30;
+    unsigned   allocnum  : 28;
     unsigned   alloctype : 2; //0-default kalloc/kfree 1-os-specific malloc/free 2-kmempool alloc/free 3-kmemblk alloc/free
+    unsigned   poolmode  : 1; //frame header and data buffers are fetched from frmpool size classes
+    unsigned   pooldata  : 1; //current data buffer belongs to frmpool, its size is class size - 1
 
     int        size;
     int        start;
@@ -59,6 +65,11 @@ frame_p frame_alloc_dbg (int size, int alloctype, void * mpool, char * file, int
 #define frame_new(size)  frame_new_dbg((size), __FILE__, __LINE__)
 frame_p frame_new_dbg    (int size, char * file, int line);
 
+/* frame whose header and data buffer come from the size-class pool of frmpool.
+   data buffer is not zeroed, frame_grow moves it to the next class, and frame_free
+   returns both to the pool. data beyond 1M bytes falls back to kalloc */
+frame_p frame_pool_new (int size);
+
 void    frame_free   (frame_t * frm);
 void    frame_free_inner (frame_p frm);
 void    frame_delete (frame_p * pfrm);
@@ -175,9 +186,42 @@ int     frame_tcp_send (frame_p frm, SOCKET fd, int waitms, int * actnum);
 #define frame_tcp_nbzc_recv(frm, fd, num, err) frame_tcp_nbzc_recv_dbg(frm, fd, num, err, __FILE__, __LINE__)
 int frame_tcp_nbzc_recv_dbg (frame_p frm, SOCKET fd, int * actnum, int * perr, char * file, int line);
 
+#ifdef _LINUX_
+/* receive at most size bytes appended to frame asynchronously through the asyncio
+   engine. cb is AsyncIOCB, called with the bytes received, 0 on peer closing, or
+   negative errno. the frame must not be modified until then */
+int     frame_tcp_recv_async (frame_p frm, SOCKET fd, int size, void * aio, void * cb, void * cbpara);
+#endif
+
 int     frame_tcp_nb_recv (frame_p frm, SOCKET fd, int * actnum, int * perr);
 int     frame_tcp_nb_send (frame_p frm, SOCKET fd, int * actnum);
 
+/* buffer chain: frames linked by next, each holding a segment of the byte stream.
+   frame_chain_recv reads the socket with one readv into the rest of the tail frame and
+   several pooled frames of bufsize, without FIONREAD. *pchain may be NULL initially.
+   the chain can be parsed in place through the view functions, and frame_free releases
+   all of it. linearize copies it into one frame only when contiguous bytes are needed */
+int     frame_chain_recv (frame_p * pchain, SOCKET fd, int bufsize, int * actnum, int * perr);
+
+int64   frame_chain_len (frame_p chain);
+int     frame_chain_num (frame_p chain);
+
+/* fill iov with the segments starting from pos, return the number of iovec filled */
+int     frame_chain_iov (frame_p chain, int64 pos, struct iovec * iov, int maxnum);
+
+int     frame_chain_get  (frame_p chain, int64 pos);
+int     frame_chain_getn (frame_p chain, int64 pos, void * pbuf, int len);
+
+/* return the position of pattern found from pos across frame boundaries, or -1 */
+int64   frame_chain_search (frame_p chain, int64 pos, void * pat, int patlen);
+
+/* remove len bytes from the head, frames consumed completely are freed */
+void    frame_chain_del_first (frame_p * pchain, int64 len);
+
+/* merge all frames into one pooled frame with one copy. the old chain is freed and
+   *pchain is replaced. a chain of only one frame is returned as is */
+frame_p frame_chain_linearize (frame_p * pchain);
+
 
 int     frame_bin_to_base64 (frame_p srcfrm, frame_p dstfrm);
 int     frame_base64_to_bin (frame_p srcfrm, frame_p dstfrm);
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _FRMPOOL_H_
+#define _FRMPOOL_H_
+
+#include "btype.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size-class pool for the data buffers and headers of frame_t. Buffers are kept in
+   power-of-two classes from 1K to 1M bytes. Each thread holds a small cache of idle
+   buffers per class, which is refilled from or drained to the global idle list in
+   batches, so a steady flow of frame allocation and release takes no lock and calls
+   no malloc. Buffers above the largest class are not pooled. */
+
+#define FRMPOOL_MIN_SHIFT   10
+#define FRMPOOL_MAX_SHIFT   20
+
+#define FRMPOOL_HDR         0    //class of frame_t headers
+#define FRMPOOL_CLASSES     (FRMPOOL_MAX_SHIFT - FRMPOOL_MIN_SHIFT + 2)
+
+typedef struct frmpool_stat_s {
+    int        unitsize;
+    long       allocated;   //units allocated from system
+    long       idle;        //units kept in global list and thread caches
+
+    uint64     hit;         //fetched from thread cache
+    uint64     refill;      //fetched from global idle list
+    uint64     miss;        //allocated from system
+    uint64     recycle;     //returned to the pool
+} FrmPoolStat;
+
+/* return the class of the buffer that holds size bytes, -1 if beyond the largest class */
+int    frmpool_class      (int size);
+int    frmpool_class_size (int cls);
+
+void * frmpool_get (int cls);
+void   frmpool_put (void * p, int cls);
+
+/* return the idle units cached by current thread to the global list */
+void   frmpool_thread_flush ();
+
+/* release the units in the global idle list to system, return the bytes released */
+long   frmpool_trim ();
+
+/* fill the array with the counters of at most num classes, return the class number */
+int    frmpool_status (FrmPoolStat * st, int num);
+void   frmpool_print  (FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
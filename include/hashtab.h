@@ -133,6 +133,10 @@ int ht_num (hashtab_t * ht);
  * to the key is never set, NULL is returned. */
 void * ht_get (hashtab_t * ht, void * key);
 
+/* same as ht_get, with the hash of key computed by the caller beforehand
+ * through the hash function of the table. */
+void * ht_get_hash (hashtab_t * ht, void * key, ulong hash);
+
 
 int ht_sort (hashtab_t * ht, HashTabCmp * cmp);
 
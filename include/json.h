@@ -60,11 +60,21 @@ typedef struct json_item {
 void * json_item_alloc ();
 int    json_item_free (void * vitem);
 
+/* objects with few items keep them in an inline array, searched linearly by
+   name length and first byte. beyond JSON_INLINE_ITEMS, they are moved into
+   a hashtab in insertion order */
+#define JSON_INLINE_ITEMS  8
+
+/* flags of json_alloc */
+#define JSON_NOLOCK        0x01  //accessed by single thread, no locking
+
 typedef struct json_obj {
  
     CRITICAL_SECTION   objCS;
-    hashtab_t        * objtab;
-    int                bytenum;
+    hashtab_t        * objtab;   //NULL while items are in initem
+    JsonItem         * initem[JSON_INLINE_ITEMS];
+    int                innum;
+    int                bytenum;  //bytes encoded by own names and values, -1 not counted
  
     uint8              kvsep;
     uint8              itemsep;
@@ -79,6 +89,7 @@ typedef struct json_obj {
     unsigned           sptype:2;   //0-standard separator(:,) 1-conf-like separator(=;)
     unsigned           cmtflag:2;  //0-not support comment  1-support comment
     unsigned           sibcoex:2;  //0-same keys exclude  1-same keys coexist
+    unsigned           nolock:1;   //1-objCS not used, single-thread access
  
     unsigned           splen:4;
     unsigned           kvsplen:4;
@@ -92,6 +103,7 @@ typedef struct json_obj {
 void * json_item_get (void * vobj, void * name, int namelen);
 int    json_item_add (void * vobj, void * name, int namelen, void * vitem);
 void * json_item_del (void * vobj, void * name, int namelen);
+void * json_item_at  (void * vobj, int ind);  //ind-th item in insertion order
 
 
 /* sptype: separator type
@@ -99,6 +111,7 @@ void * json_item_del (void * vobj, void * name, int namelen);
     1-->  { "key"="value"; "name"="data"}
  */
 void * json_init  (int sptype, int cmtflag, int sibcoex);
+void * json_alloc (int sptype, int cmtflag, int sibcoex, int flags);
 int    json_clean (void * vobj);
 
 int    json_size (void * vobj);
@@ -150,6 +163,63 @@ int    json_get_int64  (void * vobj, void * key, int keylen, int ind, int64 * va
 int    json_get_uint64 (void * vobj, void * key, int keylen, int ind, uint64 * val);
 int    json_get_double (void * vobj, void * key, int keylen, int ind, double * val);
 
+
+/* A json_mget style path split into segments and hashed once, for constant
+   paths looked up again and again. The path text is copied. */
+typedef struct json_path_seg {
+    uint8            * name;
+    int                namelen;
+    int                index;   //value index of the key, -1 the last one
+    ulong              hash;    //hash of name as computed by the member table
+} JsonPathSeg;
+
+typedef struct json_path {
+    int                segnum;
+    JsonPathSeg        seg[1];
+} JsonPath;
+
+void * json_path_compile (void * path, int pathlen);
+void   json_path_free    (void * vpath);
+
+/* same result as json_mget_value with the path compiled */
+int    json_path_get_value (void * vobj, void * vpath, void ** pval, int * vallen, void ** pobj);
+
+/* Batch extraction: a set of paths resolved in one go into members of a
+   caller struct. Paths sharing leading segments are walked once. */
+#define JSON_FIELD_INT      1   //int
+#define JSON_FIELD_INT64    2   //int64
+#define JSON_FIELD_UINT64   3   //uint64
+#define JSON_FIELD_DOUBLE   4   //double
+#define JSON_FIELD_BOOL     5   //uint8, 1 for true/yes/on or a non-zero number
+#define JSON_FIELD_STR      6   //char array of 'size' bytes, NUL terminated
+#define JSON_FIELD_PTR      7   //ckstr_t pointing to the value in place
+#define JSON_FIELD_OBJ      8   //void * of the sub JsonObj, json_extract only
+
+#define JSON_EXTRACT_MAX    64
+
+typedef struct json_field {
+    char             * path;    //json_mget style path
+    int                type;    //JSON_FIELD_XXX
+    int                offset;  //offsetof the member in the caller struct
+    int                size;    //bytes of the member for JSON_FIELD_STR
+} JsonField;
+
+void * json_extract_compile (JsonField * fld, int num);
+void   json_extract_free    (void * vext);
+
+/* fill the members of dst from the JsonObj tree. members of the fields not
+   found are left untouched. string values are taken as escaped JSON text, the
+   way json_decode keeps them: JSON_FIELD_STR gets them unescaped and
+   JSON_FIELD_PTR points to them raw, the same as json_extract_text.
+   return the number of fields filled */
+int    json_extract      (void * vext, void * vobj, void * dst);
+
+/* the same directly from the first JSON value of the text in one pass of the
+   pull parser, without building a tree. the members get the same bytes as
+   json_extract on the tree decoded from the text. return the number of fields
+   filled or a negative parse error */
+int    json_extract_text (void * vext, void * json, int length, void * dst);
+
 /* if key exists, it's value will be appended the new content */
 int    json_append      (void * vobj, void * key, int keylen, void * val, int vallen, uint8 strip);
 int    json_append_file (void * vobj, void * key, int keylen, char * fname, long startpos, long length);
@@ -179,9 +249,18 @@ int    json_add_double (void * vobj, void * key, int keylen, double val, uint8 i
 int    json_decode (void * vobj, void * pjson, int length, int findobjbgn, int strip);
 int    json_decode_file (void * vobj, void * fn, int fnlen, int findobjbgn, int strip);
 
+/* json_size gives the exact bytes of output, with the bytes of each object's
+   own names and values counted once and kept in bytenum until it changes.
+   json_encode2 appends to the frame after growing it at most once */
 int    json_encode (void * vobj, void * pjson, int len);
 int    json_encode2 (void * vobj, frame_p objfrm);
 
+/* encode into chunk_t as buffer entities of about blksize bytes (64K if 0)
+   that are filled in place and owned by the chunk. an object smaller than a
+   block is written into it whole, a bigger one member by member. return the
+   bytes appended or negative */
+int64  json_encode_chunk (void * vobj, void * chunk, int blksize);
+
 long   json_fca_decode (void * vobj, void * fca, long startpos, long length);
 
 #ifdef __cplusplus
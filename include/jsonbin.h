@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _JSONBIN_H_
+#define _JSONBIN_H_
+
+#include "frame.h"
+#include "numconv.h"
+#include "jsonpull.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MessagePack and CBOR serialization of JsonObj trees. An object becomes a
+   map, an item holding an array becomes an array, and values are written as
+   strings just as json_encode quotes them. With JSON_BIN_TYPED, values that
+   read back to the same text are written as integers, doubles, booleans or
+   nil, so the peer gets typed data and skips number parsing.
+
+   json_bin_next walks binary input without building a tree and returns the
+   same events as json_pull_next. Strings are returned pointing into the
+   input, numbers, booleans and nil as decimal text or true/false/null in a
+   small buffer of the reader. Input may hold several root values in a row.
+
+       json_bin_init(&bin, JSON_BIN_MSGPACK, p, len);
+       while ((ev = json_bin_next(&bin, &val, &vlen)) > 0 && ev != JSON_PULL_END) ...
+ */
+
+#define JSON_BIN_MSGPACK   0
+#define JSON_BIN_CBOR      1
+#define JSON_BIN_TYPED     0x10   //or'ed with format, type the values by their text
+
+typedef struct json_bin_s {
+    uint8    * data;
+    int        len;
+    int        pos;
+
+    uint8      fmt;
+    uint8      docend;
+    int        err;
+
+    int        depth;
+    struct {
+        uint8  type;     //1-map 2-array
+        uint8  indef;    //CBOR indefinite length, ended by break
+        uint8  key;      //next item of map is a key
+        int64  remain;   //items left, keys and values counted both
+    } stack[JSON_PULL_DEPTH];
+
+    uint8      numbuf[NUM_DTOA_SIZE];  //text of last number value
+    uint8      keybuf[NUM_DTOA_SIZE];  //text of last number key
+} JsonBin;
+
+/* return the bytes of output. p may be NULL or short to get the size only */
+int    json_bin_encode  (void * vobj, int fmt, void * p, int len);
+
+/* append to the frame, encoded in one pass and grown on demand.
+   return the bytes appended */
+int    json_bin_encode2 (void * vobj, int fmt, frame_p objfrm);
+
+/* append to chunk_t as owned buffer entities of about blksize bytes (64K if 0)
+   filled in place. return the bytes appended or negative */
+int64  json_bin_encode_chunk (void * vobj, int fmt, void * chunk, int blksize);
+
+/* error codes of json_bin_next and json_bin_decode:
+     -1 truncated input, -2 malformed or unsupported (CBOR chunked strings),
+     -3 nesting beyond JSON_PULL_DEPTH, -4 array in array, which JsonObj
+     has no place for, -5 root value not a map */
+int    json_bin_init (JsonBin * bin, int fmt, void * p, int len);
+int    json_bin_next (JsonBin * bin, void ** pval, int * vallen);
+
+/* decode the root map at the start of p into JsonObj.
+   return the bytes consumed or negative */
+int    json_bin_decode (void * vobj, int fmt, void * p, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _JSONPULL_H_
+#define _JSONPULL_H_
+
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pull parser for JSON arriving in fragments. Input is fed piece by piece as
+   it is received from a socket, chunk_t or file cache, and json_pull_next
+   returns one event at a time. Nothing but the token under construction is
+   kept: names and values point into the fragment fed, and only a token split
+   across two fragments is copied aside. A stream may hold any number of root
+   values one after another, as NDJSON exports do, and JSON_PULL_DOC_END is
+   returned after each of them. Memory use stays constant however big the
+   stream is.
+
+       json_pull_init(&pull, 0);
+       while ((len = read_some(buf)) > 0) {
+           json_pull_feed(&pull, buf, len);
+           while ((ev = json_pull_next(&pull, &val, &vlen)) > 0) ...
+           if (ev < 0) break;
+       }
+       json_pull_finish(&pull);
+       while ((ev = json_pull_next(&pull, &val, &vlen)) > 0) ...
+       json_pull_clean(&pull);
+ */
+
+#define JSON_PULL_MORE        0   //fragment consumed, feed the next one
+#define JSON_PULL_OBJ_BEGIN   1
+#define JSON_PULL_OBJ_END     2
+#define JSON_PULL_ARR_BEGIN   3
+#define JSON_PULL_ARR_END     4
+#define JSON_PULL_KEY         5   //member name, escapes kept raw
+#define JSON_PULL_STR         6   //string value without quotes, escapes kept raw
+#define JSON_PULL_RAW         7   //number, true, false, null or other bare word
+#define JSON_PULL_DOC_END     8   //a root value is complete
+#define JSON_PULL_END         9   //input finished and all of it parsed
+
+#define JSON_PULL_DEPTH       512
+
+typedef struct json_pull_s {
+    uint8    * data;       //fragment being parsed
+    int        len;
+    int        pos;
+    int64      offset;     //stream offset of data[0]
+
+    uint8      state;      //what the grammar expects next
+    uint8      lex;        //token left open at the end of last fragment
+    uint8      quote;      //quote char of the open string
+    uint8      bslash;     //open string ended with an unpaired backslash
+    uint8      iskey;      //open token is a member name
+    uint8      esc;        //string of last KEY/STR event has escapes
+    uint8      docend;     //root value completed, DOC_END pending
+    uint8      eof;        //json_pull_finish was called
+    uint8      tokused;    //tok holds the value of last event
+    int        err;
+
+    int        depth;
+    uint8      stack[JSON_PULL_DEPTH];
+
+    frame_p    tok;        //token split across fragments
+    int        maxtok;     //upper limit of tok, 0 unlimited
+
+    uint8    * buf;        //read buffer of json_pull_feed_fca
+    int        bufsize;
+} JsonPull;
+
+/* maxtok limits the bytes of one name or value, 0 means no limit */
+void  json_pull_init  (JsonPull * pull, int maxtok);
+void  json_pull_clean (JsonPull * pull);
+void  json_pull_reset (JsonPull * pull);
+
+/* give the next fragment. the previous one must have been consumed, that is
+   json_pull_next has returned JSON_PULL_MORE. data must stay unchanged until
+   then. return 0 or negative */
+int   json_pull_feed   (JsonPull * pull, void * data, int len);
+
+/* no more input follows: a trailing bare word is completed and an unfinished
+   value becomes an error */
+int   json_pull_finish (JsonPull * pull);
+
+/* return the next event, JSON_PULL_MORE if the fragment is used up, or a
+   negative value that sticks until json_pull_reset: -1 truncated at the end
+   of input, -2 syntax error, -3 too deep, -4 token over maxtok or out of
+   memory. pval/vallen get the bytes of KEY, STR and RAW events, which stay
+   valid until the next call. pull->esc tells whether json_unescape is needed */
+int   json_pull_next   (JsonPull * pull, void ** pval, int * vallen);
+
+/* stream offset of the next byte to be parsed */
+int64 json_pull_offset (JsonPull * pull);
+
+/* feed the contiguous bytes of chunk starting at *pos and advance *pos.
+   return the bytes fed, 0 when the chunk is exhausted */
+int   json_pull_feed_chunk (JsonPull * pull, void * chunk, int64 * pos);
+
+/* read the next block from the current position of file cache into an
+   internal buffer and feed it. return the bytes fed, 0 at end of file */
+int   json_pull_feed_fca   (JsonPull * pull, void * fca);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
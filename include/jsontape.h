@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _JSONTAPE_H_
+#define _JSONTAPE_H_
+
+#include "btype.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* JSON tape: the tokens of a JSON text in document order, referring to the
+   source buffer by offsets. It is built in two stages: a SIMD pass classifies
+   every 64-byte block into bitmasks of quotes, escapes and structural chars,
+   then one linear pass walks the set bits and validates the grammar.
+   Object members are stored as a key string token followed by the value.
+   Container tokens keep the index past their last child, so any value can be
+   skipped in O(1) without looking at its content. */
+
+#define JSON_TOK_OBJ   1
+#define JSON_TOK_ARR   2
+#define JSON_TOK_STR   3   //string, pos/len exclude the quotes, escapes kept raw
+#define JSON_TOK_RAW   4   //number, true, false, null or other bare word
+
+#define JSON_TAPE_EMPTYKEY  0x01   //some object has a zero-length key
+#define JSON_TAPE_NESTARR   0x02   //some array has an array element
+
+#define JSON_TAPE_DEPTH     512
+
+typedef struct json_tok_s {
+    uint32     type : 3;
+    uint32     esc  : 1;    //string contains backslash escapes
+    uint32     num  : 28;   //container: number of members or elements
+    uint32     pos;         //offset of '{' '[', string content or bare word
+    uint32     len;         //bytes of string content, bare word or whole container
+    uint32     next;        //index of the token following this value
+} JsonTok;
+
+typedef struct json_tape_s {
+    uint8    * json;
+    int        jsonlen;
+
+    JsonTok  * tok;
+    int        num;
+    int        size;
+
+    int        end;         //offset past the root value
+    int        flags;
+} JsonTape;
+
+void json_tape_init  (JsonTape * tape);
+void json_tape_clean (JsonTape * tape);
+
+/* tokenize the JSON value starting at json, trailing bytes after the root
+   value are not examined. json must stay unchanged while tape is used.
+   return the offset past the root value, or a negative value if the text is
+   not strictly well-formed: -1 truncated, -2 syntax error, -3 too deep,
+   -4 out of memory */
+int  json_tape_parse (JsonTape * tape, void * json, int length);
+
+
+/* Read-only lazy document over a parsed tape. Values are addressed by token
+   index, 0 being the root. Nothing is copied or allocated by the accessors:
+   names and values stay in the source buffer and strings are unescaped only
+   when json_tape_str is asked for them. Keys match case-insensitively against
+   the text as written, and if a key repeats the last one wins, the same as
+   json_decode into JsonObj does. An array value is treated like a key holding
+   multiple values: 'index' picks the element, -1 the last one. */
+
+/* token index of the index-th value of key in object 'obj', or negative:
+   -1 bad tape, -2/-3 bad key, -4 obj not an object, -100 no such key,
+   -200 index out of range */
+int  json_tape_get_value  (JsonTape * tape, int obj, void * key, int keylen, int index);
+
+/* token index of the value at a json_mget style path from the root,
+   eg. "http.server.location[0].errpage.504" */
+int  json_tape_mget_value (JsonTape * tape, void * path, int pathlen);
+
+/* iterate the members of an object or the elements of an array. *pcur is 0 at
+   the start. return the value token, or -1 at the end. pkey/keylen get the
+   raw member name of objects */
+int  json_tape_iter (JsonTape * tape, int ind, int * pcur, void ** pkey, int * keylen);
+
+/* raw bytes of a value: string content with escapes kept, bare word, or the
+   whole text of a container. return the token type or negative */
+int  json_tape_ptr (JsonTape * tape, int ind, void ** pval, int * vallen);
+
+/* copy the value into buf with escapes decoded, \u sequences as UTF-8, NUL
+   terminated and truncated to size - 1 bytes. return the bytes copied */
+int  json_tape_str (JsonTape * tape, int ind, void * buf, int size);
+
+/* decode the escapes of JSON string content the same way into buf */
+int  json_unescape (void * src, int len, void * buf, int size);
+
+/* numeric and boolean value of a string or bare word. return 0 or negative */
+int  json_tape_int64  (JsonTape * tape, int ind, int64 * val);
+int  json_tape_uint64 (JsonTape * tape, int ind, uint64 * val);
+int  json_tape_double (JsonTape * tape, int ind, double * val);
+int  json_tape_bool   (JsonTape * tape, int ind, uint8 * val);
+
+int  json_tape_get_int    (JsonTape * tape, int obj, void * key, int keylen, int index, int * val);
+int  json_tape_get_int64  (JsonTape * tape, int obj, void * key, int keylen, int index, int64 * val);
+int  json_tape_get_uint64 (JsonTape * tape, int obj, void * key, int keylen, int index, uint64 * val);
+int  json_tape_get_double (JsonTape * tape, int obj, void * key, int keylen, int index, double * val);
+int  json_tape_get_bool   (JsonTape * tape, int obj, void * key, int keylen, int index, uint8 * val);
+int  json_tape_get_str    (JsonTape * tape, int obj, void * key, int keylen, int index, void * buf, int size);
+
+int  json_tape_mget_int    (JsonTape * tape, void * path, int pathlen, int * val);
+int  json_tape_mget_int64  (JsonTape * tape, void * path, int pathlen, int64 * val);
+int  json_tape_mget_uint64 (JsonTape * tape, void * path, int pathlen, uint64 * val);
+int  json_tape_mget_double (JsonTape * tape, void * path, int pathlen, double * val);
+int  json_tape_mget_bool   (JsonTape * tape, void * path, int pathlen, uint8 * val);
+int  json_tape_mget_str    (JsonTape * tape, void * path, int pathlen, void * buf, int size);
+
+/* materialize the object token 'ind' into a new JsonObj, implemented in json.c */
+void * json_tape_obj (JsonTape * tape, int ind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _KATOMIC_H_
+#define _KATOMIC_H_
+
+#include "btype.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Thin wrappers of the compiler atomic builtins. The generic macros take operands
+   of any integer or pointer type with GCC/Clang. MSVC has no generic form, there
+   the generic macros work on 32-bit integers, and katomic_add64 on 64-bit ones. */
+
+#if defined(__GNUC__) || defined(__clang__)
+
+#define katomic_load(p)              __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define katomic_load_relaxed(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define katomic_store(p, v)          __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define katomic_store_relaxed(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+#define katomic_add(p, v)            __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define katomic_add_relaxed(p, v)    __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define katomic_add64(p, v)          __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define katomic_xchg(p, v)           __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+
+/* compare *p with *pexp, store v into *p if equal, otherwise load *p into *pexp.
+   return non-zero on success */
+#define katomic_cas(p, pexp, v)      __atomic_compare_exchange_n((p), (pexp), (v), 0, \
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#define katomic_fence()              __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#elif defined(_MSC_VER)
+
+#define katomic_load(p)              (_ReadWriteBarrier(), *(p))
+#define katomic_load_relaxed(p)      (*(p))
+#define katomic_store(p, v)          do { _ReadWriteBarrier(); *(p) = (v); } while (0)
+#define katomic_store_relaxed(p, v)  (*(p) = (v))
+
+#define katomic_add(p, v)            (_InterlockedExchangeAdd((volatile long *)(p), (long)(v)) + (long)(v))
+#define katomic_add_relaxed(p, v)    katomic_add(p, v)
+#define katomic_add64(p, v)          (_InterlockedExchangeAdd64((volatile __int64 *)(p), (__int64)(v)) + (__int64)(v))
+#define katomic_xchg(p, v)           _InterlockedExchange((volatile long *)(p), (long)(v))
+
+static __inline int katomic_cas_msc (volatile long * p, long * pexp, long v)
+{
+    long old = _InterlockedCompareExchange(p, v, *pexp);
+    if (old == *pexp) return 1;
+    *pexp = old;
+    return 0;
+}
+#define katomic_cas(p, pexp, v)      katomic_cas_msc((volatile long *)(p), (long *)(pexp), (long)(v))
+
+#define katomic_fence()              MemoryBarrier()
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #if defined(_MSC_VER)
+  #define katomic_spin_pause()       _mm_pause()
+  #else
+  #define katomic_spin_pause()       __builtin_ia32_pause()
+  #endif
+#else
+#define katomic_spin_pause()
+#endif
+
+
+/* Double-width compare-and-swap of a pointer together with a tag that is bumped
+   on every update, which defeats the ABA problem of lock-free lists.
+   cmpxchg16b is used on x86-64, cmpxchg8b on 32-bit x86. KATOMIC_HAVE_CAS2 is
+   left undefined on other platforms, callers fall back to a lock there. */
+
+#if defined(_MSC_VER)
+#define KATOMIC_ALIGN16  __declspec(align(16))
+#else
+#define KATOMIC_ALIGN16  __attribute__((aligned(16)))
+#endif
+
+typedef struct KATOMIC_ALIGN16 katomic_tagptr_s {
+    void      * ptr;
+    size_t      tag;
+} ktagptr_t;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#define KATOMIC_HAVE_CAS2 1
+
+static inline int katomic_cas2 (volatile ktagptr_t * dst, ktagptr_t * cmp, ktagptr_t * xchg)
+{
+    uint8   ret;
+
+    __asm__ __volatile__ (
+        "lock; cmpxchg16b %1\n\t"
+        "setz %0"
+        : "=q" (ret), "+m" (*dst), "+a" (cmp->ptr), "+d" (cmp->tag)
+        : "b" ((size_t)xchg->ptr), "c" (xchg->tag)
+        : "memory", "cc");
+
+    return ret;
+}
+
+#elif defined(__GNUC__) && defined(__i386__)
+
+#define KATOMIC_HAVE_CAS2 1
+
+static inline int katomic_cas2 (volatile ktagptr_t * dst, ktagptr_t * cmp, ktagptr_t * xchg)
+{
+    return __atomic_compare_exchange((volatile uint64 *)dst, (uint64 *)cmp, (uint64 *)xchg, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#elif defined(_MSC_VER) && defined(_M_X64)
+
+#define KATOMIC_HAVE_CAS2 1
+
+static __inline int katomic_cas2 (volatile ktagptr_t * dst, ktagptr_t * cmp, ktagptr_t * xchg)
+{
+    return _InterlockedCompareExchange128((volatile __int64 *)dst, (__int64)xchg->tag,
+                                          (__int64)xchg->ptr, (__int64 *)cmp);
+}
+
+#elif defined(_MSC_VER) && defined(_M_IX86)
+
+#define KATOMIC_HAVE_CAS2 1
+
+static __inline int katomic_cas2 (volatile ktagptr_t * dst, ktagptr_t * cmp, ktagptr_t * xchg)
+{
+    __int64  old = 0;
+
+    old = _InterlockedCompareExchange64((volatile __int64 *)dst, *(__int64 *)xchg, *(__int64 *)cmp);
+    if (old == *(__int64 *)cmp) return 1;
+
+    *(__int64 *)cmp = old;
+    return 0;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -36,6 +36,7 @@
 #include "frame.h"
 #include "rbtree.h"
 #include "mthread.h"
+#include "poolstat.h"
     
 #ifdef __cplusplus
 extern "C" {
@@ -57,6 +58,7 @@ extern "C" {
 
 typedef struct kem_block_ {
     time_t             stamp;
+    time_t             trimstamp; //time of trimming idle pages last time
     long               size;
     long               actsize;
     uint8              allocflag : 4; //indicate if KemBlk instance is allocated
@@ -112,9 +114,12 @@ typedef struct kem_alloc_pool_s {
     long               blksize;
     int                allocnum; //total number of allocated memory units
     time_t             checktime;
+    int                trimtime; //idle seconds after which idle pages of KemBlk are trimmed
 
     mpool_t          * kemunit_pool;
 
+    PoolStat           stat;
+
 } KemPool, kempool_t, *kempool_p;
 
 
@@ -126,6 +131,16 @@ long kempool_size (KemPool * mp);
 void kempool_print (KemPool * mp, frame_t * frm, FILE * fp, int alloclist,
                     int idlelist, int showsize, char * title, int margin);
 
+/* pre-allocate memory blocks until at least 'size' idle bytes are available.
+   flags are KMEM_PREFAULT and KMEM_MLOCK, pages of new blocks are faulted by
+   given threads. pms returns elapsed milliseconds. return the number of new blocks. */
+int  kempool_warmup (KemPool * mp, long size, int flags, int threads, long * pms);
+
+/* return the pages of idle units in blocks not accessed for idlesec seconds to OS.
+   when trimtime is set, it's done by the periodical check. return bytes trimmed. */
+long kempool_trim (KemPool * mp, int idlesec);
+int  kempool_set_trimtime (KemPool * mp, int idlesec);
+
 #define kem_alloc(mp, size) kem_alloc_dbg(mp, size, __FILE__, __LINE__)
 void * kem_alloc_dbg (void * vmp, int size, char * file, int line);
 
@@ -53,6 +53,13 @@ typedef struct kvpair_item {
 } KVPairItem;
  
  
+/* up to KVPAIR_INLINE_ITEMS items are kept in an inline array and searched
+   linearly. the hashtab is created when more items are added */
+#define KVPAIR_INLINE_ITEMS  8
+
+/* flags of kvpair_new */
+#define KVPAIR_NOLOCK        0x01  //accessed by single thread, no locking
+
 typedef struct kvpair_obj {
     unsigned           htsize : 30;
     unsigned           alloctype : 2; //0-default kalloc/kfree 1-os-specific malloc/free 2-kmempool alloc/free 3-kmemblk alloc/free
@@ -60,12 +67,17 @@ typedef struct kvpair_obj {
     void             * mpool;
 
     CRITICAL_SECTION   objCS;
-    hashtab_t        * objtab;
+    hashtab_t        * objtab;   //NULL while items are in initem
+
+    KVPairItem       * initem[KVPAIR_INLINE_ITEMS];
+    int                innum;
+    unsigned           nolock : 1; //1-objCS not used, single-thread access
  
     uint8              sepa[16];
     uint8              kvsep[8];
 } KVPairObj;
 
+void * kvpair_new   (int htsize, char * sepa, char * kvsep, int alloctype, void * mpool, int flags);
 void * kvpair_alloc (int htsize, char * sepa, char * kvsep, int alloctype, void * mpool);
 void * kvpair_init  (int htsize, char * sepa, char * kvsep);
 int    kvpair_clean (void * vobj);
@@ -114,6 +126,66 @@ int    kvpair_encode (void * vobj, void * p, int len);
 
 long   kvpair_fca_decode (void * vobj, void * fca, long startpos, long length);
 
+
+/* zero-copy view of "fid=ab92&fname=king.mp4" text, such as query strings
+   and cookie headers. The source is parsed the same way kvpair_decode does,
+   except that "name=" ending the text is kept with an empty value instead of
+   being dropped. Names and values are kept as slices of the caller's buffer,
+   which must stay unchanged while the view is in use. Slices are held inline or in one
+   block sized by a vector count of the separators, reused by later decodes.
+   Percent-decoding is done on access only: names are compared decoded when
+   they hold escapes, values are decoded by kvpair_view_get into the buffer
+   given by the caller.
+
+       KVPairView  view;
+       kvpair_view_init(&view, "&", "=", 0, NULL);
+       kvpair_view_decode(&view, query, querylen);
+       len = kvpair_view_get(&view, "fname", -1, 0, buf, sizeof(buf));
+       kvpair_view_clean(&view);
+ */
+
+#define KVPAIR_VIEW_INLINE  16
+
+typedef struct kvpair_slice {
+    uint8    * name;
+    int        namelen : 31;
+    unsigned   nameesc : 1;   //name holds % or +, compared decoded
+    uint8    * value;         //NULL if no value given
+    int        valuelen;
+} KVPairSlice;
+
+typedef struct kvpair_view {
+    int             alloctype;
+    void          * mpool;
+
+    uint8           sepa[16];
+    uint8           kvsep[8];
+
+    int             num;
+    int             size;
+    KVPairSlice   * slice;    //inslice or the block allocated
+    KVPairSlice     inslice[KVPAIR_VIEW_INLINE];
+} KVPairView;
+
+void   kvpair_view_init  (KVPairView * view, char * sepa, char * kvsep, int alloctype, void * mpool);
+void   kvpair_view_clean (KVPairView * view);
+
+/* return the bytes parsed, negative if the slices cannot be allocated */
+int    kvpair_view_decode (KVPairView * view, void * p, int len);
+
+int    kvpair_view_num (KVPairView * view);
+
+/* raw slices with escapes kept. kvpair_view_seq gives the seq-th pair in
+   order and returns 1. kvpair_view_getP gives the index-th value of the name,
+   the last one if index is -1, and returns the number of values of the name.
+   negative is returned if not found */
+int    kvpair_view_seq  (KVPairView * view, int seq, void ** pkey, int * keylen, void ** pval, int * vallen);
+int    kvpair_view_getP (KVPairView * view, void * key, int keylen, int index, void ** pval, int * vallen);
+
+/* value percent-decoded into buf, '+' taken as space. return the length of
+   the decoded value, which is more than size if buf is short, or negative */
+int    kvpair_view_get  (KVPairView * view, void * key, int keylen, int index, void * buf, int size);
+
 #ifdef __cplusplus
 }
 #endif
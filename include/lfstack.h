@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _LFSTACK_H_
+#define _LFSTACK_H_
+
+#include "btype.h"
+#include "katomic.h"
+#include "mthread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lock-free stack (Treiber stack) of pointers. Values are carried by nodes that
+   are recycled into an idle list and only freed in lfstack_free, so a racing pop
+   never dereferences released memory. Both lists are headed by a tagged pointer
+   updated via double-width CAS, which defeats the ABA problem. On platforms
+   without double-width CAS, a critical section protects the lists instead. */
+
+typedef struct lfstack_node_s {
+    struct lfstack_node_s * next;
+    void                  * value;
+} lfnode_t;
+
+typedef struct lfstack_s {
+    ktagptr_t          head;      //nodes carrying values
+    ktagptr_t          idle;      //idle nodes
+
+    int                num;       //number of values in stack
+    int                nodenum;   //number of nodes allocated
+    uint64             retry;     //number of CAS failures, i.e. contention
+
+    void             * blklist;   //memory blocks of nodes
+#ifndef KATOMIC_HAVE_CAS2
+    CRITICAL_SECTION   lock;
+#endif
+} lfstack_t;
+
+/* lfstack_t must be 16-byte aligned. it's allocated via kosmalloc, which
+   returns memory aligned properly on the platforms supporting cmpxchg16b */
+lfstack_t * lfstack_new  ();
+void        lfstack_free (lfstack_t * lfs);
+
+int    lfstack_push (lfstack_t * lfs, void * value);
+void * lfstack_pop  (lfstack_t * lfs);
+int    lfstack_num  (lfstack_t * lfs);
+
+/* take the whole chain of nodes out of the stack. the caller owns the nodes
+   exclusively and must give them back via lfstack_attach */
+lfnode_t * lfstack_detach (lfstack_t * lfs);
+void       lfstack_attach (lfstack_t * lfs, lfnode_t * chain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
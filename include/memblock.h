@@ -110,6 +110,46 @@ void * mem_block_unit_get (void * psb, int qind);
 void mem_block_print (void * psb, FILE * fp);
 
 
+/* Slab allocator for hot fixed-size objects, evolved from memory block.
+ *
+ * Each slab is one memory block aligned to its own size, so the slab header
+ * is found by masking the unit pointer, and freeing a unit is O(1). The header
+ * keeps a stack of free unit indexes and a bit array (1 means idle) used to
+ * reject invalid and duplicate frees.
+ *
+ * The leftover space of a slab is used for cache coloring: the first unit of
+ * successive slabs is shifted by one cache line, so that hot units in
+ * different slabs do not alias to the same cache sets.
+ *
+ * If a constructor is given, it is called once when the slab is created,
+ * and units keep their initialized state across mem_slab_free/mem_slab_alloc.
+ * The destructor is called only when the slab is released. Without
+ * constructor, the allocated unit is zeroed as mem_block_alloc does.
+ */
+
+typedef int  (SlabUnitCtor) (void *);
+typedef void (SlabUnitDtor) (void *);
+
+struct mem_slab_cache_s;
+typedef struct mem_slab_cache_s slabcache_t;
+
+/* unitsize is aligned to 'align' (0 means ADF_ALIGNMENT), ctor/dtor can be NULL.
+   slabs are at most 1 MB, NULL is returned if one unit does not fit in it */
+slabcache_t * mem_slab_cache_new  (int unitsize, int align, void * ctor, void * dtor);
+int           mem_slab_cache_free (slabcache_t * cache);
+
+void * mem_slab_alloc (slabcache_t * cache);
+int    mem_slab_free  (slabcache_t * cache, void * pmem);
+
+/* release the idle slabs, keeping at most 'keepnum' of them */
+int    mem_slab_cache_shrink (slabcache_t * cache, int keepnum);
+
+int    mem_slab_cache_status (slabcache_t * cache, int * slabnum, int * unitnum,
+                              int * inuse, int * slabsize);
+
+void   mem_slab_cache_print (slabcache_t * cache, FILE * fp);
+
+
 #ifdef __cplusplus
 }
 #endif
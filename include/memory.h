@@ -63,6 +63,26 @@ void   kfreeit (void * ptr);
 #define krealloc(ptr, size) krealloc_dbg((ptr), (size), __FILE__, __LINE__)
 #define kfree(ptr)          kfree_dbg((ptr), __FILE__, __LINE__)
 
+
+/* flags for warming up the memory pools */
+#define KMEM_PREFAULT   0x01   //touch every page to get it mapped in advance
+#define KMEM_MLOCK      0x02   //lock the pages into RAM, avoiding being swapped out
+
+/* Touch all pages of the given memory regions to trigger page faults in advance.
+   MADV_POPULATE_WRITE is used if available, otherwise one byte of each page is read
+   and written back. The pages are split among 'threads' threads. Content of memory
+   is kept unchanged, but the regions should not be written by others meanwhile.
+   Return the total bytes of the pages faulted. */
+long kmem_prefault (void ** pmem, long * size, int num, int threads);
+
+int  kmem_mlock   (void * pmem, long size);
+int  kmem_munlock (void * pmem, long size);
+
+/* Return the page-aligned interior of the memory to the OS via madvise DONTNEED.
+   The content of trimmed pages is lost and read as zero when touched again.
+   Return the bytes trimmed. */
+long kmem_trim (void * pmem, long size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -71,6 +71,17 @@ long   mpool_size (mpool_t * mp);
 
 void   mpool_print (mpool_t * mp, char * title, int margin, void * frm, FILE * fp);
 
+/* pre-allocate memory caches until at least unitnum units are available. flags are
+   KMEM_PREFAULT and KMEM_MLOCK, pages of new caches are faulted by given threads.
+   pms returns the elapsed milliseconds. return the number of units pre-allocated. */
+int    mpool_warmup (mpool_t * mp, int unitnum, int flags, int threads, long * pms);
+
+/* return the pages of idle units in caches not accessed for idlesec seconds to OS.
+   when trimtime is set, mpool_check does it periodically. pool with freefunc is
+   not trimmed. return the bytes trimmed. */
+long   mpool_trim (mpool_t * mp, int idlesec);
+int    mpool_set_trimtime (mpool_t * mp, int idlesec);
+
 /******************************************
 MPool example:
 
@@ -96,6 +96,13 @@ int    native_file_seek   (void * hfile, int64 offset);
 int    native_file_copy   (void * vsrc, int64 offset, int64 length, void * vdst, int64 * actnum);
 int    native_file_resize (void * hfile, int64 newsize);
 
+/* read or write asynchronously at current offset through the asyncio engine. the
+   offset is moved forward when the request completes, so sequential requests on
+   one file should be issued one after another. cb is AsyncIOCB, called with the
+   bytes transferred or negative errno. available on Linux only */
+int    native_file_read_async  (void * hfile, void * buf, int size, void * aio, void * cb, void * cbpara);
+int    native_file_write_async (void * hfile, void * buf, int size, void * aio, void * cb, void * cbpara);
+
 char * native_file_name (void * vhfile);
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _NUMCONV_H_
+#define _NUMCONV_H_
+
+#include "btype.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fast conversions between numbers and their decimal text.
+   Integers are written two digits at a time from a lookup table and parsed
+   eight digits at a time with SWAR arithmetic on little-endian hosts.
+   Doubles are written in the shortest form that reads back to the same value
+   (Schubfach algorithm, same output as the Ryu family) and read back by the
+   Eisel-Lemire algorithm, falling back to strtod for the rare ambiguous cases. */
+
+/* buffer size enough for any output of num_dtoa, including the NUL */
+#define NUM_DTOA_SIZE  32
+
+/* write the decimal digits of val ending right before 'end',
+   return the pointer to the first digit. no NUL is appended */
+uint8 * num_u64toa_r (uint64 val, uint8 * end);
+
+/* write the decimal string of val with terminating NUL into buf which
+   must hold at least 21 bytes, return the length excluding NUL */
+int     num_u64toa (uint64 val, void * buf);
+int     num_i64toa (int64 val, void * buf);
+
+/* parse the leading decimal digits of p into pval, wrapping around on
+   overflow like the plain loop did. return the number of digits consumed */
+int     num_atou64 (void * p, int len, uint64 * pval);
+
+/* write the shortest decimal string that converts back to val, in the style
+   of repr(): 0.1, 100.0, 1e+16, 1.5e-07, -0.0, inf, nan. buf must hold
+   NUM_DTOA_SIZE bytes. return the length excluding the terminating NUL */
+int     num_dtoa (double val, void * buf);
+
+/* parse the decimal floating-point number at the start of p, accepting the
+   same syntax as strtod. the result is correctly rounded.
+   return the number of bytes consumed, 0 if no number is found */
+int     num_atod (void * p, int len, double * pval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _PHASH_H_
+#define _PHASH_H_
+
+#include "btype.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Minimal perfect hash built by hash-and-displace (CHD). The keys are given by
+   their 64-bit hash values, hashed into buckets of about 4 keys each. Every
+   bucket stores the displacement that sends all of its keys to distinct free
+   slots, so N keys occupy exactly the slots 0..N-1. A key outside the built set
+   maps to some slot as well, the caller compares the key stored there. */
+
+#define PHASH_SEED  0xcbf29ce484222325ULL
+
+typedef struct phash_s {
+    int       num;      //number of keys, equal to the number of slots
+    int       bnum;     //number of buckets
+    uint32  * disp;     //displacement of each bucket
+} phash_t;
+
+/* 64-bit hash of the bytes, folding ASCII letters to lower case if nocase is set.
+   phash_hash_more continues the hash h over more bytes, which lets a compound key
+   like section and key be hashed without concatenating them. */
+uint64    phash_hash      (void * p, int len, int nocase);
+uint64    phash_hash_more (uint64 h, void * p, int len, int nocase);
+
+/* build the table for num distinct hash values. return NULL if two values are
+   equal or no displacement was found */
+phash_t * phash_build (uint64 * hv, int num);
+void      phash_free  (phash_t * ph);
+
+/* slot of hash value h, 0 <= slot < num */
+int       phash_slot  (phash_t * ph, uint64 h);
+
+/* pack up to 8 bytes into a word, zero padded, case folded if nocase is set.
+   short keys packed this way compare with a single integer compare */
+uint64    phash_word  (void * p, int len, int nocase);
+
+/* compare len bytes 8 at a time, ignoring ASCII case if nocase is set.
+   return 1 if equal */
+int       phash_equal (void * a, void * b, int len, int nocase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
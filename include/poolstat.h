@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */
+
+#ifndef _POOLSTAT_H_
+#define _POOLSTAT_H_
+
+#include "btype.h"
+#include "mthread.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* This module implements a process-wide registry of memory pools. mpool_t, bpool_t,
+   KemPool, slab caches and frmpool classes register themselves on creation and
+   unregister when freed.
+   Each pool keeps a PoolStat embedded in its own structure, whose counters are bumped
+   inside the critical section that the pool already holds, so the accounting costs
+   a few increments per fetch/recycle. A snapshot traverses all registered pools and
+   emits their counters, together with the fetch/recycle rates since the previous
+   snapshot, as JSON text or as a compact big-endian binary record. */
+
+#define POOL_TYPE_MPOOL    1
+#define POOL_TYPE_BPOOL    2
+#define POOL_TYPE_KEMPOOL  3
+#define POOL_TYPE_SLAB     4
+#define POOL_TYPE_FRAME    5
+
+typedef struct pool_stat_s {
+    long       peak;        //high-water mark of consumed units (KemPool: allocated units)
+    uint64     fetchnum;    //accumulated number of fetch/alloc calls
+    uint64     recyclenum;  //accumulated number of recycle/free calls
+    uint64     contention;  //number of times the pool lock was found busy
+} PoolStat;
+
+typedef struct pool_snap_s {
+    uint8      pooltype;
+    char       name[32];
+
+    long       unitsize;    //0 for KemPool since its units have variable sizes
+    long       allocated;   //units allocated from system (KemPool: usable bytes of blocks)
+    long       consumed;    //units handed out (KemPool: bytes handed out)
+    long       remaining;   //units idle in pool (KemPool: idle bytes)
+    long       reserved;    //bytes reserved from system, including management overhead
+    long       peak;
+    int        blknum;      //number of memory blocks/caches
+
+    uint64     fetchnum;
+    uint64     recyclenum;
+    uint64     contention;
+
+    double     fetchrate;   //fetch number per second since last snapshot
+    double     recyclerate; //recycle number per second since last snapshot
+} PoolSnap;
+
+typedef int (PoolSnapFunc) (void * pool, PoolSnap * snap);
+
+/* Entering the pool lock with a try-lock first, and counting the busy case as one
+   contention. The counter is increased after the lock is held. */
+#ifdef UNIX
+#define poolstat_lock(cs, pst) do {                       \
+        if (TryEnterCriticalSection(cs) != 0) {           \
+            EnterCriticalSection(cs);                     \
+            (pst)->contention++;                          \
+        }                                                 \
+    } while (0)
+#else
+#define poolstat_lock(cs, pst) do {                       \
+        if (TryEnterCriticalSection(cs) == 0) {           \
+            EnterCriticalSection(cs);                     \
+            (pst)->contention++;                          \
+        }                                                 \
+    } while (0)
+#endif
+
+#define poolstat_fetch(pst, consumed) do {                \
+        (pst)->fetchnum++;                                \
+        if ((long)(consumed) > (pst)->peak)               \
+            (pst)->peak = (long)(consumed);               \
+    } while (0)
+
+#define poolstat_recycle(pst)  ((pst)->recyclenum++)
+
+
+int    poolstat_register   (void * pool, int pooltype, void * snapfunc);
+int    poolstat_unregister (void * pool);
+
+int    poolstat_set_name (void * pool, char * name);
+int    poolstat_num      ();
+
+/* fill the snapshot array with at most num registered pools, return the actual number */
+int    poolstat_snapshot (PoolSnap * snap, int num);
+
+/* { "time":"1700000000", "pools":[{ "name":"mpool-0x..", "type":"mpool", ... }, ...] } */
+int    poolstat_snapshot_json (frame_p frm);
+
+/* binary layout in network byte order:
+     header: magic "PSTA"(4) version(2) poolnum(2) time(8)
+     record: type(1) namelen(1) name(namelen) unitsize(8) allocated(8) consumed(8)
+             remaining(8) reserved(8) peak(8) blknum(4) fetchnum(8) recyclenum(8)
+             contention(8) fetchrate(4, per second) recyclerate(4, per second) */
+int    poolstat_snapshot_bin (frame_p frm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -74,6 +74,14 @@ int    ssl_tcp_write  (void * vssltcp, void * pbyte, int bytelen, int * num, int
 int    ssl_tcp_writev   (void * vssltcp, void * piov, int iovcnt, int * num, int * perr);
 int    ssl_tcp_sendfile (void * vssltcp, int filefd, int64 pos, int64 size, int * num, int * perr);
 
+/* let OpenSSL 3.0+ offload record encryption to kernel TLS when the negotiated cipher
+   is supported. ssl_tcp_sendfile then sends file data by SSL_sendfile without copying.
+   return 1 if set, 0 if kTLS is not available in this build */
+int    ssl_ctx_set_ktls (void * vctx, int enable);
+
+/* return kTLS state of the connection: bit 0x01 send offloaded, bit 0x02 receive */
+int    ssl_tcp_ktls (void * vssltcp);
+
 #ifdef __cplusplus
 }
 #endif 
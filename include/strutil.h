@@ -151,6 +151,27 @@ int base64_to_bin (void * pasc, int asclen, void * pbin, int *binlen);
 /* convert binary octet stream to base64 encoded stream */
 int bin_to_base64 (void * pbin, int binlen, void * pasc, int * asclen);
  
+/* the skip family below scans with SSE4.2 or AVX2 when the CPU supports them.
+ * level: 0-scalar, 1-SSE4.2, 2-AVX2, capped by CPU. negative level just queries.
+ * return the level in use */
+int str_simd (int level);
+ 
+/* set of characters prepared once for repeated scanning */
+typedef struct str_cset_s {
+    int    level;
+    int    num;
+    uint8  set[16];     //PCMPESTRI operand
+    uint8  lo[16];      //high-nibble bits indexed by low nibble
+    uint8  hi[16];      //bit assigned to each high nibble
+    uint8  map[32];     //bitmap for scalar tail
+} str_cset_t;
+
+void str_cset_init (str_cset_t * cs, void * chs, int num);
+
+/* offset of the first byte in the set, or out of the set if neg is not 0.
+ * len is returned if none is found */
+int  str_cset_scan (str_cset_t * cs, void * p, int len, int neg);
+ 
 /* scan the byte stream untill encountering the given characters, in addition,
  * skip over all characters enclosed by "" */
 void * skipQuoteTo (void * pbyte, int len, void * tochars, int num);
@@ -172,6 +193,9 @@ void * skipOver (void * pbyte, int len, void * skippedchs, int num);
 /* reversely skip over the given characters from the byte stream */
 void * rskipOver (void * pbyte, int rlen, void * skippedchs, int num);
  
+/* count the bytes that are one of the given characters */
+int    str_count (void * pbyte, int len, void * chs, int num);
+ 
 /* get the value pointer: username = 'hellokitty'    password = '#$!7798' */
 int str_value_by_key (void * pbyte, int bytelen, void * key, void ** pval, int * vallen);
  
@@ -293,8 +317,9 @@ int conv_charset (void * srcchst, void * dstchst,
              appears before it.
     g,G      The double argument is converted in style f,e (or F,E,G  convesions).
              The precision specifies the number of significant digits.If the precision
-             is missing, 6 digits are given; if the precision is zero, it is treated as
-             1. Style e is used if the exponent from its conversion is less than -4 or
+             is missing, the shortest digits that convert back to the same double are
+             given, in the style of num_dtoa: 0.1, 100.0, 1e+16; if the precision is
+             zero, it is treated as 1. Style e is used if the exponent from its conversion is less than -4 or
              greater than or equal to the  precision.   Trailing  zeros  are removed
              from the fractional part of the result; a decimal point appears only if it
              is followed by at least one digit.
@@ -46,11 +46,47 @@ void   trlog_clean (void * vlog);
 int trlog_line (void * vlog);
 void trlog_rollover (void * vlog, int line);
 
+/* switch the log to async mode: each thread formats its lines into its own
+   lock-free ring of ringsize bytes, and one writer thread drains all rings every
+   flushms or when a ring is half full, batching them into large writes. a thread
+   whose ring is full waits up to waitus for the writer, then drops the line and
+   counts it. trlog_rollover is carried out by the writer. ringsize 0 stops it.
+   UNIX only */
+int trlog_async (void * vlog, int ringsize, int flushms, int waitus);
+
+/* lines written by writer, lines dropped and bytes written in async mode.
+   return 1 if async mode is on */
+int trlog_stat (void * vlog, uint64 * lines, uint64 * dropped, uint64 * bytes);
+
 
 #define trlog(hlog, rectime, fmt, ...) trlogfile(hlog, rectime, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define tolog(rectime, fmt, ...) trlogfile(g_trace_log, rectime, NULL, __LINE__, fmt, ##__VA_ARGS__)
 void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...);
 
+/* binary log with deferred formatting. the format is registered once per call
+   site, and the hot path copies only raw arguments (string bytes included). text
+   is rendered by the writer thread in async mode, otherwise right away. the %W
+   and %V extensions of kvsnprintf are supported, with the length modifiers hh,
+   h, l, ll, L, z, j and t. fmt must stay valid for ever, a string literal in
+   general */
+#define trlogb(hlog, rectime, fmt, ...) do {                                    \
+    static int trfid_ = 0;                                                      \
+    if (trfid_ == 0) trfid_ = trlog_fmt_register(__FILE__, __LINE__, fmt);      \
+    trlog_binary(hlog, rectime, trfid_, fmt, ##__VA_ARGS__);                    \
+} while (0)
+
+#define tologb(rectime, fmt, ...) do {                                          \
+    static int trfid_ = 0;                                                      \
+    if (trfid_ == 0) trfid_ = trlog_fmt_register(NULL, __LINE__, fmt);          \
+    trlog_binary(g_trace_log, rectime, trfid_, fmt, ##__VA_ARGS__);             \
+} while (0)
+
+/* return format id, or -1 if the registry is full or fmt has a conversion whose
+   arguments are not known, %n or %ls for example. the call site then keeps the
+   text path for good */
+int  trlog_fmt_register (char * file, int line, char * fmt);
+void trlog_binary (void * vlog, int rectime, int fid, char * fmt, ...);
+
 
 void printOctet(FILE * fp, void * data, int start, int count, int margin);
 
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifndef _ZCOPY_H_
+#define _ZCOPY_H_
+
+#include "btype.h"
+
+#ifdef UNIX
+#include <sys/uio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Zero-copy send tracker of one TCP socket based on MSG_ZEROCOPY of Linux 4.14+.
+   Pages of buffers sent via zcopy_sendv stay referenced by the kernel until the
+   completion notification is read from the socket error queue. Buffers whose owner
+   wants to free them are handed over by zcopy_hold and released through freefunc
+   only after all zero-copy sends issued before have completed. The tracker is not
+   thread-safe, it is driven by the thread that writes the socket. */
+
+typedef void ZCFree (void * porig);
+
+typedef struct zcopy_hold_s {
+    void     * porig;
+    ZCFree   * freefunc;
+    uint32     seq;        //sends before this sequence must be completed
+} ZCHold;
+
+typedef struct zcopy_s {
+    SOCKET     fd;
+    int        threshold;  //buffers smaller than this are sent by copy
+
+    uint32     nextseq;    //sequence of the next zero-copy send
+    uint32     doneseq;    //all sends before this sequence are completed
+
+    ZCHold   * holds;      //ring of held buffers ordered by seq
+    int        holdsize;
+    int        holdbgn;
+    int        holdnum;
+
+    uint64     sendnum;    //zero-copy send calls succeeded
+    uint64     sendbytes;
+    uint64     copied;     //completions reporting the kernel fell back to copy
+    uint64     released;
+} zcopy_t;
+
+/* enable SO_ZEROCOPY on fd. return NULL if the kernel does not support it.
+   threshold <= 0 uses default 16384 */
+void * zcopy_new  (SOCKET fd, int threshold);
+
+/* release all held buffers, it should be called after fd is closed */
+void   zcopy_free (void * vzc);
+
+int    zcopy_threshold (void * vzc);
+
+/* send iovec with MSG_ZEROCOPY, return bytes sent, 0 if socket is full, or < 0 on error */
+int    zcopy_sendv (void * vzc, struct iovec * iov, int iovcnt, int * perr);
+
+/* hand over a buffer to free. freefunc is called at once when no zero-copy send
+   is in flight. return 1 if held, 0 if released immediately */
+int    zcopy_hold (void * vzc, void * porig, void * freefunc);
+
+/* read the completion notifications from error queue and release the held buffers
+   no longer referenced. return the number of buffers released */
+int    zcopy_reap (void * vzc);
+
+/* number of zero-copy sends not yet completed */
+int    zcopy_inflight (void * vzc);
+int    zcopy_holdnum  (void * vzc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,211 @@
+
+#include <sys/mman.h>
+#include "adifall.ext"
+
+/* convert JSON between text and MessagePack/CBOR, or compare the speed of
+   the binary codec with json_encode2/json_decode on a payload file */
+
+static void usage (char * prog)
+{
+    printf("Usage: %s [-c] [-t] -e <in.json> <out.bin>   text to binary\n"
+           "       %s [-c] -d <in.bin> <out.json>        binary to text\n"
+           "       %s [-c] [-t] -p <in.json> [loops]     speed against json_encode2/json_decode\n"
+           "   -c  CBOR instead of MessagePack\n"
+           "   -t  write numbers, true/false/null as typed values\n",
+           prog, prog, prog);
+}
+
+static void * file_map (char * fn, long * size)
+{
+    struct stat   st;
+    void        * pbyte = NULL;
+    int           fd;
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        printf("file %s open failed\n", fn);
+        return NULL;
+    }
+
+    fstat(fd, &st);
+
+    pbyte = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pbyte == MAP_FAILED) {
+        printf("mmap %s failed\n", fn);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return pbyte;
+}
+
+static int file_save (char * fn, frame_p frm)
+{
+    FILE  * fp = NULL;
+
+    fp = fopen(fn, "wb");
+    if (!fp) {
+        printf("file %s create failed\n", fn);
+        return -1;
+    }
+
+    if (frm->len > 0)
+        fwrite(frm->data + frm->start, 1, frm->len, fp);
+    fclose(fp);
+    return 0;
+}
+
+static double used_us (btime_t * t0, int loops)
+{
+    btime_t  t1;
+    btime_t  dt;
+
+    btime(&t1);
+    dt = btime_diff(t0, &t1);
+
+    return (dt.s * 1000000.0 + dt.ms * 1000.0) / loops;
+}
+
+static void perf (void * pbyte, long size, int fmt, int loops)
+{
+    frame_p    frm = NULL;
+    frame_p    bfrm = NULL;
+    void     * obj = NULL;
+    JsonBin    bin;
+    JsonPull   pull;
+    btime_t    t0;
+    void     * val = NULL;
+    int        vlen = 0;
+    int        i, ev;
+    long       events = 0;
+
+    frm = frame_new(0);
+    bfrm = frame_new(0);
+
+    obj = json_init(0, 0, 0);
+    json_decode(obj, pbyte, size, 1, 0);
+    json_encode2(obj, frm);
+    json_bin_encode2(obj, fmt, bfrm);
+    json_clean(obj);
+
+    printf("%s%s of %ld bytes JSON: %d bytes, json_encode2 output %d bytes, %d loops\n",
+           (fmt & 0x0F) == JSON_BIN_CBOR ? "CBOR" : "MessagePack",
+           (fmt & JSON_BIN_TYPED) ? " typed" : "",
+           size, frameL(bfrm), frameL(frm), loops);
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        obj = json_init(0, 0, 0);
+        json_decode(obj, frameP(frm), frameL(frm), 1, 0);
+        json_clean(obj);
+    }
+    printf("          json_decode: %10.2f us\n", used_us(&t0, loops));
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        obj = json_init(0, 0, 0);
+        json_bin_decode(obj, fmt, frameP(bfrm), frameL(bfrm));
+        json_clean(obj);
+    }
+    printf("      json_bin_decode: %10.2f us\n", used_us(&t0, loops));
+
+    obj = json_init(0, 0, 0);
+    json_decode(obj, frameP(frm), frameL(frm), 1, 0);
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        frame_empty(frm);
+        json_encode2(obj, frm);
+    }
+    printf("         json_encode2: %10.2f us\n", used_us(&t0, loops));
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        frame_empty(bfrm);
+        json_bin_encode2(obj, fmt, bfrm);
+    }
+    printf("     json_bin_encode2: %10.2f us\n", used_us(&t0, loops));
+
+    json_clean(obj);
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        json_pull_init(&pull, 0);
+        json_pull_feed(&pull, frameP(frm), frameL(frm));
+        json_pull_finish(&pull);
+        while ((ev = json_pull_next(&pull, &val, &vlen)) > 0 && ev != JSON_PULL_END)
+            events++;
+        json_pull_clean(&pull);
+    }
+    printf("  json_pull_next walk: %10.2f us\n", used_us(&t0, loops));
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        json_bin_init(&bin, fmt, frameP(bfrm), frameL(bfrm));
+        while ((ev = json_bin_next(&bin, &val, &vlen)) > 0 && ev != JSON_PULL_END)
+            events++;
+    }
+    printf("   json_bin_next walk: %10.2f us\n", used_us(&t0, loops));
+
+    frame_free(frm);
+    frame_free(bfrm);
+}
+
+int main (int argc, char ** argv)
+{
+    void     * pbyte = NULL;
+    long       size = 0;
+    void     * obj = NULL;
+    frame_p    frm = NULL;
+    int        fmt = JSON_BIN_MSGPACK;
+    int        cmd = 0;
+    int        i, ret = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        switch (argv[i][1]) {
+        case 'c': fmt = (fmt & ~0x0F) | JSON_BIN_CBOR; break;
+        case 't': fmt |= JSON_BIN_TYPED; break;
+        case 'e': case 'd': case 'p': cmd = argv[i][1]; break;
+        default: usage(argv[0]); return 0;
+        }
+    }
+
+    if (cmd == 0 || i >= argc || (cmd != 'p' && i + 1 >= argc)) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    pbyte = file_map(argv[i], &size);
+    if (!pbyte) return -1;
+
+    if (cmd == 'p') {
+        perf(pbyte, size, fmt, i + 1 < argc ? atoi(argv[i + 1]) : 1000);
+        munmap(pbyte, size);
+        return 0;
+    }
+
+    obj = json_init(0, 0, 0);
+    frm = frame_new(0);
+
+    if (cmd == 'e') {
+        json_decode(obj, pbyte, size, 1, 0);
+        json_bin_encode2(obj, fmt, frm);
+    } else {
+        ret = json_bin_decode(obj, fmt, pbyte, size);
+        if (ret < 0) printf("%s decode failed: %d\n", argv[i], ret);
+        else json_encode2(obj, frm);
+    }
+
+    if (ret >= 0) {
+        ret = file_save(argv[i + 1], frm);
+        if (ret >= 0) printf("%s: %ld bytes -> %s: %d bytes\n", argv[i], size, argv[i + 1], frameL(frm));
+    }
+
+    frame_free(frm);
+    json_clean(obj);
+    munmap(pbyte, size);
+
+    return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,226 @@
+
+#include <sys/mman.h>
+#include "adifall.ext"
+
+/* throughput of JSON decoding on a payload file: the structural index of
+   json_tape_parse at each SIMD level, and json_decode through the tape
+   against the tolerant text scanner it falls back to. -c checks the
+   decoding of string escapes instead */
+
+static void usage (char * prog)
+{
+    printf("Usage: %s <in.json> [loops]\n"
+           "   json_tape_parse at each str_simd level, then json_decode into JsonObj\n"
+           "   through the tape and through the text scanner\n"
+           "       %s -c\n"
+           "   check escape decoding of json_unescape, json_tape_str, json_extract_text and json_extract\n",
+           prog, prog);
+}
+
+typedef struct esc_case_s {
+    char   * esc;
+    char   * utf8;
+} EscCase;
+
+static EscCase esc_case[] = {
+    { "a\\u0041b",             "aAb" },
+    { "\\u00e9",               "\xC3\xA9" },                 //lower case hex
+    { "\\u00E9",               "\xC3\xA9" },                 //upper case hex
+    { "\\u4E2d\\u6587",        "\xE4\xB8\xAD\xE6\x96\x87" },
+    { "\\u20ac",               "\xE2\x82\xAC" },
+    { "\\ud83d\\ude00",        "\xF0\x9F\x98\x80" },         //surrogate pair
+    { "\\uD83D\\uDE00!",       "\xF0\x9F\x98\x80!" },
+    { "x\\uDBFF\\uDFFFy",      "x\xF4\x8F\xBF\xBFy" },
+    { "\\t\\\"\\\\\\/\\n",       "\t\"\\/\n" },
+};
+
+typedef struct esc_dst_s {
+    char     val[64];
+} EscDst;
+
+static int check_escape (void)
+{
+    JsonField   fld = { "k", JSON_FIELD_STR, offsetof(EscDst, val), sizeof(((EscDst *)0)->val) };
+    void      * ext = NULL;
+    void      * obj = NULL;
+    JsonTape    tape;
+    EscDst      dst;
+    char        json[128];
+    char        buf[64];
+    int         i, n, ind, fail = 0;
+
+    ext = json_extract_compile(&fld, 1);
+    json_tape_init(&tape);
+
+    for (i = 0; i < sizeof(esc_case)/sizeof(esc_case[0]); i++) {
+        n = json_unescape(esc_case[i].esc, strlen(esc_case[i].esc), buf, sizeof(buf));
+        if (n != strlen(esc_case[i].utf8) || strcmp(buf, esc_case[i].utf8) != 0) {
+            printf("json_unescape \"%s\" failed\n", esc_case[i].esc);
+            fail++;
+        }
+
+        n = sprintf(json, "{\"k\":\"%s\"}", esc_case[i].esc);
+
+        buf[0] = '\0';
+        if (json_tape_parse(&tape, json, n) > 0) {
+            ind = json_tape_get_value(&tape, 0, "k", 1, 0);
+            json_tape_str(&tape, ind, buf, sizeof(buf));
+        }
+        if (strcmp(buf, esc_case[i].utf8) != 0) {
+            printf("json_tape_str \"%s\" failed\n", esc_case[i].esc);
+            fail++;
+        }
+
+        memset(&dst, 0, sizeof(dst));
+        json_extract_text(ext, json, n, &dst);
+        if (strcmp(dst.val, esc_case[i].utf8) != 0) {
+            printf("json_extract_text \"%s\" failed\n", esc_case[i].esc);
+            fail++;
+        }
+
+        /* the tree keeps the escapes, json_extract unescapes them the same */
+        memset(&dst, 0, sizeof(dst));
+        obj = json_init(0, 0, 0);
+        json_decode(obj, json, n, 1, 0);
+        json_extract(ext, obj, &dst);
+        json_clean(obj);
+
+        if (strcmp(dst.val, esc_case[i].utf8) != 0) {
+            printf("json_extract \"%s\" failed\n", esc_case[i].esc);
+            fail++;
+        }
+    }
+
+    json_tape_clean(&tape);
+    json_extract_free(ext);
+
+    printf("%d escape cases, %d failed\n", i, fail);
+    return fail ? -1 : 0;
+}
+
+static void * file_map (char * fn, long * size)
+{
+    struct stat   st;
+    void        * pbyte = NULL;
+    int           fd;
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        printf("file %s open failed\n", fn);
+        return NULL;
+    }
+
+    fstat(fd, &st);
+
+    pbyte = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pbyte == MAP_FAILED) {
+        printf("mmap %s failed\n", fn);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return pbyte;
+}
+
+static double used_sec (btime_t * t0)
+{
+    btime_t  t1;
+    btime_t  dt;
+
+    btime(&t1);
+    dt = btime_diff(t0, &t1);
+
+    return dt.s + dt.ms / 1000.0;
+}
+
+static void print_rate (char * name, long size, int loops, double sec)
+{
+    double  mbs = 0;
+
+    if (sec > 0) mbs = (double)size * loops / sec / (1024 * 1024);
+
+    printf("%28s: %9.2f ms/loop %10.2f MB/s %7.3f GB/s\n",
+           name, sec * 1000.0 / loops, mbs, mbs / 1024);
+}
+
+int main (int argc, char ** argv)
+{
+    void     * pbyte = NULL;
+    long       size = 0;
+    int        loops = 10;
+    JsonTape   tape;
+    void     * obj = NULL;
+    btime_t    t0;
+    char       name[64];
+    int        level, cpu, oldlevel;
+    int        i, ret = 0;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-c") == 0)
+        return check_escape();
+
+    if (argc > 2) loops = atoi(argv[2]);
+    if (loops <= 0) loops = 1;
+
+    pbyte = file_map(argv[1], &size);
+    if (!pbyte) return -1;
+
+    printf("%s: %ld bytes, %d loops\n", argv[1], size, loops);
+
+    json_tape_init(&tape);
+
+    ret = json_tape_parse(&tape, pbyte, size);
+    if (ret < 0) {
+        printf("json_tape_parse failed: %d, json_decode takes the text scanner only\n", ret);
+    } else {
+        printf("%d tokens%s\n", tape.num,
+               (tape.flags & (JSON_TAPE_EMPTYKEY | JSON_TAPE_NESTARR))
+                   ? ", json_decode falls back to the text scanner for this text" : "");
+    }
+
+    /* stage 1 and 2 only, scalar first, then each SIMD level of this CPU */
+    oldlevel = str_simd(-1);
+    cpu = str_simd(100);
+
+    for (level = 0; ret >= 0 && level <= cpu; level++) {
+        str_simd(level);
+
+        btime(&t0);
+        for (i = 0; i < loops; i++)
+            json_tape_parse(&tape, pbyte, size);
+
+        sprintf(name, "json_tape_parse %s", level == 0 ? "scalar" : level == 1 ? "SSE" : "AVX2");
+        print_rate(name, size, loops, used_sec(&t0));
+    }
+
+    str_simd(oldlevel);
+    json_tape_clean(&tape);
+
+    /* sptype 0 without comments decodes through the tape, a JsonObj
+       accepting comments keeps the text scanner for the same input */
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        obj = json_init(0, 0, 0);
+        json_decode(obj, pbyte, size, 1, 0);
+        json_clean(obj);
+    }
+    print_rate("json_decode tape", size, loops, used_sec(&t0));
+
+    btime(&t0);
+    for (i = 0; i < loops; i++) {
+        obj = json_init(0, 1, 0);
+        json_decode(obj, pbyte, size, 1, 0);
+        json_clean(obj);
+    }
+    print_rate("json_decode text", size, loops, used_sec(&t0));
+
+    munmap(pbyte, size);
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+
+#include <float.h>
+#include <math.h>
+#include "adifall.ext"
+
+/* checks and throughput of the numconv conversions. -c compares num_dtoa
+   with printf and strtod for round-trip and shortest digits, num_atod with
+   strtod bit by bit, and str_ato* with the plain digit loop they replaced
+   on range and overflow edges. -p times itoa, dtoa, atod and atou against
+   those old paths */
+
+static void usage (char * prog)
+{
+    printf("Usage: %s -c [count]\n"
+           "   check num_dtoa, num_atod and str_ato* on edge and count random inputs\n"
+           "       %s -p [count]\n"
+           "   time itoa, dtoa, atod and atou against sprintf, strtod and the plain loop\n",
+           prog, prog);
+}
+
+static uint64 rnd_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64 rnd64 (void)
+{
+    uint64  x = rnd_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return rnd_state = x;
+}
+
+static uint64 dbl_bits (double val)
+{
+    uint64  bits;
+
+    memcpy(&bits, &val, sizeof(bits));
+    return bits;
+}
+
+static double bits_dbl (uint64 bits)
+{
+    double  val;
+
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+/* a double of random bits, or of a random magnitude with few digits that
+   is common in real payloads like prices and coordinates */
+static double rnd_double (void)
+{
+    uint64  r = rnd64();
+    double  val;
+
+    if (r & 1) {
+        do {
+            val = bits_dbl(rnd64());
+        } while (isnan(val) || isinf(val));
+        return val;
+    }
+
+    val = (double)(rnd64() % 10000000) / (double)(1 + rnd64() % 10000);
+    return (r & 2) ? -val : val;
+}
+
+/* the plain loops that str_ato* and fmt_conv_numval used before numconv */
+static int old_atou64 (uint8 * p, int len, uint64 * pval)
+{
+    uint64  val = 0;
+    int     i;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] >= '0' && p[i] <= '9')
+            val = val * 10 + (p[i] - '0');
+        else
+            break;
+    }
+
+    *pval = val;
+    return i;
+}
+
+static int old_atoi64 (uint8 * p, int len, int64 * pval)
+{
+    uint64  val = 0;
+    int     nega = 0, i = 0;
+
+    if (len > 0 && (p[0] == '-' || p[0] == '+')) { nega = (p[0] == '-'); i++; }
+
+    i += old_atou64(p + i, len - i, &val);
+
+    *pval = nega ? (int64)(0 - val) : (int64)val;
+    return i;
+}
+
+static int old_u64toa (uint64 val, uint8 * buf)
+{
+    uint8   tmp[24];
+    uint8 * p = tmp + sizeof(tmp);
+    int     len;
+
+    do {
+        *--p = (uint8)((val % 10) + '0');
+    } while (val /= 10);
+
+    len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* significant digits of a decimal string: no sign, point, exponent,
+   leading or trailing zeros */
+static int sig_digits (char * str)
+{
+    char  * p = str;
+    int     num = 0, zeros = 0, lead = 1;
+
+    for ( ; *p && *p != 'e' && *p != 'E'; p++) {
+        if (*p < '0' || *p > '9') continue;
+        if (*p == '0') {
+            if (!lead) zeros++;
+            continue;
+        }
+        lead = 0;
+        num += zeros + 1;
+        zeros = 0;
+    }
+
+    return num;
+}
+
+/* fewest digits of %.*e that strtod reads back to val */
+static int shortest_digits (double val)
+{
+    char   buf[64];
+    int    prec;
+
+    if (val == 0) return 0;
+
+    for (prec = 0; prec < 17; prec++) {
+        sprintf(buf, "%.*e", prec, val);
+        if (strtod(buf, NULL) == val) break;
+    }
+
+    return prec + 1;
+}
+
+static int check_dtoa (double val)
+{
+    char    buf[NUM_DTOA_SIZE];
+    char    ref[64];
+    double  back;
+    int     len;
+
+    len = num_dtoa(val, buf);
+    if (len <= 0 || len >= NUM_DTOA_SIZE || len != (int)strlen(buf)) {
+        printf("num_dtoa %.17g: bad length %d\n", val, len);
+        return -1;
+    }
+
+    if (isnan(val)) return strcmp(buf, "nan") == 0 ? 0 : -1;
+
+    back = strtod(buf, NULL);
+    if (dbl_bits(back) != dbl_bits(val)) {
+        sprintf(ref, "%.17g", val);
+        printf("num_dtoa %s: \"%s\" does not read back\n", ref, buf);
+        return -1;
+    }
+
+    if (!isinf(val) && sig_digits(buf) != shortest_digits(val)) {
+        sprintf(ref, "%.17g", val);
+        printf("num_dtoa %s: \"%s\" has %d digits, shortest is %d\n",
+               ref, buf, sig_digits(buf), shortest_digits(val));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int check_atod (char * str)
+{
+    double  val = 0, ref = 0;
+    char  * end = NULL;
+    int     len;
+
+    len = num_atod(str, strlen(str), &val);
+    ref = strtod(str, &end);
+
+    if (len != end - str || dbl_bits(val) != dbl_bits(ref)) {
+        printf("num_atod \"%s\": %.17g/%d, strtod %.17g/%d\n",
+               str, val, len, ref, (int)(end - str));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int check_atoi (char * str, int len)
+{
+    int64   ref = 0;
+    uint64  uref = 0;
+    int     iv = 0;
+    long    lv = 0;
+    int64   llv = 0;
+    uint32  uv = 0;
+    ulong   ulv = 0;
+    uint64  ullv = 0;
+    int     n, un, fail = 0;
+
+    n = old_atoi64((uint8 *)str, len, &ref);
+    un = old_atou64((uint8 *)str, len, &uref);
+
+    if (str_atoi(str, len, &iv) != n || iv != (int)ref) fail++;
+    if (str_atol(str, len, &lv) != n || lv != (long)ref) fail++;
+    if (str_atoll(str, len, &llv) != n || llv != ref) fail++;
+    if (str_atou(str, len, &uv) != un || uv != (uint32)uref) fail++;
+    if (str_atoul(str, len, &ulv) != un || ulv != (ulong)uref) fail++;
+    if (str_atoull(str, len, &ullv) != un || ullv != uref) fail++;
+
+    if (fail)
+        printf("str_ato* \"%.*s\": %d of 6 differ from the plain loop\n", len, str, fail);
+
+    return fail ? -1 : 0;
+}
+
+static double dtoa_case[] = {
+    0.0, 1.0, 0.1, 0.2, 0.3, 1.5, 100.0, 123456.789, 1e15, 1e16, 1e21, 1e22, 1e23,
+    9007199254740992.0, 9007199254740993.0, 5e-324, 1e-323, 2.2250738585072009e-308,
+    2.2250738585072014e-308, DBL_MAX, DBL_MIN, 1.7976931348623157e308, 4.9406564584124654e-324,
+    1.0 / 3, 2.0 / 3, 3.141592653589793, 2.718281828459045, 1e-7, 1.5e-7, 123e-20,
+};
+
+static char * atod_case[] = {
+    "0", "-0", "0.0", ".5", "5.", "1e", "1e+", "1e-5x", "+.e1", "-", ".",
+    "1", "12345678901234567890", "123456789012345678901234567890e-10",
+    "9007199254740993", "9007199254740992.5", "2.2250738585072011e-308",
+    "2.2250738585072012e-308", "4.9406564584124654e-324", "2.4703282292062327e-324",
+    "2.4703282292062328e-324", "1.7976931348623157e308", "1.7976931348623159e308",
+    "1e23", "8.988465674311579e307", "0.000000000000000000000000000001",
+    "7.0420557077594588669468784357561207962098443483187940792729600000e+59",
+    "1e-400", "1e400", "-1e400", "1e-0000000000000000000000000010",
+    "00000000000000000000000000000001.5", "0x1p3", "inf", "-Infinity", "nan",
+    "3.14159265358979323846264338327950288419716939937510", "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124", "1.00000000000000011102230246251565404236316680908203126",
+};
+
+static char * atoi_case[] = {
+    "", "-", "+", "0", "-0", "+7", "12abc", "--1", "0000000000000000000000000123",
+    "127", "128", "255", "256", "32767", "32768", "65535", "65536",
+    "2147483647", "2147483648", "-2147483648", "-2147483649", "4294967295", "4294967296",
+    "9223372036854775807", "9223372036854775808", "-9223372036854775808", "-9223372036854775809",
+    "18446744073709551615", "18446744073709551616", "99999999999999999999", "123456789012345678901234567890",
+    "1234567 ", "12345678.9", "123456789a", "1234567890123456:",
+};
+
+static int check_all (int count)
+{
+    char    str[128];
+    double  val;
+    int     i, j, len, prev, fail = 0, total = 0;
+
+    /* num_dtoa: edges, their negatives and neighbours, then random doubles */
+    for (i = 0; i < (int)(sizeof(dtoa_case)/sizeof(dtoa_case[0])); i++) {
+        val = dtoa_case[i];
+        if (check_dtoa(val) < 0) fail++;
+        if (check_dtoa(-val) < 0) fail++;
+        if (check_dtoa(nextafter(val, DBL_MAX)) < 0) fail++;
+        if (val > 0 && check_dtoa(nextafter(val, 0)) < 0) fail++;
+        total += 4;
+    }
+
+    if (check_dtoa(HUGE_VAL) < 0) fail++;
+    if (check_dtoa(-HUGE_VAL) < 0) fail++;
+    if (check_dtoa(NAN) < 0) fail++;
+    total += 3;
+
+    for (i = 0; i < count; i++) {
+        if (check_dtoa(rnd_double()) < 0) fail++;
+    }
+    total += count;
+
+    printf("num_dtoa: %d values, %d failed\n", total, fail);
+
+    /* num_atod against strtod: edges, printf forms of random doubles, and
+       random digit strings with long mantissas and wide exponents */
+    prev = fail; total = 0;
+
+    for (i = 0; i < (int)(sizeof(atod_case)/sizeof(atod_case[0])); i++, total++) {
+        if (check_atod(atod_case[i]) < 0) fail++;
+    }
+
+    for (i = 0; i < count; i++) {
+        val = rnd_double();
+
+        sprintf(str, "%.17g", val);
+        if (check_atod(str) < 0) fail++;
+
+        sprintf(str, "%.*e", (int)(rnd64() % 25), val);
+        if (check_atod(str) < 0) fail++;
+
+        len = 1 + rnd64() % 40;
+        for (j = 0; j < len; j++) str[j] = '0' + rnd64() % 10;
+        if (rnd64() & 1) str[rnd64() % len] = '.';
+        len += sprintf(str + len, "e%d", (int)(rnd64() % 700) - 350);
+
+        if (check_atod(str) < 0) fail++;
+        total += 3;
+    }
+
+    printf("num_atod: %d strings, %d failed\n", total, fail - prev);
+
+    /* str_ato* keep the wrap-around of the plain loop on overflow */
+    prev = fail; total = 0;
+
+    for (i = 0; i < (int)(sizeof(atoi_case)/sizeof(atoi_case[0])); i++) {
+        len = strlen(atoi_case[i]);
+        if (check_atoi(atoi_case[i], len) < 0) fail++;
+        if (len > 1 && check_atoi(atoi_case[i], len - 1) < 0) fail++;
+        total += 2;
+    }
+
+    for (i = 0; i < count; i++) {
+        len = 1 + rnd64() % 30;
+        for (j = 0; j < len; j++) str[j] = '0' + rnd64() % 10;
+        if (rnd64() & 1) str[0] = '-';
+        if ((rnd64() & 3) == 0) str[rnd64() % len] = 'x';
+
+        if (check_atoi(str, len) < 0) fail++;
+        total++;
+    }
+
+    printf("str_ato*: %d strings, %d failed\n", total, fail - prev);
+
+    return fail ? -1 : 0;
+}
+
+static double used_sec (btime_t * t0)
+{
+    btime_t  t1;
+    btime_t  dt;
+
+    btime(&t1);
+    dt = btime_diff(t0, &t1);
+
+    return dt.s + dt.ms / 1000.0;
+}
+
+static void print_rate (char * name, int count, double sec, uint64 sum)
+{
+    if (sec <= 0) sec = 1e-6;
+
+    printf("%24s: %8.2f ns/op %10.2f M/s  (%llu)\n",
+           name, sec * 1e9 / count, count / sec / 1e6, (unsigned long long)sum);
+}
+
+static int perf_all (int count)
+{
+    uint64  * ival = NULL;
+    double  * dval = NULL;
+    char   ** dstr = NULL;
+    char   ** istr = NULL;
+    uint8     buf[64];
+    btime_t   t0;
+    uint64    sum, u64;
+    double    val;
+    int       i;
+
+    ival = kalloc(sizeof(uint64) * count);
+    dval = kalloc(sizeof(double) * count);
+    dstr = kalloc(sizeof(char *) * count);
+    istr = kalloc(sizeof(char *) * count);
+
+    /* integers spread over all magnitudes, doubles as in rnd_double */
+    for (i = 0; i < count; i++) {
+        ival[i] = rnd64() >> (rnd64() % 64);
+        dval[i] = rnd_double();
+
+        num_dtoa(dval[i], buf);
+        dstr[i] = str_dup(buf, strlen((char *)buf));
+
+        num_u64toa(ival[i], buf);
+        istr[i] = str_dup(buf, strlen((char *)buf));
+    }
+
+    printf("%d values per loop\n", count);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++)
+        sum += num_u64toa(ival[i], buf);
+    print_rate("num_u64toa", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++)
+        sum += old_u64toa(ival[i], buf);
+    print_rate("div-10 loop", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++)
+        sum += sprintf((char *)buf, "%llu", (unsigned long long)ival[i]);
+    print_rate("sprintf %llu", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++)
+        sum += num_dtoa(dval[i], buf);
+    print_rate("num_dtoa", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++)
+        sum += sprintf((char *)buf, "%.17g", dval[i]);
+    print_rate("sprintf %.17g", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++) {
+        num_atod(dstr[i], strlen(dstr[i]), &val);
+        sum += dbl_bits(val) & 0xFF;
+    }
+    print_rate("num_atod", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++) {
+        val = strtod(dstr[i], NULL);
+        sum += dbl_bits(val) & 0xFF;
+    }
+    print_rate("strtod", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++) {
+        str_atoull(istr[i], strlen(istr[i]), &u64);
+        sum += u64;
+    }
+    print_rate("str_atoull", count, used_sec(&t0), sum);
+
+    btime(&t0);
+    for (sum = 0, i = 0; i < count; i++) {
+        old_atou64((uint8 *)istr[i], strlen(istr[i]), &u64);
+        sum += u64;
+    }
+    print_rate("plain loop", count, used_sec(&t0), sum);
+
+    for (i = 0; i < count; i++) {
+        kfree(dstr[i]);
+        kfree(istr[i]);
+    }
+
+    kfree(istr);
+    kfree(dstr);
+    kfree(dval);
+    kfree(ival);
+
+    return 0;
+}
+
+int main (int argc, char ** argv)
+{
+    int  count = 1000000;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (argc > 2) count = atoi(argv[2]);
+    if (count <= 0) count = 1;
+
+    if (strcmp(argv[1], "-c") == 0)
+        return check_all(count);
+
+    if (strcmp(argv[1], "-p") == 0)
+        return perf_all(count);
+
+    usage(argv[0]);
+    return 0;
+}
@@ -0,0 +1,461 @@
+
+#include <sys/mman.h>
+#include "adifall.ext"
+
+/* throughput of the skip family at each str_simd level: skipTo, skipOver,
+   skipQuoteTo and rskipTo on a flat buffer, the chunk_skip_* functions on
+   the same bytes split into chunk spans, and the file_cache_skip_* functions
+   on the mmap path. the byte by byte pack path of file_cache is timed once
+   as the baseline. a synthetic HTTP header corpus is scanned first, then the
+   file given as argument. the counts of each workload must agree across all
+   the sources and levels */
+
+static void usage (char * prog)
+{
+    printf("Usage: %s <file | -> [loops]\n"
+           "   time skipTo, skipOver, skipQuoteTo and rskipTo with their chunk and\n"
+           "   file_cache variants at each str_simd level, on a HTTP header corpus\n"
+           "   and then on the file. - scans the header corpus only\n",
+           prog);
+}
+
+static char * hdr_line[] = {
+    "GET /api/v2/items?page=3&size=50&sort=-mtime HTTP/1.1\r\n",
+    "Host: www.example.com\r\n",
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n",
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n",
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8\r\n",
+    "Accept-Encoding: gzip, deflate, br\r\n",
+    "Cookie: sid=8f2a6c0e1b7d4a9f; theme=dark; cart=\"a=1; b=2\"; _ga=GA1.2.1234567890.1700000000\r\n",
+    "If-None-Match: W/\"5e1f-17c2a8d4b30\"\r\n",
+    "Content-Type: multipart/form-data; boundary=\"----WebKitFormBoundary7MA4YWxkTrZu0gW\"\r\n",
+    "Content-Disposition: attachment; filename=\"report, q3; final.pdf\"\r\n",
+    "Authorization: Digest username=\"kitty\", realm=\"api@example.com\", nonce=\"dcd98b7102dd2f0e\", qop=auth\r\n",
+    "Connection: keep-alive\r\n",
+    "Cache-Control: max-age=0\r\n",
+    "X-Forwarded-For: 203.0.113.195, 70.41.3.18, 150.172.238.178\r\n",
+    "\r\n",
+};
+
+/* one source of bytes with the four skip workloads behind it */
+typedef struct scan_src_s {
+    char   * name;
+    uint8  * pbyte;
+    int64    size;
+    void   * obj;
+    int      simd;      //0 if the scans do not go through str_simd
+
+    int64 (*skip_to)    (struct scan_src_s * src, int64 pos, char * pat, int patlen);
+    int64 (*skip_over)  (struct scan_src_s * src, int64 pos, char * pat, int patlen);
+    int64 (*skip_quote) (struct scan_src_s * src, int64 pos, char * pat, int patlen);
+    int64 (*rskip_to)   (struct scan_src_s * src, int64 pos, char * pat, int patlen);
+} ScanSrc;
+
+/* flat buffer, split at 1G since the strutil scans take an int length */
+typedef void * ScanFunc (void * p, int len, void * pat, int patlen);
+
+static int64 buf_skip (ScanSrc * src, int64 pos, char * pat, int patlen, ScanFunc * scan)
+{
+    uint8  * p = NULL, * q = NULL;
+    int64    rest = src->size - pos;
+    int      n;
+
+    while (rest > 0) {
+        n = rest > 0x40000000 ? 0x40000000 : (int)rest;
+        p = src->pbyte + pos;
+
+        q = (*scan)(p, n, pat, patlen);
+        pos += q - p;
+        if (q < p + n) break;
+        rest -= n;
+    }
+
+    return pos;
+}
+
+static int64 buf_skip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return buf_skip(src, pos, pat, patlen, skipTo);
+}
+
+static int64 buf_skip_over (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return buf_skip(src, pos, pat, patlen, skipOver);
+}
+
+static int64 buf_skip_quote (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return buf_skip(src, pos, pat, patlen, skipQuoteTo);
+}
+
+static int64 buf_rskip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    uint8  * p = NULL, * q = NULL;
+    int      n;
+
+    while (pos >= 0) {
+        n = pos + 1 > 0x40000000 ? 0x40000000 : (int)(pos + 1);
+        p = src->pbyte + pos;
+
+        q = rskipTo(p, n, pat, patlen);
+        pos -= p - q;
+        if (q > p - n) break;
+    }
+
+    return pos;
+}
+
+static int64 ck_skip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return chunk_skip_to(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 ck_skip_over (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return chunk_skip_over(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 ck_skip_quote (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return chunk_skip_quote_to(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 ck_rskip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return chunk_rskip_to(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 fca_skip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return file_cache_skip_to(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 fca_skip_over (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return file_cache_skip_over(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 fca_skip_quote (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return file_cache_skip_quote_to(src->obj, pos, -1, pat, patlen);
+}
+
+static int64 fca_rskip_to (ScanSrc * src, int64 pos, char * pat, int patlen)
+{
+    return file_cache_rskip_to(src->obj, pos, -1, pat, patlen);
+}
+
+/* workloads of a header parser: lines, tokens between delimiters, lines
+   with quoted strings skipped, lines backwards, and one scan for a byte
+   that never appears */
+#define SCAN_DELIM  " \t\r\n:;,="
+
+static int64 scan_lines (ScanSrc * src)
+{
+    int64  pos = 0, num = 0;
+
+    while (pos < src->size) {
+        pos = src->skip_to(src, pos, "\n", 1) + 1;
+        num++;
+    }
+
+    return num;
+}
+
+static int64 scan_tokens (ScanSrc * src)
+{
+    int64  pos = 0, num = 0;
+
+    while (pos < src->size) {
+        pos = src->skip_over(src, pos, SCAN_DELIM, 8);
+        if (pos >= src->size) break;
+
+        pos = src->skip_to(src, pos, SCAN_DELIM, 8);
+        num++;
+    }
+
+    return num;
+}
+
+static int64 scan_quote (ScanSrc * src)
+{
+    int64  pos = 0, num = 0;
+
+    while (pos < src->size) {
+        pos = src->skip_quote(src, pos, "\n", 1) + 1;
+        num++;
+    }
+
+    return num;
+}
+
+static int64 scan_rlines (ScanSrc * src)
+{
+    int64  pos = src->size - 1, num = 0;
+
+    while (pos >= 0) {
+        pos = src->rskip_to(src, pos, "\n", 1) - 1;
+        num++;
+    }
+
+    return num;
+}
+
+static int64 scan_absent (ScanSrc * src)
+{
+    return src->skip_to(src, 0, "\x01\x02", 2);
+}
+
+typedef struct scan_work_s {
+    char   * name;
+    int64 (*scan) (ScanSrc * src);
+} ScanWork;
+
+static ScanWork scan_work[] = {
+    { "lines",   scan_lines },
+    { "tokens",  scan_tokens },
+    { "quote",   scan_quote },
+    { "rlines",  scan_rlines },
+    { "absent",  scan_absent },
+};
+
+static double used_sec (btime_t * t0)
+{
+    btime_t  t1;
+    btime_t  dt;
+
+    btime(&t1);
+    dt = btime_diff(t0, &t1);
+
+    return dt.s + dt.ms / 1000.0;
+}
+
+static void * file_map (char * fn, long * size)
+{
+    struct stat   st;
+    void        * pbyte = NULL;
+    int           fd;
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        printf("file %s open failed\n", fn);
+        return NULL;
+    }
+
+    fstat(fd, &st);
+    if (st.st_size <= 0) {
+        printf("file %s is empty\n", fn);
+        close(fd);
+        return NULL;
+    }
+
+    pbyte = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pbyte == MAP_FAILED) {
+        printf("mmap %s failed\n", fn);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return pbyte;
+}
+
+/* time every workload of every source at each level as MB/s, the counts
+   of a workload are compared with those of the flat buffer at scalar */
+static void scan_run (ScanSrc * src, int srcnum, int loops)
+{
+    static char * lvname[] = { "scalar", "SSE4.2", "AVX2" };
+    int64   count[3], ref = 0;
+    double  mbs[3], sec;
+    btime_t t0;
+    int     oldlevel, cpu, level, lvnum;
+    int     w, s, i, n;
+
+    oldlevel = str_simd(-1);
+    cpu = str_simd(100);
+    lvnum = cpu + 1;
+
+    printf("%-16s %-7s", "source", "work");
+    for (level = 0; level < lvnum; level++)
+        printf(" %9s", lvname[level]);
+    printf("  (MB/s)  count\n");
+
+    for (w = 0; w < (int)(sizeof(scan_work)/sizeof(scan_work[0])); w++) {
+        for (s = 0; s < srcnum; s++) {
+            /* the pack path does not use str_simd, one pass at scalar is enough */
+            n = src[s].simd ? lvnum : 1;
+
+            for (level = 0; level < n; level++) {
+                str_simd(level);
+
+                btime(&t0);
+                for (i = 0; i < loops; i++)
+                    count[level] = scan_work[w].scan(&src[s]);
+                sec = used_sec(&t0);
+
+                if (sec <= 0) sec = 0.0005;
+                mbs[level] = (double)src[s].size * loops / sec / (1024 * 1024);
+            }
+
+            if (s == 0) ref = count[0];
+
+            printf("%-16s %-7s", src[s].name, scan_work[w].name);
+            for (level = 0; level < lvnum; level++) {
+                if (level < n) printf(" %9.1f", mbs[level]);
+                else printf(" %9s", "-");
+            }
+            printf("  %7s %lld", "", (long long)count[0]);
+
+            for (level = 0; level < n; level++) {
+                if (count[level] != ref) {
+                    printf("  MISMATCH %s %lld", lvname[level], (long long)count[level]);
+                    break;
+                }
+            }
+            printf("\n");
+        }
+    }
+
+    str_simd(oldlevel);
+}
+
+/* scan the bytes as a flat buffer, a chunk of at most 64 spans of 64K or
+   more, and a file_cache over the file holding the same bytes, mapped and
+   through packs. chunk_rskip_to goes byte by byte through chunk_at, whose
+   cost grows with the span count, so large files get larger spans */
+static int scan_file (char * title, uint8 * pbyte, int64 size, char * fname, int loops)
+{
+    ScanSrc   src[4];
+    void    * ck = NULL;
+    void    * fcmap = NULL;
+    void    * fcpack = NULL;
+    int64     i, n, span;
+
+    memset(src, 0, sizeof(src));
+
+    span = size / 64 > 65536 ? size / 64 : 65536;
+
+    printf("\n%s: %lld bytes, %d loops, chunk spans of %lld bytes\n",
+           title, (long long)size, loops, (long long)span);
+
+    src[0].name = "buffer";
+    src[0].simd = 1;
+    src[0].skip_to = buf_skip_to;
+    src[0].skip_over = buf_skip_over;
+    src[0].skip_quote = buf_skip_quote;
+    src[0].rskip_to = buf_rskip_to;
+
+    ck = chunk_new(8192);
+    for (i = 0; i < size; i += n) {
+        n = size - i > span ? span : size - i;
+        chunk_add_bufptr(ck, pbyte + i, n, NULL, NULL);
+    }
+
+    src[1].name = "chunk spans";
+    src[1].obj = ck;
+    src[1].simd = 1;
+    src[1].skip_to = ck_skip_to;
+    src[1].skip_over = ck_skip_over;
+    src[1].skip_quote = ck_skip_quote;
+    src[1].rskip_to = ck_rskip_to;
+
+    fcmap = file_cache_init(12, 65536);
+    file_cache_setfile(fcmap, fname, 0);
+    if (file_cache_mmap(fcmap, 1, FBUF_MAP_POPULATE | FBUF_MAP_SEQUENTIAL) < 0)
+        printf("file_cache_mmap %s failed\n", fname);
+
+    src[2].name = "file_cache mmap";
+    src[2].obj = fcmap;
+    src[2].simd = 1;
+    src[2].skip_to = fca_skip_to;
+    src[2].skip_over = fca_skip_over;
+    src[2].skip_quote = fca_skip_quote;
+    src[2].rskip_to = fca_rskip_to;
+
+    fcpack = file_cache_init(12, 65536);
+    file_cache_setfile(fcpack, fname, 0);
+
+    src[3] = src[2];
+    src[3].name = "file_cache pack";
+    src[3].obj = fcpack;
+
+    src[3].simd = 0;
+
+    for (i = 0; i < 4; i++) {
+        src[i].pbyte = pbyte;
+        src[i].size = size;
+    }
+
+    scan_run(src, 4, loops);
+
+    file_cache_clean(fcpack);
+    file_cache_clean(fcmap);
+    chunk_free(ck);
+
+    return 0;
+}
+
+/* header blocks repeated to about 1MB, written to a temporary file so
+   that file_cache reads the same bytes */
+static int scan_header (int loops)
+{
+    char     fname[] = "/tmp/strscan-XXXXXX";
+    uint8  * pbyte = NULL;
+    int64    size = 0, len;
+    int      i, fd;
+
+    pbyte = kalloc(1024 * 1024 + 4096);
+
+    while (size < 1024 * 1024) {
+        for (i = 0; i < (int)(sizeof(hdr_line)/sizeof(hdr_line[0])); i++) {
+            len = strlen(hdr_line[i]);
+            memcpy(pbyte + size, hdr_line[i], len);
+            size += len;
+        }
+    }
+
+    fd = mkstemp(fname);
+    if (fd < 0 || write(fd, pbyte, size) != size) {
+        printf("temporary file %s write failed\n", fname);
+        if (fd >= 0) { close(fd); unlink(fname); }
+        kfree(pbyte);
+        return -1;
+    }
+    close(fd);
+
+    scan_file("HTTP header corpus", pbyte, size, fname, loops);
+
+    unlink(fname);
+    kfree(pbyte);
+
+    return 0;
+}
+
+int main (int argc, char ** argv)
+{
+    void   * pbyte = NULL;
+    long     size = 0;
+    int      loops = 0;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (argc > 2) loops = atoi(argv[2]);
+
+    scan_header(loops > 0 ? loops : 20);
+
+    if (strcmp(argv[1], "-") == 0)
+        return 0;
+
+    pbyte = file_map(argv[1], &size);
+    if (!pbyte) return -1;
+
+    scan_file(argv[1], pbyte, size, argv[1], loops > 0 ? loops : 1);
+
+    munmap(pbyte, size);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+
+#include <stddef.h>
+#include <wchar.h>
+#include "adifall.ext"
+
+/* the binary log renders the same text as the text log. each line below is
+   written through trlog into one file and through trlogb into another, both
+   without time stamp, and the files are compared. formats the binary path
+   can not record, like %ls and %n, must fall back to the text path. then
+   lines/s of trlog and trlogb are timed on the given log files */
+
+static void usage (char * prog)
+{
+    printf("Usage: %s <text.log> <binary.log> [lines]\n"
+           "   check that trlogb renders as trlog does, then time both\n",
+           prog);
+}
+
+static void write_lines (void * hlog, int binary)
+{
+    char         * s = "kitty";
+    size_t         n = 123456789;
+    ssize_t        sn = -42;
+    intmax_t       jm = -9007199254740993LL;
+    ptrdiff_t      pd = -7;
+    long double    ld = 2.5L;
+
+#define LOG_LINE(fmt, ...) do {                                   \
+    if (binary) trlogb(hlog, 0, fmt, ##__VA_ARGS__);              \
+    else trlog(hlog, 0, fmt, ##__VA_ARGS__);                      \
+} while (0)
+
+    LOG_LINE("%zu %s\n", n, s);
+    LOG_LINE("%zd %zx %s\n", sn, n, s);
+    LOG_LINE("%hhd %hhu %s\n", 7, 300, s);
+    LOG_LINE("%hd %hu %s\n", -5, 70000, s);
+    LOG_LINE("[%+-5d] [%-+5d] [% 05d] [%#-8x] %s\n", 12, 34, 56, 255, s);
+    LOG_LINE("%jd %jx %td %s\n", jm, (uintmax_t)jm, pd, s);
+    LOG_LINE("%ld %lu %lld %llx %s\n", -1L, 2UL, -3LL, 0xABCDULL, s);
+    LOG_LINE("%*d|%-*.*s|%.3f %Lf %a\n", 6, 42, 8, 3, s, 3.14159, ld, 1.0);
+    LOG_LINE("%c%c %p %5.1e %G %%\n", 'o', 'k', (void *)0x1234, 12345.678, 1e-10);
+    LOG_LINE("wide %ls %s\n", L"ws", s);
+
+#undef LOG_LINE
+}
+
+static char * file_load (char * fn, long * size)
+{
+    FILE  * fp = NULL;
+    char  * pbuf = NULL;
+
+    fp = fopen(fn, "rb");
+    if (!fp) return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    pbuf = kzalloc(*size + 1);
+    if (pbuf && fread(pbuf, 1, *size, fp) != (size_t)*size) *size = 0;
+
+    fclose(fp);
+    return pbuf;
+}
+
+static int check_render (char * txtfile, char * binfile)
+{
+    void   * hlog = NULL;
+    char   * txt = NULL, * bin = NULL;
+    long     txtlen = 0, binlen = 0;
+    int      fid, ret = 0;
+
+    unlink(txtfile);
+    unlink(binfile);
+
+    hlog = trlog_init(txtfile, 0);
+    write_lines(hlog, 0);
+    trlog_clean(hlog);
+
+    hlog = trlog_init(binfile, 0);
+    write_lines(hlog, 1);
+    trlog_clean(hlog);
+
+    txt = file_load(txtfile, &txtlen);
+    bin = file_load(binfile, &binlen);
+
+    if (!txt || !bin || txtlen != binlen || memcmp(txt, bin, txtlen) != 0) {
+        printf("trlogb output differs from trlog\n--- %s\n%s--- %s\n%s",
+               txtfile, txt ? txt : "", binfile, bin ? bin : "");
+        ret = -1;
+    } else {
+        printf("%s", bin);
+        printf("trlogb renders the same %ld bytes as trlog\n", binlen);
+    }
+
+    if (txt) kfree(txt);
+    if (bin) kfree(bin);
+
+    /* formats with unknown arguments are refused */
+    fid = trlog_fmt_register(NULL, __LINE__, "%d%n\n");
+    if (fid != -1) {
+        printf("trlog_fmt_register %%n: fid %d, -1 expected\n", fid);
+        ret = -1;
+    }
+
+    fid = trlog_fmt_register(NULL, __LINE__, "%ls\n");
+    if (fid != -1) {
+        printf("trlog_fmt_register %%ls: fid %d, -1 expected\n", fid);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static double used_sec (btime_t * t0)
+{
+    btime_t  t1;
+    btime_t  dt;
+
+    btime(&t1);
+    dt = btime_diff(t0, &t1);
+
+    return dt.s + dt.ms / 1000.0;
+}
+
+static void time_log (char * txtfile, char * binfile, int lines)
+{
+    void    * hlog = NULL;
+    btime_t   t0;
+    double    sec;
+    size_t    n = 4096;
+    int       i;
+
+    hlog = trlog_init(txtfile, 0);
+    btime(&t0);
+    for (i = 0; i < lines; i++)
+        trlog(hlog, 1, "req %d size %zu user %s cost %.3f\n", i, n, "kitty", i * 0.001);
+    sec = used_sec(&t0);
+    trlog_clean(hlog);
+    printf("%8s: %10.0f lines/s\n", "trlog", sec > 0 ? lines / sec : 0);
+
+    hlog = trlog_init(binfile, 0);
+    btime(&t0);
+    for (i = 0; i < lines; i++)
+        trlogb(hlog, 1, "req %d size %zu user %s cost %.3f\n", i, n, "kitty", i * 0.001);
+    sec = used_sec(&t0);
+    trlog_clean(hlog);
+    printf("%8s: %10.0f lines/s\n", "trlogb", sec > 0 ? lines / sec : 0);
+}
+
+int main (int argc, char ** argv)
+{
+    int  lines = 100000;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (argc > 3) lines = atoi(argv[3]);
+    if (lines <= 0) lines = 1;
+
+    if (check_render(argv[1], argv[2]) < 0)
+        return -1;
+
+    time_log(argv[1], argv[2], lines);
+
+    return 0;
+}
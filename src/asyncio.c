@@ -0,0 +1,1270 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#ifdef _LINUX_
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "katomic.h"
+#include "trace.h"
+#include "asyncio.h"
+
+#ifdef _LINUX_
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+
+typedef struct asyncio_op_s {
+    struct asyncio_op_s * next;
+    struct asyncio_op_s * link;    //following request of the linked chain
+    AsyncReq              req;
+    int64                 result;
+    int                   pollfd;  //duplicated fd parked in epoll, thread engine
+    struct asyncio_op_s * chead;   //request rearmed after EAGAIN whose chain holds this one, io_uring
+    int                   cancels; //-ECANCELED of the chain awaited before it's resubmitted, io_uring
+} AIOOp;
+
+typedef struct async_io_s {
+    int                  engine;
+    int                  efd;
+
+    CRITICAL_SECTION     opCS;
+    AIOOp              * opfree;
+    int                  inflight;
+    int                  maxinflight;
+
+    /* queue of completed requests waiting for their callbacks */
+    CRITICAL_SECTION     doneCS;
+    AIOOp              * donehead;
+    AIOOp              * donetail;
+
+#ifdef HAVE_IO_URING
+    int                  ringfd;
+    unsigned             sq_entries;
+    unsigned             cq_entries;
+
+    void               * sqmap;
+    size_t               sqmaplen;
+    void               * cqmap;
+    size_t               cqmaplen;
+    struct io_uring_sqe * sqes;
+    size_t               sqeslen;
+
+    unsigned           * sqhead;
+    unsigned           * sqtail;
+    unsigned           * sqmask;
+    unsigned           * sqarray;
+    unsigned           * cqhead;
+    unsigned           * cqtail;
+    unsigned           * cqmask;
+    struct io_uring_cqe * cqes;
+
+    CRITICAL_SECTION     sqCS;
+    unsigned             sqpending;  //sqes queued but not submitted
+    uint8                inchain;    //last sqe queued carries IOSQE_IO_LINK
+    AIOOp              * rearmhead;  //chains waiting to be resubmitted behind a poll
+#endif
+
+    /* worker threads of fallback engine */
+    int                  threads;
+    pthread_t          * tids;
+    pthread_t            epolltid;
+    int                  epfd;
+    int                  quit;
+    uint8                runinit;    //runCS and runcond are initialized
+    uint8                epollok;    //epolltid is running
+
+    CRITICAL_SECTION     runCS;
+    pthread_cond_t       runcond;
+    AIOOp              * runhead;
+    AIOOp              * runtail;
+    AIOOp              * pendhead;   //requests prepared but not submitted
+    AIOOp              * pendtail;
+    AIOOp              * lastlink;   //last prepared request carrying ASYNCIO_F_LINK, both engines
+
+    int                * fixedfds;
+    int                  fixednum;
+} AsyncIO;
+
+#define aio_user_poll(op)  ((uint64)(ulong)(op) | 1)
+
+
+static AIOOp * aio_op_get (AsyncIO * aio)
+{
+    AIOOp  * op = NULL;
+
+    EnterCriticalSection(&aio->opCS);
+    op = aio->opfree;
+    if (op) aio->opfree = op->next;
+    LeaveCriticalSection(&aio->opCS);
+
+    if (!op) op = kzalloc(sizeof(*op));
+    if (op) memset(op, 0, sizeof(*op));
+
+    return op;
+}
+
+static void aio_op_put (AsyncIO * aio, AIOOp * op)
+{
+    EnterCriticalSection(&aio->opCS);
+    op->next = aio->opfree;
+    aio->opfree = op;
+    LeaveCriticalSection(&aio->opCS);
+}
+
+static void aio_done_push (AsyncIO * aio, AIOOp * op, int64 result)
+{
+    op->result = result;
+    op->next = NULL;
+
+    EnterCriticalSection(&aio->doneCS);
+    if (aio->donetail) aio->donetail->next = op;
+    else aio->donehead = op;
+    aio->donetail = op;
+    LeaveCriticalSection(&aio->doneCS);
+}
+
+static void aio_notify (AsyncIO * aio)
+{
+    uint64  val = 1;
+
+    if (write(aio->efd, &val, sizeof(val)) < 0) return;
+}
+
+static void aio_drain (AsyncIO * aio)
+{
+    uint64  val = 0;
+
+    if (read(aio->efd, &val, sizeof(val)) < 0) return;
+}
+
+/* invoke the callbacks of completed requests. the request record is released
+   before its callback, which may prepare new requests */
+static int aio_done_dispatch (AsyncIO * aio)
+{
+    AIOOp      * list = NULL;
+    AIOOp      * op = NULL;
+    AsyncIOCB  * cb = NULL;
+    void       * cbpara = NULL;
+    int64        result = 0;
+    int          num = 0;
+
+    EnterCriticalSection(&aio->doneCS);
+    list = aio->donehead;
+    aio->donehead = aio->donetail = NULL;
+    LeaveCriticalSection(&aio->doneCS);
+
+    while ((op = list) != NULL) {
+        list = op->next;
+
+        cb = op->req.cb;
+        cbpara = op->req.cbpara;
+        result = op->result;
+
+        aio_op_put(aio, op);
+        katomic_add(&aio->inflight, -1);
+        num++;
+
+        if (cb) (*cb)(cbpara, result);
+    }
+
+    return num;
+}
+
+/* sockets and pipes may return EAGAIN, the request is retried when ready */
+static int aio_op_pollevent (AIOOp * op)
+{
+    switch (op->req.opcode) {
+    case ASYNCIO_OP_READ:
+    case ASYNCIO_OP_READV:
+    case ASYNCIO_OP_RECV:
+        return POLLIN;
+    case ASYNCIO_OP_WRITE:
+    case ASYNCIO_OP_WRITEV:
+    case ASYNCIO_OP_SEND:
+    case ASYNCIO_OP_SPLICE:
+        return POLLOUT;
+    }
+    return 0;
+}
+
+static int aio_op_pollfd (AIOOp * op)
+{
+    return op->req.opcode == ASYNCIO_OP_SPLICE ? op->req.fdout : op->req.fd;
+}
+
+/* expected bytes of a request, a linked chain is broken when less is transferred */
+static int64 aio_op_expect (AIOOp * op)
+{
+    int64  len = 0;
+    int    i;
+
+    switch (op->req.opcode) {
+    case ASYNCIO_OP_READ:
+    case ASYNCIO_OP_WRITE:
+    case ASYNCIO_OP_SPLICE:
+        return op->req.len;
+    case ASYNCIO_OP_READV:
+    case ASYNCIO_OP_WRITEV:
+        for (i = 0; i < op->req.iovcnt; i++)
+            len += op->req.iov[i].iov_len;
+        return len;
+    }
+    return 0;
+}
+
+
+#ifdef HAVE_IO_URING
+
+static int uring_setup (unsigned entries, struct io_uring_params * p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter (int fd, unsigned submit, unsigned mincomplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, mincomplete, flags, NULL, 0);
+}
+
+static int uring_register (int fd, unsigned opcode, void * arg, unsigned num)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, num);
+}
+
+static int uring_init (AsyncIO * aio, int entries)
+{
+    struct io_uring_params  p;
+    uint8                 * sq = NULL;
+    uint8                 * cq = NULL;
+    int                     fd = -1;
+
+    memset(&p, 0, sizeof(p));
+
+    fd = uring_setup(entries, &p);
+    if (fd < 0) return -1;
+
+    aio->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aio->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cqmaplen > aio->sqmaplen) aio->sqmaplen = aio->cqmaplen;
+        aio->cqmaplen = 0;
+    }
+
+    sq = mmap(NULL, aio->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return -2;
+    }
+
+    if (aio->cqmaplen > 0) {
+        cq = mmap(NULL, aio->cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, aio->sqmaplen);
+            close(fd);
+            return -3;
+        }
+        aio->cqmap = cq;
+    } else {
+        cq = sq;
+    }
+    aio->sqmap = sq;
+
+    aio->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        if (aio->cqmap) munmap(aio->cqmap, aio->cqmaplen);
+        munmap(sq, aio->sqmaplen);
+        close(fd);
+        return -4;
+    }
+
+    aio->sqhead = (unsigned *)(sq + p.sq_off.head);
+    aio->sqtail = (unsigned *)(sq + p.sq_off.tail);
+    aio->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    aio->sqarray = (unsigned *)(sq + p.sq_off.array);
+
+    aio->cqhead = (unsigned *)(cq + p.cq_off.head);
+    aio->cqtail = (unsigned *)(cq + p.cq_off.tail);
+    aio->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    aio->ringfd = fd;
+    aio->sq_entries = p.sq_entries;
+    aio->cq_entries = p.cq_entries;
+
+    /* every request may take 2 CQEs when it's retried after polling */
+    aio->maxinflight = p.cq_entries / 2;
+
+    InitializeCriticalSection(&aio->sqCS);
+
+    if (uring_register(fd, IORING_REGISTER_EVENTFD, &aio->efd, 1) < 0)
+        tolog(1, "Panic: asyncio io_uring register eventfd failed, errno=%d\n", errno);
+
+    return 0;
+}
+
+static void uring_clean (AsyncIO * aio)
+{
+    munmap(aio->sqes, aio->sqeslen);
+    if (aio->cqmap) munmap(aio->cqmap, aio->cqmaplen);
+    munmap(aio->sqmap, aio->sqmaplen);
+    close(aio->ringfd);
+
+    DeleteCriticalSection(&aio->sqCS);
+}
+
+static struct io_uring_sqe * uring_sqe_get (AsyncIO * aio)
+{
+    unsigned  head = 0, tail = 0;
+
+    head = katomic_load(aio->sqhead);
+    tail = *aio->sqtail;
+
+    if (tail - head >= aio->sq_entries)
+        return NULL;
+
+    return &aio->sqes[tail & *aio->sqmask];
+}
+
+static void uring_sqe_push (AsyncIO * aio)
+{
+    unsigned  tail = *aio->sqtail;
+    unsigned  index = tail & *aio->sqmask;
+
+    aio->sqarray[index] = index;
+    katomic_store(aio->sqtail, tail + 1);
+    aio->sqpending++;
+}
+
+static int uring_submit_nolock (AsyncIO * aio)
+{
+    int   ret = 0, num = 0;
+
+    while (aio->sqpending > 0) {
+        ret = uring_enter(aio->ringfd, aio->sqpending, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EBUSY) break;
+            tolog(1, "Panic: asyncio io_uring_enter submit failed, errno=%d\n", errno);
+            break;
+        }
+        aio->sqpending -= ret;
+        num += ret;
+        if (ret == 0) break;
+    }
+
+    return num;
+}
+
+static void uring_sqe_fill (struct io_uring_sqe * sqe, AIOOp * op, int flags)
+{
+    AsyncReq  * req = &op->req;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->fd = req->fd;
+    sqe->off = (uint64)req->offset;
+    sqe->user_data = (uint64)(ulong)op;
+
+    if (flags & ASYNCIO_F_LINK) sqe->flags |= IOSQE_IO_LINK;
+    if (flags & ASYNCIO_F_FIXEDFILE) sqe->flags |= IOSQE_FIXED_FILE;
+
+    switch (req->opcode) {
+    case ASYNCIO_OP_READ:
+    case ASYNCIO_OP_WRITE:
+        if (flags & ASYNCIO_F_FIXEDBUF) {
+            sqe->opcode = req->opcode == ASYNCIO_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = req->bufindex;
+        } else {
+            sqe->opcode = req->opcode == ASYNCIO_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        }
+        sqe->addr = (uint64)(ulong)req->buf;
+        sqe->len = req->len;
+        break;
+
+    case ASYNCIO_OP_READV:
+    case ASYNCIO_OP_WRITEV:
+        sqe->opcode = req->opcode == ASYNCIO_OP_READV ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = (uint64)(ulong)req->iov;
+        sqe->len = req->iovcnt;
+        break;
+
+    case ASYNCIO_OP_RECV:
+    case ASYNCIO_OP_SEND:
+        sqe->opcode = req->opcode == ASYNCIO_OP_RECV ? IORING_OP_RECV : IORING_OP_SEND;
+        sqe->addr = (uint64)(ulong)req->buf;
+        sqe->len = req->len;
+        sqe->off = 0;
+        sqe->msg_flags = req->msgflags;
+        if (req->opcode == ASYNCIO_OP_SEND) sqe->msg_flags |= MSG_NOSIGNAL;
+        break;
+
+    case ASYNCIO_OP_SPLICE:
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = req->fdout;
+        sqe->off = (uint64)-1;
+        sqe->splice_fd_in = req->fd;
+        sqe->splice_off_in = (uint64)req->offset;
+        sqe->len = req->len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        if (flags & ASYNCIO_F_FIXEDFILE) sqe->splice_flags |= SPLICE_F_FD_IN_FIXED;
+        break;
+
+    case ASYNCIO_OP_FSYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->off = 0;
+        break;
+
+    default:
+        sqe->opcode = IORING_OP_NOP;
+        break;
+    }
+}
+
+static int uring_prep (AsyncIO * aio, AIOOp * op)
+{
+    struct io_uring_sqe  * sqe = NULL;
+
+    EnterCriticalSection(&aio->sqCS);
+
+    sqe = uring_sqe_get(aio);
+    if (!sqe && !aio->inchain) {
+        /* ring is full, flush the queued sqes. a linked chain is never split */
+        uring_submit_nolock(aio);
+        sqe = uring_sqe_get(aio);
+    }
+    if (!sqe) {
+        LeaveCriticalSection(&aio->sqCS);
+        return -EBUSY;
+    }
+
+    uring_sqe_fill(sqe, op, op->req.flags);
+    uring_sqe_push(aio);
+
+    /* the chain is kept to resubmit it whole if a request of it gets EAGAIN */
+    if (aio->lastlink) aio->lastlink->link = op;
+    aio->lastlink = (op->req.flags & ASYNCIO_F_LINK) ? op : NULL;
+
+    aio->inchain = (op->req.flags & ASYNCIO_F_LINK) ? 1 : 0;
+
+    LeaveCriticalSection(&aio->sqCS);
+
+    return 0;
+}
+
+/* queue a poll request linked with the request getting EAGAIN, followed by
+   the rest of its chain which the kernel has cancelled */
+static int uring_rearm (AsyncIO * aio, AIOOp * op)
+{
+    struct io_uring_sqe  * sqe = NULL;
+    AIOOp                * lop = NULL;
+    unsigned               head, tail, need = 1;
+
+    for (lop = op; lop; lop = lop->link) need++;
+
+    head = katomic_load(aio->sqhead);
+    tail = *aio->sqtail;
+    if (aio->sq_entries - (tail - head) < need) {
+        uring_submit_nolock(aio);
+
+        head = katomic_load(aio->sqhead);
+        tail = *aio->sqtail;
+        if (aio->sq_entries - (tail - head) < need) return -1;
+    }
+
+    sqe = uring_sqe_get(aio);
+    if (!sqe) return -2;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = aio_op_pollfd(op);
+    sqe->poll32_events = aio_op_pollevent(op);
+    sqe->flags = IOSQE_IO_LINK;
+    if (op->req.flags & ASYNCIO_F_FIXEDFILE) sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->user_data = aio_user_poll(op);
+    uring_sqe_push(aio);
+
+    for (lop = op; lop; lop = lop->link) {
+        sqe = uring_sqe_get(aio);
+        if (!sqe) return -3;
+
+        uring_sqe_fill(sqe, lop, lop->link ? lop->req.flags : lop->req.flags & ~ASYNCIO_F_LINK);
+        uring_sqe_push(aio);
+    }
+
+    return 0;
+}
+
+/* resubmit the chains waiting in rearmhead. called with sqCS held. while a
+   chain is being prepared they wait for asyncio_submit, so that the poll is
+   not linked into it */
+static void uring_rearm_flush (AsyncIO * aio)
+{
+    AIOOp  * op = NULL;
+    AIOOp  * lop = NULL;
+
+    if (!aio->rearmhead || aio->inchain) return;
+
+    while ((op = aio->rearmhead) != NULL) {
+        aio->rearmhead = op->next;
+
+        if (uring_rearm(aio, op) < 0) {
+            /* no room for the chain, fail it as the kernel did */
+            lop = op->link;
+            aio_done_push(aio, op, -EAGAIN);
+
+            for (op = lop; op; op = lop) {
+                lop = op->link;
+                aio_done_push(aio, op, -ECANCELED);
+            }
+        }
+    }
+
+    uring_submit_nolock(aio);
+}
+
+static int uring_reap (AsyncIO * aio)
+{
+    struct io_uring_cqe  * cqe = NULL;
+    AIOOp                * op = NULL;
+    AIOOp                * rearm = NULL;
+    AIOOp                * lop = NULL;
+    unsigned               head, tail;
+    uint64                 udata = 0;
+    int                    res = 0;
+    int                    num = 0;
+
+    aio_drain(aio);
+
+    EnterCriticalSection(&aio->doneCS);
+    head = *aio->cqhead;
+    tail = katomic_load(aio->cqtail);
+
+    for ( ; head != tail; head++) {
+        cqe = &aio->cqes[head & *aio->cqmask];
+        udata = cqe->user_data;
+        res = cqe->res;
+
+        /* result of the poll companion is delivered by the request it links */
+        if (udata & 1) continue;
+
+        op = (AIOOp *)(ulong)udata;
+        if (!op) continue;
+
+        /* a request after the one getting EAGAIN in a linked chain. the kernel
+           posts the head's CQE first and cancels the rest, they are resubmitted
+           with the head once all their CQEs are in */
+        if (op->chead) {
+            lop = op->chead;
+            op->chead = NULL;
+
+            if (--lop->cancels == 0) {
+                lop->next = rearm;
+                rearm = lop;
+            }
+            continue;
+        }
+
+        if (res == -EAGAIN && aio_op_pollevent(op)) {
+            for (lop = op->link; lop; lop = lop->link) {
+                lop->chead = op;
+                op->cancels++;
+            }
+
+            if (op->cancels == 0) {
+                op->next = rearm;
+                rearm = op;
+            }
+            continue;
+        }
+
+        op->result = res;
+        op->next = NULL;
+        if (aio->donetail) aio->donetail->next = op;
+        else aio->donehead = op;
+        aio->donetail = op;
+        num++;
+    }
+    katomic_store(aio->cqhead, head);
+    LeaveCriticalSection(&aio->doneCS);
+
+    if (rearm) {
+        EnterCriticalSection(&aio->sqCS);
+        while ((op = rearm) != NULL) {
+            rearm = op->next;
+            op->next = aio->rearmhead;
+            aio->rearmhead = op;
+        }
+        uring_rearm_flush(aio);
+        LeaveCriticalSection(&aio->sqCS);
+    }
+
+    return num;
+}
+
+#endif
+
+
+/* execute one request with blocking syscall, return bytes or negative errno */
+static int64 aio_op_exec (AsyncIO * aio, AIOOp * op)
+{
+    AsyncReq  * req = &op->req;
+    loff_t      off = 0;
+    ssize_t     ret = 0;
+    int         fd = req->fd;
+
+    if (req->flags & ASYNCIO_F_FIXEDFILE) {
+        if (!aio->fixedfds || fd < 0 || fd >= aio->fixednum)
+            return -EBADF;
+        fd = aio->fixedfds[fd];
+    }
+
+    switch (req->opcode) {
+    case ASYNCIO_OP_READ:
+        ret = req->offset >= 0 ? pread(fd, req->buf, req->len, req->offset)
+                               : read(fd, req->buf, req->len);
+        break;
+    case ASYNCIO_OP_WRITE:
+        ret = req->offset >= 0 ? pwrite(fd, req->buf, req->len, req->offset)
+                               : write(fd, req->buf, req->len);
+        break;
+    case ASYNCIO_OP_READV:
+        ret = req->offset >= 0 ? preadv(fd, req->iov, req->iovcnt, req->offset)
+                               : readv(fd, req->iov, req->iovcnt);
+        break;
+    case ASYNCIO_OP_WRITEV:
+        ret = req->offset >= 0 ? pwritev(fd, req->iov, req->iovcnt, req->offset)
+                               : writev(fd, req->iov, req->iovcnt);
+        break;
+    case ASYNCIO_OP_RECV:
+        ret = recv(fd, req->buf, req->len, req->msgflags);
+        break;
+    case ASYNCIO_OP_SEND:
+        ret = send(fd, req->buf, req->len, req->msgflags | MSG_NOSIGNAL);
+        break;
+    case ASYNCIO_OP_SPLICE:
+        off = req->offset;
+        ret = splice(fd, req->offset >= 0 ? &off : NULL, req->fdout, NULL, req->len, SPLICE_F_MOVE);
+        break;
+    case ASYNCIO_OP_FSYNC:
+        ret = fsync(fd);
+        break;
+    default:
+        ret = 0;
+        break;
+    }
+
+    if (ret < 0) return -errno;
+
+    return ret;
+}
+
+static void aio_run_push (AsyncIO * aio, AIOOp * head, AIOOp * tail)
+{
+    EnterCriticalSection(&aio->runCS);
+    if (aio->runtail) aio->runtail->next = head;
+    else aio->runhead = head;
+    aio->runtail = tail;
+    pthread_cond_broadcast(&aio->runcond);
+    LeaveCriticalSection(&aio->runCS);
+}
+
+/* park the request on epoll until its fd turns ready. fd is duplicated so that
+   several requests on the same socket are registered independently */
+static int aio_op_park (AsyncIO * aio, AIOOp * op)
+{
+    struct epoll_event  ev;
+    int                 fd = aio_op_pollfd(op);
+
+    if (op->req.flags & ASYNCIO_F_FIXEDFILE) {
+        if (fd < 0 || fd >= aio->fixednum) return -1;
+        fd = aio->fixedfds[fd];
+    }
+
+    op->pollfd = dup(fd);
+    if (op->pollfd < 0) return -2;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (aio_op_pollevent(op) == POLLIN ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    ev.data.ptr = op;
+
+    if (epoll_ctl(aio->epfd, EPOLL_CTL_ADD, op->pollfd, &ev) < 0) {
+        close(op->pollfd);
+        op->pollfd = -1;
+        return -3;
+    }
+
+    return 0;
+}
+
+/* execute the linked chain in order. the chain is cut when a request fails or
+   transfers less than expected, the rest are completed with ECANCELED */
+static void aio_chain_exec (AsyncIO * aio, AIOOp * op)
+{
+    AIOOp  * next = NULL;
+    int64    ret = 0;
+
+    while (op) {
+        next = op->link;
+        op->link = NULL;
+
+        ret = aio_op_exec(aio, op);
+
+        if ((ret == -EAGAIN || ret == -EWOULDBLOCK) && aio_op_pollevent(op)) {
+            op->link = next;
+            if (aio_op_park(aio, op) == 0)
+                return;
+            op->link = NULL;
+        }
+
+        aio_done_push(aio, op, ret);
+
+        if (next && (ret < 0 || ret < aio_op_expect(op))) {
+            for (op = next; op; op = next) {
+                next = op->link;
+                op->link = NULL;
+                aio_done_push(aio, op, -ECANCELED);
+            }
+            break;
+        }
+
+        op = next;
+    }
+
+    aio_notify(aio);
+}
+
+static void * aio_worker (void * arg)
+{
+    AsyncIO  * aio = (AsyncIO *)arg;
+    AIOOp    * op = NULL;
+
+    for ( ; ; ) {
+        EnterCriticalSection(&aio->runCS);
+        while (!aio->runhead && !aio->quit)
+            pthread_cond_wait(&aio->runcond, &aio->runCS);
+
+        if (!aio->runhead) {
+            LeaveCriticalSection(&aio->runCS);
+            break;
+        }
+
+        op = aio->runhead;
+        aio->runhead = op->next;
+        if (!aio->runhead) aio->runtail = NULL;
+        LeaveCriticalSection(&aio->runCS);
+
+        op->next = NULL;
+        aio_chain_exec(aio, op);
+    }
+
+    return NULL;
+}
+
+static void * aio_epoll_thread (void * arg)
+{
+    AsyncIO             * aio = (AsyncIO *)arg;
+    struct epoll_event    evs[64];
+    AIOOp               * op = NULL;
+    int                   i, num;
+
+    while (!katomic_load(&aio->quit)) {
+        num = epoll_wait(aio->epfd, evs, sizeof(evs)/sizeof(evs[0]), 500);
+
+        for (i = 0; i < num; i++) {
+            op = evs[i].data.ptr;
+
+            epoll_ctl(aio->epfd, EPOLL_CTL_DEL, op->pollfd, NULL);
+            close(op->pollfd);
+            op->pollfd = -1;
+
+            op->next = NULL;
+            aio_run_push(aio, op, op);
+        }
+    }
+
+    return NULL;
+}
+
+static int aio_thread_init (AsyncIO * aio, int threads)
+{
+    int  i;
+
+    if (threads <= 0) threads = 4;
+    if (threads > 256) threads = 256;
+
+    aio->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (aio->epfd < 0) return -1;
+
+    InitializeCriticalSection(&aio->runCS);
+    pthread_cond_init(&aio->runcond, NULL);
+    aio->runinit = 1;
+
+    aio->tids = kzalloc(threads * sizeof(pthread_t));
+    if (!aio->tids) return -2;
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&aio->tids[i], NULL, aio_worker, aio) != 0)
+            break;
+    }
+    aio->threads = i;
+
+    if (aio->threads == 0 || pthread_create(&aio->epolltid, NULL, aio_epoll_thread, aio) != 0) {
+        tolog(1, "Panic: asyncio failed to start worker threads\n");
+        return -3;
+    }
+    aio->epollok = 1;
+
+    aio->maxinflight = 65536;
+
+    return 0;
+}
+
+/* undo the steps of aio_thread_init that succeeded, it may have failed half way */
+static void aio_thread_clean (AsyncIO * aio)
+{
+    int  i;
+
+    if (aio->runinit) {
+        EnterCriticalSection(&aio->runCS);
+        katomic_store(&aio->quit, 1);
+        pthread_cond_broadcast(&aio->runcond);
+        LeaveCriticalSection(&aio->runCS);
+    }
+
+    for (i = 0; i < aio->threads; i++)
+        pthread_join(aio->tids[i], NULL);
+    if (aio->epollok)
+        pthread_join(aio->epolltid, NULL);
+
+    if (aio->tids) kfree(aio->tids);
+    if (aio->fixedfds) kfree(aio->fixedfds);
+
+    if (aio->epfd >= 0) close(aio->epfd);
+
+    if (aio->runinit) {
+        pthread_cond_destroy(&aio->runcond);
+        DeleteCriticalSection(&aio->runCS);
+    }
+}
+
+static int aio_thread_prep (AsyncIO * aio, AIOOp * op)
+{
+    EnterCriticalSection(&aio->runCS);
+
+    if (aio->lastlink) {
+        aio->lastlink->link = op;
+    } else {
+        if (aio->pendtail) aio->pendtail->next = op;
+        else aio->pendhead = op;
+        aio->pendtail = op;
+    }
+
+    aio->lastlink = (op->req.flags & ASYNCIO_F_LINK) ? op : NULL;
+
+    LeaveCriticalSection(&aio->runCS);
+
+    return 0;
+}
+
+static int aio_thread_submit (AsyncIO * aio)
+{
+    AIOOp  * op = NULL;
+    int      num = 0;
+
+    EnterCriticalSection(&aio->runCS);
+
+    for (op = aio->pendhead; op; op = op->next) num++;
+
+    if (aio->pendhead) {
+        if (aio->runtail) aio->runtail->next = aio->pendhead;
+        else aio->runhead = aio->pendhead;
+        aio->runtail = aio->pendtail;
+        aio->pendhead = aio->pendtail = NULL;
+
+        pthread_cond_broadcast(&aio->runcond);
+    }
+    aio->lastlink = NULL;
+
+    LeaveCriticalSection(&aio->runCS);
+
+    return num;
+}
+
+
+void * asyncio_init (int entries, int threads, int engine)
+{
+    AsyncIO  * aio = NULL;
+
+    if (entries <= 0) entries = 256;
+    if (entries > 32768) entries = 32768;
+
+    aio = kzalloc(sizeof(*aio));
+    if (!aio) return NULL;
+
+    aio->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (aio->efd < 0) {
+        kfree(aio);
+        return NULL;
+    }
+
+    InitializeCriticalSection(&aio->opCS);
+    InitializeCriticalSection(&aio->doneCS);
+    aio->epfd = -1;
+
+#ifdef HAVE_IO_URING
+    if (engine != ASYNCIO_THREAD && uring_init(aio, entries) == 0) {
+        aio->engine = ASYNCIO_URING;
+        return aio;
+    }
+#endif
+
+    if (aio_thread_init(aio, threads) < 0) {
+        aio->engine = ASYNCIO_THREAD;
+        asyncio_clean(aio);
+        return NULL;
+    }
+    aio->engine = ASYNCIO_THREAD;
+
+    return aio;
+}
+
+int asyncio_clean (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+    AIOOp    * op = NULL;
+
+    if (!aio) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        uring_clean(aio);
+#endif
+    if (aio->engine == ASYNCIO_THREAD)
+        aio_thread_clean(aio);
+
+    while ((op = aio->donehead) != NULL) {
+        aio->donehead = op->next;
+        kfree(op);
+    }
+    while ((op = aio->opfree) != NULL) {
+        aio->opfree = op->next;
+        kfree(op);
+    }
+
+    close(aio->efd);
+
+    DeleteCriticalSection(&aio->opCS);
+    DeleteCriticalSection(&aio->doneCS);
+
+    kfree(aio);
+    return 0;
+}
+
+int asyncio_engine (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio) return ASYNCIO_NONE;
+
+    return aio->engine;
+}
+
+int asyncio_eventfd (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio) return -1;
+
+    return aio->efd;
+}
+
+int asyncio_inflight (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio) return 0;
+
+    return katomic_load_relaxed(&aio->inflight);
+}
+
+int asyncio_register_buffers (void * vaio, struct iovec * iov, int num)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio || !iov || num <= 0) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        return uring_register(aio->ringfd, IORING_REGISTER_BUFFERS, iov, num) < 0 ? -errno : 0;
+#endif
+
+    /* worker threads access the buffers by their addresses directly */
+    return 0;
+}
+
+int asyncio_unregister_buffers (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        return uring_register(aio->ringfd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0 ? -errno : 0;
+#endif
+
+    return 0;
+}
+
+int asyncio_register_files (void * vaio, int * fds, int num)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio || !fds || num <= 0) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        return uring_register(aio->ringfd, IORING_REGISTER_FILES, fds, num) < 0 ? -errno : 0;
+#endif
+
+    if (aio->fixedfds) return -EBUSY;
+
+    aio->fixedfds = kalloc(num * sizeof(int));
+    if (!aio->fixedfds) return -ENOMEM;
+
+    memcpy(aio->fixedfds, fds, num * sizeof(int));
+    aio->fixednum = num;
+
+    return 0;
+}
+
+int asyncio_unregister_files (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+
+    if (!aio) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        return uring_register(aio->ringfd, IORING_UNREGISTER_FILES, NULL, 0) < 0 ? -errno : 0;
+#endif
+
+    if (aio->fixedfds) kfree(aio->fixedfds);
+    aio->fixedfds = NULL;
+    aio->fixednum = 0;
+
+    return 0;
+}
+
+int asyncio_prep (void * vaio, AsyncReq * req)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+    AIOOp    * op = NULL;
+    int        ret = 0;
+
+    if (!aio || !req) return -1;
+
+    if (katomic_add(&aio->inflight, 1) > aio->maxinflight) {
+        katomic_add(&aio->inflight, -1);
+        return -EBUSY;
+    }
+
+    op = aio_op_get(aio);
+    if (!op) {
+        katomic_add(&aio->inflight, -1);
+        return -ENOMEM;
+    }
+
+    op->req = *req;
+    op->pollfd = -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING)
+        ret = uring_prep(aio, op);
+    else
+#endif
+        ret = aio_thread_prep(aio, op);
+
+    if (ret < 0) {
+        aio_op_put(aio, op);
+        katomic_add(&aio->inflight, -1);
+    }
+
+    return ret;
+}
+
+int asyncio_submit (void * vaio)
+{
+    AsyncIO  * aio = (AsyncIO *)vaio;
+    int        num = 0;
+
+    if (!aio) return -1;
+
+#ifdef HAVE_IO_URING
+    if (aio->engine == ASYNCIO_URING) {
+        EnterCriticalSection(&aio->sqCS);
+        num = uring_submit_nolock(aio);
+        aio->inchain = 0;
+        aio->lastlink = NULL;
+        uring_rearm_flush(aio);
+        LeaveCriticalSection(&aio->sqCS);
+        return num;
+    }
+#endif
+
+    return aio_thread_submit(aio);
+}
+
+int asyncio_poll (void * vaio, int waitms)
+{
+    AsyncIO       * aio = (AsyncIO *)vaio;
+    struct pollfd   pfd;
+    int             num = 0;
+
+    if (!aio) return -1;
+
+    for ( ; ; ) {
+#ifdef HAVE_IO_URING
+        if (aio->engine == ASYNCIO_URING)
+            uring_reap(aio);
+        else
+#endif
+            aio_drain(aio);
+
+        num = aio_done_dispatch(aio);
+        if (num > 0 || waitms == 0) break;
+
+        pfd.fd = aio->efd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, waitms) <= 0)
+            break;
+        waitms = 0;
+    }
+
+    return num;
+}
+
+#else
+
+void * asyncio_init (int entries, int threads, int engine) { return NULL; }
+int    asyncio_clean (void * vaio) { return -1; }
+int    asyncio_engine (void * vaio) { return ASYNCIO_NONE; }
+int    asyncio_eventfd (void * vaio) { return -1; }
+int    asyncio_inflight (void * vaio) { return 0; }
+int    asyncio_register_buffers (void * vaio, struct iovec * iov, int num) { return -1; }
+int    asyncio_unregister_buffers (void * vaio) { return -1; }
+int    asyncio_register_files (void * vaio, int * fds, int num) { return -1; }
+int    asyncio_unregister_files (void * vaio) { return -1; }
+int    asyncio_prep (void * vaio, AsyncReq * req) { return -1; }
+int    asyncio_submit (void * vaio) { return -1; }
+int    asyncio_poll (void * vaio, int waitms) { return -1; }
+
+#endif
+
+
+static int asyncio_do (void * vaio, int opcode, int fd, void * buf, int len, struct iovec * iov,
+                       int iovcnt, int64 offset, void * cb, void * cbpara)
+{
+    AsyncReq  req;
+    int       ret = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.opcode = opcode;
+    req.fd = fd;
+    req.offset = offset;
+    req.buf = buf;
+    req.len = len;
+    req.iov = iov;
+    req.iovcnt = iovcnt;
+    req.cb = (AsyncIOCB *)cb;
+    req.cbpara = cbpara;
+
+    ret = asyncio_prep(vaio, &req);
+    if (ret < 0) return ret;
+
+    asyncio_submit(vaio);
+
+    return 0;
+}
+
+int asyncio_read (void * vaio, int fd, void * buf, int len, int64 offset, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_READ, fd, buf, len, NULL, 0, offset, cb, cbpara);
+}
+
+int asyncio_write (void * vaio, int fd, void * buf, int len, int64 offset, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_WRITE, fd, buf, len, NULL, 0, offset, cb, cbpara);
+}
+
+int asyncio_readv (void * vaio, int fd, struct iovec * iov, int iovcnt, int64 offset, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_READV, fd, NULL, 0, iov, iovcnt, offset, cb, cbpara);
+}
+
+int asyncio_writev (void * vaio, int fd, struct iovec * iov, int iovcnt, int64 offset, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_WRITEV, fd, NULL, 0, iov, iovcnt, offset, cb, cbpara);
+}
+
+int asyncio_recv (void * vaio, int fd, void * buf, int len, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_RECV, fd, buf, len, NULL, 0, 0, cb, cbpara);
+}
+
+int asyncio_send (void * vaio, int fd, void * buf, int len, void * cb, void * cbpara)
+{
+    return asyncio_do(vaio, ASYNCIO_OP_SEND, fd, buf, len, NULL, 0, 0, cb, cbpara);
+}
+
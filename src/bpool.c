@@ -31,6 +31,10 @@
 #include "memory.h"
 #include "arfifo.h"
 #include "rbtree.h"
+#include "btime.h"
+#include "poolstat.h"
+#include "katomic.h"
+#include "lfstack.h"
 
 #ifdef UNIX
 #include "mthread.h"
@@ -70,6 +74,10 @@ typedef struct buffer_pool {
 
     time_t   idletick;
 
+    /* idle seconds after which the pages of idle units are returned to OS */
+    int      trimtime;
+    time_t   trimtick;
+
     /* the memory units organized via the following fifo queue */
     CRITICAL_SECTION   ulCS;
     arfifo_t         * fifo;
@@ -77,6 +85,14 @@ typedef struct buffer_pool {
 
     rbtree_t         * rmduptree;
 
+    /* in lock-free mode, idle units are kept in 2 lock-free stacks instead of
+       the fifo queues, the counters are updated by relaxed atomic operations */
+    uint8              lockfree;
+    lfstack_t        * lffresh;     //units pre-allocated but never handed out
+    lfstack_t        * lfrecycle;   //units recycled
+
+    PoolStat           stat;
+
 } bpool_t;
 
 
@@ -90,6 +106,30 @@ int bpool_unit_cmp_key (void * a, void * b)
     return 0;
 }
 
+static int bpool_stat_snap (void * vpool, PoolSnap * snap)
+{
+    bpool_t * pool = (bpool_t *)vpool;
+
+    if (!pool || !snap) return -1;
+
+    snap->unitsize = pool->unitsize;
+    snap->allocated = pool->allocated;
+    snap->consumed = pool->consumed;
+    snap->remaining = pool->remaining;
+    snap->reserved = (long)pool->allocated * pool->unitsize + sizeof(*pool);
+    snap->peak = pool->stat.peak;
+    snap->blknum = pool->allocnum > 0 ? (pool->allocated + pool->allocnum - 1) / pool->allocnum : 0;
+
+    snap->fetchnum = pool->stat.fetchnum;
+    snap->recyclenum = pool->stat.recyclenum;
+    snap->contention = pool->stat.contention;
+
+    if (pool->lockfree)
+        snap->contention += pool->lffresh->retry + pool->lfrecycle->retry;
+
+    return 0;
+}
+
 bpool_t * bpool_init (bpool_t * pool)
 {
     bpool_t * pmem = NULL;
@@ -113,6 +153,8 @@ bpool_t * bpool_init (bpool_t * pool)
 
     pmem->rmduptree = rbtree_new(bpool_unit_cmp_key, 1);
 
+    poolstat_register(pmem, POOL_TYPE_BPOOL, bpool_stat_snap);
+
     return pmem;
 }
 
@@ -124,6 +166,23 @@ int bpool_clean (bpool_t * pool)
 
     if (!pool) return -1;
 
+    poolstat_unregister(pool);
+
+    if (pool->lockfree) {
+        while ((punit = lfstack_pop(pool->lfrecycle)) != NULL) {
+            if (pool->unitfree)
+                (*pool->unitfree)(punit);
+            else
+                kfree(punit);
+        }
+        while ((punit = lfstack_pop(pool->lffresh)) != NULL)
+            kfree(punit);
+
+        lfstack_free(pool->lfrecycle);
+        lfstack_free(pool->lffresh);
+        pool->lfrecycle = pool->lffresh = NULL;
+    }
+
     EnterCriticalSection(&pool->ulCS);
 
     num = ar_fifo_num(pool->refifo);
@@ -156,6 +215,52 @@ int bpool_clean (bpool_t * pool)
     return 0;
 }
 
+static void * bpool_lf_fetch (bpool_t * pool)
+{
+    void * punit = NULL;
+    void * pnew = NULL;
+    int    consumed = 0;
+    int    i = 0;
+
+    punit = lfstack_pop(pool->lffresh);
+    if (!punit)
+        punit = lfstack_pop(pool->lfrecycle);
+
+    if (punit) {
+        katomic_add_relaxed(&pool->remaining, -1);
+
+    } else {
+        /* hand out the first unit of the newly allocated batch, others are idle */
+        for (i = 0; i < pool->allocnum; i++) {
+            pnew = kzalloc(pool->unitsize);
+            if (!pnew) continue;
+
+            katomic_add_relaxed(&pool->allocated, 1);
+
+            if (!punit) {
+                punit = pnew;
+            } else if (lfstack_push(pool->lffresh, pnew) < 0) {
+                kfree(pnew);
+                katomic_add_relaxed(&pool->allocated, -1);
+            } else {
+                katomic_add_relaxed(&pool->remaining, 1);
+            }
+        }
+        if (!punit) return NULL;
+    }
+
+    consumed = katomic_add_relaxed(&pool->consumed, 1);
+
+    katomic_add64(&pool->stat.fetchnum, 1);
+    if (consumed > pool->stat.peak)
+        pool->stat.peak = consumed;
+
+    if (pool->unitinit)
+        (*pool->unitinit)(punit);
+
+    return punit;
+}
+
 void * bpool_fetch (bpool_t * pool)
 {
     void * punit = NULL;
@@ -163,7 +268,10 @@ void * bpool_fetch (bpool_t * pool)
 
     if (!pool) return NULL;
 
-    EnterCriticalSection(&pool->ulCS);
+    if (pool->lockfree)
+        return bpool_lf_fetch(pool);
+
+    poolstat_lock(&pool->ulCS, &pool->stat);
 
     /* pool->fifo stores objects pre-allocated but not handed out.
        pool->recytree stores the recycled objects. */
@@ -196,6 +304,8 @@ void * bpool_fetch (bpool_t * pool)
            and only once. It is very dangerous and not allowed to recycle the
            same memory unit into the memory pool repeatedly! */
         rbtree_insert(pool->rmduptree, punit, punit, NULL);
+
+        poolstat_fetch(&pool->stat, pool->consumed);
     }
 
     LeaveCriticalSection(&pool->ulCS);
@@ -206,19 +316,140 @@ void * bpool_fetch (bpool_t * pool)
     return punit;
 }
 
+/* Trimming the pages of idle units. The units in fifo have never been handed out.
+   The recycled units in refifo may hold resources released by unitfree, they are
+   trimmed only when no unitfree is set. */
+static long bpool_trim_units (bpool_t * pool)
+{
+    long   trimmed = 0;
+    int    i, num;
+
+    num = ar_fifo_num(pool->fifo);
+    for (i = 0; i < num; i++)
+        trimmed += kmem_trim(ar_fifo_value(pool->fifo, i), pool->unitsize);
+
+    if (!pool->unitfree) {
+        num = ar_fifo_num(pool->refifo);
+        for (i = 0; i < num; i++)
+            trimmed += kmem_trim(ar_fifo_value(pool->refifo, i), pool->unitsize);
+    }
+
+    pool->trimtick = time(0);
+
+    return trimmed;
+}
+
+/* pages of idle units are trimmed after taking the units out of the stack,
+   the fetchers meanwhile find the stack empty and allocate new units */
+static long bpool_lf_trim_units (bpool_t * pool)
+{
+    lfnode_t  * chain = NULL;
+    lfnode_t  * node = NULL;
+    long        trimmed = 0;
+
+    chain = lfstack_detach(pool->lffresh);
+    for (node = chain; node; node = node->next)
+        trimmed += kmem_trim(node->value, pool->unitsize);
+    lfstack_attach(pool->lffresh, chain);
+
+    if (!pool->unitfree) {
+        chain = lfstack_detach(pool->lfrecycle);
+        for (node = chain; node; node = node->next)
+            trimmed += kmem_trim(node->value, pool->unitsize);
+        lfstack_attach(pool->lfrecycle, chain);
+    }
+
+    pool->trimtick = time(0);
+
+    return trimmed;
+}
+
+static int bpool_lf_recycle (bpool_t * pool, void * punit)
+{
+    int   threshold = 0;
+    int   isfresh = 0;
+
+    katomic_add64(&pool->stat.recyclenum, 1);
+
+    if (pool->unitfree && pool->unit_freesize > 0 && pool->getunitsize != NULL) {
+        if ((*pool->getunitsize)(punit) >= pool->unit_freesize) {
+            (*pool->unitfree)(punit);
+            katomic_add_relaxed(&pool->allocated, -1);
+            katomic_add_relaxed(&pool->consumed, -1);
+            return 0;
+        }
+    }
+
+    katomic_add_relaxed(&pool->consumed, -1);
+
+    if (lfstack_push(pool->lfrecycle, punit) < 0) {
+        if (pool->unitfree) (*pool->unitfree)(punit);
+        else kfree(punit);
+        katomic_add_relaxed(&pool->allocated, -1);
+        return 0;
+    }
+    katomic_add_relaxed(&pool->remaining, 1);
+
+    /* same policy as locked mode. concurrent recyclers may release a few
+       more units than the threshold, which does no harm */
+    threshold = pool->allocnum << 1;
+
+    if (katomic_load_relaxed(&pool->allocated) > pool->allocnum &&
+        katomic_load_relaxed(&pool->remaining) >= threshold)
+    {
+        if (pool->idletick == 0) {
+            pool->idletick = time(0);
+
+        } else if (time(0) - pool->idletick > 300) {
+            while (katomic_load_relaxed(&pool->allocated) > pool->allocnum &&
+                   katomic_load_relaxed(&pool->remaining) > threshold)
+            {
+                isfresh = 0;
+                punit = lfstack_pop(pool->lfrecycle);
+                if (!punit) {
+                    punit = lfstack_pop(pool->lffresh);
+                    isfresh = 1;
+                }
+                if (!punit) break;
+
+                if (pool->unitfree && !isfresh) (*pool->unitfree)(punit);
+                else kfree(punit);
+
+                katomic_add_relaxed(&pool->remaining, -1);
+                katomic_add_relaxed(&pool->allocated, -1);
+            }
+        }
+    } else if (pool->idletick > 0) {
+        pool->idletick = 0;
+    }
+
+    if (pool->trimtime > 0 && pool->idletick > 0 && pool->trimtick < pool->idletick &&
+        time(0) - pool->idletick >= pool->trimtime)
+    {
+        bpool_lf_trim_units(pool);
+    }
+
+    return 0;
+}
+
 int bpool_recycle (bpool_t * pool, void * punit)
 {
     int   threshold = 0;
 
     if (!pool || !punit) return -1;
 
-    EnterCriticalSection(&pool->ulCS);
+    if (pool->lockfree)
+        return bpool_lf_recycle(pool, punit);
+
+    poolstat_lock(&pool->ulCS, &pool->stat);
 
     if (rbtree_delete(pool->rmduptree, punit) != punit) {
         LeaveCriticalSection(&pool->ulCS);
         return -10;
     }
 
+    poolstat_recycle(&pool->stat);
+
     if (pool->unitfree && pool->unit_freesize > 0 && pool->getunitsize != NULL) {
         if ((*pool->getunitsize)(punit) >= pool->unit_freesize) {
             (*pool->unitfree)(punit);
@@ -266,10 +497,147 @@ int bpool_recycle (bpool_t * pool, void * punit)
         pool->idletick = 0;
     }
 
+    if (pool->trimtime > 0 && pool->idletick > 0 && pool->trimtick < pool->idletick &&
+        time(0) - pool->idletick >= pool->trimtime)
+    {
+        bpool_trim_units(pool);
+    }
+
     LeaveCriticalSection(&pool->ulCS);
     return 0;
 }
 
+int bpool_warmup (bpool_t * pool, int unitnum, int flags, int threads, long * pms)
+{
+    void   ** pmem = NULL;
+    long    * size = NULL;
+    void    * punit = NULL;
+    btime_t   tick;
+    int       i, num = 0, total = 0;
+
+    if (pms) *pms = 0;
+
+    if (!pool) return -1;
+    if (pool->unitsize < 1) return -2;
+
+    btime(&tick);
+
+    EnterCriticalSection(&pool->ulCS);
+
+    if (unitnum > pool->remaining)
+        total = unitnum - pool->remaining;
+
+    if (total > 0) {
+        pmem = kosmalloc(total * sizeof(void *));
+        size = kosmalloc(total * sizeof(long));
+    }
+
+    /* units are zeroed by kzalloc, which faults their pages at the same time.
+       in lock-free mode, they are pushed into stack after being faulted in */
+    for (i = 0; i < total && pmem && size; i++) {
+        punit = kzalloc(pool->unitsize);
+        if (!punit) break;
+
+        if (!pool->lockfree) {
+            ar_fifo_push(pool->fifo, punit);
+            pool->allocated++;
+            pool->remaining++;
+        }
+
+        pmem[num] = punit;
+        size[num] = pool->unitsize;
+        num++;
+    }
+
+    if (num > 0 && (flags & KMEM_PREFAULT))
+        kmem_prefault(pmem, size, num, threads);
+
+    if (flags & KMEM_MLOCK) {
+        for (i = 0; i < num; i++)
+            kmem_mlock(pmem[i], size[i]);
+    }
+
+    for (i = 0; pool->lockfree && i < num; i++) {
+        if (lfstack_push(pool->lffresh, pmem[i]) < 0) {
+            kfree(pmem[i]);
+            continue;
+        }
+        katomic_add_relaxed(&pool->allocated, 1);
+        katomic_add_relaxed(&pool->remaining, 1);
+    }
+
+    LeaveCriticalSection(&pool->ulCS);
+
+    if (pmem) kosfree(pmem);
+    if (size) kosfree(size);
+
+    if (pms) *pms = btime_diff_now(&tick);
+
+    return num;
+}
+
+long bpool_trim (bpool_t * pool)
+{
+    long   trimmed = 0;
+
+    if (!pool) return -1;
+
+    if (pool->lockfree)
+        return bpool_lf_trim_units(pool);
+
+    EnterCriticalSection(&pool->ulCS);
+    trimmed = bpool_trim_units(pool);
+    LeaveCriticalSection(&pool->ulCS);
+
+    return trimmed;
+}
+
+int bpool_set_trimtime (bpool_t * pool, int idlesec)
+{
+    if (!pool) return -1;
+    pool->trimtime = idlesec;
+    return 0;
+}
+
+
+int bpool_set_lockfree (bpool_t * pool, int lockfree)
+{
+    if (!pool) return -1;
+
+    lockfree = lockfree ? 1 : 0;
+    if (pool->lockfree == lockfree) return 0;
+
+    EnterCriticalSection(&pool->ulCS);
+
+    if (pool->allocated > 0) {
+        LeaveCriticalSection(&pool->ulCS);
+        return -2;
+    }
+
+    if (lockfree) {
+        pool->lffresh = lfstack_new();
+        pool->lfrecycle = lfstack_new();
+
+        if (!pool->lffresh || !pool->lfrecycle) {
+            lfstack_free(pool->lffresh);
+            lfstack_free(pool->lfrecycle);
+            pool->lffresh = pool->lfrecycle = NULL;
+
+            LeaveCriticalSection(&pool->ulCS);
+            return -3;
+        }
+    } else {
+        lfstack_free(pool->lffresh);
+        lfstack_free(pool->lfrecycle);
+        pool->lffresh = pool->lfrecycle = NULL;
+    }
+
+    pool->lockfree = lockfree;
+
+    LeaveCriticalSection(&pool->ulCS);
+
+    return 0;
+}
 
 int bpool_set_initfunc (bpool_t * pool, void * init)
 {
@@ -347,6 +715,12 @@ int bpool_status (bpool_t * pool, int * allocated, int * remaining,
     if (allocated) *allocated = pool->allocated;
     if (remaining) *remaining = pool->remaining;
     if (consumed) *consumed = pool->consumed;
+    if (pool->lockfree) {
+        if (fifonum) *fifonum = lfstack_num(pool->lffresh);
+        if (refifonum) *refifonum = lfstack_num(pool->lfrecycle);
+        return 0;
+    }
+
     if (fifonum) *fifonum = ar_fifo_num(pool->fifo);
     if (refifonum) *refifonum =  ar_fifo_num(pool->refifo);
 
@@ -37,10 +37,15 @@
 #include "strutil.h"
 #include "chunk.h"
 #include "patmat.h"
+#include "asyncio.h"
 #include "tsock.h"
+#include "zcopy.h"
 #if defined(_WIN32) || defined(_WIN64)
 #include <io.h>
 #endif
+#ifdef _LINUX_
+#include <sys/sendfile.h>
+#endif
 
 static char * chunk_end_flag = "0\r\n\r\n";
 
@@ -275,6 +280,8 @@ void chunk_zero (void * vck)
     ck->procnotify = NULL;
     ck->procnotifypara = NULL;
     ck->procnotifycbval = 0;
+
+    ck->zcopy = NULL;
 }
 
  
@@ -1278,6 +1285,29 @@ int chunk_go_ahead (void * vck, void * msg, int64 offset, int64 step)
     return 0;
 }
 
+static void chunk_buffer_push (chunk_t * ck, ckent_t * ent)
+{
+    arr_push(ck->entity_list, ent);
+
+    ck->size += ent->length;
+    ck->bufnum++;
+
+#if defined(_WIN32) || defined(_WIN64)
+    sprintf(ent->lenstr, "%I64x\r\n", ent->length);
+#else
+    sprintf(ent->lenstr, "%llx\r\n", ent->length);
+#endif
+    ent->lenstrlen = strlen(ent->lenstr);
+    strcpy(ent->trailer, "\r\n");
+    ent->trailerlen = 2;
+    ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+
+    if (ck->endsize > 0) {
+        ck->endsize = ck->size;
+        ck->chunkendsize = ck->chunksize;
+    }
+}
+
 int chunk_add_buffer (void * vck, void * pbuf, int64 len)
 {
     chunk_t  * ck = (chunk_t *)vck;
@@ -1311,25 +1341,46 @@ int chunk_add_buffer (void * vck, void * pbuf, int64 len)
         ((char *)ent->u.buf.pbyte)[len] = '\0';
     }
 
-    arr_push(ck->entity_list, ent);
+    chunk_buffer_push(ck, ent);
 
-    ck->size += len;
-    ck->bufnum++;
+    return 0;
+}
 
-#if defined(_WIN32) || defined(_WIN64)
-    sprintf(ent->lenstr, "%I64x\r\n", ent->length);
-#else
-    sprintf(ent->lenstr, "%llx\r\n", ent->length);
-#endif
-    ent->lenstrlen = strlen(ent->lenstr);
-    strcpy(ent->trailer, "\r\n");
-    ent->trailerlen = 2;
-    ck->chunksize += ent->length + ent->lenstrlen + ent->trailerlen;
+void * chunk_buffer_alloc (void * vck, int64 size)
+{
+    chunk_t  * ck = (chunk_t *)vck;
 
-    if (ck->endsize > 0) {
-        ck->endsize = ck->size;
-        ck->chunkendsize = ck->chunksize;
-    }
+    if (!ck || size < 0) return NULL;
+
+    return k_mem_alloc(size + 1, ck->alloctype, ck->mpool);
+}
+
+void chunk_buffer_free (void * vck, void * pbuf)
+{
+    chunk_t  * ck = (chunk_t *)vck;
+
+    if (!ck || !pbuf) return;
+
+    k_mem_free(pbuf, ck->alloctype, ck->mpool);
+}
+
+int chunk_add_buffer_own (void * vck, void * pbuf, int64 len)
+{
+    chunk_t  * ck = (chunk_t *)vck;
+    ckent_t  * ent = NULL;
+
+    if (!ck) return -1;
+    if (!pbuf || len < 0) return -2;
+
+    ent = k_mem_zalloc(sizeof(*ent), ck->alloctype, ck->mpool);
+    if (!ent) return -100;
+
+    ent->cktype = CKT_BUFFER;
+    ent->length = len;
+    ent->u.buf.pbyte = pbuf;
+    ((char *)pbuf)[len] = '\0';
+
+    chunk_buffer_push(ck, ent);
 
     return 0;
 }
@@ -2257,7 +2308,11 @@ int chunk_remove (void * vck, int64 pos, int httpchunk)
             ent->u.bufptr.porig && ent->u.bufptr.freefunc &&
             chunk_bufptr_porig_find(ck, ent->u.bufptr.porig) <= 0)
         {
-            (*ent->u.bufptr.freefunc)(ent->u.bufptr.porig);
+            /* kernel may still reference the pages sent by zero-copy */
+            if (ck->zcopy)
+                zcopy_hold(ck->zcopy, ent->u.bufptr.porig, ent->u.bufptr.freefunc);
+            else
+                (*ent->u.bufptr.freefunc)(ent->u.bufptr.porig);
         }
 
         chunk_entity_free(ck, ent);
@@ -2334,6 +2389,56 @@ int chunk_buf_and_file (void * vck)
     return ck->bufnum > 0 ? 1 : 0;
 }
 
+static void chunk_entity_file_open (ckent_t * ent)
+{
+    if (ent->u.filename.hfile != NULL) return;
+
+    ent->u.filename.hfile = native_file_open(ent->u.filename.fname, NF_READ);
+
+    if (ent->u.filename.fsize != native_file_size(ent->u.filename.hfile)) {
+#ifdef UNIX
+        file_attr(ent->u.filename.fname,
+                  &ent->u.filename.inode,
+                  &ent->u.filename.fsize, NULL,
+                  &ent->u.filename.mtime, NULL);
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+        native_file_attr(ent->u.filename.hfile,
+                         &ent->u.filename.fsize,
+                         &ent->u.filename.mtime,
+                         &ent->u.filename.inode, NULL);
+#endif
+    }
+}
+
+/* get the file descriptor and the file offset where the entity data begins */
+static int chunk_entity_file (ckent_t * ent, int * pfd, int64 * pfpos)
+{
+    switch (ent->cktype) {
+    case CKT_FILE_NAME:
+        chunk_entity_file_open(ent);
+        if (!ent->u.filename.hfile) return -1;
+
+        *pfd = native_file_fd(ent->u.filename.hfile);
+        *pfpos = ent->u.filename.offset;
+        return 0;
+
+    case CKT_FILE_PTR:
+        if (!ent->u.fileptr.fp) return -1;
+
+        *pfd = fileno(ent->u.fileptr.fp);
+        *pfpos = ent->u.fileptr.offset;
+        return 0;
+
+    case CKT_FILE_DESC:
+        *pfd = ent->u.filefd.fd;
+        *pfpos = ent->u.filefd.offset;
+        return 0;
+    }
+
+    return -1;
+}
+
 int chunk_vec_get (void * vck, int64 offset, chunk_vec_t * pvec, int httpchunk)
 {
     chunk_t  * ck = (chunk_t *)vck;
@@ -2457,24 +2562,7 @@ int chunk_vec_get (void * vck, int64 offset, chunk_vec_t * pvec, int httpchunk)
                 if (pvec->vectype != 0 && pvec->vectype != 2)
                     return 21;
 
-                if (ent->u.filename.hfile == NULL) {
-                    ent->u.filename.hfile = native_file_open(ent->u.filename.fname, NF_READ);
-
-                    if (ent->u.filename.fsize != native_file_size(ent->u.filename.hfile)) {
-#ifdef UNIX
-                        file_attr(ent->u.filename.fname,
-                                  &ent->u.filename.inode,
-                                  &ent->u.filename.fsize, NULL,
-                                  &ent->u.filename.mtime, NULL);
-#endif
-#if defined(_WIN32) || defined(_WIN64)
-                        native_file_attr(ent->u.filename.hfile,
-                                         &ent->u.filename.fsize,
-                                         &ent->u.filename.mtime,
-                                         &ent->u.filename.inode, NULL);
-#endif
-                    }
-                }
+                chunk_entity_file_open(ent);
 
                 pvec->filefd = native_file_fd(ent->u.filename.hfile);
 #if defined(_WIN32) || defined(_WIN64)
@@ -2668,6 +2756,633 @@ int chunk_writev (void * vck, int fd, int64 offset, int64 * actnum, int httpchun
 }
 
 
+int chunk_set_zerocopy (void * vck, void * zcopy)
+{
+    chunk_t  * ck = (chunk_t *)vck;
+
+    if (!ck) return -1;
+
+    ck->zcopy = zcopy;
+
+    return 0;
+}
+
+chunk_plan_t * chunk_plan_new ()
+{
+    chunk_plan_t * plan = NULL;
+
+    plan = kzalloc(sizeof(*plan));
+    if (!plan) return NULL;
+
+    return plan;
+}
+
+void chunk_plan_free (chunk_plan_t * plan)
+{
+    if (!plan) return;
+
+    kfree(plan);
+}
+
+void chunk_plan_reset (chunk_plan_t * plan)
+{
+    if (!plan) return;
+
+    plan->ck = NULL;
+    plan->offset = 0;
+    plan->size = 0;
+    plan->sent = 0;
+    plan->segind = 0;
+    plan->iovind = 0;
+    plan->segnum = 0;
+    plan->iovnum = 0;
+}
+
+static int chunk_plan_add_mem (chunk_plan_t * plan, void * pbyte, int64 len, int segtype)
+{
+    ckplanseg_t * seg = NULL;
+
+    if (len <= 0) return 0;
+
+    if (plan->iovnum >= CHUNK_PLAN_IOVS) return -1;
+
+    seg = plan->segnum > 0 ? &plan->segs[plan->segnum - 1] : NULL;
+    if (!seg || seg->segtype != segtype) {
+        if (plan->segnum >= CHUNK_PLAN_SEGS) return -2;
+
+        seg = &plan->segs[plan->segnum++];
+        memset(seg, 0, sizeof(*seg));
+        seg->segtype = segtype;
+        seg->iovbgn = plan->iovnum;
+        seg->filefd = -1;
+    }
+
+    plan->iovs[plan->iovnum].iov_base = pbyte;
+    plan->iovs[plan->iovnum].iov_len = len;
+    plan->iovnum++;
+
+    seg->iovcnt++;
+    seg->size += len;
+    plan->size += len;
+
+    return 1;
+}
+
+static int chunk_plan_add_file (chunk_plan_t * plan, int filefd, int64 fpos, int64 len)
+{
+    ckplanseg_t * seg = NULL;
+
+    if (len <= 0) return 0;
+
+    if (filefd < 0) return -1;
+    if (plan->segnum >= CHUNK_PLAN_SEGS) return -2;
+
+    seg = &plan->segs[plan->segnum++];
+    memset(seg, 0, sizeof(*seg));
+    seg->segtype = 2;
+    seg->iovbgn = plan->iovnum;
+    seg->filefd = filefd;
+    seg->fpos = fpos;
+    seg->size = len;
+
+    plan->size += len;
+
+    return 1;
+}
+
+/* walk the entity list once from offset, gathering as many segments as the plan holds */
+static int chunk_plan_build (chunk_t * ck, chunk_plan_t * plan, int64 offset, int httpchunk)
+{
+    ckent_t  * ent = NULL;
+    int        i, num;
+    int64      accentlen = 0;
+    int64      readpos = 0;
+    int64      curpos = 0;
+    int64      curlen = 0;
+    int64      fpos = 0;
+    int        filefd = -1;
+    void     * pbyte = NULL;
+    int64      bytelen = 0;
+
+    chunk_plan_reset(plan);
+
+    plan->ck = ck;
+    plan->httpchunk = httpchunk;
+    plan->offset = offset;
+
+    accentlen = httpchunk ? ck->rmchunklen : ck->rmentlen;
+    readpos = offset;
+
+    num = arr_num(ck->entity_list);
+
+    for (i = 0; i < num; i++) {
+        ent = arr_value(ck->entity_list, i);
+        if (!ent) continue;
+
+        if (httpchunk) {
+            if (ent->lenstrlen > 0 && readpos < accentlen + ent->lenstrlen) {
+                curpos = readpos - accentlen;
+                curlen = ent->lenstrlen - curpos;
+
+                if (chunk_plan_add_mem(plan, ent->lenstr + curpos, curlen, 1) < 0)
+                    return 1;
+                readpos += curlen;
+            }
+            accentlen += ent->lenstrlen;
+        }
+
+        if (ent->length > 0 && readpos < accentlen + ent->length) {
+            curpos = readpos - accentlen;
+            curlen = ent->length - curpos;
+
+            switch (ent->cktype) {
+            case CKT_CHAR_ARRAY:
+                pbyte = ent->u.charr.pbyte + curpos;
+                goto addmem;
+            case CKT_BUFFER:
+                pbyte = (uint8 *)ent->u.buf.pbyte + curpos;
+                goto addmem;
+            case CKT_BUFFER_PTR:
+                pbyte = (uint8 *)ent->u.bufptr.pbyte + curpos;
+                if (ck->zcopy && curlen >= zcopy_threshold(ck->zcopy)) {
+                    if (chunk_plan_add_mem(plan, pbyte, curlen, 3) < 0)
+                        return 1;
+                    break;
+                }
+            addmem:
+                if (chunk_plan_add_mem(plan, pbyte, curlen, 1) < 0)
+                    return 1;
+                break;
+
+            case CKT_FILE_NAME:
+            case CKT_FILE_PTR:
+            case CKT_FILE_DESC:
+                if (chunk_entity_file(ent, &filefd, &fpos) < 0)
+                    return 1;
+                if (chunk_plan_add_file(plan, filefd, fpos + curpos, curlen) < 0)
+                    return 1;
+                break;
+
+            case CKT_CALLBACK:
+                if (!ent->u.callback.fetchfunc) return 1;
+
+                pbyte = NULL;
+                bytelen = 0;
+                (*ent->u.callback.fetchfunc)(ent->u.callback.fetchpara,
+                                               ent->u.callback.offset + curpos,
+                                               curlen, &pbyte, &bytelen);
+                if (!pbyte || bytelen <= 0) return 1;
+
+                if (bytelen > curlen) bytelen = curlen;
+                if (chunk_plan_add_mem(plan, pbyte, bytelen, 1) < 0)
+                    return 1;
+
+                /* fetched data may be less than requested, plan ends here */
+                if (bytelen < curlen) return 1;
+                break;
+
+            default:
+                return 1;
+            }
+
+            readpos += curlen;
+        }
+        accentlen += ent->length;
+
+        if (httpchunk) {
+            if (ent->trailerlen > 0 && readpos < accentlen + ent->trailerlen) {
+                curpos = readpos - accentlen;
+                curlen = ent->trailerlen - curpos;
+
+                if (chunk_plan_add_mem(plan, ent->trailer + curpos, curlen, 1) < 0)
+                    return 1;
+                readpos += curlen;
+            }
+            accentlen += ent->trailerlen;
+        }
+    }
+
+    if (httpchunk && ck->chunkendsize > 0 && readpos < accentlen + 5) { //0\r\n\r\n
+        curpos = readpos - accentlen;
+        curlen = 5 - curpos;
+
+        chunk_plan_add_mem(plan, chunk_end_flag + curpos, curlen, 1);
+    }
+
+    return 1;
+}
+
+/* bytes were sent from the current segment, advance the segment and iovec cursor */
+static void chunk_plan_forward (chunk_plan_t * plan, int64 num)
+{
+    ckplanseg_t  * seg = NULL;
+    struct iovec * iov = NULL;
+    int64          n = 0;
+
+    plan->sent += num;
+
+    while (num > 0 && plan->segind < plan->segnum) {
+        seg = &plan->segs[plan->segind];
+
+        n = num < seg->size ? num : seg->size;
+        seg->size -= n;
+        num -= n;
+
+        if (seg->segtype == 2) {
+            seg->fpos += n;
+
+        } else {
+            while (n > 0) {
+                iov = &plan->iovs[plan->iovind];
+                if ((int64)iov->iov_len <= n) {
+                    n -= iov->iov_len;
+                    plan->iovind++;
+                } else {
+                    iov->iov_base = (uint8 *)iov->iov_base + n;
+                    iov->iov_len -= n;
+                    n = 0;
+                }
+            }
+        }
+
+        if (seg->size <= 0) {
+            plan->segind++;
+            if (plan->segind < plan->segnum)
+                plan->iovind = plan->segs[plan->segind].iovbgn;
+        }
+    }
+}
+
+int chunk_writev_plan (void * vck, int fd, int64 offset, chunk_plan_t * plan,
+                       int64 * actnum, int httpchunk)
+{
+    chunk_t     * ck = (chunk_t *)vck;
+    ckplanseg_t * seg = NULL;
+    int64         ret = 0;
+    int64         want = 0;
+    int           err = 0;
+    int           cnt = 0;
+#if defined(_LINUX_)
+    off_t         offval = 0;
+#else
+    int64         num = 0;
+    int           wnum = 0;
+#endif
+
+    if (actnum) *actnum = 0;
+
+    if (!ck) return -1;
+    if (!plan) return -2;
+
+    plan->flushbytes = 0;
+    plan->flushcalls = 0;
+    plan->builds = 0;
+    plan->flushnum++;
+
+    /* release the zero-copy buffers whose transmission has completed */
+    if (ck->zcopy) zcopy_reap(ck->zcopy);
+
+    if (httpchunk) {
+        if (offset < ck->rmchunklen)
+            return -3;
+
+        if (offset >= ck->chunksize) {
+            if (ck->chunkendsize > 0) return -4;
+            else return 0;
+        }
+
+    } else {
+        if (offset < ck->rmentlen)
+            offset = ck->rmentlen;
+
+        if (offset >= ck->size) {
+            if (ck->endsize > 0) return -4;
+            else return 0;
+        }
+    }
+
+    /* the cached plan is usable only if it resumes exactly at offset */
+    if (plan->ck != ck || plan->httpchunk != httpchunk ||
+        plan->offset + plan->sent != offset)
+        plan->segind = plan->segnum = 0;
+
+    while (chunk_get_end(ck, offset, httpchunk) == 0) {
+
+        if (plan->segind >= plan->segnum) {
+            chunk_plan_build(ck, plan, offset, httpchunk);
+            plan->builds++;
+
+            /* no available data to send, waiting for more data... */
+            if (plan->size <= 0) break;
+        }
+
+        seg = &plan->segs[plan->segind];
+
+        if (seg->segtype == 3) {
+            cnt = seg->iovbgn + seg->iovcnt - plan->iovind;
+            want = seg->size;
+            ret = zcopy_sendv(ck->zcopy, plan->iovs + plan->iovind, cnt, &err);
+            if (ret == 0 && err == 0) err = EAGAIN;
+
+        } else if (seg->segtype == 1) {
+            cnt = seg->iovbgn + seg->iovcnt - plan->iovind;
+            want = seg->size;
+#ifdef UNIX
+            ret = writev(fd, plan->iovs + plan->iovind, cnt);
+            err = errno;
+#else
+            ret = filefd_writev(fd, plan->iovs + plan->iovind, cnt, &num);
+            ret = ret < 0 ? -1 : num;
+            err = ret == 0 ? EAGAIN : 0;
+#endif
+        } else {
+            want = min(seg->size, SENDFILE_MAXSIZE);
+#if defined(_LINUX_)
+            offval = seg->fpos;
+            ret = sendfile(fd, seg->filefd, &offval, want);
+            err = errno;
+            if (ret == 0) {
+                /* the file was truncated, offset is beyond the end of file */
+                if (actnum) *actnum = plan->flushbytes;
+                return -40;
+            }
+#else
+            ret = tcp_sendfile(fd, seg->filefd, seg->fpos, seg->size, &wnum, &err);
+            ret = ret < 0 ? -1 : wnum;
+            if (ret == 0 && err == 0) err = EAGAIN;
+#endif
+        }
+        plan->flushcalls++;
+
+        if (ret < 0 || (ret == 0 && seg->segtype != 2)) {
+            if (err == EINTR) continue;
+            if (ret == 0 || err == EAGAIN || err == EWOULDBLOCK) break;
+
+            if (actnum) *actnum = plan->flushbytes;
+            plan->totalbytes += plan->flushbytes;
+            plan->totalcalls += plan->flushcalls;
+            return seg->segtype == 2 ? -100 : -101;
+        }
+#if !defined(_LINUX_)
+        if (ret == 0) break;
+#endif
+
+        chunk_plan_forward(plan, ret);
+
+        offset += ret;
+        plan->flushbytes += ret;
+
+        /* socket send buffer is full */
+        if (ret < want) break;
+    }
+
+    if (actnum) *actnum = plan->flushbytes;
+
+    plan->totalbytes += plan->flushbytes;
+    plan->totalcalls += plan->flushcalls;
+
+    return 0;
+}
+
+
+#ifdef _LINUX_
+
+typedef struct chunk_aio_s {
+    chunk_t      * ck;
+    void         * aio;
+    int            fd;
+    int            httpchunk;
+
+    int64          pos;
+    int64          total;
+
+    chunk_vec_t    iovec;
+
+    /* file data is moved to fd by a pair of linked splices through a pipe */
+    int            pipefd[2];
+    int            pipelen;   //bytes spliced into pipe but not yet into fd
+    int            pending;   //splice requests outstanding
+    int64          err;
+
+    AsyncIOCB    * cb;
+    void         * cbpara;
+} ChunkAIO;
+
+static void chunk_aio_step (ChunkAIO * cka);
+
+static void chunk_aio_finish (ChunkAIO * cka, int64 ret)
+{
+    if (cka->pipefd[0] >= 0) close(cka->pipefd[0]);
+    if (cka->pipefd[1] >= 0) close(cka->pipefd[1]);
+
+    if (cka->cb)
+        (*cka->cb)(cka->cbpara, ret < 0 ? ret : cka->total);
+
+    kfree(cka);
+}
+
+static void chunk_aio_writev_done (void * para, int64 result)
+{
+    ChunkAIO  * cka = (ChunkAIO *)para;
+
+    if (result < 0) {
+        chunk_aio_finish(cka, result);
+        return;
+    }
+
+    cka->pos += result;
+    cka->total += result;
+
+    if (result == 0) {
+        chunk_aio_finish(cka, 0);
+        return;
+    }
+
+    chunk_aio_step(cka);
+}
+
+static void chunk_aio_splice_next (ChunkAIO * cka)
+{
+    if (--cka->pending > 0) return;
+
+    if (cka->err < 0) {
+        chunk_aio_finish(cka, cka->err);
+        return;
+    }
+
+    chunk_aio_step(cka);
+}
+
+static void chunk_aio_splice_in_done (void * para, int64 result)
+{
+    ChunkAIO  * cka = (ChunkAIO *)para;
+
+    if (result > 0)
+        cka->pipelen += result;
+    else if (result < 0)
+        cka->err = result;
+    else
+        cka->err = -EIO;  //file is shorter than expected
+
+    chunk_aio_splice_next(cka);
+}
+
+static void chunk_aio_splice_out_done (void * para, int64 result)
+{
+    ChunkAIO  * cka = (ChunkAIO *)para;
+
+    /* ECANCELED means the splice into pipe was short, the rest in pipe is
+       drained in next step */
+    if (result > 0) {
+        cka->pipelen -= result;
+        cka->pos += result;
+        cka->total += result;
+    } else if (result < 0 && result != -ECANCELED && cka->err == 0) {
+        cka->err = result;
+    }
+
+    chunk_aio_splice_next(cka);
+}
+
+static void chunk_aio_step (ChunkAIO * cka)
+{
+    AsyncReq    req[2];
+    int64       len = 0;
+    int         ret = 0;
+
+    memset(req, 0, sizeof(req));
+
+    if (cka->pipelen > 0) {
+        req[0].opcode = ASYNCIO_OP_SPLICE;
+        req[0].fd = cka->pipefd[0];
+        req[0].fdout = cka->fd;
+        req[0].offset = -1;
+        req[0].len = cka->pipelen;
+        req[0].cb = chunk_aio_splice_out_done;
+        req[0].cbpara = cka;
+
+        cka->pending = 1;
+        if ((ret = asyncio_prep(cka->aio, &req[0])) < 0) {
+            chunk_aio_finish(cka, ret);
+            return;
+        }
+        asyncio_submit(cka->aio);
+        return;
+    }
+
+    if (chunk_get_end(cka->ck, cka->pos, cka->httpchunk) != 0) {
+        chunk_aio_finish(cka, 0);
+        return;
+    }
+
+    memset(&cka->iovec, 0, sizeof(cka->iovec));
+    ret = chunk_vec_get(cka->ck, cka->pos, &cka->iovec, cka->httpchunk);
+
+    if (ret < 0 || (cka->iovec.vectype != 1 && cka->iovec.vectype != 2 && cka->iovec.size > 0)) {
+        chunk_aio_finish(cka, -EINVAL);
+        return;
+    }
+
+    if (cka->iovec.size == 0) {
+        /* no available data to send, waiting for more data... */
+        chunk_aio_finish(cka, 0);
+        return;
+    }
+
+    if (cka->iovec.vectype == 1) { //mem buffer, writev
+        ret = asyncio_writev(cka->aio, cka->fd, cka->iovec.iovs, cka->iovec.iovcnt, -1,
+                             chunk_aio_writev_done, cka);
+        if (ret < 0) chunk_aio_finish(cka, ret);
+        return;
+    }
+
+    /* file, splice into pipe and then into fd, one pipe capacity per step */
+    if (cka->pipefd[0] < 0 && pipe(cka->pipefd) < 0) {
+        chunk_aio_finish(cka, -errno);
+        return;
+    }
+
+    len = cka->iovec.size;
+    if (len > 65536) len = 65536;
+
+    req[0].opcode = ASYNCIO_OP_SPLICE;
+    req[0].flags = ASYNCIO_F_LINK;
+    req[0].fd = cka->iovec.filefd;
+    req[0].fdout = cka->pipefd[1];
+    req[0].offset = cka->iovec.fpos;
+    req[0].len = (int)len;
+    req[0].cb = chunk_aio_splice_in_done;
+    req[0].cbpara = cka;
+
+    req[1].opcode = ASYNCIO_OP_SPLICE;
+    req[1].fd = cka->pipefd[0];
+    req[1].fdout = cka->fd;
+    req[1].offset = -1;
+    req[1].len = (int)len;
+    req[1].cb = chunk_aio_splice_out_done;
+    req[1].cbpara = cka;
+
+    cka->pending = 2;
+    cka->err = 0;
+
+    if ((ret = asyncio_prep(cka->aio, &req[0])) < 0) {
+        chunk_aio_finish(cka, ret);
+        return;
+    }
+    if ((ret = asyncio_prep(cka->aio, &req[1])) < 0) {
+        /* the first one is in queue, its callback finishes the job */
+        cka->pending = 1;
+        cka->err = ret;
+    }
+    asyncio_submit(cka->aio);
+}
+
+int chunk_writev_async (void * vck, int fd, int64 offset, int httpchunk, void * aio, void * cb, void * cbpara)
+{
+    chunk_t   * ck = (chunk_t *)vck;
+    ChunkAIO  * cka = NULL;
+
+    if (!ck) return -1;
+    if (!aio) return -2;
+
+    if (httpchunk) {
+        if (offset < ck->rmchunklen)
+            return -3;
+
+        if (offset >= ck->chunksize) {
+            if (ck->chunkendsize > 0) return -4;
+            else return 0;
+        }
+
+    } else {
+        if (offset < ck->rmentlen)
+            offset = ck->rmentlen;
+
+        if (offset >= ck->size) {
+            if (ck->endsize > 0) return -4;
+            else return 0;
+        }
+    }
+
+    cka = kzalloc(sizeof(*cka));
+    if (!cka) return -5;
+
+    cka->ck = ck;
+    cka->aio = aio;
+    cka->fd = fd;
+    cka->httpchunk = httpchunk;
+    cka->pos = offset;
+    cka->pipefd[0] = cka->pipefd[1] = -1;
+    cka->cb = (AsyncIOCB *)cb;
+    cka->cbpara = cbpara;
+
+    chunk_aio_step(cka);
+
+    return 1;
+}
+
+#endif
+
 int chunk_at (void * vck, int64 pos, int * ind)
 {
     chunk_t  * ck = (chunk_t *)vck;
@@ -3114,10 +3829,9 @@ int64 chunk_skip_to (void * vck, int64 pos, int64 skiplimit, void * vpat, int pa
 {
     chunk_t  * ck = (chunk_t *)vck;
     uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
+    uint8    * p = NULL, * q = NULL;
+    int64      plen = 0, n = 0;
     int64      i = 0, fsize;
-
-    ckpos_vec_t posvec = {0};
  
     if (!ck) return -1;
     if (!pat || patlen <= 0) return pos;
@@ -3127,13 +3841,16 @@ int64 chunk_skip_to (void * vck, int64 pos, int64 skiplimit, void * vpat, int pa
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    while (i < fsize) {
+        p = chunk_ptr(ck, pos + i, NULL, NULL, &plen);
+        if (!p || plen <= 0) return pos + i;
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
+        n = plen < fsize - i ? plen : fsize - i;
+        if (n > 0x40000000) n = 0x40000000;
+
+        q = skipTo(p, (int)n, pat, patlen);
+        i += q - p;
+        if (q < p + n) break;
     }
  
     return pos + i;
@@ -3171,11 +3888,10 @@ int64 chunk_skip_over (void * vck, int64 pos, int64 skiplimit, void * vpat, int
 {
     chunk_t  * ck = (chunk_t *)vck;
     uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
+    uint8    * p = NULL, * q = NULL;
+    int64      plen = 0, n = 0;
     int64      i = 0, fsize;
  
-    ckpos_vec_t posvec = {0};
- 
     if (!ck) return -1;
     if (!pat || patlen <= 0) return pos;
     if (pos >= ck->size) return ck->size;
@@ -3184,15 +3900,16 @@ int64 chunk_skip_over (void * vck, int64 pos, int64 skiplimit, void * vpat, int
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    while (i < fsize) {
+        p = chunk_ptr(ck, pos + i, NULL, NULL, &plen);
+        if (!p || plen <= 0) return pos + i;
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
+        n = plen < fsize - i ? plen : fsize - i;
+        if (n > 0x40000000) n = 0x40000000;
 
-        if (j >= patlen) return pos + i;
+        q = skipOver(p, (int)n, pat, patlen);
+        i += q - p;
+        if (q < p + n) break;
     }
  
     return pos + i;
@@ -3300,11 +4017,10 @@ int64 chunk_skip_esc_to  (void * vck, int64 pos, int64 skiplimit, void * vpat, i
 {
     chunk_t  * ck = (chunk_t *)vck;
     uint8    * pat = (uint8 *)vpat;
-    int        fch = 0, j;
+    uint8    * p = NULL, * q = NULL;
+    int64      plen = 0, n = 0;
     int64      i = 0, fsize;
  
-    ckpos_vec_t posvec = {0};
- 
     if (!ck) return -1;
     if (!pat || patlen <= 0) return pos;
     if (pos >= ck->size) return ck->size;
@@ -3313,18 +4029,16 @@ int64 chunk_skip_esc_to  (void * vck, int64 pos, int64 skiplimit, void * vpat, i
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = chunk_char(ck, pos + i, &posvec, NULL);
-        if (fch < 0) return pos + i;
+    while (i < fsize) {
+        p = chunk_ptr(ck, pos + i, NULL, NULL, &plen);
+        if (!p || plen <= 0) return pos + i;
 
-        if (fch == '\\') {
-            i++;
-            continue;
-        }
+        n = plen < fsize - i ? plen : fsize - i;
+        if (n > 0x40000000) n = 0x40000000;
 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
+        q = skipEscTo(p, (int)n, pat, patlen);
+        i += q - p;
+        if (q < p + n) break;
     }
  
     return pos + i;
@@ -33,12 +33,22 @@
 #include "dynarr.h"
 #include "fileop.h"
 #include "strutil.h"
+#include "katomic.h"
+#include "mthread.h"
+#include "phash.h"
 
 #ifdef UNIX
 #include <sys/stat.h>
 #include <fcntl.h>
 #endif
 
+#ifdef _LINUX_
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
 #include "confile.h"
  
 hashtab_t * ht_global_conf = NULL;
@@ -197,8 +207,10 @@ static char * conf_strdup (char * str, int len)
     if (!str) return NULL;
 
     pbuf = kalloc(len + 1);
+    if (!pbuf) return NULL;
 
     str_ncpy(pbuf, str, len);
+    pbuf[len] = '\0';
 
     return pbuf;
 }
@@ -299,6 +311,12 @@ itemhandle:
             line->cfgtype = CFGTYPE_ITEM;
 
         pbuf = strchr(piter, '=');
+        if (!pbuf) { //a key without '=' and value
+            if (pcmt) *pcmt = '\0';
+            pbuf = str_trim(piter);
+            line->key = conf_strdup(pbuf, strlen(pbuf));
+            continue;
+        }
         if (pcmt && pbuf > pcmt) { //abc  #this = is comment
             *pcmt = '\0';
             pbuf = str_trim(piter);
@@ -697,3 +715,548 @@ int conf_set_bool(void * vconf, char * sect, char * key, uint8 value)
     return 0;
 }
 
+
+/* compiled snapshot: entries sit at their perfect hash slot, strings and
+   entries share one block with the snapshot header */
+
+typedef struct conf_entry {
+    char      * sect;       //NULL for the items before any section
+    char      * key;
+    char      * value;
+    int         sectlen;    //-1 for the items before any section
+    int         keylen;
+
+    int         ival;
+    uint32      uval;
+    long        hval;
+    double      dval;
+    uint8       bval;
+} ConfEntry;
+
+typedef struct conf_snap {
+    long        refcnt;
+    uint32      version;
+
+    int         num;
+    phash_t   * ph;
+    ConfEntry * ent;
+} ConfSnap;
+
+typedef struct conf_cand {
+    uint64      hash;
+    int         seq;
+    char      * sect;
+    CFGLine   * line;
+} ConfCand;
+
+static uint64 conf_snap_hash (char * sect, int sectlen, char * key, int keylen)
+{
+    uint64   h = PHASH_SEED;
+
+    /* keep the items before any section apart from a section named [] */
+    if (sectlen < 0) h++;
+    else h = phash_hash_more(h, sect, sectlen, 1);
+
+    return phash_hash_more(h, key, keylen, 1);
+}
+
+static int conf_cand_cmp (const void * a, const void * b)
+{
+    ConfCand * ca = (ConfCand *)a;
+    ConfCand * cb = (ConfCand *)b;
+
+    if (ca->hash != cb->hash) return ca->hash < cb->hash ? -1 : 1;
+    return ca->seq - cb->seq;
+}
+
+static int conf_cand_same (ConfCand * a, ConfCand * b)
+{
+    if (!a->sect != !b->sect) return 0;
+    if (a->sect && strcasecmp(a->sect, b->sect) != 0) return 0;
+    return strcasecmp(a->line->key, b->line->key) == 0;
+}
+
+static void conf_entry_parse (ConfEntry * ent)
+{
+    char   * v = ent->value;
+
+    /* same conversions as conf_get_int, conf_get_ulong and others */
+    if (strlen(v) >= 2 && strncasecmp(v, "0x", 2) == 0) {
+        ent->ival = strtol(v+2, NULL, 16);
+        ent->uval = strtol(v+2, NULL, 16);
+    } else {
+        ent->ival = atoi(v);
+        ent->uval = strtoul(v, (char **)NULL, 10);
+    }
+    ent->hval = strtol(v, (char **)NULL, 16);
+    ent->dval = strtod(v, (char **)NULL);
+
+    ent->bval = (strcasecmp(v, "yes") == 0 ||
+                 strcasecmp(v, "true") == 0 ||
+                 strcasecmp(v, "1") == 0) ? 1 : 0;
+}
+
+static char * conf_snap_strcpy (char ** ppool, char * str, int len)
+{
+    char  * p = *ppool;
+
+    memcpy(p, str, len);
+    p[len] = '\0';
+    *ppool = p + len + 1;
+
+    return p;
+}
+
+void * conf_snap_build (void * vconf)
+{
+    ConfMgmt  * conf = (ConfMgmt *)vconf;
+    ConfSnap  * snap = NULL;
+    ConfCand  * cand = NULL;
+    uint64    * hv = NULL;
+    CFGLine   * line = NULL;
+    CFGLine   * sect = NULL;
+    ConfEntry * ent = NULL;
+    char      * pool = NULL;
+    int         skip = 0;
+    int         i, j, num, cnt = 0;
+    size_t      strsize = 0;
+
+    if (!conf) return NULL;
+
+    num = arr_num(conf->line_list);
+    if (num > 0) {
+        cand = kzalloc(num * sizeof(*cand));
+        hv = kalloc(num * sizeof(*hv));
+        if (!cand || !hv) goto fail;
+    }
+
+    /* the items reachable by conf_get_xxx: a section repeated later in the
+       file is not registered, the first of a repeated key wins */
+    for (i = 0; i < num; i++) {
+        line = (CFGLine *)arr_value(conf->line_list, i);
+        if (!line) continue;
+
+        if (line->cfgtype == CFGTYPE_SECTION || line->cfgtype == CFGTYPE_SECTION_CMT) {
+            sect = line;
+            skip = ht_get(conf->sect_table, line->key) != line;
+            continue;
+        }
+
+        if (line->cfgtype != CFGTYPE_ITEM && line->cfgtype != CFGTYPE_ITEM_CMT)
+            continue;
+        if (skip || !line->key || !line->value) continue;
+
+        cand[cnt].sect = sect ? sect->key : NULL;
+        cand[cnt].line = line;
+        cand[cnt].seq = cnt;
+        cand[cnt].hash = conf_snap_hash(cand[cnt].sect, sect ? strlen(sect->key) : -1,
+                                        line->key, strlen(line->key));
+        cnt++;
+    }
+
+    if (cnt > 1) qsort(cand, cnt, sizeof(*cand), conf_cand_cmp);
+
+    for (i = 0, j = 0; i < cnt; i++) {
+        if (j > 0 && cand[j-1].hash == cand[i].hash && conf_cand_same(&cand[j-1], &cand[i]))
+            continue;
+
+        cand[j] = cand[i];
+        hv[j] = cand[j].hash;
+        strsize += (cand[j].sect ? strlen(cand[j].sect) + 1 : 0)
+                 + strlen(cand[j].line->key) + strlen(cand[j].line->value) + 2;
+        j++;
+    }
+    cnt = j;
+
+    snap = kzalloc(sizeof(*snap) + cnt * sizeof(ConfEntry) + strsize);
+    if (!snap) goto fail;
+
+    snap->refcnt = 1;
+    snap->num = cnt;
+    snap->ent = (ConfEntry *)(snap + 1);
+    pool = (char *)(snap->ent + cnt);
+
+    if (cnt > 0) {
+        snap->ph = phash_build(hv, cnt);
+        if (!snap->ph) goto fail;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        ent = &snap->ent[phash_slot(snap->ph, hv[i])];
+
+        if (cand[i].sect) {
+            ent->sectlen = strlen(cand[i].sect);
+            ent->sect = conf_snap_strcpy(&pool, cand[i].sect, ent->sectlen);
+        } else {
+            ent->sectlen = -1;
+        }
+
+        ent->keylen = strlen(cand[i].line->key);
+        ent->key = conf_snap_strcpy(&pool, cand[i].line->key, ent->keylen);
+        ent->value = conf_snap_strcpy(&pool, cand[i].line->value, strlen(cand[i].line->value));
+
+        conf_entry_parse(ent);
+    }
+
+    if (cand) kfree(cand);
+    if (hv) kfree(hv);
+
+    return snap;
+
+fail:
+    if (cand) kfree(cand);
+    if (hv) kfree(hv);
+    if (snap) {
+        phash_free(snap->ph);
+        kfree(snap);
+    }
+    return NULL;
+}
+
+void * conf_snap_load (char * file)
+{
+    void  * conf = NULL;
+    void  * snap = NULL;
+
+    if (!file) return NULL;
+
+    conf = conf_mgmt_init(NULL);
+    if (!conf) return NULL;
+
+    if (conf_mgmt_read(conf, file) >= 0)
+        snap = conf_snap_build(conf);
+
+    conf_mgmt_cleanup(conf);
+
+    return snap;
+}
+
+void * conf_snap_hold (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (snap) katomic_add(&snap->refcnt, 1);
+
+    return snap;
+}
+
+void conf_snap_release (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return;
+
+    if (katomic_add(&snap->refcnt, -1) == 0) {
+        phash_free(snap->ph);
+        kfree(snap);
+    }
+}
+
+int conf_snap_num (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return 0;
+
+    return snap->num;
+}
+
+uint32 conf_snap_version (void * vsnap)
+{
+    ConfSnap * snap = (ConfSnap *)vsnap;
+
+    if (!snap) return 0;
+
+    return snap->version;
+}
+
+static ConfEntry * conf_snap_find (ConfSnap * snap, char * sect, char * key)
+{
+    ConfEntry * ent = NULL;
+    int         sectlen = -1;
+    int         keylen = 0;
+
+    if (!snap || !key || snap->num <= 0) return NULL;
+
+    keylen = str_len(key);
+    if (sect) sectlen = str_len(sect);
+
+    ent = &snap->ent[phash_slot(snap->ph, conf_snap_hash(sect, sectlen, key, keylen))];
+
+    if (ent->keylen != keylen || ent->sectlen != sectlen) return NULL;
+    if (!phash_equal(ent->key, key, keylen, 1)) return NULL;
+    if (sectlen > 0 && !phash_equal(ent->sect, sect, sectlen, 1)) return NULL;
+
+    return ent;
+}
+
+char * conf_snap_string (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->value : NULL;
+}
+
+int conf_snap_int (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->ival : -1;
+}
+
+uint32 conf_snap_ulong (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->uval : 0;
+}
+
+long conf_snap_hexlong (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->hval : -1;
+}
+
+double conf_snap_double (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->dval : 0.;
+}
+
+uint8 conf_snap_bool (void * snap, char * sect, char * key)
+{
+    ConfEntry * ent = conf_snap_find((ConfSnap *)snap, sect, key);
+
+    return ent ? ent->bval : 0;
+}
+
+
+/* live config. readers count themselves in 'readers' only for the few
+   instructions between loading the snapshot pointer and taking a reference,
+   the reloader waits for that count to drain before it drops the old one */
+
+typedef struct conf_live {
+    char              confile[128];
+
+    ConfSnap        * snap;
+    long              readers;
+    uint32            version;
+
+    CRITICAL_SECTION  reloadCS;
+
+#ifdef _LINUX_
+    uint8             watching;
+    int               infd;
+    int               stopfd[2];
+    pthread_t         thread;
+#endif
+} ConfLive;
+
+int conf_live_reload (void * vlive)
+{
+    ConfLive * live = (ConfLive *)vlive;
+    ConfSnap * snap = NULL;
+    ConfSnap * old = NULL;
+
+    if (!live) return -1;
+
+    EnterCriticalSection(&live->reloadCS);
+
+    snap = conf_snap_load(live->confile);
+    if (!snap) {
+        LeaveCriticalSection(&live->reloadCS);
+        return -100;
+    }
+
+    snap->version = ++live->version;
+
+    old = live->snap;
+    katomic_store(&live->snap, snap);
+    katomic_fence();
+
+    while (katomic_load(&live->readers) > 0)
+        katomic_spin_pause();
+
+    LeaveCriticalSection(&live->reloadCS);
+
+    conf_snap_release(old);
+
+    return 0;
+}
+
+void * conf_live_get (void * vlive)
+{
+    ConfLive * live = (ConfLive *)vlive;
+    ConfSnap * snap = NULL;
+
+    if (!live) return NULL;
+
+    katomic_add(&live->readers, 1);
+    katomic_fence();
+
+    snap = katomic_load(&live->snap);
+    if (snap) katomic_add(&snap->refcnt, 1);
+
+    katomic_add(&live->readers, -1);
+
+    return snap;
+}
+
+void * conf_live_update (void * vlive, void * snap)
+{
+    ConfLive * live = (ConfLive *)vlive;
+    void     * cur = NULL;
+
+    if (!live) return snap;
+
+    if (snap && snap == (void *)katomic_load(&live->snap))
+        return snap;
+
+    cur = conf_live_get(live);
+    conf_snap_release(snap);
+
+    return cur;
+}
+
+#ifdef _LINUX_
+
+static void * conf_live_watch_thread (void * arg)
+{
+    ConfLive      * live = (ConfLive *)arg;
+    struct pollfd   pfd[2];
+    char            buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event * ev = NULL;
+    char          * name = NULL;
+    char          * p = NULL;
+    int             n, hit, timeout;
+
+    name = strrchr(live->confile, '/');
+    name = name ? name + 1 : live->confile;
+
+    for (hit = 0; ; ) {
+        pfd[0].fd = live->infd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = live->stopfd[0];
+        pfd[1].events = POLLIN;
+
+        /* once the file changed, wait for the burst of events an editor
+           makes to settle, then reload one time */
+        timeout = hit ? 50 : -1;
+
+        n = poll(pfd, 2, timeout);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || pfd[1].revents) break;
+
+        if (n == 0) {
+            conf_live_reload(live);
+            hit = 0;
+            continue;
+        }
+
+        if (!(pfd[0].revents & POLLIN)) continue;
+
+        n = read(live->infd, buf, sizeof(buf));
+        for (p = buf; n > 0 && p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, name) == 0)
+                hit = 1;
+        }
+    }
+
+    return NULL;
+}
+
+static int conf_live_watch (ConfLive * live)
+{
+    char    dir[128];
+    char  * p = NULL;
+
+    p = strrchr(live->confile, '/');
+    if (!p) strcpy(dir, ".");
+    else if (p == live->confile) strcpy(dir, "/");
+    else str_secpy(dir, sizeof(dir)-1, live->confile, p - live->confile);
+
+    /* watch the directory, editors replace the file by renaming onto it */
+    live->infd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (live->infd < 0) return -100;
+
+    if (inotify_add_watch(live->infd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(live->infd);
+        return -101;
+    }
+
+    if (pipe(live->stopfd) < 0) {
+        close(live->infd);
+        return -102;
+    }
+
+    if (pthread_create(&live->thread, NULL, conf_live_watch_thread, live) != 0) {
+        close(live->infd);
+        close(live->stopfd[0]);
+        close(live->stopfd[1]);
+        return -103;
+    }
+
+    live->watching = 1;
+    return 0;
+}
+
+static void conf_live_unwatch (ConfLive * live)
+{
+    if (!live->watching) return;
+
+    if (write(live->stopfd[1], "q", 1) < 0) {}
+    pthread_join(live->thread, NULL);
+
+    close(live->infd);
+    close(live->stopfd[0]);
+    close(live->stopfd[1]);
+
+    live->watching = 0;
+}
+
+#endif
+
+void * conf_live_open (char * file, int watch)
+{
+    ConfLive * live = NULL;
+
+    if (!file) return NULL;
+
+    live = kzalloc(sizeof(*live));
+    if (!live) return NULL;
+
+    str_secpy(live->confile, sizeof(live->confile)-1, file, str_len(file));
+    InitializeCriticalSection(&live->reloadCS);
+
+    if (conf_live_reload(live) < 0) {
+        DeleteCriticalSection(&live->reloadCS);
+        kfree(live);
+        return NULL;
+    }
+
+#ifdef _LINUX_
+    if (watch) conf_live_watch(live);
+#endif
+
+    return live;
+}
+
+int conf_live_close (void * vlive)
+{
+    ConfLive * live = (ConfLive *)vlive;
+
+    if (!live) return -1;
+
+#ifdef _LINUX_
+    conf_live_unwatch(live);
+#endif
+
+    conf_snap_release(live->snap);
+    DeleteCriticalSection(&live->reloadCS);
+
+    kfree(live);
+    return 0;
+}
@@ -33,10 +33,18 @@
 #include "mthread.h"
 #include "bpool.h"
 #include "nativefile.h"
+#include "fileop.h"
+#include "strutil.h"
 
 #include "filecache.h"
 
+#ifdef UNIX
+#include <fcntl.h>
+#include <pthread.h>
+#endif
+
 typedef int FCCDNRead (void * pmedia, uint8 * pbuf, uint32 * readsize, int64 offset);
+typedef void * FCScan (void * p, int len, void * pat, int num);
 
 
 typedef struct file_cache { 
@@ -83,6 +91,27 @@ typedef struct file_cache {
     uint32             failread;
  
     void             * avail_event;
+
+    /* read-ahead prefetch by background thread */
+    int                pfahead;      //packs kept loaded ahead of the read position, 0-disabled
+    int                pfrun;
+    int                pflastpack;
+    int                pfseqrun;     //successive sequential pack advances
+    uint64             pfreq;
+    uint64             pfloaded;     //packs loaded by prefetch thread
+    uint64             pflag;        //reads blocked because the pack was still loading
+    int64              pfadvised;    //file offset up to which WILLNEED has been advised
+#ifdef UNIX
+    pthread_t          pfthread;
+    pthread_mutex_t    pfmutex;
+    pthread_cond_t     pfcond;
+#endif
+
+    /* memory-mapped mode, packs are bypassed when mapbyte is set */
+    uint8            * mapbyte;      //media content at cache->offset
+    void             * mapaddr;
+    int64              mapsize;      //bytes mapped from mapaddr
+    int64              maplen;       //bytes available from mapbyte
  
 } FileCache;
  
@@ -153,6 +182,16 @@ static void * file_cache_get_idle_pack (void * vcache);
 static int file_cache_seek_to (void * vcache, int64 offset);
 static int file_cache_load_pack (void * vcache, void * vpack);
 
+static void file_cache_pf_advance (FileCache * cache);
+static void file_cache_pf_stop (FileCache * cache);
+static int  file_cache_pf_start (FileCache * cache);
+static void file_cache_munmap (FileCache * cache);
+static long file_cache_map_skip  (FileCache * cache, long pos, int skiplimit,
+                                  void * pat, int patlen, FCScan * scan);
+static long file_cache_map_rskip (FileCache * cache, long pos, int skiplimit,
+                                  void * pat, int patlen, FCScan * scan);
+static int  file_cache_map_read  (FileCache * cache, void * pbuf, int length);
+
 
 void * file_cache_init (int packnum, int packsize)
 {
@@ -192,6 +231,12 @@ void * file_cache_init (int packnum, int packsize)
 
     cache->avail_event = event_create();
 
+    cache->pflastpack = -1;
+#ifdef UNIX
+    pthread_mutex_init(&cache->pfmutex, NULL);
+    pthread_cond_init(&cache->pfcond, NULL);
+#endif
+
     if (packsize <= 0) packsize = 8192;
     buflen = packnum * packsize;
     if (packnum > 0) pbuf = kalloc(buflen);
@@ -212,6 +257,12 @@ int file_cache_clean (void * vcache)
 
     if (!cache) return -1;
 
+    file_cache_pf_stop(cache);
+#ifdef UNIX
+    pthread_mutex_destroy(&cache->pfmutex);
+    pthread_cond_destroy(&cache->pfcond);
+#endif
+
     if (cache->avail_event) {
         event_destroy(cache->avail_event);
         cache->avail_event = NULL;
@@ -220,6 +271,7 @@ int file_cache_clean (void * vcache)
     DeleteCriticalSection(&cache->cacheCS);
 
     DeleteCriticalSection(&cache->fpCS);
+    file_cache_munmap(cache);
     if (cache->mediatype == 1 && cache->hfile) {
         native_file_close(cache->hfile);
         cache->hfile = NULL;
@@ -268,6 +320,8 @@ int file_cache_setbuf (void * vcache, void * pbuf, int buflen, int packsize)
     if (packsize <= 0) packsize = 8192;
     if (buflen < packsize) return -4;
 
+    file_cache_pf_stop(cache);
+
     EnterCriticalSection(&cache->cacheCS);
     /* clear the old pack list */
     for (i=0; i<cache->packnum; i++) {
@@ -306,6 +360,8 @@ int file_cache_setbuf (void * vcache, void * pbuf, int buflen, int packsize)
 
     LeaveCriticalSection(&cache->cacheCS);
 
+    if (cache->pfahead > 0) file_cache_pf_start(cache);
+
     return 0;
 }
 
@@ -317,6 +373,8 @@ int file_cache_packlist_prepare (void * vcache)
 
     if (!cache) return -1;
 
+    file_cache_pf_stop(cache);
+
     EnterCriticalSection(&cache->cacheCS);
 
     if (cache->packsize > 0) {
@@ -341,8 +399,14 @@ int file_cache_packlist_prepare (void * vcache)
         pack->rcvlen = 0;
     }
 
+    cache->pflastpack = -1;
+    cache->pfseqrun = 0;
+    cache->pfadvised = 0;
+
     LeaveCriticalSection(&cache->cacheCS);
 
+    if (cache->pfahead > 0) file_cache_pf_start(cache);
+
     return 0;
 }
 
@@ -354,6 +418,9 @@ int file_cache_setfile (void * vcache, char * file, int64 offset)
     if (!cache) return -1;
     if (!file) return -2;
  
+    file_cache_pf_stop(cache);
+    file_cache_munmap(cache);
+
     cache->mediatype = 1;
 
     if (file) strncpy(cache->filename, file, sizeof(cache->filename)-1);
@@ -376,6 +443,9 @@ int file_cache_setcdn (void * vcache, void * pmedia, int64 offset, uint64 msize,
     if (!pmedia) return -2;
     if (!cdnread) return -3;
  
+    file_cache_pf_stop(cache);
+    file_cache_munmap(cache);
+
     cache->mediatype = 2;
  
     cache->pmedia = pmedia;
@@ -394,6 +464,7 @@ int file_cache_eof (void * vcache)
 
     if (!cache) return -1;
 
+    if (cache->mapbyte) return cache->seekpos >= cache->maplen ? 1 : 0;
     if (cache->seekpos >= cache->length) return 1;
     return 0;
 }
@@ -449,6 +520,10 @@ static int file_cache_seek_to (void * vcache, int64 offset)
     cache->seekpos = offset;
     cache->seek_pack = seekpack = (int)(offset/cache->packsize);
 
+    /* the prefetch thread takes cacheCS and sees the window after shifting */
+    if (cache->pfahead > 0 && seekpack != cache->pflastpack)
+        file_cache_pf_advance(cache);
+
     if (cache->seek_pack > cache->bgn_pack && 
         cache->bgn_pack == cache->bgn_pack_max) return 0;
 
@@ -492,6 +567,13 @@ int file_cache_seek (void * vcache, int64 offset)
 
     if (!cache) return -1; 
  
+    if (cache->mapbyte) {
+        if (offset > cache->maplen) offset = cache->maplen;
+        if (offset < 0) offset = 0;
+        cache->seekpos = offset;
+        return 0;
+    }
+
     if (offset >= cache->length) 
         offset = cache->length - 1;
  
@@ -501,7 +583,7 @@ int file_cache_seek (void * vcache, int64 offset)
     ret = file_cache_seek_to(cache, offset);
     LeaveCriticalSection(&cache->cacheCS); 
 
-    if (ret >= 0) ret = file_cache_load_all(cache);
+    if (ret >= 0 && cache->pfahead <= 0) ret = file_cache_load_all(cache);
 
     return ret; 
 
@@ -518,6 +600,9 @@ long file_cache_skip_over (void * vcache, long pos, int skiplimit, void * vpat,
     if (!cache) return -1;
     if (!pat || patlen <= 0) return pos;
 
+    if (cache->mapbyte)
+        return file_cache_map_skip(cache, pos, skiplimit, pat, patlen, skipOver);
+
     fsize = cache->length - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
@@ -543,6 +628,9 @@ long file_cache_rskip_over (void * vcache, long pos, int skiplimit, void * vpat,
          
     if (!cache) return -1; 
     if (!pat || patlen <= 0) return pos;
+
+    if (cache->mapbyte)
+        return file_cache_map_rskip(cache, pos, skiplimit, pat, patlen, rskipOver);
  
     if (pos <= 0) return pos;
 
@@ -636,6 +724,9 @@ long file_cache_skip_to (void * vcache, long pos, int skiplimit, void * vpat, in
      
     if (!cache) return -1;
     if (!pat || patlen <= 0) return pos;
+
+    if (cache->mapbyte)
+        return file_cache_map_skip(cache, pos, skiplimit, pat, patlen, skipTo);
      
     fsize = cache->length;
     for (i = 0; i < fsize - pos; i++) {
@@ -660,6 +751,9 @@ long file_cache_rskip_to (void * vcache, long pos, int skiplimit, void * vpat, i
      
     if (!cache) return -1;
     if (!pat || patlen <= 0) return pos;
+
+    if (cache->mapbyte)
+        return file_cache_map_rskip(cache, pos, skiplimit, pat, patlen, rskipTo);
  
     fsize = cache->length;
     if (pos < 0) return 0;
@@ -687,6 +781,9 @@ long file_cache_skip_esc_to (void * vcache, long pos, int skiplimit, void * vpat
       
     if (!cache) return -1;
     if (!pat || patlen <= 0) return pos;
+
+    if (cache->mapbyte)
+        return file_cache_map_skip(cache, pos, skiplimit, pat, patlen, skipEscTo);
       
     fsize = cache->length;
     for (i = 0; i < fsize - pos; i++) {
@@ -718,6 +815,12 @@ int file_cache_at (void * vcache, int64 offset)
  
     if (!cache) return -1;
  
+    if (cache->mapbyte) {
+        if (offset < 0 || offset >= cache->maplen) return -1;
+        cache->seekpos = offset;
+        return cache->mapbyte[offset];
+    }
+
     if (offset >= cache->length) return -1;
  
     if (cache->seekpos != offset) {
@@ -731,7 +834,7 @@ int file_cache_at (void * vcache, int64 offset)
     pack = arr_value(cache->pack_list, seekpack % cache->packnum);
     if (!pack) return -201;
 
-    if (pack->state == PACK_NULL)
+    if (pack->state != PACK_SUCC)
         file_cache_load_pack(cache, pack);
 
     packpos = (int)(seekpos % cache->packsize);
@@ -772,6 +875,7 @@ int file_cache_read (void * vcache, void * pbuf, int length, int nbmode)
     struct timeval t1, tmid;
 
     if (!cache) return -1;
+    if (cache->mapbyte) return file_cache_map_read(cache, pbuf, length);
     if (cache->seekpos >= cache->length) return -200;
 
     cache->totalread++;
@@ -783,7 +887,7 @@ int file_cache_read (void * vcache, void * pbuf, int length, int nbmode)
         pack = arr_value(cache->pack_list, seekpack % cache->packnum);
         if (!pack) return -201;
 
-        if (pack->state == PACK_NULL) 
+        if (pack->state != PACK_SUCC) 
             file_cache_load_pack(cache, pack);
 
         packpos = (int)(seekpos % cache->packsize);
@@ -826,7 +930,7 @@ int file_cache_read (void * vcache, void * pbuf, int length, int nbmode)
     }
 
     if (iter < length) cache->failread++;
-    file_cache_load_all(cache);
+    if (cache->pfahead <= 0) file_cache_load_all(cache);
 
     return iter;
 }
@@ -845,6 +949,7 @@ int file_cache_recv (void * vcache, void * pbuf, int length, int waitms)
     struct timeval t1, tmid;
  
     if (!cache) return -1;
+    if (cache->mapbyte) return file_cache_map_read(cache, pbuf, length);
     if (cache->seekpos >= cache->length) return -200;
  
     cache->totalread++;
@@ -856,7 +961,7 @@ int file_cache_recv (void * vcache, void * pbuf, int length, int waitms)
         pack = arr_value(cache->pack_list, seekpack % cache->packnum);
         if (!pack) return -201;
  
-        if (pack->state == PACK_NULL)
+        if (pack->state != PACK_SUCC)
             file_cache_load_pack(cache, pack);
  
         packpos = (int)(seekpos % cache->packsize);
@@ -901,32 +1006,36 @@ int file_cache_recv (void * vcache, void * pbuf, int length, int waitms)
     }
  
     if (iter < length) cache->failread++;
-    file_cache_load_all(cache);
+    if (cache->pfahead <= 0) file_cache_load_all(cache);
 
     return iter;
 }
  
 
-static int file_cache_load_pack (void * vcache, void * vpack)
+/* read the data of the pack from media, called with packCS held */
+static void file_cache_pack_read (FileCache * cache, FilePack * pack)
 {
-    FileCache * cache = (FileCache *)vcache;
-    FilePack  * pack = (FilePack *)vpack;
     int64       offset = 0;
     
-    if (!cache) return -1;
-    
-    EnterCriticalSection(&pack->packCS);
     pack->state = PACK_INIT;
     pack->rcvlen = 0;
 
-    if (pack->packind >= cache->packtotal-1)
+    if (pack->packind >= cache->packtotal-1 && cache->residual > 0)
         pack->length = cache->residual;
     else
         pack->length = cache->packsize;
-    LeaveCriticalSection(&pack->packCS);
     
     offset = cache->offset + (int64)pack->packind * (int64)cache->packsize;
 
+#ifdef UNIX
+    /* pread leaves the file position alone, no need to serialize with fpCS */
+    if (cache->mediatype == 1) {
+        long  ret = pread(native_file_fd(cache->hfile), pack->pbyte, pack->length, offset);
+        pack->rcvlen = ret > 0 ? ret : 0;
+        return;
+    }
+#endif
+
     EnterCriticalSection(&cache->fpCS);
 
     if (cache->mediatype == 1) {
@@ -940,10 +1049,355 @@ static int file_cache_load_pack (void * vcache, void * vpack)
     }
 
     LeaveCriticalSection(&cache->fpCS);
+}
+
+static int file_cache_load_pack (void * vcache, void * vpack)
+{
+    FileCache * cache = (FileCache *)vcache;
+    FilePack  * pack = (FilePack *)vpack;
+    
+    if (!cache) return -1;
+    
+    /* the prefetch thread holds packCS while loading, wait for it here */
+    if (pack->state == PACK_INIT && cache->pfahead > 0)
+        cache->pflag++;
+
+    EnterCriticalSection(&pack->packCS);
+
+    /* loaded already, or being received by other loader */
+    if (pack->state != PACK_NULL) {
+        LeaveCriticalSection(&pack->packCS);
+        return 0;
+    }
+
+    file_cache_pack_read(cache, pack);
 
     pack->state = PACK_SUCC;
 
+    LeaveCriticalSection(&pack->packCS);
+
+    return 0;
+}
+
+
+#ifdef UNIX
+
+/* load the first idle pack within the prefetch window, return 1 if one is loaded */
+static int file_cache_pf_load_one (FileCache * cache)
+{
+    FilePack  * pack = NULL;
+    int64       from = 0;
+    int64       to = 0;
+    int         i, end;
+
+    EnterCriticalSection(&cache->cacheCS);
+
+    end = cache->seek_pack + cache->pfahead;
+    if (end > cache->bgn_pack + cache->packnum) end = cache->bgn_pack + cache->packnum;
+    if (end > cache->packtotal) end = cache->packtotal;
+
+    for (i = cache->seek_pack; i < end; i++) {
+        pack = arr_value(cache->pack_list, i % cache->packnum);
+        if (!pack || pack->packind != i || pack->state != PACK_NULL)
+            continue;
+
+        EnterCriticalSection(&pack->packCS);
+        if (pack->state != PACK_NULL) {
+            LeaveCriticalSection(&pack->packCS);
+            continue;
+        }
+
+        pack->state = PACK_INIT;
+
+        /* reader shifting the window waits on packCS in file_pack_exit_load */
+        LeaveCriticalSection(&cache->cacheCS);
+
+        file_cache_pack_read(cache, pack);
+        file_pack_state_to(pack, PACK_SUCC);
+
+        LeaveCriticalSection(&pack->packCS);
+
+        cache->pfloaded++;
+        file_pack_ready_notify(pack);
+
+        return 1;
+    }
+
+    /* let the kernel read ahead the data beyond the window asynchronously */
+    if (cache->mediatype == 1 && end < cache->packtotal) {
+        from = cache->offset + (int64)end * cache->packsize;
+        to = from + (int64)cache->pfahead * cache->packsize;
+
+        if (to > cache->pfadvised) {
+            if (from < cache->pfadvised) from = cache->pfadvised;
+#ifdef POSIX_FADV_WILLNEED
+            posix_fadvise(native_file_fd(cache->hfile), from, to - from, POSIX_FADV_WILLNEED);
+#endif
+            cache->pfadvised = to;
+        }
+    }
+
+    LeaveCriticalSection(&cache->cacheCS);
+
+    return 0;
+}
+
+static void * file_cache_pf_thread (void * arg)
+{
+    FileCache * cache = (FileCache *)arg;
+    uint64      reqseen = 0;
+
+    for ( ; ; ) {
+        pthread_mutex_lock(&cache->pfmutex);
+        while (cache->pfrun && cache->pfreq == reqseen)
+            pthread_cond_wait(&cache->pfcond, &cache->pfmutex);
+        reqseen = cache->pfreq;
+        pthread_mutex_unlock(&cache->pfmutex);
+
+        if (!cache->pfrun) break;
+
+        while (cache->pfrun && file_cache_pf_load_one(cache) > 0);
+    }
+
+    return NULL;
+}
+
+#endif
+
+/* called with cacheCS held when the read position moves to another pack */
+static void file_cache_pf_advance (FileCache * cache)
+{
+    if (cache->seek_pack == cache->pflastpack + 1)
+        cache->pfseqrun++;
+    else
+        cache->pfseqrun = 0;
+
+    /* random access does not benefit from loading ahead */
+    if (cache->pfseqrun < 1 && cache->pflastpack >= 0) {
+        cache->pflastpack = cache->seek_pack;
+        return;
+    }
+
+    cache->pflastpack = cache->seek_pack;
+
+#ifdef UNIX
+    pthread_mutex_lock(&cache->pfmutex);
+    cache->pfreq++;
+    pthread_cond_signal(&cache->pfcond);
+    pthread_mutex_unlock(&cache->pfmutex);
+#endif
+}
+
+static int file_cache_pf_start (FileCache * cache)
+{
+#ifdef UNIX
+    if (cache->pfrun) return 0;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (cache->mediatype == 1 && cache->hfile)
+        posix_fadvise(native_file_fd(cache->hfile), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    cache->pfrun = 1;
+    cache->pfreq++;  //load the packs ahead of current position at once
+
+    if (pthread_create(&cache->pfthread, NULL, file_cache_pf_thread, cache) != 0) {
+        cache->pfrun = 0;
+        return -100;
+    }
+
+    return 1;
+#else
+    return -100;
+#endif
+}
+
+static void file_cache_pf_stop (FileCache * cache)
+{
+#ifdef UNIX
+    if (!cache->pfrun) return;
+
+    pthread_mutex_lock(&cache->pfmutex);
+    cache->pfrun = 0;
+    pthread_cond_signal(&cache->pfcond);
+    pthread_mutex_unlock(&cache->pfmutex);
+
+    pthread_join(cache->pfthread, NULL);
+#endif
+}
+
+int file_cache_prefetch (void * vcache, int ahead)
+{
+    FileCache * cache = (FileCache *)vcache;
+
+    if (!cache) return -1;
+
+    if (ahead <= 0) {
+        file_cache_pf_stop(cache);
+        cache->pfahead = 0;
+        return 0;
+    }
+
+    if (cache->mapbyte) return -3;
+
+    /* the packs kept behind the read position are not available for prefetching */
+    if (ahead > cache->packnum - cache->prefix)
+        ahead = cache->packnum - cache->prefix;
+    if (ahead <= 0) return -2;
+
+    cache->pfahead = ahead;
+
+    if (file_cache_pf_start(cache) < 0) {
+        cache->pfahead = 0;
+        return -100;
+    }
+
+    return 0;
+}
+
+int file_cache_prefetch_stat (void * vcache, uint64 * loaded, uint64 * lagged)
+{
+    FileCache * cache = (FileCache *)vcache;
+
+    if (!cache) return -1;
+
+    if (loaded) *loaded = cache->pfloaded;
+    if (lagged) *lagged = cache->pflag;
+
+    return cache->pfahead;
+}
+
+
+/* memory-mapped mode: the whole media from cache->offset is mapped read-only,
+   packs are bypassed and pointers into the mapping are handed out directly */
+
+static void file_cache_munmap (FileCache * cache)
+{
+#ifdef UNIX
+    if (cache->mapaddr) {
+        file_munmap(cache->mapaddr, cache->mapsize);
+    }
+#endif
+    cache->mapaddr = NULL;
+    cache->mapbyte = NULL;
+    cache->mapsize = 0;
+    cache->maplen = 0;
+}
+
+int file_cache_mmap (void * vcache, int enable, int flags)
+{
+    FileCache * cache = (FileCache *)vcache;
+#ifdef UNIX
+    void      * pmap = NULL;
+    int64       mapsize = 0, mapoff = 0;
+    int         mflags = MAP_SHARED;
+#endif
+
+    if (!cache) return -1;
+
+    file_cache_munmap(cache);
+    if (!enable) return 0;
+
+#ifdef UNIX
+    if (cache->mediatype != 1 || !cache->hfile) return -2;
+    if (cache->length <= cache->offset) return -3;
+
+#ifdef MAP_POPULATE
+    if (flags & FBUF_MAP_POPULATE) mflags |= MAP_POPULATE;
+#endif
+
+    cache->mapbyte = file_mmap(NULL, native_file_fd(cache->hfile), cache->offset,
+                               cache->length - cache->offset, PROT_READ, mflags,
+                               &pmap, &mapsize, &mapoff);
+    if (!cache->mapbyte) return -100;
+
+    cache->mapaddr = pmap;
+    cache->mapsize = mapsize;
+    cache->maplen = mapsize - (cache->offset - mapoff);
+
+    if (flags & FBUF_MAP_SEQUENTIAL)
+        madvise(cache->mapaddr, cache->mapsize, MADV_SEQUENTIAL);
+
+    /* packs are not touched any more, the prefetch thread has nothing to do */
+    file_cache_pf_stop(cache);
+    cache->pfahead = 0;
+
+    cache->seekpos = 0;
+    cache->seek_pack = 0;
+
     return 0;
+#else
+    return -100;
+#endif
+}
+
+static long file_cache_map_skip (FileCache * cache, long pos, int skiplimit,
+                                 void * pat, int patlen, FCScan * scan)
+{
+    uint8  * p = NULL, * q = NULL;
+    int64    rest = 0, i = 0;
+    int      n = 0;
+
+    if (pos < 0 || pos >= cache->maplen) return pos;
+
+    rest = cache->maplen - pos;
+    if (skiplimit >= 0 && skiplimit < rest)
+        rest = skiplimit;
+
+    while (i < rest) {
+        n = rest - i > 0x40000000 ? 0x40000000 : (int)(rest - i);
+        p = cache->mapbyte + pos + i;
+
+        q = (*scan)(p, n, pat, patlen);
+        i += q - p;
+        if (q < p + n) break;
+    }
+
+    return pos + i;
+}
+
+static long file_cache_map_rskip (FileCache * cache, long pos, int skiplimit,
+                                  void * pat, int patlen, FCScan * scan)
+{
+    uint8  * p = NULL, * q = NULL;
+    int64    rest = 0, i = 0;
+    int      n = 0;
+
+    if (pos < 0) return 0;
+    if (pos >= cache->maplen) pos = cache->maplen - 1;
+
+    rest = pos + 1;
+    if (skiplimit >= 0 && skiplimit < rest)
+        rest = skiplimit;
+
+    while (i < rest) {
+        n = rest - i > 0x40000000 ? 0x40000000 : (int)(rest - i);
+        p = cache->mapbyte + pos - i;
+
+        q = (*scan)(p, n, pat, patlen);
+        i += p - q;
+        if (q > p - n) break;
+    }
+
+    return pos - i;
+}
+
+static int file_cache_map_read (FileCache * cache, void * pbuf, int length)
+{
+    int64    rest = 0;
+
+    if (cache->seekpos >= cache->maplen) return -200;
+
+    rest = cache->maplen - cache->seekpos;
+    if (length > rest) length = (int)rest;
+
+    if (pbuf && length > 0)
+        memcpy(pbuf, cache->mapbyte + cache->seekpos, length);
+
+    cache->seekpos += length;
+    cache->totalread++;
+
+    return length;
 }
 
 
@@ -1043,6 +1497,13 @@ int file_cache_len (void * vcache, int * successive)
  
     if (!cache) return 0;
  
+    if (cache->mapbyte) {
+        if (successive) *successive = 0;
+        if (cache->seekpos >= cache->maplen) return 0;
+        if (cache->maplen - cache->seekpos > 0x7FFFFFFF) return 0x7FFFFFFF;
+        return (int)(cache->maplen - cache->seekpos);
+    }
+
     packpos = (int)(cache->seekpos % cache->packsize);
     for (i = cache->seek_pack; i < cache->bgn_pack + cache->packnum && i < cache->packtotal; i++) {
         packind = i % cache->packnum;
@@ -1069,6 +1530,8 @@ void * file_cache_ptr (void * vcache)
 
     if (!cache) return NULL;
 
+    if (cache->mapbyte) return cache->mapbyte + cache->seekpos;
+
     pack = arr_value(cache->pack_list, cache->seek_pack%cache->packnum);
     packpos = (int)(cache->seekpos % cache->packsize);
     return (uint8 *)pack->pbyte + packpos;
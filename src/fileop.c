@@ -27,6 +27,12 @@
  * #####################################################
  */ 
  
+#ifdef _LINUX_
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include "btype.h"
 #include "fileop.h"
 #include "strutil.h"
@@ -43,6 +49,7 @@
 
 #ifdef _LINUX_
 #include <sys/sendfile.h>
+#include <poll.h>
 #endif
 #ifdef _FREEBSD_
 #include <sys/types.h>
@@ -275,6 +282,14 @@ int filefd_copy (int fdin, int64 offset, int64 length, int fdout, int64 * actnum
                 usleep(50);
                 continue;
             }
+#ifdef _LINUX_
+            /* sendfile does not support this pair of descriptors, move the rest through a pipe */
+            if (errno == EINVAL || errno == ENOSYS) {
+                ret = filefd_splice(fdin, offset + wlen, length - wlen, fdout, &toread);
+                if (actnum) *actnum = wlen + toread;
+                return ret < 0 ? -400 : 0;
+            }
+#endif
             if (actnum) *actnum = wlen;
             return -400;
         }
@@ -324,6 +339,74 @@ int filefd_copy (int fdin, int64 offset, int64 length, int fdout, int64 * actnum
 }
  
  
+int filefd_splice (int fdin, int64 offset, int64 length, int fdout, int64 * actnum)
+{
+#ifdef _LINUX_
+    struct pollfd  pfd;
+    int            pipefd[2];
+    loff_t         inoff = offset;
+    int64          wlen = 0;
+    ssize_t        inpipe = 0;
+    ssize_t        ret = 0;
+    int            err = 0;
+
+    if (actnum) *actnum = 0;
+
+    if (fdin < 0) return -1;
+    if (fdout < 0) return -2;
+    if (length <= 0) return 0;
+
+    if (pipe(pipefd) < 0) return -10;
+
+#ifdef F_SETPIPE_SZ
+    fcntl(pipefd[1], F_SETPIPE_SZ, 1048576);
+#endif
+
+    for (wlen = 0; wlen < length && err == 0; ) {
+        ret = splice(fdin, &inoff, pipefd[1], NULL, min(length - wlen, 1048576),
+                     SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            err = -20;
+            break;
+        }
+        if (ret == 0) break;  //end of file
+
+        /* all data in pipe must be drained to fdout before the next round */
+        for (inpipe = ret; inpipe > 0; ) {
+            ret = splice(pipefd[0], NULL, fdout, NULL, inpipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (ret > 0) {
+                inpipe -= ret;
+                wlen += ret;
+                continue;
+            }
+
+            if (ret < 0 && errno == EINTR) continue;
+
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pfd.fd = fdout;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, 5000) > 0 && !(pfd.revents & (POLLERR | POLLHUP)))
+                    continue;
+            }
+
+            err = -30;
+            break;
+        }
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    if (actnum) *actnum = wlen;
+
+    return err < 0 ? err : 0;
+#else
+    return filefd_copy(fdin, offset, length, fdout, actnum);
+#endif
+}
+
 long file_read (FILE * fp, void * buf, long readlen)
 {
     long i, iRet = 0;
@@ -1322,7 +1405,8 @@ typedef struct file_buf_s {
  
     int           pagecount;   //how many memory pages used, passed by initializing
     int           pagesize;
-    int           mapsize;
+    int64         mapsize;     //window size, the whole file is mapped when equal to fsize
+    int           mapflag;     //FBUF_MAP_POPULATE, FBUF_MAP_SEQUENTIAL
  
     int64         mapoff;
     int64         maplen;
@@ -1465,9 +1549,45 @@ int64 fbuf_size (void * vfb)
     return fbf->fsize;
 }
  
+int fbuf_mapmode (void * vfb, int64 winsize, int flags)
+{
+    fbuf_t * fbf = (fbuf_t *)vfb;
+ 
+    if (!fbf) return -1;
+ 
+    if (fbf->pbyte != NULL) {
+#ifdef UNIX
+        munmap(fbf->mapaddr, fbf->maplen);
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+        file_munmap(fbf->hmap, fbf->mapaddr);
+#endif
+        fbf->pbyte = NULL;
+    }
+    fbf->mapoff = fbf->maplen = 0;
+ 
+    if (winsize <= 0 || winsize >= fbf->fsize)
+        fbf->mapsize = fbf->fsize;
+    else
+        fbf->mapsize = (winsize + fbf->pagesize - 1) / fbf->pagesize * fbf->pagesize;
+    if (fbf->mapsize < fbf->pagesize)
+        fbf->mapsize = fbf->pagesize;
+ 
+    fbf->mapflag = flags;
+ 
+    /* whole-file mode maps eagerly so that the first access is not charged */
+    if (fbf->mapsize >= fbf->fsize && fbf->fsize > 0)
+        return fbuf_mmap(fbf, 0);
+ 
+    return 0;
+}
+ 
 int fbuf_mmap (void * vfb, int64 pos)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
+#ifdef UNIX
+    int      flags = 0;
+#endif
  
     if (!fbf) return -1;
  
@@ -1493,13 +1613,23 @@ int fbuf_mmap (void * vfb, int64 pos)
             fbf->maplen = fbf->mapsize;
  
 #ifdef UNIX
-        fbf->pbyte = mmap(fbf->pbyte, fbf->maplen,
-                            PROT_READ | PROT_WRITE, MAP_SHARED,
+        flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (fbf->mapflag & FBUF_MAP_POPULATE)
+            flags |= MAP_POPULATE;
+#endif
+        /* file is opened read-only, a writable shared mapping would fail with EACCES */
+        fbf->pbyte = mmap(NULL, fbf->maplen, PROT_READ, flags,
                             fbf->fd, fbf->mapoff);
         if (fbf->pbyte == MAP_FAILED) {
+            fbf->pbyte = NULL;
+            fbf->maplen = 0;
             return -3;
         }
         fbf->mapaddr = fbf->pbyte;
+
+        if (fbf->mapflag & FBUF_MAP_SEQUENTIAL)
+            madvise(fbf->mapaddr, fbf->maplen, MADV_SEQUENTIAL);
 #endif
  
 #if defined(_WIN32) || defined(_WIN64)
@@ -1519,6 +1649,9 @@ int fbuf_at (void * vfb, int64 pos)
  
     if (!fbf) return -1;
  
+    if (fbf->pbyte && pos >= fbf->mapoff && pos < fbf->mapoff + fbf->maplen)
+        return fbf->pbyte[pos - fbf->mapoff];
+ 
     if (fbuf_mmap(fbf, pos) < 0)
         return -2;
  
@@ -1528,6 +1661,7 @@ int fbuf_at (void * vfb, int64 pos)
 void * fbuf_ptr (void * vfb, int64 pos, void ** ppbuf, int * plen)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
+    int64    len = 0;
  
     if (!fbf) return NULL;
  
@@ -1535,7 +1669,10 @@ void * fbuf_ptr (void * vfb, int64 pos, void ** ppbuf, int * plen)
         return NULL;
  
     if (ppbuf) *ppbuf = fbf->pbyte + pos - fbf->mapoff;
-    if (plen) *plen = fbf->maplen - (pos - fbf->mapoff);
+    if (plen) {
+        len = fbf->maplen - (pos - fbf->mapoff);
+        *plen = len > 0x7FFFFFFF ? 0x7FFFFFFF : (int)len;
+    }
  
     return fbf->pbyte + pos - fbf->mapoff;
 }
@@ -1562,27 +1699,47 @@ int fbuf_read (void * vfb, int64 pos, void * pbuf, int len)
 }
  
  
+/* locate the mapped window holding pos, return the scannable bytes forward (or
+   backward when back is set) from pos, capped to int range for strutil scanners */
+static int fbuf_window (fbuf_t * fbf, int64 pos, int back, uint8 ** pp)
+{
+    int64  n;
+
+    if (fbuf_mmap(fbf, pos) < 0)
+        return -1;
+
+    *pp = fbf->pbyte + (pos - fbf->mapoff);
+
+    if (back) n = pos - fbf->mapoff + 1;
+    else n = fbf->mapoff + fbf->maplen - pos;
+
+    if (n > 0x40000000) n = 0x40000000;
+
+    return (int)n;
+}
+
 long fbuf_skip_to (void * vfb, long pos, int skiplimit, void * vpat, int patlen)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
-    uint8  * pat = (uint8 *)vpat;
-    int      fch = 0, j;
+    uint8  * p = NULL, * q = NULL;
     long     i = 0, fsize;
+    int      n;
  
     if (!fbf) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
  
     fsize = fbf->fsize - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = fbuf_at(fbf, pos + i);
-        if (fch < 0) break;
- 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos + i;
-        }
+    while (i < fsize) {
+        n = fbuf_window(fbf, pos + i, 0, &p);
+        if (n <= 0) break;
+        if (n > fsize - i) n = fsize - i;
+
+        q = skipTo(p, n, vpat, patlen);
+        i += q - p;
+        if (q < p + n) break;
     }
  
     return pos + i;
@@ -1591,26 +1748,28 @@ long fbuf_skip_to (void * vfb, long pos, int skiplimit, void * vpat, int patlen)
 long fbuf_rskip_to (void * vfb, long pos, int skiplimit, void * vpat, int patlen)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
-    uint8  * pat = (uint8 *)vpat;
-    int      fch = 0;
-    long     i = 0, j = 0;
+    uint8  * p = NULL, * q = NULL;
+    long     i = 0, fsize;
+    int      n;
  
     if (!fbf) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
  
     if (pos < 0) return 0;
     if (pos >= fbf->fsize) pos = fbf->fsize - 1;
  
-    for (i = 0; i <= pos; i++) {
-        if (skiplimit >= 0 && i >= skiplimit)
-            break;
- 
-        fch = fbuf_at(fbf, pos - i);
-        if (fch < 0) break;
+    fsize = pos + 1;
+    if (skiplimit >= 0 && skiplimit < fsize)
+        fsize = skiplimit;
  
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) return pos - i;
-        }
+    while (i < fsize) {
+        n = fbuf_window(fbf, pos - i, 1, &p);
+        if (n <= 0) break;
+        if (n > fsize - i) n = fsize - i;
+
+        q = rskipTo(p, n, vpat, patlen);
+        i += p - q;
+        if (q > p - n) break;
     }
  
     return pos - i;
@@ -1619,27 +1778,25 @@ long fbuf_rskip_to (void * vfb, long pos, int skiplimit, void * vpat, int patlen
 long fbuf_skip_over (void * vfb, long pos, int skiplimit, void * vpat, int patlen)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
-    uint8  * pat = (uint8 *)vpat;
-    int      fch = 0;
-    long     i, fsize = 0;
-    int      j = 0;
+    uint8  * p = NULL, * q = NULL;
+    long     i = 0, fsize = 0;
+    int      n;
  
     if (!fbf) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
  
     fsize = fbf->fsize - pos;
     if (skiplimit >= 0 && skiplimit < fsize)
         fsize = skiplimit;
  
-    for (i = 0; i < fsize; i++) {
-        fch = fbuf_at(fbf, pos + i);
-        if (fch < 0) break;
- 
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
- 
-        if (j >= patlen) return pos + i;
+    while (i < fsize) {
+        n = fbuf_window(fbf, pos + i, 0, &p);
+        if (n <= 0) break;
+        if (n > fsize - i) n = fsize - i;
+
+        q = skipOver(p, n, vpat, patlen);
+        i += q - p;
+        if (q < p + n) break;
     }
  
     return pos + i;
@@ -1648,28 +1805,28 @@ long fbuf_skip_over (void * vfb, long pos, int skiplimit, void * vpat, int patle
 long fbuf_rskip_over (void * vfb, long pos, int skiplimit, void * vpat, int patlen)
 {
     fbuf_t * fbf = (fbuf_t *)vfb;
-    uint8  * pat = (uint8 *)vpat;
-    int      fch = 0;
-    long     i;
-    int      j = 0;
+    uint8  * p = NULL, * q = NULL;
+    long     i = 0, fsize;
+    int      n;
  
     if (!fbf) return -1;
-    if (!pat || patlen <= 0) return pos;
+    if (!vpat || patlen <= 0) return pos;
  
     if (pos <= 0) return pos;
     if (pos >= fbf->fsize) pos = fbf->fsize - 1;
  
-    for (i = 0; i <= pos; i++) {
-        if (skiplimit >= 0 && i >= skiplimit)
-            break;
- 
-        fch = fbuf_at(fbf, pos - i);
-        if (fch < 0) break;
+    fsize = pos + 1;
+    if (skiplimit >= 0 && skiplimit < fsize)
+        fsize = skiplimit;
  
-        for (j = 0; j < patlen; j++) {
-            if (pat[j] == fch) break;
-        }
-        if (j >= patlen) return pos - i;
+    while (i < fsize) {
+        n = fbuf_window(fbf, pos - i, 1, &p);
+        if (n <= 0) break;
+        if (n > fsize - i) n = fsize - i;
+
+        q = rskipOver(p, n, vpat, patlen);
+        i += p - q;
+        if (q > p - n) break;
     }
  
     return pos - i;
@@ -31,10 +31,12 @@
 #include "memory.h"
 #include "kemalloc.h"
 #include "frame.h"
+#include "frmpool.h"
 #include "strutil.h"
 #include "patmat.h"
 #include "fileop.h"
 #include "tsock.h"
+#include "asyncio.h"
 
 #include <stdarg.h>
 #include <assert.h>
@@ -108,6 +110,99 @@ frame_p frame_alloc_dbg (int size, int alloctype, void * mpool, char * file, int
     return frm;
 }
 
+/* release data buffer to the pool or memory allocator where it was fetched */
+static void frame_data_release (frame_p frm)
+{
+    if (!frm->data) return;
+
+    if (frm->pooldata)
+        frmpool_put(frm->data, frmpool_class(frm->size + 1));
+    else
+        k_mem_free(frm->data, frm->alloctype, frm->mpool);
+
+    frm->data = NULL;
+    frm->pooldata = 0;
+}
+
+/* allocate data buffer for a frame without buffer. pool-mode frame takes
+   the buffer of the smallest class holding size bytes */
+static void frame_data_new (frame_p frm, int size, char * file, int line)
+{
+    int   cls = -1;
+
+    if (frm->poolmode && (cls = frmpool_class(size + 1)) >= 0 &&
+        (frm->data = frmpool_get(cls)) != NULL)
+    {
+        frm->size = frmpool_class_size(cls) - 1;
+        frm->pooldata = 1;
+    } else {
+        frm->size = size;
+        frm->data = k_mem_zalloc_dbg(frm->size + 1, frm->alloctype, frm->mpool, file, line);
+        frm->pooldata = 0;
+    }
+
+    frm->allocnum = 1;
+}
+
+/* move the data of pool-mode frame to a new buffer holding bufsize bytes, the
+   content is shifted by the given offset. buffer is fetched from the size class
+   if bufsize is within the largest class, otherwise from memory allocator */
+static int frame_pool_regrow (frame_p frm, int bufsize, int shift, char * file, int line)
+{
+    uint8  * pbuf = NULL;
+    int      cls = 0;
+    int      newsize = 0;
+
+    cls = frmpool_class(bufsize + 1);
+
+    if (cls < 0 && frm->data && !frm->pooldata) {
+        /* already beyond the largest class, realloc it in place. content is
+           moved ahead before shrinking, or backward after growing */
+        if (shift < 0) {
+            if (frm->len > 0)
+                memmove(frm->data + frm->start + shift, frm->data + frm->start, frm->len);
+            frm->start += shift;
+            shift = 0;
+        }
+
+        pbuf = k_mem_realloc_dbg(frm->data, bufsize + 1, frm->alloctype, frm->mpool, file, line);
+        if (!pbuf) return -1;
+
+        if (frm->len > 0 && shift > 0)
+            memmove(pbuf + frm->start + shift, pbuf + frm->start, frm->len);
+
+        frm->data = pbuf;
+        frm->size = bufsize;
+        frm->start += shift;
+        frm->allocnum++;
+        return 0;
+    }
+
+    if (cls >= 0) {
+        pbuf = frmpool_get(cls);
+        newsize = frmpool_class_size(cls) - 1;
+    } else {
+        pbuf = k_mem_alloc_dbg(bufsize + 1, frm->alloctype, frm->mpool, file, line);
+        newsize = bufsize;
+    }
+    if (!pbuf) return -1;
+
+    if (!frm->data) {
+        frm->start = frm->len = 0;
+    } else if (frm->len > 0) {
+        memcpy(pbuf + frm->start + shift, frm->data + frm->start, frm->len);
+    }
+    frame_data_release(frm);
+
+    frm->data = pbuf;
+    frm->pooldata = cls >= 0 ? 1 : 0;
+    frm->size = newsize;
+    frm->start += shift;
+    frm->allocnum++;
+
+    return 0;
+}
+
 frame_p frame_new_dbg (int size, char * file, int line)
 {
     frame_p frm = NULL;
@@ -135,6 +230,22 @@ frame_p frame_new_dbg (int size, char * file, int line)
     return frm;
 }
 
+frame_p frame_pool_new (int size)
+{
+    frame_p frm = NULL;
+
+    frm = frmpool_get(FRMPOOL_HDR);
+    if (!frm) return NULL;
+
+    memset(frm, 0, sizeof(*frm));
+    frm->poolmode = 1;
+
+    if (size > 0)
+        frame_data_new(frm, size, __FILE__, __LINE__);
+
+    return frm;
+}
+
 void frame_free (frame_p frm)
 {
     frame_p  iter = NULL;
@@ -144,11 +255,12 @@ void frame_free (frame_p frm)
     do {
         iter = frm->next;
 
-        if (frm->data) {
-            k_mem_free(frm->data, frm->alloctype, frm->mpool);
-            frm->data = NULL;
-        }
-        k_mem_free(frm, frm->alloctype, frm->mpool);
+        frame_data_release(frm);
+
+        if (frm->poolmode)
+            frmpool_put(frm, FRMPOOL_HDR);
+        else
+            k_mem_free(frm, frm->alloctype, frm->mpool);
 
         frm = iter;
     } while (frm != NULL);
@@ -163,10 +275,7 @@ void frame_free_inner (frame_p frm)
     do {
         iter = frm->next;
 
-        if (frm->data) {
-            k_mem_free(frm->data, frm->alloctype, frm->mpool);
-            frm->data = NULL;
-        }
+        frame_data_release(frm);
 
         frm = iter;
     } while (frm != NULL);
@@ -245,7 +354,10 @@ frame_p frame_dup (frame_p frm)
 
     if (!frm) return NULL;
 
-    dst = frame_alloc(frm->len, frm->alloctype, frm->mpool);
+    if (frm->poolmode)
+        dst = frame_pool_new(frm->len);
+    else
+        dst = frame_alloc(frm->len, frm->alloctype, frm->mpool);
     if (!dst) return NULL;
 
     memcpy(dst->data + dst->start, frm->data + frm->start, frm->len);
@@ -277,6 +389,11 @@ void frame_grow_dbg (frame_p frm, int size, char * file, int line)
     dif = DEFAULT_SIZE - dif;
     size += dif;
 
+    if (frm->poolmode) {
+        frame_pool_regrow(frm, frm->size + size, 0, file, line);
+        return;
+    }
+
     if (frm->data == NULL) {
         frm->data = k_mem_zalloc_dbg(frm->size + size + 1, frm->alloctype, frm->mpool, file, line);
         frm->start = 0;
@@ -327,6 +444,11 @@ void frame_grow_head_dbg (frame_p frm, int size, char * file, int line)
     dif = DEFAULT_SIZE - dif;
     size += dif;
  
+    if (frm->poolmode) {
+        frame_pool_regrow(frm, frm->size + size, size, file, line);
+        return;
+    }
+
     if (frm->data == NULL) {
         frm->data = k_mem_zalloc_dbg(frm->size + size + 1, frm->alloctype, frm->mpool, file, line);
         frm->len = 0;
@@ -561,9 +683,7 @@ void frame_put_first (frame_p frm, int byte)
     if (!frm) return;
 
     if (frm->data == NULL) {
-        frm->size = DEFAULT_SIZE;
-        frm->data = k_mem_zalloc(frm->size + 1, frm->alloctype, frm->mpool);
-        frm->allocnum = 1;
+        frame_data_new(frm, DEFAULT_SIZE, __FILE__, __LINE__);
         frm->start = frm->size/2;
         frm->len = 0;
     }
@@ -598,9 +718,7 @@ void frame_put_nfirst (frame_p frm, void * bytes, int n)
     if (n <= 0) return;
 
     if (frm->data == NULL) {
-        frm->size = n + DEFAULT_SIZE - (n % DEFAULT_SIZE);
-        frm->data = k_mem_zalloc(frm->size + 1, frm->alloctype, frm->mpool);
-        frm->allocnum = 1;
+        frame_data_new(frm, n + DEFAULT_SIZE - (n % DEFAULT_SIZE), __FILE__, __LINE__);
         frm->start = n;
         frm->len = 0;
     }
@@ -635,9 +753,7 @@ void frame_put_last (frame_p frm, int byte)
     if (!frm) return;
 
     if (frm->data == NULL) {
-        frm->size = DEFAULT_SIZE;
-        frm->data = k_mem_zalloc(frm->size + 1, frm->alloctype, frm->mpool);
-        frm->allocnum = 1;
+        frame_data_new(frm, DEFAULT_SIZE, __FILE__, __LINE__);
         frm->start = frm->size/2;
         frm->len = 0;
     }
@@ -671,9 +787,7 @@ void frame_put_nlast_dbg (frame_p frm, void * bytes, int n, char * file, int lin
     if (n <= 0) return;
 
     if (frm->data == NULL) {
-        frm->size = n + DEFAULT_SIZE - (n % DEFAULT_SIZE);
-        frm->data = k_mem_zalloc_dbg(frm->size + 1, frm->alloctype, frm->mpool, file, line);
-        frm->allocnum = 1;
+        frame_data_new(frm, n + DEFAULT_SIZE - (n % DEFAULT_SIZE), file, line);
         frm->start = 0;
         frm->len = 0;
     }
@@ -992,8 +1106,7 @@ int frame_attach (frame_p frm, void * pbuf, int len)
     if (!frm || !pbuf || len <= 0)
         return -1;
 
-    if (frm->data)
-        k_mem_free(frm->data, frm->alloctype, frm->mpool);
+    frame_data_release(frm);
 
     frm->data = pbuf;
     frm->start = 0;
@@ -1649,6 +1762,58 @@ error: /* connection exception */
     return ret;
 }
  
+#ifdef _LINUX_
+
+typedef struct frame_aio_s {
+    frame_p       frm;
+    AsyncIOCB   * cb;
+    void        * cbpara;
+} FrameAIO;
+
+static void frame_aio_recv_done (void * para, int64 result)
+{
+    FrameAIO  * fa = (FrameAIO *)para;
+
+    if (result > 0)
+        fa->frm->len += result;
+
+    if (fa->cb) (*fa->cb)(fa->cbpara, result);
+
+    kfree(fa);
+}
+
+int frame_tcp_recv_async (frame_p frm, SOCKET fd, int size, void * aio, void * cb, void * cbpara)
+{
+    FrameAIO  * fa = NULL;
+    int         ret = 0;
+
+    if (fd == INVALID_SOCKET) return -1;
+    if (!frm) return -2;
+    if (!aio) return -3;
+
+    if (size <= 0) size = 16384;
+
+    if (frame_rest(frm) < size)
+        frame_grow(frm, size - frame_rest(frm));
+
+    fa = kzalloc(sizeof(*fa));
+    if (!fa) return -4;
+
+    fa->frm = frm;
+    fa->cb = (AsyncIOCB *)cb;
+    fa->cbpara = cbpara;
+
+    ret = asyncio_recv(aio, fd, frame_end(frm), size, frame_aio_recv_done, fa);
+    if (ret < 0) {
+        kfree(fa);
+        return -100;
+    }
+
+    return 0;
+}
+
+#endif
+
 int frame_tcp_nb_recv (frame_p frm, SOCKET fd, int * actnum, int * perr)
 {
     uint8   buf[524288];
@@ -1729,6 +1894,342 @@ error: /* connection exception */
     return ret;
 }
  
+/* Receive from non-blocking socket into a chain of fixed-size frames linked by next.
+   The rest space of the tail frame and FRAME_CHAIN_NEW newly fetched pool frames are
+   filled by one readv call. A short read means the socket buffer is drained, so no
+   FIONREAD probing and no extra recv only to get EAGAIN. Unused frames go back to
+   frmpool immediately. Return value is same as frame_tcp_nb_recv */
+
+#define FRAME_CHAIN_NEW  4
+
+int frame_chain_recv (frame_p * pchain, SOCKET fd, int bufsize, int * actnum, int * perr)
+{
+    frame_p       last = NULL;
+    frame_p       newfrm[FRAME_CHAIN_NEW];
+    struct iovec  iov[FRAME_CHAIN_NEW + 1];
+    int           iovcnt = 0, newnum = 0, rest = 0;
+    int           i, ret = 0, cap = 0, len = 0, readLen = 0;
+    int           errcode;
+#if defined(_WIN32) || defined(_WIN64)
+    WSABUF        wsabuf[FRAME_CHAIN_NEW + 1];
+    DWORD         recvnum = 0, flags = 0;
+#endif
+
+    if (actnum) *actnum = 0;
+    if (perr) *perr = 0;
+
+    if (!pchain) return -1;
+    if (fd == INVALID_SOCKET) return -1;
+
+    if (bufsize <= 0) bufsize = 16384;
+
+    /* data size of pooled frame is class size - 1, request it to fit the class exactly */
+    if (bufsize > 1 && bufsize <= frmpool_class_size(FRMPOOL_CLASSES - 1))
+        bufsize = frmpool_class_size(frmpool_class(bufsize)) - 1;
+
+    for (last = *pchain; last && last->next; last = last->next);
+
+    for (readLen = 0; ; ) {
+        iovcnt = cap = 0;
+
+        rest = frame_rest(last);
+        if (rest > 0) {
+            iov[iovcnt].iov_base = frame_end(last);
+            iov[iovcnt].iov_len = rest;
+            iovcnt++; cap += rest;
+        }
+
+        for (newnum = 0; newnum < FRAME_CHAIN_NEW; newnum++) {
+            newfrm[newnum] = frame_pool_new(bufsize);
+            if (!newfrm[newnum]) break;
+
+            iov[iovcnt].iov_base = newfrm[newnum]->data;
+            iov[iovcnt].iov_len = newfrm[newnum]->size;
+            iovcnt++; cap += newfrm[newnum]->size;
+        }
+
+        if (iovcnt == 0) {
+            ret = -10;
+            goto error;
+        }
+
+#ifdef UNIX
+        errno = 0;
+        ret = readv(fd, iov, iovcnt);
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+        for (i = 0; i < iovcnt; i++) {
+            wsabuf[i].buf = iov[i].iov_base;
+            wsabuf[i].len = (ULONG)iov[i].iov_len;
+        }
+        flags = 0;
+        ret = WSARecv(fd, wsabuf, iovcnt, &recvnum, &flags, NULL, NULL);
+        if (ret == 0) ret = (int)recvnum;
+#endif
+
+        if (ret > 0) {
+            readLen += ret;
+            len = ret;
+
+            if (rest > 0) {
+                i = len < rest ? len : rest;
+                last->len += i;
+                len -= i;
+            }
+
+            for (i = 0; i < newnum; i++) {
+                if (len <= 0) {
+                    frame_free(newfrm[i]);
+                    continue;
+                }
+
+                newfrm[i]->len = len < newfrm[i]->size ? len : newfrm[i]->size;
+                len -= newfrm[i]->len;
+
+                if (last) last->next = newfrm[i];
+                else *pchain = newfrm[i];
+                last = newfrm[i];
+            }
+
+            if (ret < cap) break;
+            continue;
+        }
+
+        for (i = 0; i < newnum; i++)
+            frame_free(newfrm[i]);
+
+#ifdef UNIX
+        if (perr) *perr = errno;
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+        if (perr) *perr = errcode = WSAGetLastError();
+#endif
+
+        if (ret == 0) {
+            if (actnum) *actnum = readLen;
+            return -20;
+
+        } else if (ret == SOCKET_ERROR) {
+#if defined(_WIN32) || defined(_WIN64)
+            errcode = WSAGetLastError();
+            if (errcode == WSAEINTR) {
+                continue;
+            }
+            if (errcode == WSAEWOULDBLOCK) {
+                break;
+            }
+#endif
+#ifdef UNIX
+            errcode = errno;
+            if (errcode == EINTR) {
+                continue;
+            }
+            if (errcode == EAGAIN || errcode == EWOULDBLOCK) {
+                break;
+            }
+#endif
+            ret = -30;
+            goto error;
+        }
+    }
+
+    if (actnum) *actnum = readLen;
+    return readLen;
+
+error:
+    if (actnum) *actnum = readLen;
+    return ret;
+}
+
+int64 frame_chain_len (frame_p chain)
+{
+    int64  len = 0;
+
+    for ( ; chain; chain = chain->next)
+        len += chain->len;
+
+    return len;
+}
+
+int frame_chain_num (frame_p chain)
+{
+    int  num = 0;
+
+    for ( ; chain; chain = chain->next)
+        num++;
+
+    return num;
+}
+
+/* locate the frame holding the byte at pos of chain, *poff is the offset in that frame */
+static frame_p frame_chain_locate (frame_p chain, int64 pos, int * poff)
+{
+    for ( ; chain; chain = chain->next) {
+        if (pos < chain->len) break;
+        pos -= chain->len;
+    }
+
+    if (poff) *poff = chain ? (int)pos : 0;
+
+    return chain;
+}
+
+int frame_chain_iov (frame_p chain, int64 pos, struct iovec * iov, int maxnum)
+{
+    frame_p  frm = NULL;
+    int      off = 0, num = 0;
+
+    if (!iov || maxnum <= 0 || pos < 0) return 0;
+
+    frm = frame_chain_locate(chain, pos, &off);
+
+    for (num = 0; frm && num < maxnum; frm = frm->next, off = 0) {
+        if (frm->len - off <= 0) continue;
+
+        iov[num].iov_base = frm->data + frm->start + off;
+        iov[num].iov_len = frm->len - off;
+        num++;
+    }
+
+    return num;
+}
+
+int frame_chain_get (frame_p chain, int64 pos)
+{
+    frame_p  frm = NULL;
+    int      off = 0;
+
+    if (pos < 0) return -1;
+
+    frm = frame_chain_locate(chain, pos, &off);
+    if (!frm) return -1;
+
+    return frm->data[frm->start + off];
+}
+
+int frame_chain_getn (frame_p chain, int64 pos, void * pbuf, int len)
+{
+    frame_p  frm = NULL;
+    uint8  * p = (uint8 *)pbuf;
+    int      off = 0, n = 0, num = 0;
+
+    if (!pbuf || len <= 0 || pos < 0) return 0;
+
+    frm = frame_chain_locate(chain, pos, &off);
+
+    for (num = 0; frm && num < len; frm = frm->next, off = 0) {
+        n = frm->len - off;
+        if (n > len - num) n = len - num;
+        if (n <= 0) continue;
+
+        memcpy(p + num, frm->data + frm->start + off, n);
+        num += n;
+    }
+
+    return num;
+}
+
+/* compare pattern with the bytes starting at offset off of frm, crossing boundaries */
+static int frame_chain_match (frame_p frm, int off, uint8 * pat, int patlen)
+{
+    int  n = 0;
+
+    for ( ; frm && patlen > 0; frm = frm->next, off = 0) {
+        n = frm->len - off;
+        if (n > patlen) n = patlen;
+        if (n <= 0) continue;
+
+        if (memcmp(frm->data + frm->start + off, pat, n) != 0)
+            return 0;
+
+        pat += n;
+        patlen -= n;
+    }
+
+    return patlen == 0;
+}
+
+int64 frame_chain_search (frame_p chain, int64 pos, void * pat, int patlen)
+{
+    frame_p  frm = NULL;
+    uint8  * pbgn = NULL;
+    uint8  * p = NULL;
+    int      off = 0;
+
+    if (!pat || patlen <= 0 || pos < 0) return -1;
+
+    frm = frame_chain_locate(chain, pos, &off);
+    pos -= off;
+
+    for ( ; frm; pos += frm->len, frm = frm->next, off = 0) {
+        pbgn = frm->data + frm->start;
+
+        while (off < frm->len) {
+            p = memchr(pbgn + off, *(uint8 *)pat, frm->len - off);
+            if (!p) break;
+
+            off = p - pbgn;
+            if (frame_chain_match(frm, off, pat, patlen))
+                return pos + off;
+
+            off++;
+        }
+    }
+
+    return -1;
+}
+
+void frame_chain_del_first (frame_p * pchain, int64 len)
+{
+    frame_p  frm = NULL;
+    frame_p  next = NULL;
+
+    if (!pchain) return;
+
+    for (frm = *pchain; frm && len > 0; frm = next) {
+        if (len < frm->len) {
+            frame_del_first(frm, (int)len);
+            break;
+        }
+
+        len -= frm->len;
+
+        next = frm->next;
+        frm->next = NULL;
+        frame_free(frm);
+    }
+
+    *pchain = frm;
+}
+
+frame_p frame_chain_linearize (frame_p * pchain)
+{
+    frame_p  chain = NULL;
+    frame_p  frm = NULL;
+    frame_p  iter = NULL;
+    int64    len = 0;
+
+    if (!pchain || !(chain = *pchain)) return NULL;
+
+    if (chain->next == NULL) return chain;
+
+    len = frame_chain_len(chain);
+    if (len >= 0x7FFFFFFF) return NULL;
+
+    frm = frame_pool_new((int)len);
+    if (!frm) return NULL;
+
+    for (iter = chain; iter; iter = iter->next) {
+        memcpy(frm->data + frm->len, iter->data + iter->start, iter->len);
+        frm->len += iter->len;
+    }
+
+    frame_free(chain);
+
+    *pchain = frm;
+    return frm;
+}
+
 int frame_tcp_nb_send (frame_p frm, SOCKET fd, int * actnum)
 {
     int     sendLen = 0;
@@ -2854,6 +3355,20 @@ frame_p frame_realloc (frame_p frm, int size)
 
     if (frm->size <= size) return frm;
 
+    if (frm->poolmode) {
+        if (frm->len > size) frm->len = size;
+
+        if (frm->pooldata && frmpool_class(size + 1) == frmpool_class(frm->size + 1)) {
+            if (frm->len > 0 && frm->start > 0)
+                memmove(frm->data, frm->data + frm->start, frm->len);
+            frm->start = 0;
+            return frm;
+        }
+
+        frame_pool_regrow(frm, size, -frm->start, __FILE__, __LINE__);
+        return frm;
+    }
+
     pbyte = frm->data;
 
     frm->data = k_mem_alloc(size + 1, frm->alloctype, frm->mpool);
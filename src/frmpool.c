@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "trace.h"
+#include "frame.h"
+#include "poolstat.h"
+#include "frmpool.h"
+
+typedef struct frmpool_class_s {
+    CRITICAL_SECTION   lock;
+
+    int                unitsize;
+    int                cachemax;    //max idle units cached by one thread
+    int                batch;       //units moved between thread cache and global list at once
+    long               idlemax;     //max idle units kept in global list
+
+    void             * idlelist;    //idle units linked by their first pointer
+    long               idlenum;
+    long               allocated;
+
+    /* counters of exited threads, or of the callers without thread cache */
+    uint64             hit;
+    uint64             refill;
+    uint64             miss;
+    uint64             recycle;
+
+    PoolStat           stat;
+} FrmPoolClass;
+
+typedef struct frmpool_tcache_s {
+    struct frmpool_tcache_s * prev;
+    struct frmpool_tcache_s * next;
+
+    void             * list[FRMPOOL_CLASSES];
+    int                num[FRMPOOL_CLASSES];
+
+    uint64             hit[FRMPOOL_CLASSES];
+    uint64             refill[FRMPOOL_CLASSES];
+    uint64             miss[FRMPOOL_CLASSES];
+    uint64             recycle[FRMPOOL_CLASSES];
+} FrmTCache;
+
+
+static FrmPoolClass    g_frmpool[FRMPOOL_CLASSES];
+static FrmTCache     * g_frmpool_tclist = NULL;
+
+#ifdef UNIX
+static INIT_STATIC_CS(g_frmpool_CS);
+static pthread_once_t  g_frmpool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   g_frmpool_key;
+#else
+static CRITICAL_SECTION g_frmpool_CS;
+static uint8           g_frmpool_init = 0;
+#endif
+
+#define frmpool_next(p)  (*(void **)(p))
+
+static int frmpool_stat_snap (void * pool, PoolSnap * snap);
+static void frmpool_tcache_free (void * arg);
+
+
+static void frmpool_init ()
+{
+    FrmPoolClass * pc = NULL;
+    char           name[32];
+    int            i;
+
+    for (i = 0; i < FRMPOOL_CLASSES; i++) {
+        pc = &g_frmpool[i];
+        memset(pc, 0, sizeof(*pc));
+
+        InitializeCriticalSection(&pc->lock);
+
+        if (i == FRMPOOL_HDR) {
+            pc->unitsize = sizeof(frame_t);
+            pc->cachemax = 64;
+            pc->idlemax = 4096;
+            sprintf(name, "frmpool-hdr");
+        } else {
+            pc->unitsize = 1 << (FRMPOOL_MIN_SHIFT + i - 1);
+
+            pc->cachemax = (256 << 10) / pc->unitsize;
+            if (pc->cachemax > 32) pc->cachemax = 32;
+            if (pc->cachemax < 2) pc->cachemax = 2;
+
+            pc->idlemax = (16 << 20) / pc->unitsize;
+            if (pc->idlemax > 1024) pc->idlemax = 1024;
+            if (pc->idlemax < 16) pc->idlemax = 16;
+
+            if (pc->unitsize >= (1 << 20))
+                sprintf(name, "frmpool-%dM", pc->unitsize >> 20);
+            else
+                sprintf(name, "frmpool-%dK", pc->unitsize >> 10);
+        }
+        pc->batch = pc->cachemax / 2;
+
+        poolstat_register(pc, POOL_TYPE_FRAME, frmpool_stat_snap);
+        poolstat_set_name(pc, name);
+    }
+
+#ifdef UNIX
+    pthread_key_create(&g_frmpool_key, frmpool_tcache_free);
+#endif
+}
+
+#ifdef UNIX
+
+static FrmTCache * frmpool_tcache ()
+{
+    FrmTCache * tc = NULL;
+
+    pthread_once(&g_frmpool_once, frmpool_init);
+
+    tc = pthread_getspecific(g_frmpool_key);
+    if (tc) return tc;
+
+    tc = koszmalloc(sizeof(*tc));
+    if (!tc) return NULL;
+
+    EnterCriticalSection(&g_frmpool_CS);
+    tc->prev = NULL;
+    tc->next = g_frmpool_tclist;
+    if (g_frmpool_tclist) g_frmpool_tclist->prev = tc;
+    g_frmpool_tclist = tc;
+    LeaveCriticalSection(&g_frmpool_CS);
+
+    pthread_setspecific(g_frmpool_key, tc);
+
+    return tc;
+}
+
+#else
+
+/* no thread cache on Windows, all callers go to the global list */
+static FrmTCache * frmpool_tcache ()
+{
+    if (!g_frmpool_init) {
+        g_frmpool_init = 1;
+        InitializeCriticalSection(&g_frmpool_CS);
+        frmpool_init();
+    }
+    return NULL;
+}
+
+#endif
+
+
+int frmpool_class (int size)
+{
+    int  cls = 0;
+    int  usize = 1 << FRMPOOL_MIN_SHIFT;
+
+    if (size < 0) return -1;
+
+    for (cls = 1; cls < FRMPOOL_CLASSES; cls++, usize <<= 1) {
+        if (size <= usize) return cls;
+    }
+
+    return -1;
+}
+
+int frmpool_class_size (int cls)
+{
+    if (cls < 0 || cls >= FRMPOOL_CLASSES)
+        return 0;
+
+    if (cls == FRMPOOL_HDR)
+        return sizeof(frame_t);
+
+    return 1 << (FRMPOOL_MIN_SHIFT + cls - 1);
+}
+
+/* push the chain of num units into global list. the units beyond the
+   limitation of idle number are released to system */
+static void frmpool_class_push (FrmPoolClass * pc, void * head, void * tail, int num)
+{
+    void  * p = NULL;
+    void  * freelist = NULL;
+
+    if (!pc || !head || num <= 0) return;
+
+    poolstat_lock(&pc->lock, &pc->stat);
+
+    while (pc->idlenum + num > pc->idlemax && head) {
+        p = head;
+        head = frmpool_next(p);
+        frmpool_next(p) = freelist;
+        freelist = p;
+        num--;
+        pc->allocated--;
+    }
+
+    if (head && num > 0) {
+        frmpool_next(tail) = pc->idlelist;
+        pc->idlelist = head;
+        pc->idlenum += num;
+    }
+
+    LeaveCriticalSection(&pc->lock);
+
+    while ((p = freelist) != NULL) {
+        freelist = frmpool_next(p);
+        kosfree(p);
+    }
+}
+
+void * frmpool_get (int cls)
+{
+    FrmTCache    * tc = NULL;
+    FrmPoolClass * pc = NULL;
+    void         * p = NULL;
+    void         * q = NULL;
+    int            i;
+
+    if (cls < 0 || cls >= FRMPOOL_CLASSES)
+        return NULL;
+
+    tc = frmpool_tcache();
+
+    if (tc && tc->num[cls] > 0) {
+        p = tc->list[cls];
+        tc->list[cls] = frmpool_next(p);
+        tc->num[cls]--;
+        tc->hit[cls]++;
+        return p;
+    }
+
+    pc = &g_frmpool[cls];
+
+    poolstat_lock(&pc->lock, &pc->stat);
+
+    if (pc->idlenum > 0) {
+        p = pc->idlelist;
+        pc->idlelist = frmpool_next(p);
+        pc->idlenum--;
+
+        if (tc) {
+            /* refill the thread cache with a batch of units in one go */
+            for (i = 1; i < pc->batch && pc->idlenum > 0; i++) {
+                q = pc->idlelist;
+                pc->idlelist = frmpool_next(q);
+                pc->idlenum--;
+
+                frmpool_next(q) = tc->list[cls];
+                tc->list[cls] = q;
+                tc->num[cls]++;
+            }
+            tc->refill[cls]++;
+        } else {
+            pc->refill++;
+        }
+
+    } else {
+        pc->allocated++;
+        if (pc->allocated > pc->stat.peak)
+            pc->stat.peak = pc->allocated;
+
+        if (tc) tc->miss[cls]++;
+        else pc->miss++;
+    }
+
+    LeaveCriticalSection(&pc->lock);
+
+    if (p) return p;
+
+    p = kosmalloc(pc->unitsize);
+    if (!p) {
+        EnterCriticalSection(&pc->lock);
+        pc->allocated--;
+        LeaveCriticalSection(&pc->lock);
+
+        tolog(1, "Panic: frmpool_get %d bytes failed\n", pc->unitsize);
+    }
+
+    return p;
+}
+
+void frmpool_put (void * p, int cls)
+{
+    FrmTCache    * tc = NULL;
+    FrmPoolClass * pc = NULL;
+    void         * head = NULL;
+    void         * tail = NULL;
+    int            i;
+
+    if (!p || cls < 0 || cls >= FRMPOOL_CLASSES)
+        return;
+
+    pc = &g_frmpool[cls];
+
+    tc = frmpool_tcache();
+    if (!tc) {
+        EnterCriticalSection(&pc->lock);
+        pc->recycle++;
+        LeaveCriticalSection(&pc->lock);
+
+        frmpool_next(p) = NULL;
+        frmpool_class_push(pc, p, p, 1);
+        return;
+    }
+
+    frmpool_next(p) = tc->list[cls];
+    tc->list[cls] = p;
+    tc->num[cls]++;
+    tc->recycle[cls]++;
+
+    if (tc->num[cls] <= pc->cachemax)
+        return;
+
+    /* drain a batch of units into global list */
+    head = tail = tc->list[cls];
+    for (i = 1; i < pc->batch; i++)
+        tail = frmpool_next(tail);
+
+    tc->list[cls] = frmpool_next(tail);
+    tc->num[cls] -= pc->batch;
+    frmpool_next(tail) = NULL;
+
+    frmpool_class_push(pc, head, tail, pc->batch);
+}
+
+static void frmpool_tcache_flush (FrmTCache * tc)
+{
+    void  * head = NULL;
+    void  * tail = NULL;
+    int     i;
+
+    if (!tc) return;
+
+    for (i = 0; i < FRMPOOL_CLASSES; i++) {
+        if (tc->num[i] <= 0) continue;
+
+        head = tail = tc->list[i];
+        while (frmpool_next(tail))
+            tail = frmpool_next(tail);
+
+        frmpool_class_push(&g_frmpool[i], head, tail, tc->num[i]);
+
+        tc->list[i] = NULL;
+        tc->num[i] = 0;
+    }
+}
+
+static void frmpool_tcache_free (void * arg)
+{
+    FrmTCache    * tc = (FrmTCache *)arg;
+    FrmPoolClass * pc = NULL;
+    int            i;
+
+    if (!tc) return;
+
+    frmpool_tcache_flush(tc);
+
+    EnterCriticalSection(&g_frmpool_CS);
+
+    for (i = 0; i < FRMPOOL_CLASSES; i++) {
+        pc = &g_frmpool[i];
+        pc->hit += tc->hit[i];
+        pc->refill += tc->refill[i];
+        pc->miss += tc->miss[i];
+        pc->recycle += tc->recycle[i];
+    }
+
+    if (tc->prev) tc->prev->next = tc->next;
+    else g_frmpool_tclist = tc->next;
+    if (tc->next) tc->next->prev = tc->prev;
+
+    LeaveCriticalSection(&g_frmpool_CS);
+
+    kosfree(tc);
+}
+
+void frmpool_thread_flush ()
+{
+#ifdef UNIX
+    FrmTCache * tc = NULL;
+
+    pthread_once(&g_frmpool_once, frmpool_init);
+
+    tc = pthread_getspecific(g_frmpool_key);
+    if (tc) frmpool_tcache_flush(tc);
+#endif
+}
+
+long frmpool_trim ()
+{
+    FrmPoolClass * pc = NULL;
+    void         * p = NULL;
+    void         * list = NULL;
+    long           num = 0;
+    long           bytes = 0;
+    int            i;
+
+    frmpool_tcache();
+
+    for (i = 0; i < FRMPOOL_CLASSES; i++) {
+        pc = &g_frmpool[i];
+
+        EnterCriticalSection(&pc->lock);
+        list = pc->idlelist;
+        num = pc->idlenum;
+        pc->idlelist = NULL;
+        pc->idlenum = 0;
+        pc->allocated -= num;
+        LeaveCriticalSection(&pc->lock);
+
+        while ((p = list) != NULL) {
+            list = frmpool_next(p);
+            kosfree(p);
+        }
+        bytes += num * pc->unitsize;
+    }
+
+    return bytes;
+}
+
+/* the counters and idle numbers of other threads are read without their
+   owner's consent, the result is a close approximation while running */
+static void frmpool_class_status (int cls, FrmPoolStat * st)
+{
+    FrmPoolClass * pc = &g_frmpool[cls];
+    FrmTCache    * tc = NULL;
+
+    memset(st, 0, sizeof(*st));
+
+    st->unitsize = pc->unitsize;
+
+    EnterCriticalSection(&g_frmpool_CS);
+
+    EnterCriticalSection(&pc->lock);
+    st->allocated = pc->allocated;
+    st->idle = pc->idlenum;
+    st->hit = pc->hit;
+    st->refill = pc->refill;
+    st->miss = pc->miss;
+    st->recycle = pc->recycle;
+    LeaveCriticalSection(&pc->lock);
+
+    for (tc = g_frmpool_tclist; tc; tc = tc->next) {
+        st->idle += tc->num[cls];
+        st->hit += tc->hit[cls];
+        st->refill += tc->refill[cls];
+        st->miss += tc->miss[cls];
+        st->recycle += tc->recycle[cls];
+    }
+
+    LeaveCriticalSection(&g_frmpool_CS);
+}
+
+int frmpool_status (FrmPoolStat * st, int num)
+{
+    int  i;
+
+    if (!st || num <= 0) return 0;
+
+    frmpool_tcache();
+
+    if (num > FRMPOOL_CLASSES) num = FRMPOOL_CLASSES;
+
+    for (i = 0; i < num; i++)
+        frmpool_class_status(i, &st[i]);
+
+    return num;
+}
+
+void frmpool_print (FILE * fp)
+{
+    FrmPoolStat  st[FRMPOOL_CLASSES];
+    int          i, num;
+
+    if (!fp) fp = stdout;
+
+    num = frmpool_status(st, FRMPOOL_CLASSES);
+
+    fprintf(fp, "FramePool: %d classes\n", num);
+    for (i = 0; i < num; i++) {
+        if (st[i].allocated == 0 && st[i].hit + st[i].refill + st[i].miss == 0)
+            continue;
+
+        fprintf(fp, "  Unit %7d: allocated=%ld idle=%ld hit=%llu refill=%llu miss=%llu recycle=%llu\n",
+                st[i].unitsize, st[i].allocated, st[i].idle,
+                (unsigned long long)st[i].hit, (unsigned long long)st[i].refill,
+                (unsigned long long)st[i].miss, (unsigned long long)st[i].recycle);
+    }
+}
+
+static int frmpool_stat_snap (void * pool, PoolSnap * snap)
+{
+    FrmPoolClass * pc = (FrmPoolClass *)pool;
+    FrmPoolStat    st;
+    int            cls;
+
+    if (!pc || !snap) return -1;
+
+    cls = pc - g_frmpool;
+    if (cls < 0 || cls >= FRMPOOL_CLASSES) return -2;
+
+    frmpool_class_status(cls, &st);
+
+    snap->unitsize = st.unitsize;
+    snap->allocated = st.allocated;
+    snap->consumed = st.allocated - st.idle;
+    snap->remaining = st.idle;
+    snap->reserved = st.allocated * st.unitsize;
+    snap->peak = pc->stat.peak;
+    snap->blknum = 1;
+
+    snap->fetchnum = st.hit + st.refill + st.miss;
+    snap->recyclenum = st.recycle;
+    snap->contention = pc->stat.contention;
+
+    return 0;
+}
+
@@ -432,11 +432,15 @@ int ht_num (hashtab_t * ht)
 
 void * ht_get (hashtab_t * ht, void * key)
 {
-    ulong hash = 0;
+    if (!ht || !key) return NULL;
+
+    return ht_get_hash(ht, key, (*ht->hashFunc)(key));
+}
 
+void * ht_get_hash (hashtab_t * ht, void * key, ulong hash)
+{
     if (!ht || !key) return NULL;
 
-    hash = (*ht->hashFunc)(key);
     hash %= ht->len;
 
     switch (ht->ptab[hash].count) {
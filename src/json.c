@@ -32,7 +32,11 @@
 #include "hashtab.h"
 #include "mthread.h"
 #include "strutil.h"
+#include "numconv.h"
+#include "jsontape.h"
+#include "jsonpull.h"
 #include "filecache.h"
+#include "chunk.h"
 #include "patmat.h"
 #include "fileop.h"
 #include "nativefile.h"
@@ -183,7 +187,7 @@
             return -501;                                       \
         }                                                      \
                                                                \
-        *val = func(p, NULL);                                  \
+        func(p, len, val);                                     \
     }                                                          \
     return ret;
 
@@ -301,19 +305,84 @@ int json_item_free (void * vitem)
 }
 
 
+#define JsonLock(obj)   do { if (!(obj)->nolock) EnterCriticalSection(&(obj)->objCS); } while (0)
+#define JsonUnlock(obj) do { if (!(obj)->nolock) LeaveCriticalSection(&(obj)->objCS); } while (0)
+
+static int json_obj_num (JsonObj * obj)
+{
+    if (obj->objtab) return ht_num(obj->objtab);
+    return obj->innum;
+}
+
+static JsonItem * json_obj_item (JsonObj * obj, int ind)
+{
+    if (obj->objtab) return ht_value(obj->objtab, ind);
+
+    if (ind < 0 || ind >= obj->innum) return NULL;
+    return obj->initem[ind];
+}
+
+/* linear search of the inline items, comparing length and first byte
+   before the case-insensitive compare of the whole name */
+static int json_inline_find (JsonObj * obj, void * name, int namelen)
+{
+    JsonItem * item = NULL;
+    uint8      ch = adf_tolower(*(uint8 *)name);
+    int        i;
+
+    for (i = 0; i < obj->innum; i++) {
+        item = obj->initem[i];
+        if (item->namelen != namelen) continue;
+        if (adf_tolower(item->name[0]) != ch) continue;
+        if (str_ncasecmp(item->name, name, namelen) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* move the inline items into a hashtab, keeping their order */
+static int json_obj_promote (JsonObj * obj)
+{
+    ckstr_t  key;
+    int      i;
+
+    obj->objtab = ht_new(200, json_item_cmp_key);
+    if (!obj->objtab) return -1;
+
+    ht_set_hash_func(obj->objtab, ckstr_string_hash);
+
+    for (i = 0; i < obj->innum; i++) {
+        key.p = (char *)obj->initem[i]->name;
+        key.len = obj->initem[i]->namelen;
+        ht_set(obj->objtab, &key, obj->initem[i]);
+        obj->initem[i] = NULL;
+    }
+    obj->innum = 0;
+
+    return 0;
+}
+
 void * json_init (int sptype, int cmtflag, int sibcoex)
+{
+    return json_alloc(sptype, cmtflag, sibcoex, 0);
+}
+
+void * json_alloc (int sptype, int cmtflag, int sibcoex, int flags)
 {
     JsonObj * obj = NULL;
 
     obj = kzalloc(sizeof(*obj));
     if (!obj) return NULL;
 
-    InitializeCriticalSection(&obj->objCS);
+    obj->nolock = (flags & JSON_NOLOCK) ? 1 : 0;
+    if (!obj->nolock)
+        InitializeCriticalSection(&obj->objCS);
 
-    obj->objtab = ht_new(200, json_item_cmp_key);
-    ht_set_hash_func(obj->objtab, ckstr_string_hash);
+    obj->objtab = NULL;
+    obj->innum = 0;
 
-    obj->bytenum = 0;
+    obj->bytenum = -1;
 
     obj->sptype = (sptype == 0 ? 0 : 1);
     obj->cmtflag = cmtflag;
@@ -364,17 +433,74 @@ void * json_init (int sptype, int cmtflag, int sibcoex)
 int json_clean (void * vobj)
 {
     JsonObj * obj = (JsonObj *)vobj;
+    int       i;
 
     if (!obj) return -1;
 
-    DeleteCriticalSection(&obj->objCS);
+    if (!obj->nolock)
+        DeleteCriticalSection(&obj->objCS);
 
-    ht_free_all(obj->objtab, json_item_free);
+    if (obj->objtab) {
+        ht_free_all(obj->objtab, json_item_free);
+    } else {
+        for (i = 0; i < obj->innum; i++)
+            json_item_free(obj->initem[i]);
+    }
 
     kfree(obj);
     return 0;
 }
 
+/* bytes json_encode writes for the object itself, not counting the contents
+   of sub-objects. kept in bytenum until the object is changed */
+static int json_self_size (JsonObj * obj)
+{
+    JsonItem  * item = NULL;
+    JsonValue * jval = NULL;
+    int         size = 0;
+    int         i, j, num;
+
+    if (obj->bytenum >= 0) return obj->bytenum;
+
+    size = 2;  //{}
+
+    num = json_obj_num(obj);
+
+    for (i = 0; i < num; i++) {
+
+        item = json_obj_item(obj, i);
+        if (!item || !item->name || item->namelen <= 0) continue;
+        if (item->valnum <= 0) continue;
+
+        if (size > 2) size += 2;  //item separator and space
+
+        size += item->namelen + 3;  //quoted name and kvsep
+
+        if (item->arrflag == 1 || (item->arrflag == 2 && item->valnum > 1))
+            size += 2;
+
+        for (j = 0; j < item->valnum; j++) {
+            if (j > 0) size += 2;
+
+            if (item->valnum == 1)
+                jval = (JsonValue *)item->valobj;
+            else
+                jval = arr_value((arr_t *)item->valobj, j);
+
+            if (!jval || jval->valtype != 0) continue;
+
+            size += 2;
+            if (jval->value && jval->valuelen > 0)
+                size += json_escape(jval->value, jval->valuelen, NULL, 0);
+        }
+    }
+
+    obj->bytenum = size;
+
+    return size;
+}
+
+/* exact bytes of the output of json_encode */
 int json_size (void * vobj)
 {
     JsonObj   * obj = (JsonObj *)vobj;
@@ -387,14 +513,15 @@ int json_size (void * vobj)
 
     if (!obj) return 0;
 
-    size = obj->bytenum;
+    size = json_self_size(obj);
 
-    num = ht_num(obj->objtab);
+    num = json_obj_num(obj);
 
     for (i = 0; i < num; i++) {
 
-        item = (JsonItem *)ht_value(obj->objtab, i);
-        if (!item || item->valnum <= 0) continue;
+        item = json_obj_item(obj, i);
+        if (!item || !item->name || item->namelen <= 0) continue;
+        if (item->valnum <= 0) continue;
 
         if (item->valnum == 1) {
 
@@ -443,7 +570,7 @@ int json_num (void * vobj)
 
     if (!obj) return 0;
 
-    return ht_num(obj->objtab);
+    return json_obj_num(obj);
 }
 
 void * json_item_get (void * vobj, void * name, int namelen)
@@ -451,6 +578,7 @@ void * json_item_get (void * vobj, void * name, int namelen)
     JsonObj    * obj = (JsonObj *)vobj;
     JsonItem   * item = NULL;
     ckstr_t      key;
+    int          i;
 
     if (!obj) return NULL;
 
@@ -458,12 +586,15 @@ void * json_item_get (void * vobj, void * name, int namelen)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return NULL;
 
-    key.p = name;
-    key.len = namelen;
-
-    EnterCriticalSection(&obj->objCS);
-    item = ht_get(obj->objtab, &key);
-    LeaveCriticalSection(&obj->objCS);
+    JsonLock(obj);
+    if (obj->objtab) {
+        key.p = name;
+        key.len = namelen;
+        item = ht_get(obj->objtab, &key);
+    } else if ((i = json_inline_find(obj, name, namelen)) >= 0) {
+        item = obj->initem[i];
+    }
+    JsonUnlock(obj);
 
     return item;
 }
@@ -479,12 +610,33 @@ int json_item_add (void * vobj, void * name, int namelen, void * vitem)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return -3;
  
+    JsonLock(obj);
+
+    if (!obj->objtab) {
+        if (json_inline_find(obj, name, namelen) >= 0) {
+            JsonUnlock(obj);
+            return 0;
+        }
+
+        if (obj->innum < JSON_INLINE_ITEMS) {
+            obj->initem[obj->innum++] = item;
+            obj->bytenum = -1;
+            JsonUnlock(obj);
+            return 0;
+        }
+
+        if (json_obj_promote(obj) < 0) {
+            JsonUnlock(obj);
+            return -100;
+        }
+    }
+
     key.p = name;
     key.len = namelen;
  
-    EnterCriticalSection(&obj->objCS);
     ht_set(obj->objtab, &key, item);
-    LeaveCriticalSection(&obj->objCS);
+    obj->bytenum = -1;
+    JsonUnlock(obj);
  
     return 0;
 }
@@ -494,6 +646,7 @@ void * json_item_del (void * vobj, void * name, int namelen)
     JsonObj    * obj = (JsonObj *)vobj;
     JsonItem   * item = NULL;
     ckstr_t      key;
+    int          i;
  
     if (!obj) return NULL;
  
@@ -501,17 +654,34 @@ void * json_item_del (void * vobj, void * name, int namelen)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return NULL;
  
-    key.p = name;
-    key.len = namelen;
- 
-    EnterCriticalSection(&obj->objCS);
-    item = ht_delete(obj->objtab, &key);
-    LeaveCriticalSection(&obj->objCS);
+    JsonLock(obj);
+    if (obj->objtab) {
+        key.p = name;
+        key.len = namelen;
+        item = ht_delete(obj->objtab, &key);
+    } else if ((i = json_inline_find(obj, name, namelen)) >= 0) {
+        item = obj->initem[i];
+        obj->innum--;
+        if (i < obj->innum)
+            memmove(&obj->initem[i], &obj->initem[i+1], (obj->innum - i) * sizeof(JsonItem *));
+        obj->initem[obj->innum] = NULL;
+    }
+    obj->bytenum = -1;
+    JsonUnlock(obj);
  
     return item;
 }
 
 
+void * json_item_at (void * vobj, int ind)
+{
+    JsonObj * obj = (JsonObj *)vobj;
+
+    if (!obj) return NULL;
+
+    return json_obj_item(obj, ind);
+}
+
 int json_iter (void * vobj, int ind, int valind, void ** pkey, int * keylen,
                void ** pval, int * vallen, void ** pobj)
 {
@@ -528,11 +698,11 @@ int json_iter (void * vobj, int ind, int valind, void ** pkey, int * keylen,
 
     if (!obj) return -1;
 
-    num = ht_num(obj->objtab);
+    num = json_obj_num(obj);
 
     if (ind < 0 || ind >= num) return -100;
 
-    item = ht_value(obj->objtab, ind);
+    item = json_obj_item(obj, ind);
     if (!item) return -200;
 
     if (pkey) *pkey = item->name;
@@ -623,6 +793,7 @@ int json_mdel (void * vobj, void * key, int keylen)
             if (index >= 0 && index < item->valnum && item->valnum > 1) {
                 jval = arr_delete((arr_t *)item->valobj, index);
                 json_value_free(jval);
+                subobj->bytenum = -1;
                 return 1;
             }
 
@@ -877,7 +1048,7 @@ int json_mget_uint64 (void * vobj, void * key, int keylen, uint64 * val)
  
 int json_mget_double (void * vobj, void * key, int keylen, double * val)
 {
-    objgetd(vobj, key, keylen, val, 1, 0, strtod);
+    objgetd(vobj, key, keylen, val, 1, 0, num_atod);
 }
 
 
@@ -1079,7 +1250,519 @@ int json_get_uint64 (void * vobj, void * key, int keylen, int index, uint64 * va
  
 int json_get_double (void * vobj, void * key, int keylen, int index, double * val)
 {
-    objgetd(vobj, key, keylen, val, 0, index, strtod);
+    objgetd(vobj, key, keylen, val, 0, index, num_atod);
+}
+
+
+static JsonValue * json_path_seg_value (JsonObj * obj, JsonPathSeg * seg, int * perr)
+{
+    JsonItem  * item = NULL;
+    JsonValue * jval = NULL;
+    ckstr_t     key;
+    int         index = 0;
+
+    if (!obj) { *perr = -1; return NULL; }
+
+    JsonLock(obj);
+    if (obj->objtab) {
+        key.p = (char *)seg->name;
+        key.len = seg->namelen;
+        item = ht_get_hash(obj->objtab, &key, seg->hash);
+    } else if ((index = json_inline_find(obj, seg->name, seg->namelen)) >= 0) {
+        item = obj->initem[index];
+    }
+    JsonUnlock(obj);
+
+    if (!item || item->valnum <= 0) {
+        *perr = -100;
+        return NULL;
+    }
+
+    index = seg->index;
+    if (index < 0) index = item->valnum - 1;
+    if (index >= item->valnum || index < 0) {
+        *perr = -200;
+        return NULL;
+    }
+
+    if (index == 0 && item->valnum == 1) {
+        jval = (JsonValue *)item->valobj;
+
+    } else if (item->valnum > 1) {
+        jval = arr_value((arr_t *)item->valobj, index);
+    }
+
+    if (!jval) *perr = -300;
+
+    return jval;
+}
+
+void * json_path_compile (void * path, int pathlen)
+{
+    JsonPath  * jp = NULL;
+    uint8     * text = NULL;
+    char      * plist[32];
+    int         plen[32];
+    void      * sublist[3];
+    int         sublen[3];
+    char      * name = NULL;
+    int         i, num, keylen;
+
+    if (!path) return NULL;
+    if (pathlen < 0) pathlen = str_len(path);
+    if (pathlen <= 0) return NULL;
+
+    num = string_tokenize(path, pathlen, ".", 1, (void **)plist, plen, 32);
+    if (num <= 0) return NULL;
+
+    /* segments and the copy of path text in one block */
+    jp = kzalloc(sizeof(*jp) + (num - 1) * sizeof(JsonPathSeg) + pathlen + 1);
+    if (!jp) return NULL;
+
+    text = (uint8 *)&jp->seg[num];
+    memcpy(text, path, pathlen);
+
+    num = string_tokenize(text, pathlen, ".", 1, (void **)plist, plen, num);
+
+    for (i = 0; i < num; i++) {
+        name = plist[i]; keylen = plen[i];
+
+        if (keylen >= 2 && (name[0] == '"' || name[0] == '\'') && name[keylen - 1] == name[0]) {
+            name++; keylen -= 2;
+        }
+
+        if (string_tokenize(name, keylen, "[]", 2, sublist, sublen, 3) > 1)
+            str_atoi(sublist[1], sublen[1], &jp->seg[i].index);
+
+        jp->seg[i].name = sublist[0];
+        jp->seg[i].namelen = sublen[0];
+        jp->seg[i].hash = string_hash(sublist[0], sublen[0], 0);
+    }
+    jp->segnum = num;
+
+    return jp;
+}
+
+void json_path_free (void * vpath)
+{
+    if (vpath) kfree(vpath);
+}
+
+int json_path_get_value (void * vobj, void * vpath, void ** pval, int * vallen, void ** pobj)
+{
+    JsonObj   * obj = (JsonObj *)vobj;
+    JsonPath  * path = (JsonPath *)vpath;
+    JsonValue * jval = NULL;
+    int         i, err = 0;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+    if (pobj) *pobj = NULL;
+
+    if (!obj) return -1;
+    if (!path || path->segnum <= 0) return -2;
+
+    for (i = 0; i < path->segnum && obj; i++) {
+        jval = json_path_seg_value(obj, &path->seg[i], &err);
+        if (!jval) return err;
+
+        if (jval->valtype == 0) break;
+
+        obj = jval->jsonobj;
+    }
+
+    if (!jval) return -400;
+
+    if (jval->valtype == 0) { //generic string
+        if (pval) *pval = jval->value;
+        if (vallen) *vallen = jval->valuelen;
+    } else { //object
+        if (pobj) *pobj = jval->jsonobj;
+    }
+
+    return 1;
+}
+
+
+typedef struct json_xfield {
+    JsonPath         * path;
+    int                type;
+    int                offset;
+    int                size;
+    int                share;   //leading segments same as the field before
+} JsonXField;
+
+typedef struct json_extract {
+    int                num;
+    JsonXField         fld[1];
+} JsonExtract;
+
+static int json_path_seg_cmp (JsonPathSeg * a, JsonPathSeg * b)
+{
+    int  ret = 0;
+
+    ret = str_ncasecmp(a->name, b->name, min(a->namelen, b->namelen));
+    if (ret == 0) ret = a->namelen - b->namelen;
+    if (ret == 0) ret = a->index - b->index;
+
+    return ret;
+}
+
+static int json_xfield_cmp (const void * a, const void * b)
+{
+    JsonPath  * pa = ((JsonXField *)a)->path;
+    JsonPath  * pb = ((JsonXField *)b)->path;
+    int         i, ret;
+
+    for (i = 0; i < pa->segnum && i < pb->segnum; i++) {
+        ret = json_path_seg_cmp(&pa->seg[i], &pb->seg[i]);
+        if (ret != 0) return ret;
+    }
+
+    return pa->segnum - pb->segnum;
+}
+
+void * json_extract_compile (JsonField * fld, int num)
+{
+    JsonExtract * ext = NULL;
+    JsonXField  * xf = NULL;
+    JsonPath    * prev = NULL;
+    int           i, j;
+
+    if (!fld || num <= 0 || num > JSON_EXTRACT_MAX) return NULL;
+
+    ext = kzalloc(sizeof(*ext) + (num - 1) * sizeof(JsonXField));
+    if (!ext) return NULL;
+
+    for (i = 0; i < num; i++) {
+        xf = &ext->fld[i];
+
+        xf->path = json_path_compile(fld[i].path, -1);
+        if (!xf->path) {
+            ext->num = i;
+            json_extract_free(ext);
+            return NULL;
+        }
+
+        xf->type = fld[i].type;
+        xf->offset = fld[i].offset;
+        xf->size = fld[i].size;
+    }
+    ext->num = num;
+
+    /* sorted paths put common prefixes next to each other */
+    qsort(ext->fld, num, sizeof(JsonXField), json_xfield_cmp);
+
+    for (i = 1, prev = ext->fld[0].path; i < num; i++) {
+        xf = &ext->fld[i];
+
+        for (j = 0; j < prev->segnum && j < xf->path->segnum; j++) {
+            if (json_path_seg_cmp(&prev->seg[j], &xf->path->seg[j]) != 0)
+                break;
+        }
+        xf->share = j;
+        prev = xf->path;
+    }
+
+    return ext;
+}
+
+void json_extract_free (void * vext)
+{
+    JsonExtract * ext = (JsonExtract *)vext;
+    int           i;
+
+    if (!ext) return;
+
+    for (i = 0; i < ext->num; i++)
+        json_path_free(ext->fld[i].path);
+
+    kfree(ext);
+}
+
+static void json_field_store (JsonXField * xf, void * dst, uint8 * p, int len, void * subobj, int esc)
+{
+    uint8     * pmem = (uint8 *)dst + xf->offset;
+    ckstr_t   * ck = NULL;
+    int64       ival = 0;
+    uint64      uval = 0;
+    double      dval = 0;
+    int         ret = 0;
+
+    switch (xf->type) {
+    case JSON_FIELD_OBJ:
+        *(void **)pmem = subobj;
+        return;
+
+    case JSON_FIELD_PTR:
+        ck = (ckstr_t *)pmem;
+        ck->p = (char *)p;
+        ck->len = len;
+        return;
+
+    case JSON_FIELD_STR:
+        if (xf->size <= 0) return;
+
+        if (esc) {
+            json_unescape(p, len, pmem, xf->size);
+        } else {
+            ret = min(len, xf->size - 1);
+            if (ret > 0 && p) memcpy(pmem, p, ret);
+            pmem[ret] = '\0';
+        }
+        return;
+    }
+
+    while (len > 0 && ISSPACE(*p)) {
+        p++; len--;
+    }
+
+    switch (xf->type) {
+    case JSON_FIELD_INT:
+    case JSON_FIELD_INT64:
+        ret = str_atoll(p, len, &ival);
+        if (ret < len && (p[ret] == '.' || p[ret] == 'e' || p[ret] == 'E')) {
+            num_atod(p, len, &dval);
+            ival = (int64)dval;
+        }
+
+        if (xf->type == JSON_FIELD_INT) *(int *)pmem = (int)ival;
+        else *(int64 *)pmem = ival;
+        break;
+
+    case JSON_FIELD_UINT64:
+        if (len > 0 && *p == '+') { p++; len--; }
+
+        ret = str_atoull(p, len, &uval);
+        if (ret < len && (p[ret] == '.' || p[ret] == 'e' || p[ret] == 'E')) {
+            num_atod(p, len, &dval);
+            uval = (uint64)dval;
+        }
+
+        *(uint64 *)pmem = uval;
+        break;
+
+    case JSON_FIELD_DOUBLE:
+        num_atod(p, len, &dval);
+        *(double *)pmem = dval;
+        break;
+
+    case JSON_FIELD_BOOL:
+        if ((len == 2 && str_ncasecmp(p, "on", 2) == 0) ||
+            (len == 3 && str_ncasecmp(p, "yes", 3) == 0) ||
+            (len == 4 && str_ncasecmp(p, "true", 4) == 0))
+            *pmem = 1;
+        else
+            *pmem = (num_atod(p, len, &dval) > 0 && dval != 0) ? 1 : 0;
+        break;
+    }
+}
+
+int json_extract (void * vext, void * vobj, void * dst)
+{
+    JsonExtract * ext = (JsonExtract *)vext;
+    JsonXField  * xf = NULL;
+    JsonPath    * path = NULL;
+    JsonValue   * jval = NULL;
+    JsonObj     * objs[32];
+    int           i, j, err = 0;
+    int           valid = 1;
+    int           found = 0;
+
+    if (!ext || !vobj || !dst) return -1;
+
+    objs[0] = (JsonObj *)vobj;
+
+    for (i = 0; i < ext->num; i++) {
+        xf = &ext->fld[i];
+        path = xf->path;
+
+        /* objs[0 .. valid-1] were reached by the previous path, restart
+           from the deepest one on the prefix shared with it */
+        j = min(xf->share, valid - 1);
+        if (j > path->segnum - 1) j = path->segnum - 1;
+
+        for ( ; j < path->segnum; j++) {
+            jval = json_path_seg_value(objs[j], &path->seg[j], &err);
+            if (!jval) break;
+
+            if (j == path->segnum - 1) {
+                if (jval->valtype == 0 && xf->type != JSON_FIELD_OBJ) {
+                    /* json_decode keeps the escapes, unescape as json_extract_text does */
+                    json_field_store(xf, dst, jval->value, jval->valuelen, NULL, 1);
+                    found++;
+                } else if (jval->valtype != 0 && xf->type == JSON_FIELD_OBJ) {
+                    json_field_store(xf, dst, NULL, 0, jval->jsonobj, 0);
+                    found++;
+                }
+                break;
+            }
+
+            if (jval->valtype == 0 || !jval->jsonobj) break;
+
+            objs[j + 1] = jval->jsonobj;
+        }
+        valid = j + 1;
+    }
+
+    return found;
+}
+
+
+#define JSON_XMATCH_KEY    0   //member name equals the segment
+#define JSON_XMATCH_ELEM   1   //segment index picks the array element
+#define JSON_XMATCH_FIRST  2   //segment index picks a non-array value
+#define JSON_XMATCH_LEAF   3   //path ends at the segment
+#define JSON_XMATCH_INNER  4   //path goes deeper than the segment
+
+static uint64 json_xfield_match (JsonExtract * ext, uint64 mask, int lvl, int how,
+                                 void * key, int keylen, int elem)
+{
+    JsonPathSeg * seg = NULL;
+    uint64        ret = 0;
+    ulong         hash = 0;
+    int           i, ok = 0;
+
+    if (how == JSON_XMATCH_KEY) hash = string_hash(key, keylen, 0);
+
+    for (i = 0; i < ext->num && mask >> i; i++) {
+        if (((mask >> i) & 1) == 0) continue;
+
+        seg = &ext->fld[i].path->seg[lvl];
+
+        switch (how) {
+        case JSON_XMATCH_KEY:
+            ok = seg->hash == hash && seg->namelen == keylen &&
+                 str_ncasecmp(seg->name, key, keylen) == 0;
+            break;
+        case JSON_XMATCH_ELEM:
+            ok = seg->index == elem || seg->index == -1;
+            break;
+        case JSON_XMATCH_FIRST:
+            ok = seg->index == 0 || seg->index == -1;
+            break;
+        case JSON_XMATCH_LEAF:
+            ok = ext->fld[i].path->segnum == lvl + 1;
+            break;
+        default:
+            ok = ext->fld[i].path->segnum > lvl + 1;
+            break;
+        }
+
+        if (ok) ret |= (uint64)1 << i;
+    }
+
+    return ret;
+}
+
+#define JSON_XFRAME_NUM  72   //nested deeper than 2 frames per segment never matches
+
+typedef struct json_xframe {
+    uint64             mask;    //fields whose segments so far lead here
+    int                lvl;     //segment matched by members or elements
+    int                elem;    //index of next array element
+    uint8              arr;
+} JsonXFrame;
+
+int json_extract_text (void * vext, void * json, int length, void * dst)
+{
+    JsonExtract * ext = (JsonExtract *)vext;
+    JsonXFrame    stk[JSON_XFRAME_NUM];
+    JsonXFrame  * top = NULL;
+    JsonPull      pull;
+    uint64        keymask = 0;
+    uint64        found = 0;
+    uint64        m = 0;
+    void        * val = NULL;
+    int           vallen = 0;
+    int           depth = 0;
+    int           ev = 0, lvl = 0, i;
+
+    if (!ext || !json || !dst) return -1;
+    if (length < 0) length = str_len(json);
+
+    json_pull_init(&pull, 0);
+    json_pull_feed(&pull, json, length);
+    json_pull_finish(&pull);
+
+    while ((ev = json_pull_next(&pull, &val, &vallen)) > 0) {
+        if (ev == JSON_PULL_DOC_END || ev == JSON_PULL_END) break;
+
+        if (ev == JSON_PULL_OBJ_END || ev == JSON_PULL_ARR_END) {
+            depth--;
+            continue;
+        }
+
+        top = (depth > 0 && depth <= JSON_XFRAME_NUM) ? &stk[depth - 1] : NULL;
+
+        if (ev == JSON_PULL_KEY) {
+            keymask = 0;
+            if (top && top->mask && !top->arr)
+                keymask = json_xfield_match(ext, top->mask, top->lvl, JSON_XMATCH_KEY, val, vallen, 0);
+            continue;
+        }
+
+        /* a value, m is the set of fields matched up to segment lvl */
+        m = 0; lvl = 0;
+        if (depth == 0) {
+            if (ev == JSON_PULL_OBJ_BEGIN)
+                m = ext->num >= 64 ? ~(uint64)0 : ((uint64)1 << ext->num) - 1;
+
+        } else if (top && top->mask) {
+            lvl = top->lvl;
+
+            if (top->arr)
+                m = json_xfield_match(ext, top->mask, lvl, JSON_XMATCH_ELEM, NULL, 0, top->elem);
+            else if (ev != JSON_PULL_ARR_BEGIN)
+                m = json_xfield_match(ext, keymask, lvl, JSON_XMATCH_FIRST, NULL, 0, 0);
+            else
+                m = keymask;
+        }
+        if (top && top->arr) top->elem++;
+
+        if (ev == JSON_PULL_OBJ_BEGIN || ev == JSON_PULL_ARR_BEGIN) {
+            if (depth < JSON_XFRAME_NUM) {
+                top = &stk[depth];
+                memset(top, 0, sizeof(*top));
+
+                if (ev == JSON_PULL_ARR_BEGIN) {
+                    /* arrays nested in arrays are not addressable by path */
+                    top->arr = 1;
+                    top->lvl = lvl;
+                    if (depth > 0 && !stk[depth - 1].arr) top->mask = m;
+
+                } else if (depth == 0) {
+                    top->mask = m;
+
+                } else if (m) {
+                    top->lvl = lvl + 1;
+                    top->mask = json_xfield_match(ext, m, lvl, JSON_XMATCH_INNER, NULL, 0, 0);
+                }
+            }
+            depth++;
+            continue;
+        }
+
+        if (depth == 0 || !m) continue;
+
+        m = json_xfield_match(ext, m, lvl, JSON_XMATCH_LEAF, NULL, 0, 0);
+
+        for (i = 0; i < ext->num && m >> i; i++) {
+            if (((m >> i) & 1) == 0 || ext->fld[i].type == JSON_FIELD_OBJ) continue;
+
+            json_field_store(&ext->fld[i], dst, val, vallen, NULL,
+                             ev == JSON_PULL_STR ? pull.esc : 0);
+            found |= (uint64)1 << i;
+        }
+    }
+
+    json_pull_clean(&pull);
+
+    if (ev < 0) return ev;
+
+    for (i = 0; found; found &= found - 1) i++;
+
+    return i;
 }
 
  
@@ -1117,8 +1800,6 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
             item->namelen = keylen;
         }
         json_item_add(obj, key, keylen, item);
-
-        obj->bytenum += keylen + 3;
     }
     item->arrflag = isarr;
 
@@ -1127,7 +1808,7 @@ int json_add (void * vobj, void * key, int keylen, void * val, int vallen, uint8
     jval->value = strip ? json_strip_dup(val, vallen) : str_dup(val, vallen);
     jval->valuelen = jval->value ? str_len(jval->value) : 0;
 
-    obj->bytenum += vallen + 3;
+    obj->bytenum = -1;
 
     if (item->arrflag) {
         if (item->valnum == 0) {
@@ -1199,8 +1880,6 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
         }
 
         json_item_add(obj, key, keylen, item);
- 
-        obj->bytenum += keylen + 3;
     }
  
     if (item->valnum < 1) {
@@ -1209,7 +1888,7 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
         jval->value = strip ? json_strip_dup(val, vallen) : str_dup(val, vallen);
         jval->valuelen = jval->value ? str_len(jval->value) : 0;
 
-        obj->bytenum += vallen + 3;
+        obj->bytenum = -1;
 
         item->valobj = jval;
         item->valnum = 1;
@@ -1218,7 +1897,7 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
         jval = item->valobj;
         if (!jval) jval = item->valobj = json_value_alloc();
 
-        obj->bytenum += vallen + 3;
+        obj->bytenum = -1;
         jval->value = krealloc(jval->value, jval->valuelen + vallen + 1);
 
         if (jval->value) {
@@ -1240,7 +1919,7 @@ int json_append (void * vobj, void * key, int keylen, void * val, int vallen, ui
             jval = arr_value(vallist, i);
             if (!jval) continue;
 
-            obj->bytenum += vallen + 3;
+            obj->bytenum = -1;
             jval->value = krealloc(jval->value, jval->valuelen + vallen + 1);
 
             if (jval->value) {
@@ -1293,8 +1972,6 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
         item->name = str_dup(key, keylen);
         item->namelen = keylen;
         json_item_add(obj, key, keylen, item);
- 
-        obj->bytenum += keylen+3;
     }
  
     if (item->valnum < 1) {
@@ -1308,7 +1985,7 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
         jval->valuelen = json_strip(jval->value, length, jval->value, length);
         jval->value[jval->valuelen] = '\0';
 
-        obj->bytenum += length+3;
+        obj->bytenum = -1;
  
         item->valobj = jval;
         item->valnum = 1;
@@ -1317,7 +1994,7 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
         jval = item->valobj;
         if (!jval) jval = item->valobj = json_value_alloc();
  
-        obj->bytenum += length+3;
+        obj->bytenum = -1;
         jval->value = krealloc(jval->value, jval->valuelen + length + 1);
  
         if (jval->value) {
@@ -1339,7 +2016,7 @@ int json_append_file (void * vobj, void * key, int keylen, char * fname, long st
             jval = arr_value(vallist, i);
             if (!jval) continue;
  
-            obj->bytenum += length+3;
+            obj->bytenum = -1;
             jval->value = krealloc(jval->value, jval->valuelen + length + 1);
  
             if (jval->value) {
@@ -1393,6 +2070,7 @@ int json_add_by_fca (void * vobj, void * fca, long keypos, int keylen, long valp
     }
 
     item->arrflag = isarr;
+    obj->bytenum = -1;
  
     jval = json_value_alloc();
 
@@ -1457,10 +2135,12 @@ void * json_add_obj (void * vobj, void * key, int keylen, uint8 isarr)
         json_item_add(obj, key, keylen, item);
     }
     item->arrflag = isarr;
+    obj->bytenum = -1;
 
     jval = json_value_alloc();
     jval->valtype = 1;
-    jval->jsonobj = json_init(obj->sptype, obj->cmtflag, obj->sibcoex);
+    jval->jsonobj = json_alloc(obj->sptype, obj->cmtflag, obj->sibcoex,
+                               obj->nolock ? JSON_NOLOCK : 0);
 
     if (item->arrflag) {
         if (item->valnum == 0) {
@@ -1517,10 +2197,12 @@ void * json_add_obj_by_fca (void * vobj, void * fca, long keypos, int keylen, ui
         kfree(key);
     }
     item->arrflag = isarr;
+    obj->bytenum = -1;
  
     jval = json_value_alloc();
     jval->valtype = 1;
-    jval->jsonobj = json_init(obj->sptype, obj->cmtflag, obj->sibcoex);
+    jval->jsonobj = json_alloc(obj->sptype, obj->cmtflag, obj->sibcoex,
+                               obj->nolock ? JSON_NOLOCK : 0);
  
     if (item->arrflag) {
         if (item->valnum == 0) item->valobj = jval;
@@ -1557,7 +2239,7 @@ int json_add_int8 (void * vobj, void * key, int keylen, int8 val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-    sprintf(buf, "%d", val);
+    num_i64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
  
@@ -1572,7 +2254,7 @@ int json_add_uint8 (void * vobj, void * key, int keylen, uint8 val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-    sprintf(buf, "%u", val);
+    num_u64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
  
@@ -1588,7 +2270,7 @@ int json_add_int16 (void * vobj, void * key, int keylen, int16 val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
      
-    sprintf(buf, "%d", val);
+    num_i64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }    
 
@@ -1603,7 +2285,7 @@ int json_add_uint16 (void * vobj, void * key, int keylen, uint16 val, uint8 isar
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-    sprintf(buf, "%u", val);
+    num_u64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
  
@@ -1619,7 +2301,7 @@ int json_add_int (void * vobj, void * key, int keylen, int val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
 
-    sprintf(buf, "%d", val);
+    num_i64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1634,7 +2316,7 @@ int json_add_uint32 (void * vobj, void * key, int keylen, uint32 val, uint8 isar
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3; 
  
-    sprintf(buf, "%u", val); 
+    num_u64toa(val, buf); 
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1649,7 +2331,7 @@ int json_add_long (void * vobj, void * key, int keylen, long val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3; 
  
-    sprintf(buf, "%ld", val); 
+    num_i64toa(val, buf); 
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1664,7 +2346,7 @@ int json_add_ulong (void * vobj, void * key, int keylen, ulong val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-    sprintf(buf, "%lu", val);
+    num_u64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1679,11 +2361,7 @@ int json_add_int64 (void * vobj, void * key, int keylen, int64 val, uint8 isarr)
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-#if defined(_WIN32) || defined(_WIN64)
-    sprintf(buf, "%I64d", val);
-#else
-    sprintf(buf, "%lld", val);
-#endif
+    num_i64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1698,11 +2376,7 @@ int json_add_uint64 (void * vobj, void * key, int keylen, uint64 val, uint8 isar
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-#if defined(_WIN32) || defined(_WIN64)
-    sprintf(buf, "%I64u", val);
-#else
-    sprintf(buf, "%llu", val);
-#endif
+    num_u64toa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1717,7 +2391,7 @@ int json_add_double (void * vobj, void * key, int keylen, double val, uint8 isar
     if (keylen < 0) keylen = str_len(key);
     if (keylen <= 0) return -3;
  
-    sprintf(buf, "%f", val);
+    num_dtoa(val, buf);
     return json_add(obj, key, keylen, buf, -1, isarr, 0);
 }
 
@@ -1791,7 +2465,7 @@ uint8 * find_closed_tag (uint8 * pbgn, uint8 * pend, char * tagname)
     return pkvend + taglen + 3;
 }
 
-int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int strip)
+static int json_decode_text (void * vobj, void * vjson, int length, int findobjbgn, int strip)
 {
     JsonObj  * obj = (JsonObj *)vobj;
     uint8    * pjson = (uint8 *)vjson;
@@ -2008,7 +2682,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
                 else
                     subobj = json_add_obj(obj, name, namelen, 0);
 
-                pbgn = poct + json_decode(subobj, poct, pend-poct, 1, strip);
+                pbgn = poct + json_decode_text(subobj, poct, pend-poct, 1, strip);
 
             } else if (*poct == '[') { //array
                 poct++;
@@ -2022,7 +2696,7 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
 
                     if (*pbgn == '{') {
                         subobj = json_add_obj(obj, name, namelen, 1);
-                        poct = pbgn + json_decode(subobj, pbgn, pend-pbgn, 1, strip);
+                        poct = pbgn + json_decode_text(subobj, pbgn, pend-pbgn, 1, strip);
 
                     } else {
                         pkvend = skipQuoteTo(pbgn, pend-pbgn, obj->arrend, obj->arrendlen);
@@ -2119,6 +2793,112 @@ int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int stri
 
     return pbgn-pjson;
 }
+
+/* build the members of the object token 'ind' into obj, issuing the same
+   json_add/json_add_obj calls as json_decode_text does for the same text */
+static void json_decode_tape (JsonObj * obj, JsonTape * tape, int ind, int strip)
+{
+    JsonTok  * tok = tape->tok;
+    JsonObj  * subobj = NULL;
+    uint8    * name = NULL;
+    uint8    * value = NULL;
+    uint8    * poct = NULL;
+    int        namelen = 0;
+    int        valuelen = 0;
+    int        i, j;
+
+    for (i = ind + 1; i < (int)tok[ind].next; i = tok[i].next) {
+        name = tape->json + tok[i].pos;
+        namelen = tok[i].len;
+        i++;
+
+        if (tok[i].type == JSON_TOK_OBJ) {
+            if ((namelen == 6 && str_ncasecmp(name, "script", 6) == 0) ||
+                (namelen == 12 && str_ncasecmp(name, "reply_script", 12) == 0) ||
+                (namelen == 18 && str_ncasecmp(name, "cache_check_script", 18) == 0))
+            {
+                /* script codes between the braces are kept as a constant */
+                value = tape->json + tok[i].pos;
+                poct = value + tok[i].len - 1;
+
+                value = skipOver(value+1, poct-value-1, " \t\r\n\f\v", 6);
+                poct = rskipOver(poct-1, poct-value, " \t\r\n\f\v", 6);
+                valuelen = poct + 1 - value;
+
+                if (valuelen > 0)
+                    json_add(obj, name, namelen, value, valuelen, 1, strip);
+                continue;
+            }
+
+            subobj = json_add_obj(obj, name, namelen, obj->sibcoex ? 2 : 0);
+            if (subobj) json_decode_tape(subobj, tape, i, strip);
+
+        } else if (tok[i].type == JSON_TOK_ARR) {
+            for (j = i + 1; j < (int)tok[i].next; j = tok[j].next) {
+                if (tok[j].type == JSON_TOK_OBJ) {
+                    subobj = json_add_obj(obj, name, namelen, 1);
+                    if (subobj) json_decode_tape(subobj, tape, j, strip);
+                } else {
+                    json_add(obj, name, namelen, tape->json + tok[j].pos, tok[j].len, 1, strip);
+                }
+            }
+
+        } else {
+            json_add(obj, name, namelen, tape->json + tok[i].pos, tok[i].len,
+                     obj->sibcoex ? 2 : 0, strip);
+        }
+    }
+}
+
+void * json_tape_obj (JsonTape * tape, int ind)
+{
+    JsonObj  * obj = NULL;
+
+    if (!tape || !tape->tok || ind < 0 || ind >= tape->num) return NULL;
+    if (tape->tok[ind].type != JSON_TOK_OBJ) return NULL;
+
+    obj = json_init(0, 0, 0);
+    if (!obj) return NULL;
+
+    json_decode_tape(obj, tape, ind, 0);
+    return obj;
+}
+
+int json_decode (void * vobj, void * vjson, int length, int findobjbgn, int strip)
+{
+    JsonObj  * obj = (JsonObj *)vobj;
+    uint8    * pjson = (uint8 *)vjson;
+    JsonTape   tape;
+    int        skip = 0;
+    int        ret = 0;
+
+    if (!obj) return 0;
+    if (!pjson) return 0;
+    if (length < 0) length = str_len(pjson);
+    if (length <= 0) return 0;
+
+    /* standard JSON goes through the structural index and one linear pass.
+       text the strict grammar rejects, such as conf-style separators, comments,
+       unquoted keys or trailing commas, is left to the tolerant scanner */
+    if (findobjbgn && obj->sptype == 0 && !obj->cmtflag) {
+        skip = (uint8 *)skipOver(pjson, length, " \t\r\n\f\v", 6) - pjson;
+
+        if (skip < length && pjson[skip] == '{') {
+            json_tape_init(&tape);
+
+            ret = json_tape_parse(&tape, pjson + skip, length - skip);
+            if (ret > 0 && !(tape.flags & (JSON_TAPE_EMPTYKEY | JSON_TAPE_NESTARR))) {
+                json_decode_tape(obj, &tape, 0, strip);
+                json_tape_clean(&tape);
+                return skip + ret;
+            }
+
+            json_tape_clean(&tape);
+        }
+    }
+
+    return json_decode_text(obj, pjson, length, findobjbgn, strip);
+}
  
 int json_decode_file (void * vobj, void * fn, int fnlen, int findobjbgn, int strip)
 {
@@ -2355,11 +3135,11 @@ int json_encode (void * vobj, void * vjson, int len)
     if (iter + 1 <= len) pjson[iter] = '{';
     iter++;
 
-    num = ht_num(obj->objtab);
+    num = json_obj_num(obj);
 
     for (i = 0; i < num; i++) {
 
-        item = (JsonItem *)ht_value(obj->objtab, i);
+        item = json_obj_item(obj, i);
         if (!item || !item->name || item->namelen <= 0) continue;
         if (item->valnum <= 0) continue;
 
@@ -2448,68 +3228,180 @@ int json_value_encode2 (void * vjval, frame_p objfrm)
 }
 
 int json_encode2 (void * vobj, frame_p objfrm)
-{        
+{
     JsonObj   * obj = (JsonObj *)vobj;
-    JsonItem  * item = NULL; 
-    JsonValue * jval = NULL; 
-    int         iter = 0;
-    int         i, num; 
-    int         j;
+    int         size = 0;
+
+    if (!obj || !objfrm) return 0;
+
+    /* sized exactly beforehand, so the frame grows at most once */
+    size = json_size(obj);
+
+    if (frame_rest(objfrm) < size)
+        frame_grow(objfrm, size - frame_rest(objfrm));
+
+    if (frame_rest(objfrm) < size) return 0;
+
+    json_encode(obj, frame_end(objfrm), size);
+    frame_len_add(objfrm, size);
+
+    return size;
+}
+
+typedef struct json_ckwriter {
+    void             * chunk;
+    int                blksize;
+
+    uint8            * buf;     //block being filled, from chunk_buffer_alloc
+    int                size;
+    int                len;
+
+    int64              total;
+    int                err;
+} JsonCkWriter;
+
+/* hand the filled part of current block over to the chunk */
+static void json_ckw_flush (JsonCkWriter * w)
+{
+    if (!w->buf) return;
+
+    if (w->len > 0 && chunk_add_buffer_own(w->chunk, w->buf, w->len) >= 0) {
+        w->total += w->len;
+    } else {
+        if (w->len > 0) w->err = -1;
+        chunk_buffer_free(w->chunk, w->buf);
+    }
+
+    w->buf = NULL;
+    w->size = w->len = 0;
+}
+
+/* room for need bytes, a new block is started when current one is short */
+static uint8 * json_ckw_room (JsonCkWriter * w, int need)
+{
+    if (w->err) return NULL;
+
+    if (w->buf && w->size - w->len >= need)
+        return w->buf + w->len;
+
+    json_ckw_flush(w);
+
+    w->size = need > w->blksize ? need : w->blksize;
+    w->buf = chunk_buffer_alloc(w->chunk, w->size);
+    if (!w->buf) {
+        w->err = -2;
+        return NULL;
+    }
+
+    return w->buf;
+}
+
+static void json_ckw_put (JsonCkWriter * w, void * p, int len)
+{
+    uint8  * dst = json_ckw_room(w, len);
+
+    if (!dst) return;
+
+    memcpy(dst, p, len);
+    w->len += len;
+}
+
+static void json_encode_ckw (JsonObj * obj, JsonCkWriter * w)
+{
+    JsonItem  * item = NULL;
+    JsonValue * jval = NULL;
+    uint8     * dst = NULL;
+    uint8       sep[2];
+    int         size = 0;
+    int         i, j, num;
     uint8       needcomma = 0;
- 
-    if (!obj) return 0;
- 
-    frame_put_last(objfrm, '{'); iter++;
- 
-    num = ht_num(obj->objtab);
 
-    for (i = 0; i < num; i++) {
+    if (!obj || w->err) return;
+
+    /* an object fitting in one block is encoded there in one go */
+    size = json_size(obj);
+    if (size <= w->blksize) {
+        dst = json_ckw_room(w, size);
+        if (dst) w->len += json_encode(obj, dst, size);
+        return;
+    }
 
-        item = (JsonItem *)ht_value(obj->objtab, i);
+    json_ckw_put(w, "{", 1);
+
+    num = json_obj_num(obj);
+
+    for (i = 0; i < num && !w->err; i++) {
+
+        item = json_obj_item(obj, i);
         if (!item || !item->name || item->namelen <= 0) continue;
         if (item->valnum <= 0) continue;
- 
+
         if (needcomma) {
-            frame_put_last(objfrm, obj->itemsep);
-            frame_put_last(objfrm, ' ');
-            iter += 2;
+            sep[0] = obj->itemsep; sep[1] = ' ';
+            json_ckw_put(w, sep, 2);
         }
- 
-        frame_put_last(objfrm, '"'); iter++;
-        frame_put_nlast(objfrm, item->name, item->namelen); iter += item->namelen;
-        frame_put_last(objfrm, '"'); iter++;
-        frame_put_last(objfrm, obj->kvsep); iter++;
 
-        if (item->arrflag == 1) {
-            frame_put_last(objfrm, '['); iter++;
-        } else if (item->arrflag == 2 && item->valnum > 1) {
-            frame_put_last(objfrm, '['); iter++;
-        }
+        json_ckw_put(w, "\"", 1);
+        json_ckw_put(w, item->name, item->namelen);
+        sep[0] = '"'; sep[1] = obj->kvsep;
+        json_ckw_put(w, sep, 2);
 
-        if (item->valnum == 1) {
-            jval = (JsonValue *)item->valobj;
-            if (jval) iter += json_value_encode2(jval, objfrm);
+        if (item->arrflag == 1 || (item->arrflag == 2 && item->valnum > 1))
+            json_ckw_put(w, "[", 1);
 
-        } else {
-            for (j = 0; j < item->valnum; j++) {
-                if (j > 0) { frame_append(objfrm, ", "); iter += 2; }
- 
+        for (j = 0; j < item->valnum; j++) {
+            if (j > 0) json_ckw_put(w, ", ", 2);
+
+            if (item->valnum == 1)
+                jval = (JsonValue *)item->valobj;
+            else
                 jval = arr_value((arr_t *)item->valobj, j);
-                if (jval) iter += json_value_encode2(jval, objfrm);
+
+            if (!jval) continue;
+
+            if (jval->valtype != 0) {
+                json_encode_ckw(jval->jsonobj, w);
+                continue;
             }
-        }
 
-        if (item->arrflag == 1) {
-            frame_put_last(objfrm, ']'); iter++;
-        } else if (item->arrflag == 2 && item->valnum > 1) {
-            frame_put_last(objfrm, ']'); iter++;
+            size = 2;
+            if (jval->value && jval->valuelen > 0)
+                size += json_escape(jval->value, jval->valuelen, NULL, 0);
+
+            dst = json_ckw_room(w, size);
+            if (!dst) break;
+
+            dst[0] = '"';
+            if (size > 2) json_escape(jval->value, jval->valuelen, dst + 1, size - 2);
+            dst[size - 1] = '"';
+            w->len += size;
         }
- 
+
+        if (item->arrflag == 1 || (item->arrflag == 2 && item->valnum > 1))
+            json_ckw_put(w, "]", 1);
+
         needcomma = 1;
     }
- 
-    frame_put_last(objfrm, '}'); iter++;
 
-    return iter;
+    json_ckw_put(w, "}", 1);
 }
 
+int64 json_encode_chunk (void * vobj, void * chunk, int blksize)
+{
+    JsonCkWriter  w;
+
+    if (!vobj || !chunk) return -1;
+
+    memset(&w, 0, sizeof(w));
+    w.chunk = chunk;
+    w.blksize = blksize > 0 ? blksize : 64 * 1024;
+
+    json_encode_ckw((JsonObj *)vobj, &w);
+    json_ckw_flush(&w);
+
+    if (w.err) return w.err;
+
+    return w.total;
+}
+
+
@@ -0,0 +1,868 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "dynarr.h"
+#include "hashtab.h"
+#include "mthread.h"
+#include "frame.h"
+#include "chunk.h"
+#include "strutil.h"
+#include "numconv.h"
+#include "json.h"
+#include "jsonbin.h"
+
+#include <math.h>
+
+/* kinds of head and of item decoded */
+#define BIN_UINT    1
+#define BIN_NINT    2   //negative integer, value -1-n
+#define BIN_STR     3
+#define BIN_ARR     4
+#define BIN_MAP     5
+#define BIN_DBL     6
+#define BIN_NIL     7
+#define BIN_TRUE    8
+#define BIN_FALSE   9
+#define BIN_BREAK   10
+
+
+/* output goes to a flat buffer, the end of a frame grown on demand, or
+   blocks handed over to a chunk. p/size/len describe the room being filled */
+typedef struct json_bin_writer {
+    uint8            * p;
+    int                size;
+    int                len;
+
+    frame_p            frm;
+    void             * chunk;
+    int                blksize;
+    int64              total;   //bytes handed over to chunk
+
+    uint8              fmt;
+    uint8              typed;
+    int                err;
+} JsonBinWriter;
+
+static void bin_flush (JsonBinWriter * w)
+{
+    if (!w->chunk || !w->p) return;
+
+    if (w->len > 0 && chunk_add_buffer_own(w->chunk, w->p, w->len) >= 0) {
+        w->total += w->len;
+    } else {
+        if (w->len > 0) w->err = -1;
+        chunk_buffer_free(w->chunk, w->p);
+    }
+
+    w->p = NULL;
+    w->size = w->len = 0;
+}
+
+static uint8 * bin_room_more (JsonBinWriter * w, int n)
+{
+    int   grow;
+
+    if (w->err) return NULL;
+
+    if (w->frm) {
+        /* frame length is added at the end, so frame_end stays the start */
+        grow = frame_size(w->frm) > n ? frame_size(w->frm) : n;
+        frame_grow(w->frm, w->len + grow - w->size);
+
+        w->p = frame_end(w->frm);
+        w->size = frame_rest(w->frm);
+        if (w->size - w->len < n) {
+            w->err = -2;
+            return NULL;
+        }
+        return w->p + w->len;
+    }
+
+    /* flat buffer too short: only counted */
+    if (!w->chunk) return NULL;
+
+    bin_flush(w);
+
+    w->size = n > w->blksize ? n : w->blksize;
+    w->p = chunk_buffer_alloc(w->chunk, w->size);
+    if (!w->p) {
+        w->err = -2;
+        return NULL;
+    }
+
+    return w->p;
+}
+
+/* room for n bytes. the caller writes there if not NULL and adds n to len */
+static inline uint8 * bin_room (JsonBinWriter * w, int n)
+{
+    if (w->p && w->size - w->len >= n)
+        return w->p + w->len;
+
+    return bin_room_more(w, n);
+}
+
+static void bin_put (JsonBinWriter * w, void * src, int n)
+{
+    uint8  * dst;
+
+    if (n <= 0) return;
+
+    dst = bin_room(w, n);
+    if (dst) memcpy(dst, src, n);
+
+    w->len += n;
+}
+
+static int bin_be_put (uint8 * p, uint64 val, int n)
+{
+    int  i;
+
+    for (i = n - 1; i >= 0; i--) {
+        p[i] = (uint8)val;
+        val >>= 8;
+    }
+    return n;
+}
+
+static uint64 bin_be_get (uint8 * p, int n)
+{
+    uint64  val = 0;
+    int     i;
+
+    for (i = 0; i < n; i++)
+        val = (val << 8) | p[i];
+    return val;
+}
+
+static int msgpack_head (uint8 * p, int kind, uint64 n)
+{
+    int64  v;
+
+    switch (kind) {
+    case BIN_MAP:
+        if (n < 16) { p[0] = 0x80 | (uint8)n; return 1; }
+        if (n <= 0xFFFF) { p[0] = 0xde; return 1 + bin_be_put(p + 1, n, 2); }
+        p[0] = 0xdf; return 1 + bin_be_put(p + 1, n, 4);
+
+    case BIN_ARR:
+        if (n < 16) { p[0] = 0x90 | (uint8)n; return 1; }
+        if (n <= 0xFFFF) { p[0] = 0xdc; return 1 + bin_be_put(p + 1, n, 2); }
+        p[0] = 0xdd; return 1 + bin_be_put(p + 1, n, 4);
+
+    case BIN_STR:
+        if (n < 32) { p[0] = 0xa0 | (uint8)n; return 1; }
+        if (n <= 0xFF) { p[0] = 0xd9; return 1 + bin_be_put(p + 1, n, 1); }
+        if (n <= 0xFFFF) { p[0] = 0xda; return 1 + bin_be_put(p + 1, n, 2); }
+        p[0] = 0xdb; return 1 + bin_be_put(p + 1, n, 4);
+
+    case BIN_UINT:
+        if (n < 128) { p[0] = (uint8)n; return 1; }
+        if (n <= 0xFF) { p[0] = 0xcc; return 1 + bin_be_put(p + 1, n, 1); }
+        if (n <= 0xFFFF) { p[0] = 0xcd; return 1 + bin_be_put(p + 1, n, 2); }
+        if (n <= 0xFFFFFFFFULL) { p[0] = 0xce; return 1 + bin_be_put(p + 1, n, 4); }
+        p[0] = 0xcf; return 1 + bin_be_put(p + 1, n, 8);
+
+    case BIN_NINT:
+        v = -1 - (int64)n;
+        if (v >= -32) { p[0] = (uint8)v; return 1; }
+        if (v >= -128) { p[0] = 0xd0; return 1 + bin_be_put(p + 1, (uint64)v, 1); }
+        if (v >= -32768) { p[0] = 0xd1; return 1 + bin_be_put(p + 1, (uint64)v, 2); }
+        if (v >= -2147483647LL - 1) { p[0] = 0xd2; return 1 + bin_be_put(p + 1, (uint64)v, 4); }
+        p[0] = 0xd3; return 1 + bin_be_put(p + 1, (uint64)v, 8);
+
+    case BIN_NIL:   p[0] = 0xc0; return 1;
+    case BIN_FALSE: p[0] = 0xc2; return 1;
+    case BIN_TRUE:  p[0] = 0xc3; return 1;
+    case BIN_DBL:   p[0] = 0xcb; return 1 + bin_be_put(p + 1, n, 8);
+    }
+
+    return 0;
+}
+
+static int cbor_head (uint8 * p, int kind, uint64 n)
+{
+    uint8  major = 0;
+
+    switch (kind) {
+    case BIN_UINT: major = 0; break;
+    case BIN_NINT: major = 1; break;
+    case BIN_STR:  major = 3; break;
+    case BIN_ARR:  major = 4; break;
+    case BIN_MAP:  major = 5; break;
+    case BIN_FALSE: p[0] = 0xf4; return 1;
+    case BIN_TRUE:  p[0] = 0xf5; return 1;
+    case BIN_NIL:   p[0] = 0xf6; return 1;
+    case BIN_DBL:   p[0] = 0xfb; return 1 + bin_be_put(p + 1, n, 8);
+    default: return 0;
+    }
+
+    major <<= 5;
+
+    if (n < 24) { p[0] = major | (uint8)n; return 1; }
+    if (n <= 0xFF) { p[0] = major | 24; return 1 + bin_be_put(p + 1, n, 1); }
+    if (n <= 0xFFFF) { p[0] = major | 25; return 1 + bin_be_put(p + 1, n, 2); }
+    if (n <= 0xFFFFFFFFULL) { p[0] = major | 26; return 1 + bin_be_put(p + 1, n, 4); }
+    p[0] = major | 27; return 1 + bin_be_put(p + 1, n, 8);
+}
+
+static void bin_put_head (JsonBinWriter * w, int kind, uint64 n)
+{
+    uint8    head[9];
+    uint8  * dst;
+    int      len;
+
+    /* written in place when the longest head fits */
+    dst = bin_room(w, 9);
+    if (!dst) dst = head;
+
+    if (w->fmt == JSON_BIN_CBOR)
+        len = cbor_head(dst, kind, n);
+    else
+        len = msgpack_head(dst, kind, n);
+
+    if (dst == head) bin_put(w, head, len);
+    else w->len += len;
+}
+
+/* with JSON_BIN_TYPED, write a value as number, boolean or nil when that
+   reads back to exactly the same text. return 0 if it is left a string */
+static int bin_put_typed (JsonBinWriter * w, uint8 * p, int len)
+{
+    uint8    buf[NUM_DTOA_SIZE];
+    uint64   u = 0;
+    double   d = 0;
+    int      neg = 0;
+    int      i;
+    union { double d; uint64 u; } dv;
+
+    if (len <= 0 || len >= NUM_DTOA_SIZE) return 0;
+
+    switch (p[0]) {
+    case 't':
+        if (len == 4 && memcmp(p, "true", 4) == 0) { bin_put_head(w, BIN_TRUE, 0); return 1; }
+        return 0;
+    case 'f':
+        if (len == 5 && memcmp(p, "false", 5) == 0) { bin_put_head(w, BIN_FALSE, 0); return 1; }
+        return 0;
+    case 'n':
+        if (len == 4 && memcmp(p, "null", 4) == 0) { bin_put_head(w, BIN_NIL, 0); return 1; }
+        return 0;
+    case '-':
+        neg = 1;
+        break;
+    default:
+        if (p[0] < '0' || p[0] > '9') return 0;
+    }
+
+    /* integer of at most 18 digits without leading zeros fits any int64 */
+    i = num_atou64(p + neg, len - neg, &u);
+    if (i > 0 && i + neg == len && i <= 18) {
+        if (p[neg] == '0' && (i > 1 || neg)) return 0;
+
+        if (neg) bin_put_head(w, BIN_NINT, u - 1);
+        else bin_put_head(w, BIN_UINT, u);
+        return 1;
+    }
+
+    if (num_atod(p, len, &d) != len) return 0;
+    if (num_dtoa(d, buf) != len || memcmp(buf, p, len) != 0) return 0;
+
+    dv.d = d;
+    bin_put_head(w, BIN_DBL, dv.u);
+    return 1;
+}
+
+static void bin_put_value (JsonBinWriter * w, JsonValue * jval);
+
+static void bin_put_obj (JsonBinWriter * w, JsonObj * obj)
+{
+    JsonItem  * item = NULL;
+    int         i, j, num, cnt;
+    uint8       isarr;
+
+    num = obj ? json_num(obj) : 0;
+
+    for (cnt = 0, i = 0; i < num; i++) {
+        item = json_item_at(obj, i);
+        if (!item || !item->name || item->namelen <= 0) continue;
+        if (item->valnum <= 0) continue;
+        cnt++;
+    }
+
+    bin_put_head(w, BIN_MAP, cnt);
+
+    for (i = 0; i < num && !w->err; i++) {
+        item = json_item_at(obj, i);
+        if (!item || !item->name || item->namelen <= 0) continue;
+        if (item->valnum <= 0) continue;
+
+        bin_put_head(w, BIN_STR, item->namelen);
+        bin_put(w, item->name, item->namelen);
+
+        isarr = (item->arrflag == 1 || (item->arrflag == 2 && item->valnum > 1));
+
+        if (!isarr) {
+            bin_put_value(w, item->valnum == 1 ? item->valobj
+                                               : arr_value((arr_t *)item->valobj, 0));
+            continue;
+        }
+
+        bin_put_head(w, BIN_ARR, item->valnum);
+
+        for (j = 0; j < item->valnum; j++) {
+            bin_put_value(w, item->valnum == 1 ? item->valobj
+                                               : arr_value((arr_t *)item->valobj, j));
+        }
+    }
+}
+
+static void bin_put_value (JsonBinWriter * w, JsonValue * jval)
+{
+    if (!jval) {
+        bin_put_head(w, BIN_NIL, 0);
+        return;
+    }
+
+    if (jval->valtype != 0) {
+        bin_put_obj(w, (JsonObj *)jval->jsonobj);
+        return;
+    }
+
+    if (w->typed && bin_put_typed(w, jval->value, jval->valuelen))
+        return;
+
+    bin_put_head(w, BIN_STR, jval->valuelen);
+    if (jval->value) bin_put(w, jval->value, jval->valuelen);
+}
+
+int json_bin_encode (void * vobj, int fmt, void * p, int len)
+{
+    JsonBinWriter  w;
+
+    if (!vobj) return 0;
+
+    memset(&w, 0, sizeof(w));
+    w.p = p;
+    w.size = p ? len : 0;
+    w.fmt = fmt & 0x0F;
+    w.typed = (fmt & JSON_BIN_TYPED) ? 1 : 0;
+
+    bin_put_obj(&w, (JsonObj *)vobj);
+
+    return w.len;
+}
+
+int json_bin_encode2 (void * vobj, int fmt, frame_p objfrm)
+{
+    JsonBinWriter  w;
+
+    if (!vobj || !objfrm) return 0;
+
+    memset(&w, 0, sizeof(w));
+    w.frm = objfrm;
+    w.p = frame_end(objfrm);
+    w.size = frame_rest(objfrm);
+    w.fmt = fmt & 0x0F;
+    w.typed = (fmt & JSON_BIN_TYPED) ? 1 : 0;
+
+    bin_put_obj(&w, (JsonObj *)vobj);
+
+    if (w.err) return 0;
+
+    frame_len_add(objfrm, w.len);
+
+    return w.len;
+}
+
+int64 json_bin_encode_chunk (void * vobj, int fmt, void * chunk, int blksize)
+{
+    JsonBinWriter  w;
+
+    if (!vobj || !chunk) return -1;
+
+    memset(&w, 0, sizeof(w));
+    w.chunk = chunk;
+    w.blksize = blksize > 0 ? blksize : 64 * 1024;
+    w.fmt = fmt & 0x0F;
+    w.typed = (fmt & JSON_BIN_TYPED) ? 1 : 0;
+
+    bin_put_obj(&w, (JsonObj *)vobj);
+    bin_flush(&w);
+
+    if (w.err) return w.err;
+
+    return w.total;
+}
+
+
+typedef struct bin_item {
+    int        kind;
+    uint8      indef;
+    uint64     n;        //integer, length or count of container
+    uint8    * p;        //string bytes
+    double     d;
+} BinItem;
+
+#define BIN_NEED(bin, n)  if ((uint64)((bin)->len - (bin)->pos) < (uint64)(n)) return -1
+
+static int msgpack_item (JsonBin * bin, BinItem * it)
+{
+    uint8   b;
+    int     n = 0;
+    union { uint32 u; float f; } fv;
+    union { uint64 u; double d; } dv;
+
+    BIN_NEED(bin, 1);
+    b = bin->data[bin->pos++];
+
+    if (b <= 0x7f) { it->kind = BIN_UINT; it->n = b; return 0; }
+    if (b >= 0xe0) { it->kind = BIN_NINT; it->n = (uint64)(-1 - (int64)(int8)b); return 0; }
+    if (b <= 0x8f) { it->kind = BIN_MAP; it->n = b & 0x0F; return 0; }
+    if (b <= 0x9f) { it->kind = BIN_ARR; it->n = b & 0x0F; return 0; }
+    if (b <= 0xbf) { it->kind = BIN_STR; it->n = b & 0x1F; goto str; }
+
+    switch (b) {
+    case 0xc0: it->kind = BIN_NIL; return 0;
+    case 0xc2: it->kind = BIN_FALSE; return 0;
+    case 0xc3: it->kind = BIN_TRUE; return 0;
+
+    case 0xc4: case 0xc5: case 0xc6:  //bin 8/16/32
+        n = 1 << (b - 0xc4);
+        BIN_NEED(bin, n);
+        it->kind = BIN_STR;
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n;
+        goto str;
+
+    case 0xc7: case 0xc8: case 0xc9:  //ext 8/16/32, type byte skipped
+        n = 1 << (b - 0xc7);
+        BIN_NEED(bin, n + 1);
+        it->kind = BIN_STR;
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n + 1;
+        goto str;
+
+    case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:  //fixext
+        BIN_NEED(bin, 1);
+        it->kind = BIN_STR;
+        it->n = 1 << (b - 0xd4);
+        bin->pos += 1;
+        goto str;
+
+    case 0xca:
+        BIN_NEED(bin, 4);
+        fv.u = (uint32)bin_be_get(bin->data + bin->pos, 4);
+        bin->pos += 4;
+        it->kind = BIN_DBL; it->d = fv.f;
+        return 0;
+
+    case 0xcb:
+        BIN_NEED(bin, 8);
+        dv.u = bin_be_get(bin->data + bin->pos, 8);
+        bin->pos += 8;
+        it->kind = BIN_DBL; it->d = dv.d;
+        return 0;
+
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        n = 1 << (b - 0xcc);
+        BIN_NEED(bin, n);
+        it->kind = BIN_UINT;
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n;
+        return 0;
+
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+        n = 1 << (b - 0xd0);
+        BIN_NEED(bin, n);
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n;
+        /* sign extension from n bytes */
+        if (n < 8 && (it->n >> (n * 8 - 1)) & 1)
+            it->n |= ~0ULL << (n * 8);
+        if ((int64)it->n < 0) {
+            it->kind = BIN_NINT;
+            it->n = (uint64)(-1 - (int64)it->n);
+        } else {
+            it->kind = BIN_UINT;
+        }
+        return 0;
+
+    case 0xd9: case 0xda: case 0xdb:
+        n = 1 << (b - 0xd9);
+        BIN_NEED(bin, n);
+        it->kind = BIN_STR;
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n;
+        goto str;
+
+    case 0xdc: case 0xdd: case 0xde: case 0xdf:
+        n = (b & 1) ? 4 : 2;
+        BIN_NEED(bin, n);
+        it->kind = b >= 0xde ? BIN_MAP : BIN_ARR;
+        it->n = bin_be_get(bin->data + bin->pos, n);
+        bin->pos += n;
+        return 0;
+    }
+
+    return -2;
+
+str:
+    BIN_NEED(bin, it->n);
+    it->p = bin->data + bin->pos;
+    bin->pos += (int)it->n;
+    return 0;
+}
+
+static double cbor_half (uint16 h)
+{
+    int     exp = (h >> 10) & 0x1F;
+    int     mant = h & 0x3FF;
+    double  val;
+
+    if (exp == 0) val = ldexp(mant, -24);
+    else if (exp != 31) val = ldexp(mant + 1024, exp - 25);
+    else val = mant == 0 ? INFINITY : NAN;
+
+    return (h & 0x8000) ? -val : val;
+}
+
+static int cbor_item (JsonBin * bin, BinItem * it)
+{
+    uint8   b, major, ai;
+    int     n;
+    union { uint32 u; float f; } fv;
+    union { uint64 u; double d; } dv;
+
+    for ( ; ; ) {
+        BIN_NEED(bin, 1);
+        b = bin->data[bin->pos++];
+        major = b >> 5;
+        ai = b & 0x1F;
+
+        it->indef = 0;
+        it->n = 0;
+
+        if (ai < 24) {
+            it->n = ai;
+        } else if (ai <= 27) {
+            n = 1 << (ai - 24);
+            BIN_NEED(bin, n);
+            it->n = bin_be_get(bin->data + bin->pos, n);
+            bin->pos += n;
+        } else if (ai == 31) {
+            it->indef = 1;
+        } else {
+            return -2;
+        }
+
+        if (major != 6) break;
+
+        /* tags are skipped, the tagged item is taken as it is */
+        if (it->indef) return -2;
+    }
+
+    switch (major) {
+    case 0:
+        if (it->indef) return -2;
+        it->kind = BIN_UINT;
+        return 0;
+
+    case 1:
+        if (it->indef) return -2;
+        it->kind = BIN_NINT;
+        return 0;
+
+    case 2: case 3:
+        /* chunked strings cannot be referred to in place */
+        if (it->indef) return -2;
+        it->kind = BIN_STR;
+        BIN_NEED(bin, it->n);
+        it->p = bin->data + bin->pos;
+        bin->pos += (int)it->n;
+        return 0;
+
+    case 4:
+        it->kind = BIN_ARR;
+        return 0;
+
+    case 5:
+        it->kind = BIN_MAP;
+        return 0;
+    }
+
+    /* major type 7 */
+    switch (ai) {
+    case 20: it->kind = BIN_FALSE; return 0;
+    case 21: it->kind = BIN_TRUE; return 0;
+    case 22: case 23: it->kind = BIN_NIL; return 0;
+    case 25: it->kind = BIN_DBL; it->d = cbor_half((uint16)it->n); return 0;
+    case 26: fv.u = (uint32)it->n; it->kind = BIN_DBL; it->d = fv.f; return 0;
+    case 27: dv.u = it->n; it->kind = BIN_DBL; it->d = dv.d; return 0;
+    case 31: it->kind = BIN_BREAK; return 0;
+    }
+
+    /* other simple values given as their number */
+    it->kind = BIN_UINT;
+    return 0;
+}
+
+int json_bin_init (JsonBin * bin, int fmt, void * p, int len)
+{
+    if (!bin) return -1;
+
+    bin->data = p;
+    bin->len = p && len > 0 ? len : 0;
+    bin->pos = 0;
+
+    bin->fmt = fmt & 0x0F;
+    bin->docend = 0;
+    bin->err = 0;
+    bin->depth = 0;
+
+    return 0;
+}
+
+static int bin_close (JsonBin * bin)
+{
+    int  type = bin->stack[--bin->depth].type;
+
+    if (bin->depth == 0) bin->docend = 1;
+
+    return type == 1 ? JSON_PULL_OBJ_END : JSON_PULL_ARR_END;
+}
+
+/* decimal text of a number or the word of true/false/null */
+static int bin_scalar_text (BinItem * it, uint8 * buf, void ** pval)
+{
+    int  len = 0;
+
+    *pval = buf;
+
+    switch (it->kind) {
+    case BIN_UINT:
+        return num_u64toa(it->n, buf);
+
+    case BIN_NINT:
+        /* -1-n, which goes one beyond the int64 range */
+        if (it->n == ~0ULL) {
+            memcpy(buf, "-18446744073709551616", 21);
+            return 21;
+        }
+        buf[0] = '-';
+        len = num_u64toa(it->n + 1, buf + 1);
+        return len + 1;
+
+    case BIN_DBL:
+        return num_dtoa(it->d, buf);
+
+    case BIN_TRUE:  *pval = "true"; return 4;
+    case BIN_FALSE: *pval = "false"; return 5;
+    }
+
+    *pval = "null";
+    return 4;
+}
+
+int json_bin_next (JsonBin * bin, void ** pval, int * vallen)
+{
+    BinItem   it;
+    void    * val = NULL;
+    int       len = 0;
+    int       ret = 0;
+    int       iskey = 0;
+    int       top = 0;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!bin) return -2;
+    if (bin->err) return bin->err;
+
+    top = bin->depth - 1;
+
+    if (bin->depth > 0) {
+        if (!bin->stack[top].indef && bin->stack[top].remain <= 0)
+            return bin_close(bin);
+
+    } else if (bin->docend) {
+        bin->docend = 0;
+        return JSON_PULL_DOC_END;
+
+    } else if (bin->pos >= bin->len) {
+        return JSON_PULL_END;
+    }
+
+    memset(&it, 0, sizeof(it));
+
+    if (bin->fmt == JSON_BIN_CBOR)
+        ret = cbor_item(bin, &it);
+    else
+        ret = msgpack_item(bin, &it);
+
+    if (ret < 0) return bin->err = ret;
+
+    if (it.kind == BIN_BREAK) {
+        if (bin->depth <= 0 || !bin->stack[top].indef)
+            return bin->err = -2;
+        if (bin->stack[top].type == 1 && !bin->stack[top].key)
+            return bin->err = -2;     //break between key and value
+        return bin_close(bin);
+    }
+
+    if (bin->depth > 0) {
+        iskey = bin->stack[top].type == 1 && bin->stack[top].key;
+
+        if (!bin->stack[top].indef) bin->stack[top].remain--;
+        if (bin->stack[top].type == 1) bin->stack[top].key ^= 1;
+    }
+
+    if (it.kind == BIN_MAP || it.kind == BIN_ARR) {
+        if (iskey) return bin->err = -2;
+        if (bin->depth >= JSON_PULL_DEPTH) return bin->err = -3;
+
+        /* every item takes one byte at least */
+        if (!it.indef && it.n > (uint64)(bin->len - bin->pos))
+            return bin->err = -1;
+
+        top = bin->depth++;
+        bin->stack[top].type = it.kind == BIN_MAP ? 1 : 2;
+        bin->stack[top].indef = it.indef;
+        bin->stack[top].key = 1;
+        bin->stack[top].remain = it.kind == BIN_MAP ? (int64)it.n * 2 : (int64)it.n;
+
+        return it.kind == BIN_MAP ? JSON_PULL_OBJ_BEGIN : JSON_PULL_ARR_BEGIN;
+    }
+
+    if (bin->depth == 0) bin->docend = 1;
+
+    if (it.kind == BIN_STR) {
+        val = it.p;
+        len = (int)it.n;
+    } else {
+        len = bin_scalar_text(&it, iskey ? bin->keybuf : bin->numbuf, &val);
+    }
+
+    if (pval) *pval = val;
+    if (vallen) *vallen = len;
+
+    if (iskey) return JSON_PULL_KEY;
+
+    return it.kind == BIN_STR ? JSON_PULL_STR : JSON_PULL_RAW;
+}
+
+
+typedef struct json_bin_node {
+    JsonObj   * obj;
+    uint8     * key;
+    int         keylen;
+    uint8       inarr;
+    uint8       kbuf[NUM_DTOA_SIZE];
+} JsonBinNode;
+
+int json_bin_decode (void * vobj, int fmt, void * p, int len)
+{
+    JsonBin       bin;
+    JsonBinNode * stack = NULL;
+    JsonBinNode * cur = NULL;
+    JsonObj     * sub = NULL;
+    void        * val = NULL;
+    int           vlen = 0;
+    int           depth = 0;
+    int           ev, ret = 0;
+
+    if (!vobj) return -1;
+
+    json_bin_init(&bin, fmt, p, len);
+
+    ev = json_bin_next(&bin, &val, &vlen);
+    if (ev < 0) return ev;
+    if (ev != JSON_PULL_OBJ_BEGIN) return -5;
+
+    stack = kzalloc(sizeof(*stack) * JSON_PULL_DEPTH);
+    if (!stack) return -100;
+
+    cur = &stack[depth++];
+    cur->obj = vobj;
+
+    while ((ev = json_bin_next(&bin, &val, &vlen)) > 0) {
+
+        switch (ev) {
+        case JSON_PULL_KEY:
+            if (val == bin.keybuf) {
+                memcpy(cur->kbuf, val, vlen);
+                val = cur->kbuf;
+            }
+            cur->key = val;
+            cur->keylen = vlen;
+            break;
+
+        case JSON_PULL_STR:
+        case JSON_PULL_RAW:
+            json_add(cur->obj, cur->key, cur->keylen, val, vlen, cur->inarr, 0);
+            break;
+
+        case JSON_PULL_OBJ_BEGIN:
+            sub = json_add_obj(cur->obj, cur->key, cur->keylen, cur->inarr);
+            cur = &stack[depth++];
+            memset(cur, 0, sizeof(*cur));
+            cur->obj = sub;
+            break;
+
+        case JSON_PULL_ARR_BEGIN:
+            if (cur->inarr) { ret = -4; goto done; }
+            sub = cur->obj;
+            cur = &stack[depth++];
+            cur->obj = sub;
+            cur->key = stack[depth - 2].key;
+            cur->keylen = stack[depth - 2].keylen;
+            cur->inarr = 1;
+            break;
+
+        case JSON_PULL_OBJ_END:
+        case JSON_PULL_ARR_END:
+            depth--;
+            if (depth > 0) cur = &stack[depth - 1];
+            break;
+
+        case JSON_PULL_DOC_END:
+            ret = bin.pos;
+            goto done;
+        }
+    }
+
+    ret = ev < 0 ? ev : -1;
+
+done:
+    kfree(stack);
+    return ret;
+}
+
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "dynarr.h"
+#include "frame.h"
+#include "chunk.h"
+#include "filecache.h"
+#include "jsonpull.h"
+
+/* grammar states */
+#define JP_VALUE      0   //a value is expected
+#define JP_OBJ_FIRST  1   //first member name or '}'
+#define JP_OBJ_KEY    2   //member name after ','
+#define JP_COLON      3
+#define JP_ARR_FIRST  4   //first element or ']'
+#define JP_NEXT       5   //',' or the close of current container
+
+/* token left open at the end of a fragment */
+#define JP_LEX_NONE   0
+#define JP_LEX_STR    1
+#define JP_LEX_RAW    2
+
+#define JP_SPACE(c)   ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+#define JP_DELIM(c)   (JP_SPACE(c) || (c) == ',' || (c) == ':' || (c) == '{' || (c) == '}' || \
+                       (c) == '[' || (c) == ']' || (c) == '"' || (c) == '\'')
+
+#define JP_FEED_SIZE  16384
+
+
+void json_pull_init (JsonPull * pull, int maxtok)
+{
+    if (!pull) return;
+
+    memset(pull, 0, sizeof(*pull));
+    pull->maxtok = maxtok > 0 ? maxtok : 0;
+}
+
+void json_pull_clean (JsonPull * pull)
+{
+    if (!pull) return;
+
+    if (pull->tok) {
+        frame_free(pull->tok);
+        pull->tok = NULL;
+    }
+
+    if (pull->buf) {
+        kfree(pull->buf);
+        pull->buf = NULL;
+    }
+    pull->bufsize = 0;
+}
+
+void json_pull_reset (JsonPull * pull)
+{
+    frame_p    tok = NULL;
+    uint8    * buf = NULL;
+    int        bufsize = 0;
+    int        maxtok = 0;
+
+    if (!pull) return;
+
+    tok = pull->tok;
+    buf = pull->buf;
+    bufsize = pull->bufsize;
+    maxtok = pull->maxtok;
+
+    memset(pull, 0, sizeof(*pull));
+
+    frame_empty(tok);
+    pull->tok = tok;
+    pull->buf = buf;
+    pull->bufsize = bufsize;
+    pull->maxtok = maxtok;
+}
+
+int json_pull_feed (JsonPull * pull, void * data, int len)
+{
+    if (!pull) return -1;
+    if (pull->err) return pull->err;
+    if (pull->eof) return -2;
+
+    if (pull->pos < pull->len) return -3;
+
+    if (!data || len < 0) len = 0;
+
+    pull->offset += pull->len;
+    pull->data = (uint8 *)data;
+    pull->len = len;
+    pull->pos = 0;
+
+    return 0;
+}
+
+int json_pull_finish (JsonPull * pull)
+{
+    if (!pull) return -1;
+
+    pull->eof = 1;
+    return 0;
+}
+
+int64 json_pull_offset (JsonPull * pull)
+{
+    if (!pull) return 0;
+
+    return pull->offset + pull->pos;
+}
+
+static int json_pull_fail (JsonPull * pull, int err)
+{
+    pull->err = err;
+    return err;
+}
+
+/* save the head of a token that continues in the next fragment */
+static int json_pull_keep (JsonPull * pull, void * p, int len)
+{
+    if (len <= 0) return 0;
+
+    if (pull->maxtok > 0 && frameL(pull->tok) + len > pull->maxtok)
+        return -4;
+
+    if (!pull->tok) {
+        pull->tok = frame_new(len < 256 ? 256 : len);
+        if (!pull->tok) return -4;
+    }
+
+    frame_put_nlast(pull->tok, p, len);
+    return 0;
+}
+
+/* hand out the bytes of a completed token, joined with the saved head if any */
+static int json_pull_token (JsonPull * pull, uint8 * p, int len, void ** pval, int * vallen)
+{
+    if (frameL(pull->tok) > 0) {
+        if (json_pull_keep(pull, p, len) < 0) return -4;
+
+        pull->tokused = 1;
+        p = frameP(pull->tok);
+        len = frameL(pull->tok);
+    }
+
+    if (pval) *pval = p;
+    if (vallen) *vallen = len;
+
+    return 0;
+}
+
+static void json_pull_valdone (JsonPull * pull)
+{
+    if (pull->depth > 0) {
+        pull->state = JP_NEXT;
+    } else {
+        pull->state = JP_VALUE;
+        pull->docend = 1;
+    }
+}
+
+static int json_pull_string (JsonPull * pull, void ** pval, int * vallen)
+{
+    uint8    * p = pull->data + pull->pos;
+    uint8    * end = pull->data + pull->len;
+    uint8    * s = p;
+    uint8      quote = pull->quote;
+    uint8      bslash = pull->bslash;
+
+    for ( ; p < end; p++) {
+        if (bslash) {
+            bslash = 0;
+        } else if (*p == '\\') {
+            bslash = 1;
+            pull->esc = 1;
+        } else if (*p == quote) {
+            break;
+        }
+    }
+
+    if (p >= end) {
+        if (json_pull_keep(pull, s, (int)(p - s)) < 0)
+            return json_pull_fail(pull, -4);
+
+        pull->bslash = bslash;
+        pull->lex = JP_LEX_STR;
+        pull->pos = pull->len;
+
+        if (pull->eof) return json_pull_fail(pull, -1);
+        return JSON_PULL_MORE;
+    }
+
+    if (json_pull_token(pull, s, (int)(p - s), pval, vallen) < 0)
+        return json_pull_fail(pull, -4);
+
+    pull->bslash = 0;
+    pull->lex = JP_LEX_NONE;
+    pull->pos = (int)(p + 1 - pull->data);
+
+    if (pull->iskey) {
+        pull->state = JP_COLON;
+        return JSON_PULL_KEY;
+    }
+
+    json_pull_valdone(pull);
+    return JSON_PULL_STR;
+}
+
+static int json_pull_raw (JsonPull * pull, void ** pval, int * vallen)
+{
+    uint8    * p = pull->data + pull->pos;
+    uint8    * end = pull->data + pull->len;
+    uint8    * s = p;
+
+    while (p < end && !JP_DELIM(*p)) p++;
+
+    if (p >= end && !pull->eof) {
+        if (json_pull_keep(pull, s, (int)(p - s)) < 0)
+            return json_pull_fail(pull, -4);
+
+        pull->lex = JP_LEX_RAW;
+        pull->pos = pull->len;
+        return JSON_PULL_MORE;
+    }
+
+    if (json_pull_token(pull, s, (int)(p - s), pval, vallen) < 0)
+        return json_pull_fail(pull, -4);
+
+    pull->lex = JP_LEX_NONE;
+    pull->pos = (int)(p - pull->data);
+
+    if (pull->iskey) {
+        pull->state = JP_COLON;
+        return JSON_PULL_KEY;
+    }
+
+    json_pull_valdone(pull);
+    return JSON_PULL_RAW;
+}
+
+static int json_pull_open (JsonPull * pull, uint8 c)
+{
+    if (pull->depth >= JSON_PULL_DEPTH)
+        return json_pull_fail(pull, -3);
+
+    pull->stack[pull->depth++] = c;
+    pull->pos++;
+
+    if (c == '{') {
+        pull->state = JP_OBJ_FIRST;
+        return JSON_PULL_OBJ_BEGIN;
+    }
+
+    pull->state = JP_ARR_FIRST;
+    return JSON_PULL_ARR_BEGIN;
+}
+
+static int json_pull_close (JsonPull * pull, uint8 c)
+{
+    pull->depth--;
+    pull->pos++;
+
+    json_pull_valdone(pull);
+
+    return c == '}' ? JSON_PULL_OBJ_END : JSON_PULL_ARR_END;
+}
+
+int json_pull_next (JsonPull * pull, void ** pval, int * vallen)
+{
+    uint8    * p = NULL;
+    uint8    * end = NULL;
+    uint8      c = 0;
+    uint8      top = 0;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!pull) return -2;
+    if (pull->err) return pull->err;
+
+    if (pull->tokused) {
+        frame_empty(pull->tok);
+        pull->tokused = 0;
+    }
+
+    if (pull->docend) {
+        pull->docend = 0;
+        return JSON_PULL_DOC_END;
+    }
+
+    if (pull->lex == JP_LEX_STR)
+        return json_pull_string(pull, pval, vallen);
+
+    if (pull->lex == JP_LEX_RAW)
+        return json_pull_raw(pull, pval, vallen);
+
+    for ( ; ; ) {
+        p = pull->data + pull->pos;
+        end = pull->data + pull->len;
+
+        while (p < end && JP_SPACE(*p)) p++;
+        pull->pos = (int)(p - pull->data);
+
+        if (p >= end) {
+            if (!pull->eof) return JSON_PULL_MORE;
+
+            if (pull->depth > 0 || pull->state != JP_VALUE)
+                return json_pull_fail(pull, -1);
+
+            return JSON_PULL_END;
+        }
+
+        c = *p;
+        top = pull->depth > 0 ? pull->stack[pull->depth - 1] : 0;
+
+        switch (pull->state) {
+        case JP_COLON:
+            if (c != ':') return json_pull_fail(pull, -2);
+            pull->pos++;
+            pull->state = JP_VALUE;
+            continue;
+
+        case JP_NEXT:
+            if (c == ',') {
+                pull->pos++;
+                pull->state = (top == '{') ? JP_OBJ_KEY : JP_VALUE;
+                continue;
+            }
+            if ((c == '}' && top == '{') || (c == ']' && top == '['))
+                return json_pull_close(pull, c);
+
+            return json_pull_fail(pull, -2);
+
+        case JP_OBJ_FIRST:
+            if (c == '}') return json_pull_close(pull, c);
+            /* fall through */
+
+        case JP_OBJ_KEY:
+            pull->iskey = 1;
+            pull->esc = 0;
+
+            if (c == '"' || c == '\'') {
+                pull->quote = c;
+                pull->pos++;
+                return json_pull_string(pull, pval, vallen);
+            }
+            if (!JP_DELIM(c)) return json_pull_raw(pull, pval, vallen);
+
+            return json_pull_fail(pull, -2);
+
+        case JP_ARR_FIRST:
+            if (c == ']') return json_pull_close(pull, c);
+            /* fall through */
+
+        default:
+            if (c == '{' || c == '[')
+                return json_pull_open(pull, c);
+
+            pull->iskey = 0;
+            pull->esc = 0;
+
+            if (c == '"' || c == '\'') {
+                pull->quote = c;
+                pull->pos++;
+                return json_pull_string(pull, pval, vallen);
+            }
+            if (!JP_DELIM(c)) return json_pull_raw(pull, pval, vallen);
+
+            return json_pull_fail(pull, -2);
+        }
+    }
+
+    return JSON_PULL_MORE;
+}
+
+int json_pull_feed_chunk (JsonPull * pull, void * chunk, int64 * pos)
+{
+    void     * pbyte = NULL;
+    int64      len = 0;
+
+    if (!pull || !chunk || !pos) return -1;
+
+    /* one contiguous piece, no more than an int can index */
+    if (chunk_read_ptr(chunk, *pos, 0x40000000, &pbyte, &len, 0) <= 0 || len <= 0)
+        return 0;
+
+    if (json_pull_feed(pull, pbyte, (int)len) < 0) return -1;
+
+    *pos += len;
+    return (int)len;
+}
+
+int json_pull_feed_fca (JsonPull * pull, void * fca)
+{
+    int        ret = 0;
+
+    if (!pull || !fca) return -1;
+
+    if (pull->pos < pull->len) return -3;
+
+    if (!pull->buf) {
+        pull->buf = kalloc(JP_FEED_SIZE);
+        if (!pull->buf) return -4;
+        pull->bufsize = JP_FEED_SIZE;
+    }
+
+    ret = file_cache_read(fca, pull->buf, pull->bufsize, 0);
+    if (ret <= 0) return 0;
+
+    if (json_pull_feed(pull, pull->buf, ret) < 0) return -1;
+
+    return ret;
+}
+
@@ -0,0 +1,857 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "strutil.h"
+#include "numconv.h"
+#include "jsontape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_STR_SIMD)
+#define JSON_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* per-block classification, bit i stands for byte i of the 64-byte block */
+typedef struct json_blk_s {
+    uint64     quote;
+    uint64     bslash;
+    uint64     op;       //{ } [ ] : ,
+    uint64     space;
+} JsonBlk;
+
+/* parser expectations */
+#define JT_VALUE      0
+#define JT_OBJ_FIRST  1   //key or '}'
+#define JT_OBJ_KEY    2
+#define JT_COLON      3
+#define JT_ARR_FIRST  4   //value or ']'
+#define JT_NEXT       5   //',' or closing bracket
+#define JT_DONE       6
+
+#define json_isop(c) ((c) == '{' || (c) == '}' || (c) == '[' || (c) == ']' || (c) == ':' || (c) == ',')
+#define json_isspace(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+
+static inline int json_ctz64 (uint64 val)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(val);
+#else
+    int n = 0;
+
+    while (!(val & 1)) { val >>= 1; n++; }
+    return n;
+#endif
+}
+
+static void json_classify (uint8 * p, JsonBlk * blk)
+{
+    uint64   bit = 1;
+    int      i;
+
+    memset(blk, 0, sizeof(*blk));
+
+    for (i = 0; i < 64; i++, bit <<= 1) {
+        if (p[i] == '"') blk->quote |= bit;
+        else if (p[i] == '\\') blk->bslash |= bit;
+        else if (json_isop(p[i])) blk->op |= bit;
+        else if (json_isspace(p[i])) blk->space |= bit;
+    }
+}
+
+#ifdef JSON_SIMD
+__attribute__((target("sse2")))
+static void json_classify_sse2 (uint8 * p, JsonBlk * blk)
+{
+    __m128i  vq = _mm_set1_epi8('"');
+    __m128i  vb = _mm_set1_epi8('\\');
+    __m128i  vlb = _mm_set1_epi8('{');  //'[' | 0x20 == '{'
+    __m128i  vrb = _mm_set1_epi8('}');  //']' | 0x20 == '}'
+    __m128i  v20 = _mm_set1_epi8(0x20);
+    __m128i  vco = _mm_set1_epi8(':');
+    __m128i  vcm = _mm_set1_epi8(',');
+    __m128i  v9 = _mm_set1_epi8('\t');
+    __m128i  v4 = _mm_set1_epi8(4);
+    __m128i  c, lc, t;
+    int      i;
+
+    memset(blk, 0, sizeof(*blk));
+
+    for (i = 0; i < 64; i += 16) {
+        c = _mm_loadu_si128((__m128i *)(p + i));
+        lc = _mm_or_si128(c, v20);
+
+        blk->quote |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(c, vq)) << i;
+        blk->bslash |= (uint64)(uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(c, vb)) << i;
+
+        t = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lc, vlb), _mm_cmpeq_epi8(lc, vrb)),
+                         _mm_or_si128(_mm_cmpeq_epi8(c, vco), _mm_cmpeq_epi8(c, vcm)));
+        blk->op |= (uint64)(uint32)_mm_movemask_epi8(t) << i;
+
+        /* ' ' or '\t' .. '\r' by unsigned c - 9 <= 4 */
+        t = _mm_sub_epi8(c, v9);
+        t = _mm_or_si128(_mm_cmpeq_epi8(c, v20), _mm_cmpeq_epi8(_mm_min_epu8(t, v4), t));
+        blk->space |= (uint64)(uint32)_mm_movemask_epi8(t) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void json_classify_avx2 (uint8 * p, JsonBlk * blk)
+{
+    __m256i  vq = _mm256_set1_epi8('"');
+    __m256i  vb = _mm256_set1_epi8('\\');
+    __m256i  vlb = _mm256_set1_epi8('{');
+    __m256i  vrb = _mm256_set1_epi8('}');
+    __m256i  v20 = _mm256_set1_epi8(0x20);
+    __m256i  vco = _mm256_set1_epi8(':');
+    __m256i  vcm = _mm256_set1_epi8(',');
+    __m256i  v9 = _mm256_set1_epi8('\t');
+    __m256i  v4 = _mm256_set1_epi8(4);
+    __m256i  c, lc, t;
+    int      i;
+
+    memset(blk, 0, sizeof(*blk));
+
+    for (i = 0; i < 64; i += 32) {
+        c = _mm256_loadu_si256((__m256i *)(p + i));
+        lc = _mm256_or_si256(c, v20);
+
+        blk->quote |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, vq)) << i;
+        blk->bslash |= (uint64)(uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, vb)) << i;
+
+        t = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lc, vlb), _mm256_cmpeq_epi8(lc, vrb)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(c, vco), _mm256_cmpeq_epi8(c, vcm)));
+        blk->op |= (uint64)(uint32)_mm256_movemask_epi8(t) << i;
+
+        t = _mm256_sub_epi8(c, v9);
+        t = _mm256_or_si256(_mm256_cmpeq_epi8(c, v20), _mm256_cmpeq_epi8(_mm256_min_epu8(t, v4), t));
+        blk->space |= (uint64)(uint32)_mm256_movemask_epi8(t) << i;
+    }
+}
+#endif
+
+/* bytes escaped by a backslash. a backslash ending the previous block
+   escapes bit 0, which is passed in and out through pcarry */
+static inline uint64 json_escaped (uint64 bslash, uint64 * pcarry)
+{
+    uint64   escaped = *pcarry;
+    int      i;
+
+    bslash &= ~escaped;
+    *pcarry = 0;
+
+    while (bslash) {
+        i = json_ctz64(bslash);
+        if (i == 63) { *pcarry = 1; break; }
+
+        escaped |= (uint64)1 << (i + 1);
+        bslash &= ~((uint64)3 << i);
+    }
+
+    return escaped;
+}
+
+/* bit i is the parity of the set bits 0..i: ones from an opening quote
+   up to, not including, its closing quote */
+static inline uint64 json_prefix_xor (uint64 x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+
+void json_tape_init (JsonTape * tape)
+{
+    if (!tape) return;
+
+    memset(tape, 0, sizeof(*tape));
+}
+
+void json_tape_clean (JsonTape * tape)
+{
+    if (!tape) return;
+
+    if (tape->tok) kfree(tape->tok);
+    memset(tape, 0, sizeof(*tape));
+}
+
+static JsonTok * json_tape_push (JsonTape * tape, int type, uint32 pos, uint32 len)
+{
+    JsonTok  * tok = NULL;
+    int        size = 0;
+
+    if (tape->num >= tape->size) {
+        size = tape->size < 64 ? 64 : tape->size * 2;
+        tok = krealloc(tape->tok, size * sizeof(*tok));
+        if (!tok) return NULL;
+
+        tape->tok = tok;
+        tape->size = size;
+    }
+
+    tok = tape->tok + tape->num++;
+    tok->type = type;
+    tok->esc = 0;
+    tok->num = 0;
+    tok->pos = pos;
+    tok->len = len;
+    tok->next = tape->num;
+
+    return tok;
+}
+
+int json_tape_parse (JsonTape * tape, void * vjson, int length)
+{
+    uint8    * json = (uint8 *)vjson;
+    uint8      tail[64];
+    uint8    * p = NULL;
+    JsonBlk    blk;
+    JsonTok  * tok = NULL;
+    int        stack[JSON_TAPE_DEPTH];
+    int        depth = 0;
+    int        state = JT_VALUE;
+    int        iskey = 0;
+    int        instr = 0;
+    int        strpos = 0;
+    int        level = 0;
+    int        base, pos, end;
+    uint64     esccarry = 0, strcarry = 0, rawcarry = 0;
+    uint64     escaped, quote, inside, raw, bits;
+
+    if (!tape || !json || length <= 0) return -1;
+
+    tape->json = json;
+    tape->jsonlen = length;
+    tape->num = 0;
+    tape->end = 0;
+    tape->flags = 0;
+
+    if (tape->size < length / 8 + 16) {
+        tok = krealloc(tape->tok, (length / 8 + 16) * sizeof(*tok));
+        if (!tok) return -4;
+        tape->tok = tok;
+        tape->size = length / 8 + 16;
+    }
+
+#ifdef JSON_SIMD
+    level = str_simd(-1);
+#endif
+
+    for (base = 0; base < length; base += 64) {
+        /* stage 1: masks of the bytes to visit */
+        if (base + 64 <= length) {
+            p = json + base;
+        } else {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, json + base, length - base);
+            p = tail;
+        }
+
+#ifdef JSON_SIMD
+        if (level >= 2) json_classify_avx2(p, &blk);
+        else if (level >= 1) json_classify_sse2(p, &blk);
+        else
+#endif
+        json_classify(p, &blk);
+
+        escaped = json_escaped(blk.bslash, &esccarry);
+        quote = blk.quote & ~escaped;
+        inside = json_prefix_xor(quote) ^ strcarry;
+        strcarry = (uint64)((int64)inside >> 63);
+
+        /* bare words start where a byte that is none of quote, operator and
+           space follows one that is */
+        raw = ~(blk.quote | blk.op | blk.space) & ~inside;
+        bits = raw & ~((raw << 1) | rawcarry);
+        rawcarry = raw >> 63;
+
+        bits |= quote | (blk.op & ~inside);
+
+        /* stage 2: walk the set bits in order */
+        for ( ; bits; bits &= bits - 1) {
+            pos = base + json_ctz64(bits);
+
+            if (instr) {  //only the closing quote reaches here
+                tok = json_tape_push(tape, JSON_TOK_STR, strpos, pos - strpos);
+                if (!tok) return -4;
+                if (memchr(json + strpos, '\\', pos - strpos)) tok->esc = 1;
+                instr = 0;
+
+                if (iskey) {
+                    if (pos == strpos) tape->flags |= JSON_TAPE_EMPTYKEY;
+                    state = JT_COLON;
+                } else {
+                    state = depth > 0 ? JT_NEXT : JT_DONE;
+                }
+                goto next;
+            }
+
+            switch (json[pos]) {
+            case '"':
+                if (state == JT_OBJ_FIRST || state == JT_OBJ_KEY) {
+                    iskey = 1;
+                    tape->tok[stack[depth-1]].num++;
+                } else if (state == JT_VALUE || state == JT_ARR_FIRST) {
+                    iskey = 0;
+                    if (depth > 0 && tape->tok[stack[depth-1]].type == JSON_TOK_ARR)
+                        tape->tok[stack[depth-1]].num++;
+                } else {
+                    return -2;
+                }
+                instr = 1;
+                strpos = pos + 1;
+                break;
+
+            case '{':
+            case '[':
+                if (state != JT_VALUE && state != JT_ARR_FIRST) return -2;
+                if (depth >= JSON_TAPE_DEPTH) return -3;
+
+                if (depth > 0 && tape->tok[stack[depth-1]].type == JSON_TOK_ARR) {
+                    tape->tok[stack[depth-1]].num++;
+                    if (json[pos] == '[') tape->flags |= JSON_TAPE_NESTARR;
+                }
+
+                stack[depth++] = tape->num;
+                if (json[pos] == '{') {
+                    if (!json_tape_push(tape, JSON_TOK_OBJ, pos, 0)) return -4;
+                    state = JT_OBJ_FIRST;
+                } else {
+                    if (!json_tape_push(tape, JSON_TOK_ARR, pos, 0)) return -4;
+                    state = JT_ARR_FIRST;
+                }
+                break;
+
+            case '}':
+            case ']':
+                if (depth <= 0) return -2;
+                tok = tape->tok + stack[depth-1];
+
+                if (json[pos] == '}') {
+                    if (tok->type != JSON_TOK_OBJ || (state != JT_OBJ_FIRST && state != JT_NEXT))
+                        return -2;
+                } else {
+                    if (tok->type != JSON_TOK_ARR || (state != JT_ARR_FIRST && state != JT_NEXT))
+                        return -2;
+                }
+
+                tok->len = pos + 1 - tok->pos;
+                tok->next = tape->num;
+                depth--;
+                state = depth > 0 ? JT_NEXT : JT_DONE;
+                break;
+
+            case ':':
+                if (state != JT_COLON) return -2;
+                state = JT_VALUE;
+                break;
+
+            case ',':
+                if (state != JT_NEXT) return -2;
+                if (tape->tok[stack[depth-1]].type == JSON_TOK_OBJ)
+                    state = JT_OBJ_KEY;
+                else
+                    state = JT_VALUE;
+                break;
+
+            default:  //bare word
+                if (state != JT_VALUE && state != JT_ARR_FIRST) return -2;
+                if (!((json[pos] >= '0' && json[pos] <= '9') || json[pos] == '-' ||
+                      (json[pos] >= 'a' && json[pos] <= 'z') || json[pos] == '+' ||
+                      (json[pos] >= 'A' && json[pos] <= 'Z') || json[pos] == '.'))
+                    return -2;
+
+                for (end = pos + 1; end < length; end++) {
+                    if (json[end] == '"' || json_isop(json[end]) || json_isspace(json[end]))
+                        break;
+                }
+
+                if (depth > 0 && tape->tok[stack[depth-1]].type == JSON_TOK_ARR)
+                    tape->tok[stack[depth-1]].num++;
+
+                if (!json_tape_push(tape, JSON_TOK_RAW, pos, end - pos)) return -4;
+
+                if (depth == 0) {
+                    tape->end = end;
+                    return end;
+                }
+                state = JT_NEXT;
+                break;
+            }
+
+        next:
+            if (state == JT_DONE) {
+                tape->end = pos + 1;
+                return pos + 1;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+/* the index-th value held by a member whose value token is ind */
+static int json_tape_index (JsonTape * tape, int ind, int index)
+{
+    JsonTok  * tok = tape->tok + ind;
+    int        i;
+
+    if (tok->type != JSON_TOK_ARR) {
+        if (index > 0) return -200;
+        return ind;
+    }
+
+    if (tok->num == 0) return -100;
+
+    if (index < 0) index = tok->num - 1;
+    if (index >= (int)tok->num) return -200;
+
+    for (i = ind + 1; index > 0; index--)
+        i = tape->tok[i].next;
+
+    return i;
+}
+
+int json_tape_get_value (JsonTape * tape, int obj, void * key, int keylen, int index)
+{
+    JsonTok  * tok = NULL;
+    int        found = -1;
+    int        i;
+
+    if (!tape || !tape->tok || obj < 0 || obj >= tape->num) return -1;
+
+    if (!key) return -2;
+    if (keylen < 0) keylen = str_len(key);
+    if (keylen <= 0) return -3;
+
+    tok = tape->tok;
+    if (tok[obj].type != JSON_TOK_OBJ) return -4;
+
+    /* keys are at obj + 1 and then past each value */
+    for (i = obj + 1; i < (int)tok[obj].next; i = tok[i + 1].next) {
+        if ((int)tok[i].len == keylen && str_ncasecmp(tape->json + tok[i].pos, key, keylen) == 0)
+            found = i + 1;
+    }
+
+    if (found < 0) return -100;
+
+    return json_tape_index(tape, found, index);
+}
+
+int json_tape_mget_value (JsonTape * tape, void * path, int pathlen)
+{
+    char     * plist[32];
+    int        plen[32];
+    void     * sublist[3];
+    int        sublen[3];
+    char     * name = NULL;
+    int        keylen = 0;
+    int        num, subnum, i;
+    int        index = 0;
+    int        ind = 0;
+
+    if (!tape || !tape->tok || tape->num <= 0) return -1;
+
+    if (!path) return -2;
+    if (pathlen < 0) pathlen = str_len(path);
+    if (pathlen <= 0) return -3;
+
+    num = string_tokenize(path, pathlen, ".", 1, (void **)plist, plen, 32);
+
+    for (i = 0; i < num && ind >= 0; i++) {
+        name = plist[i]; keylen = plen[i];
+
+        if (keylen >= 2 && (name[0] == '"' || name[0] == '\'') && name[keylen - 1] == name[0]) {
+            name++; keylen -= 2;
+        }
+
+        subnum = string_tokenize(name, keylen, "[]", 2, sublist, sublen, 3);
+
+        index = 0;
+        if (subnum > 1) str_atoi(sublist[1], sublen[1], &index);
+
+        ind = json_tape_get_value(tape, ind, sublist[0], sublen[0], index);
+    }
+
+    return ind;
+}
+
+int json_tape_iter (JsonTape * tape, int ind, int * pcur, void ** pkey, int * keylen)
+{
+    JsonTok  * tok = NULL;
+    int        cur = 0;
+
+    if (pkey) *pkey = NULL;
+    if (keylen) *keylen = 0;
+
+    if (!tape || !tape->tok || ind < 0 || ind >= tape->num || !pcur) return -1;
+
+    tok = tape->tok;
+    if (tok[ind].type != JSON_TOK_OBJ && tok[ind].type != JSON_TOK_ARR) return -1;
+
+    cur = *pcur;
+    if (cur <= ind) cur = ind + 1;
+    if (cur >= (int)tok[ind].next) return -1;
+
+    if (tok[ind].type == JSON_TOK_OBJ) {
+        if (pkey) *pkey = tape->json + tok[cur].pos;
+        if (keylen) *keylen = tok[cur].len;
+        cur++;
+    }
+
+    *pcur = tok[cur].next;
+    return cur;
+}
+
+int json_tape_ptr (JsonTape * tape, int ind, void ** pval, int * vallen)
+{
+    JsonTok  * tok = NULL;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!tape || !tape->tok || ind < 0 || ind >= tape->num) return -1;
+
+    tok = tape->tok + ind;
+    if (pval) *pval = tape->json + tok->pos;
+    if (vallen) *vallen = tok->len;
+
+    return tok->type;
+}
+
+/* append code point u as UTF-8, return the bytes written or 0 if no room */
+static int json_utf8_put (uint8 * dst, int room, uint32 u)
+{
+    if (u < 0x80) {
+        if (room < 1) return 0;
+        dst[0] = (uint8)u;
+        return 1;
+    }
+    if (u < 0x800) {
+        if (room < 2) return 0;
+        dst[0] = (uint8)(0xC0 | (u >> 6));
+        dst[1] = (uint8)(0x80 | (u & 0x3F));
+        return 2;
+    }
+    if (u < 0x10000) {
+        if (room < 3) return 0;
+        dst[0] = (uint8)(0xE0 | (u >> 12));
+        dst[1] = (uint8)(0x80 | ((u >> 6) & 0x3F));
+        dst[2] = (uint8)(0x80 | (u & 0x3F));
+        return 3;
+    }
+    if (room < 4) return 0;
+    dst[0] = (uint8)(0xF0 | (u >> 18));
+    dst[1] = (uint8)(0x80 | ((u >> 12) & 0x3F));
+    dst[2] = (uint8)(0x80 | ((u >> 6) & 0x3F));
+    dst[3] = (uint8)(0x80 | (u & 0x3F));
+    return 4;
+}
+
+int json_unescape (void * vsrc, int len, void * buf, int size)
+{
+    uint8    * dst = (uint8 *)buf;
+    uint8    * src = (uint8 *)vsrc;
+    uint8    * end = NULL;
+    uint32     u = 0, u2 = 0;
+    int        num = 0, ret;
+
+    if (!buf || size <= 0) return -1;
+    dst[0] = '\0';
+
+    if (!src || len <= 0) return 0;
+    end = src + len;
+
+    while (src < end && num < size - 1) {
+        if (*src != '\\' || src + 1 >= end) {
+            dst[num++] = *src++;
+            continue;
+        }
+
+        src++;
+        switch (*src++) {
+        case 'b': dst[num++] = '\b'; break;
+        case 'f': dst[num++] = '\f'; break;
+        case 'n': dst[num++] = '\n'; break;
+        case 'r': dst[num++] = '\r'; break;
+        case 't': dst[num++] = '\t'; break;
+        case 'u':
+            if (end - src < 4 || str_hextou(src, 4, &u) != 4) {
+                dst[num++] = 'u';
+                break;
+            }
+            src += 4;
+
+            /* a high surrogate followed by a low one makes one code point */
+            if (u >= 0xD800 && u < 0xDC00 && end - src >= 6 && src[0] == '\\' && src[1] == 'u' &&
+                str_hextou(src + 2, 4, &u2) == 4 && u2 >= 0xDC00 && u2 < 0xE000)
+            {
+                u = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+                src += 6;
+            }
+
+            ret = json_utf8_put(dst + num, size - 1 - num, u);
+            if (ret == 0) goto done;
+            num += ret;
+            break;
+        default:  //\" \\ \/ and unknown escapes give the char itself
+            dst[num++] = src[-1];
+            break;
+        }
+    }
+
+done:
+    dst[num] = '\0';
+    return num;
+}
+
+int json_tape_str (JsonTape * tape, int ind, void * buf, int size)
+{
+    JsonTok  * tok = NULL;
+    int        num = 0;
+
+    if (!buf || size <= 0) return -1;
+    *(uint8 *)buf = '\0';
+
+    if (!tape || !tape->tok || ind < 0 || ind >= tape->num) return -1;
+
+    tok = tape->tok + ind;
+
+    if (!tok->esc) {
+        num = min((int)tok->len, size - 1);
+        memcpy(buf, tape->json + tok->pos, num);
+        ((uint8 *)buf)[num] = '\0';
+        return num;
+    }
+
+    return json_unescape(tape->json + tok->pos, tok->len, buf, size);
+}
+
+
+/* string content or bare word of a scalar value */
+static int json_tape_scalar (JsonTape * tape, int ind, uint8 ** pp, int * plen)
+{
+    JsonTok  * tok = NULL;
+
+    if (!tape || !tape->tok || ind < 0 || ind >= tape->num) return -1;
+
+    tok = tape->tok + ind;
+    if (tok->type != JSON_TOK_STR && tok->type != JSON_TOK_RAW) return -500;
+
+    *pp = tape->json + tok->pos;
+    *plen = tok->len;
+
+    if (*plen <= 0) return -501;
+    return 0;
+}
+
+int json_tape_int64 (JsonTape * tape, int ind, int64 * val)
+{
+    uint8    * p = NULL;
+    int        len = 0;
+    int        ret = 0;
+    double     dval = 0;
+
+    if (val) *val = 0;
+
+    if ((ret = json_tape_scalar(tape, ind, &p, &len)) < 0) return ret;
+
+    ret = str_atoll(p, len, val);
+    if (ret < len && (p[ret] == '.' || p[ret] == 'e' || p[ret] == 'E')) {
+        num_atod(p, len, &dval);
+        if (val) *val = (int64)dval;
+    }
+
+    return 0;
+}
+
+int json_tape_uint64 (JsonTape * tape, int ind, uint64 * val)
+{
+    uint8    * p = NULL;
+    int        len = 0;
+    int        ret = 0;
+    double     dval = 0;
+
+    if (val) *val = 0;
+
+    if ((ret = json_tape_scalar(tape, ind, &p, &len)) < 0) return ret;
+
+    if (*p == '+') { p++; len--; }
+
+    ret = str_atoull(p, len, val);
+    if (ret < len && (p[ret] == '.' || p[ret] == 'e' || p[ret] == 'E')) {
+        num_atod(p, len, &dval);
+        if (val) *val = (uint64)dval;
+    }
+
+    return 0;
+}
+
+int json_tape_double (JsonTape * tape, int ind, double * val)
+{
+    uint8    * p = NULL;
+    int        len = 0;
+    int        ret = 0;
+
+    if (val) *val = 0;
+
+    if ((ret = json_tape_scalar(tape, ind, &p, &len)) < 0) return ret;
+
+    num_atod(p, len, val);
+    return 0;
+}
+
+int json_tape_bool (JsonTape * tape, int ind, uint8 * val)
+{
+    uint8    * p = NULL;
+    int        len = 0;
+    int        ret = 0;
+    double     dval = 0;
+
+    if (val) *val = 0;
+
+    if ((ret = json_tape_scalar(tape, ind, &p, &len)) < 0) return ret;
+
+    if ((len == 4 && str_ncasecmp(p, "true", 4) == 0) ||
+        (len == 3 && str_ncasecmp(p, "yes", 3) == 0) ||
+        (len == 2 && str_ncasecmp(p, "on", 2) == 0))
+    {
+        if (val) *val = 1;
+
+    } else if (num_atod(p, len, &dval) > 0 && dval != 0) {
+        if (val) *val = 1;
+    }
+
+    return 0;
+}
+
+
+#define tape_get(tape, obj, key, keylen, index, func, type, val)      \
+    type   tmp = 0;                                                    \
+    int    ind = 0;                                                    \
+                                                                       \
+    ind = json_tape_get_value(tape, obj, key, keylen, index);          \
+    if (ind < 0) return ind;                                           \
+                                                                       \
+    ind = func(tape, ind, &tmp);                                       \
+    if (val) *val = tmp;                                               \
+    return ind;
+
+#define tape_mget(tape, path, pathlen, func, type, val)                \
+    type   tmp = 0;                                                    \
+    int    ind = 0;                                                    \
+                                                                       \
+    ind = json_tape_mget_value(tape, path, pathlen);                   \
+    if (ind < 0) return ind;                                           \
+                                                                       \
+    ind = func(tape, ind, &tmp);                                       \
+    if (val) *val = tmp;                                               \
+    return ind;
+
+int json_tape_get_int (JsonTape * tape, int obj, void * key, int keylen, int index, int * val)
+{
+    tape_get(tape, obj, key, keylen, index, json_tape_int64, int64, val);
+}
+
+int json_tape_get_int64 (JsonTape * tape, int obj, void * key, int keylen, int index, int64 * val)
+{
+    tape_get(tape, obj, key, keylen, index, json_tape_int64, int64, val);
+}
+
+int json_tape_get_uint64 (JsonTape * tape, int obj, void * key, int keylen, int index, uint64 * val)
+{
+    tape_get(tape, obj, key, keylen, index, json_tape_uint64, uint64, val);
+}
+
+int json_tape_get_double (JsonTape * tape, int obj, void * key, int keylen, int index, double * val)
+{
+    tape_get(tape, obj, key, keylen, index, json_tape_double, double, val);
+}
+
+int json_tape_get_bool (JsonTape * tape, int obj, void * key, int keylen, int index, uint8 * val)
+{
+    tape_get(tape, obj, key, keylen, index, json_tape_bool, uint8, val);
+}
+
+int json_tape_get_str (JsonTape * tape, int obj, void * key, int keylen, int index, void * buf, int size)
+{
+    int    ind = 0;
+
+    if (buf && size > 0) *(uint8 *)buf = '\0';
+
+    ind = json_tape_get_value(tape, obj, key, keylen, index);
+    if (ind < 0) return ind;
+
+    return json_tape_str(tape, ind, buf, size);
+}
+
+int json_tape_mget_int (JsonTape * tape, void * path, int pathlen, int * val)
+{
+    tape_mget(tape, path, pathlen, json_tape_int64, int64, val);
+}
+
+int json_tape_mget_int64 (JsonTape * tape, void * path, int pathlen, int64 * val)
+{
+    tape_mget(tape, path, pathlen, json_tape_int64, int64, val);
+}
+
+int json_tape_mget_uint64 (JsonTape * tape, void * path, int pathlen, uint64 * val)
+{
+    tape_mget(tape, path, pathlen, json_tape_uint64, uint64, val);
+}
+
+int json_tape_mget_double (JsonTape * tape, void * path, int pathlen, double * val)
+{
+    tape_mget(tape, path, pathlen, json_tape_double, double, val);
+}
+
+int json_tape_mget_bool (JsonTape * tape, void * path, int pathlen, uint8 * val)
+{
+    tape_mget(tape, path, pathlen, json_tape_bool, uint8, val);
+}
+
+int json_tape_mget_str (JsonTape * tape, void * path, int pathlen, void * buf, int size)
+{
+    int    ind = 0;
+
+    if (buf && size > 0) *(uint8 *)buf = '\0';
+
+    ind = json_tape_mget_value(tape, path, pathlen);
+    if (ind < 0) return ind;
+
+    return json_tape_str(tape, ind, buf, size);
+}
+
@@ -32,6 +32,7 @@
 #include "rbtree.h"
 #include "strutil.h"
 #include "trace.h"
+#include "btime.h"
 
 
 typedef struct kem_unit {
@@ -759,6 +760,41 @@ void * kemblk_realloc_unit_dbg (void * vblk, void * p, int resize, char * file,
 }
 
 
+static int kempool_stat_snap (void * vmp, PoolSnap * snap)
+{
+    KemPool * mp = (KemPool *)vmp;
+    KemBlk  * blk = NULL;
+    int       i, num;
+
+    if (!mp || !snap) return -1;
+
+    EnterCriticalSection(&mp->mpCS);
+
+    num = arr_num(mp->blk_list);
+    for (i = 0; i < num; i++) {
+        blk = arr_value(mp->blk_list, i);
+        if (!blk) continue;
+
+        snap->allocated += blk->actsize;
+        snap->consumed += blk->allocsize;
+        snap->remaining += blk->restsize;
+    }
+    snap->blknum = num;
+
+    snap->peak = mp->stat.peak;
+    snap->fetchnum = mp->stat.fetchnum;
+    snap->recyclenum = mp->stat.recyclenum;
+    snap->contention = mp->stat.contention;
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    snap->unitsize = 0;
+    snap->reserved = kempool_size(mp);
+
+    return 0;
+}
+
+
 KemPool * kempool_alloc (long size, int unitnum)
 {
     KemPool * mp = NULL;
@@ -785,6 +821,8 @@ KemPool * kempool_alloc (long size, int unitnum)
     mpool_set_unitsize(mp->kemunit_pool, sizeof(KemUnit));
     mpool_set_initfunc(mp->kemunit_pool, kemunit_init);
 
+    poolstat_register(mp, POOL_TYPE_KEMPOOL, kempool_stat_snap);
+
     return mp;
 }
 
@@ -794,6 +832,8 @@ int kempool_free (KemPool * mp)
 
     if (!mp) return -1;
 
+    poolstat_unregister(mp);
+
     EnterCriticalSection(&mp->mpCS);
 
     while (arr_num(mp->blk_list) > 0) {
@@ -953,6 +993,34 @@ void kempool_print (KemPool * mp, frame_t * frm, FILE * fp, int alloclist, int i
     }
 }
 
+static long kemblk_trim (KemBlk * blk)
+{
+    KemUnit   * unit = NULL;
+    rbtnode_t * node = NULL;
+    long        trimmed = 0;
+    int         i, num;
+
+    if (!blk) return 0;
+
+    EnterCriticalSection(&blk->idletreeCS);
+
+    num = rbtree_num(blk->pos_idle_tree);
+    node = rbtree_min_node(blk->pos_idle_tree);
+    for (i = 0; i < num && node; i++) {
+        unit = RBTObj(node);
+        node = rbtnode_next(node);
+        if (!unit) continue;
+
+        trimmed += kmem_trim(blk->pbgn + unit->pos, unit->len);
+    }
+
+    blk->trimstamp = time(0);
+
+    LeaveCriticalSection(&blk->idletreeCS);
+
+    return trimmed;
+}
+
 int kempool_check (KemPool * mp)
 {
     KemBlk   * blk = NULL;
@@ -985,6 +1053,19 @@ int kempool_check (KemPool * mp)
         }
     }
 
+    if (mp->trimtime > 0) {
+        num = arr_num(mp->blk_list);
+        for (i = 0; i < num; i++) {
+            blk = arr_value(mp->blk_list, i);
+            if (!blk) continue;
+
+            if (curt - blk->stamp < mp->trimtime || blk->trimstamp >= blk->stamp)
+                continue;
+
+            kemblk_trim(blk);
+        }
+    }
+
     mp->checktime = curt;
 
     LeaveCriticalSection(&mp->mpCS);
@@ -993,6 +1074,107 @@ int kempool_check (KemPool * mp)
 }
 
 
+int kempool_warmup (KemPool * mp, long size, int flags, int threads, long * pms)
+{
+    KemBlk   * blk = NULL;
+    void    ** pmem = NULL;
+    long     * psize = NULL;
+    long       restsize = 0;
+    btime_t    tick;
+    int        i, num = 0, blknum = 0;
+
+    if (pms) *pms = 0;
+
+    if (!mp) return -1;
+    if (mp->blksize <= 0) return -2;
+
+    btime(&tick);
+
+    EnterCriticalSection(&mp->mpCS);
+
+    num = arr_num(mp->blk_list);
+    for (i = 0; i < num; i++) {
+        blk = arr_value(mp->blk_list, i);
+        if (blk) restsize += blk->restsize;
+    }
+
+    if (size > restsize)
+        blknum = (size - restsize + mp->blksize - 1) / mp->blksize;
+
+    if (blknum > 0) {
+        pmem = kosmalloc(blknum * sizeof(void *));
+        psize = kosmalloc(blknum * sizeof(long));
+    }
+
+    for (num = 0; num < blknum && pmem && psize; ) {
+        blk = kemblk_alloc(mp, mp->blksize);
+        if (!blk) break;
+
+        arr_push(mp->blk_list, blk);
+        arr_insert_by(mp->sort_blk_list, blk, kemblk_cmp_kemblk);
+
+        pmem[num] = blk->pbgn;
+        psize[num] = blk->actsize;
+        num++;
+    }
+
+    /* the new blocks are faulted within the lock, since the memory units
+       allocated from them by other threads must not be touched meanwhile */
+    if (num > 0 && (flags & KMEM_PREFAULT))
+        kmem_prefault(pmem, psize, num, threads);
+
+    if (flags & KMEM_MLOCK) {
+        for (i = 0; i < num; i++)
+            kmem_mlock(pmem[i], psize[i]);
+    }
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    if (pmem) kosfree(pmem);
+    if (psize) kosfree(psize);
+
+    if (pms) *pms = btime_diff_now(&tick);
+
+    return num;
+}
+
+long kempool_trim (KemPool * mp, int idlesec)
+{
+    KemBlk   * blk = NULL;
+    time_t     curt = 0;
+    long       trimmed = 0;
+    int        i, num;
+
+    if (!mp) return -1;
+
+    curt = time(0);
+
+    EnterCriticalSection(&mp->mpCS);
+
+    num = arr_num(mp->blk_list);
+    for (i = 0; i < num; i++) {
+        blk = arr_value(mp->blk_list, i);
+        if (!blk) continue;
+
+        if (curt - blk->stamp < idlesec) continue;
+
+        trimmed += kemblk_trim(blk);
+    }
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    return trimmed;
+}
+
+int kempool_set_trimtime (KemPool * mp, int idlesec)
+{
+    if (!mp) return -1;
+
+    mp->trimtime = idlesec;
+    return 0;
+}
+
+
 static void * kem_alloc_one_dbg (void * vmp, int size, void * exclblk, char * file, int line)
 {
     KemPool * mp = (KemPool *)vmp;
@@ -1002,7 +1184,7 @@ static void * kem_alloc_one_dbg (void * vmp, int size, void * exclblk, char * fi
 
     if (!mp) return NULL;
 
-    EnterCriticalSection(&mp->mpCS);
+    poolstat_lock(&mp->mpCS, &mp->stat);
 
     num = arr_num(mp->blk_list);
     for (i = 0; i < num; i++) {
@@ -1023,6 +1205,7 @@ static void * kem_alloc_one_dbg (void * vmp, int size, void * exclblk, char * fi
         pmem = kemblk_alloc_unit_dbg(blk, size, file, line);
         if (pmem) {
             mp->allocnum++;
+            poolstat_fetch(&mp->stat, mp->allocnum);
             LeaveCriticalSection(&mp->mpCS);
             return pmem;
         }
@@ -1044,6 +1227,7 @@ static void * kem_alloc_one_dbg (void * vmp, int size, void * exclblk, char * fi
     pmem = kemblk_alloc_unit_dbg(blk, size, file, line);
     if (pmem) {
         mp->allocnum++;
+        poolstat_fetch(&mp->stat, mp->allocnum);
     } else {
         tolog(1, "Panic: failed to alloc %d from KemBlk %p pbgn=%p size=%ld allocsize=%ld "
                  "restsize=%ld allocnum=%d blknum=%d!\n",
@@ -1080,7 +1264,7 @@ int kem_free_dbg (void * vmp, void * p, char * file, int line)
     if (!mp) return -1;
     if (!p) return -2;
 
-    EnterCriticalSection(&mp->mpCS);
+    poolstat_lock(&mp->mpCS, &mp->stat);
 
     blk = arr_find_by(mp->sort_blk_list, p, kemblk_cmp_p);
     if (!blk || (pos = (uint8 *)p - blk->pbgn) < 0) {
@@ -1090,6 +1274,7 @@ int kem_free_dbg (void * vmp, void * p, char * file, int line)
     }
 
     mp->allocnum--;
+    poolstat_recycle(&mp->stat);
 
     LeaveCriticalSection(&mp->mpCS);
     
@@ -1153,6 +1338,7 @@ void * kem_realloc_dbg (void * vmp, void * p, int resize, char * file, int line)
 
     EnterCriticalSection(&mp->mpCS);
     mp->allocnum--;
+    poolstat_recycle(&mp->stat);
     LeaveCriticalSection(&mp->mpCS);
 
     return pnew;
@@ -292,44 +292,78 @@ int kvpair_item_free (void * vitem)
 }
 
 
-void * kvpair_alloc (int htsize, char * sepa, char * kvsep, int alloctype, void * mpool)
+#define KVLock(obj)   do { if (!(obj)->nolock) EnterCriticalSection(&(obj)->objCS); } while (0)
+#define KVUnlock(obj) do { if (!(obj)->nolock) LeaveCriticalSection(&(obj)->objCS); } while (0)
+
+static KVPairItem * kvpair_obj_item (KVPairObj * obj, int ind)
 {
-    KVPairObj * obj = NULL;
+    if (obj->objtab) return ht_value(obj->objtab, ind);
 
-    obj = k_mem_zalloc(sizeof(*obj), alloctype, mpool);
-    if (!obj) return NULL;
+    if (ind < 0 || ind >= obj->innum) return NULL;
+    return obj->initem[ind];
+}
 
-    obj->alloctype = alloctype;
-    obj->mpool = mpool;
+/* linear search of the inline items, comparing length and first byte
+   before the whole name. names are case-sensitive, as the hashtab's
+   generic_hash makes them once the items are promoted */
+static int kvpair_inline_find (KVPairObj * obj, void * name, int namelen)
+{
+    KVPairItem * item = NULL;
+    uint8        ch = *(uint8 *)name;
+    int          i;
+
+    for (i = 0; i < obj->innum; i++) {
+        item = obj->initem[i];
+        if ((int)item->namelen != namelen) continue;
+        if (item->name[0] != ch) continue;
+        if (memcmp(item->name, name, namelen) == 0)
+            return i;
+    }
 
-    if (htsize <= 0) htsize = 200;
-    obj->htsize = htsize;
+    return -1;
+}
+
+/* move the inline items into a hashtab, keeping their order */
+static int kvpair_obj_promote (KVPairObj * obj)
+{
+    CommStrKey  key;
+    int         i;
 
-    InitializeCriticalSection(&obj->objCS);
+    obj->objtab = ht_alloc(obj->htsize, kvpair_item_cmp_key, obj->alloctype, obj->mpool);
+    if (!obj->objtab) return -1;
 
-    obj->objtab = ht_alloc(obj->htsize, kvpair_item_cmp_key, alloctype, mpool);
     ht_set_hash_func(obj->objtab, commstrkey_hash_func);
 
-    if (sepa) str_ncpy(obj->sepa, sepa, sizeof(obj->sepa)-1);
-    if (kvsep) str_ncpy(obj->kvsep, kvsep, sizeof(obj->kvsep)-1);
+    for (i = 0; i < obj->innum; i++) {
+        key.name = obj->initem[i]->name;
+        key.namelen = obj->initem[i]->namelen;
+        ht_set(obj->objtab, &key, obj->initem[i]);
+        obj->initem[i] = NULL;
+    }
+    obj->innum = 0;
 
-    return obj;
+    return 0;
 }
 
-void * kvpair_init (int htsize, char * sepa, char * kvsep)
+void * kvpair_new (int htsize, char * sepa, char * kvsep, int alloctype, void * mpool, int flags)
 {
     KVPairObj * obj = NULL;
 
-    obj = kzalloc(sizeof(*obj));
+    obj = k_mem_zalloc(sizeof(*obj), alloctype, mpool);
     if (!obj) return NULL;
 
+    obj->alloctype = alloctype;
+    obj->mpool = mpool;
+
     if (htsize <= 0) htsize = 200;
     obj->htsize = htsize;
 
-    InitializeCriticalSection(&obj->objCS);
+    obj->nolock = (flags & KVPAIR_NOLOCK) ? 1 : 0;
+    if (!obj->nolock)
+        InitializeCriticalSection(&obj->objCS);
 
-    obj->objtab = ht_new(obj->htsize, kvpair_item_cmp_key);
-    ht_set_hash_func(obj->objtab, commstrkey_hash_func);
+    obj->objtab = NULL;
+    obj->innum = 0;
 
     if (sepa) str_ncpy(obj->sepa, sepa, sizeof(obj->sepa)-1);
     if (kvsep) str_ncpy(obj->kvsep, kvsep, sizeof(obj->kvsep)-1);
@@ -337,15 +371,31 @@ void * kvpair_init (int htsize, char * sepa, char * kvsep)
     return obj;
 }
 
+void * kvpair_alloc (int htsize, char * sepa, char * kvsep, int alloctype, void * mpool)
+{
+    return kvpair_new(htsize, sepa, kvsep, alloctype, mpool, 0);
+}
+
+void * kvpair_init (int htsize, char * sepa, char * kvsep)
+{
+    return kvpair_new(htsize, sepa, kvsep, 0, NULL, 0);
+}
+
 int kvpair_clean (void * vobj)
 {
     KVPairObj * obj = (KVPairObj *)vobj;
 
     if (!obj) return -1;
 
-    DeleteCriticalSection(&obj->objCS);
+    if (!obj->nolock)
+        DeleteCriticalSection(&obj->objCS);
 
-    ht_free_all(obj->objtab, kvpair_item_free);
+    kvpair_zero(obj);
+
+    if (obj->objtab) {
+        ht_free(obj->objtab);
+        obj->objtab = NULL;
+    }
 
     k_mem_free(obj, obj->alloctype, obj->mpool);
     return 0;
@@ -354,10 +404,19 @@ int kvpair_clean (void * vobj)
 int kvpair_zero (void * vobj)
 {
     KVPairObj * obj = (KVPairObj *)vobj;
+    int         i;
  
     if (!obj) return -1;
  
-    ht_free_member(obj->objtab, kvpair_item_free);
+    if (obj->objtab) {
+        ht_free_member(obj->objtab, kvpair_item_free);
+    } else {
+        for (i = 0; i < obj->innum; i++) {
+            kvpair_item_free(obj->initem[i]);
+            obj->initem[i] = NULL;
+        }
+        obj->innum = 0;
+    }
  
     return 0;
 }
@@ -367,6 +426,7 @@ void * kvpair_get_item (void * vobj, void * name, int namelen)
     KVPairObj  * obj = (KVPairObj *)vobj;
     KVPairItem * item = NULL;
     CommStrKey   key;
+    int          i;
 
     if (!obj) return NULL;
 
@@ -374,12 +434,15 @@ void * kvpair_get_item (void * vobj, void * name, int namelen)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return NULL;
 
-    key.name = name;
-    key.namelen = namelen;
-
-    EnterCriticalSection(&obj->objCS);
-    item = ht_get(obj->objtab, &key);
-    LeaveCriticalSection(&obj->objCS);
+    KVLock(obj);
+    if (obj->objtab) {
+        key.name = name;
+        key.namelen = namelen;
+        item = ht_get(obj->objtab, &key);
+    } else if ((i = kvpair_inline_find(obj, name, namelen)) >= 0) {
+        item = obj->initem[i];
+    }
+    KVUnlock(obj);
 
     return item;
 }
@@ -395,12 +458,31 @@ int kvpair_add_item (void * vobj, void * name, int namelen, void * vitem)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return -3;
  
+    KVLock(obj);
+
+    if (!obj->objtab) {
+        if (kvpair_inline_find(obj, name, namelen) >= 0) {
+            KVUnlock(obj);
+            return 0;
+        }
+
+        if (obj->innum < KVPAIR_INLINE_ITEMS) {
+            obj->initem[obj->innum++] = item;
+            KVUnlock(obj);
+            return 0;
+        }
+
+        if (kvpair_obj_promote(obj) < 0) {
+            KVUnlock(obj);
+            return -100;
+        }
+    }
+
     key.name = name;
     key.namelen = namelen;
  
-    EnterCriticalSection(&obj->objCS);
     ht_set(obj->objtab, &key, item);
-    LeaveCriticalSection(&obj->objCS);
+    KVUnlock(obj);
  
     return 0;
 }
@@ -410,6 +492,7 @@ void * kvpair_del_item (void * vobj, void * name, int namelen)
     KVPairObj  * obj = (KVPairObj *)vobj;
     KVPairItem * item = NULL; 
     CommStrKey key; 
+    int        i;
      
     if (!obj) return NULL;
      
@@ -417,12 +500,19 @@ void * kvpair_del_item (void * vobj, void * name, int namelen)
     if (namelen < 0) namelen = str_len(name);
     if (namelen <= 0) return NULL; 
      
-    key.name = name;
-    key.namelen = namelen;
- 
-    EnterCriticalSection(&obj->objCS);
-    item = ht_delete(obj->objtab, &key);
-    LeaveCriticalSection(&obj->objCS);
+    KVLock(obj);
+    if (obj->objtab) {
+        key.name = name;
+        key.namelen = namelen;
+        item = ht_delete(obj->objtab, &key);
+    } else if ((i = kvpair_inline_find(obj, name, namelen)) >= 0) {
+        item = obj->initem[i];
+        obj->innum--;
+        if (i < obj->innum)
+            memmove(&obj->initem[i], &obj->initem[i+1], (obj->innum - i) * sizeof(KVPairItem *));
+        obj->initem[obj->innum] = NULL;
+    }
+    KVUnlock(obj);
  
     return item;
 }
@@ -450,7 +540,8 @@ int kvpair_num (void * vobj)
  
     if (!obj) return 0;
  
-    return ht_num(obj->objtab);
+    if (obj->objtab) return ht_num(obj->objtab);
+    return obj->innum;
 }
 
  
@@ -465,9 +556,9 @@ int kvpair_seq_get (void * vobj, int seq, void ** pkey, int * keylen, int index,
  
     if (!obj) return -1;
  
-    EnterCriticalSection(&obj->objCS);
-    item = ht_value(obj->objtab, seq);
-    LeaveCriticalSection(&obj->objCS);
+    KVLock(obj);
+    item = kvpair_obj_item(obj, seq);
+    KVUnlock(obj);
 
     if (item) {
         if (pkey) *pkey = item->name;
@@ -1122,9 +1213,9 @@ int kvpair_encode (void * vobj, void * vbyte, int len)
 
     if (!obj) return 0;
 
-    num = ht_num(obj->objtab);
+    num = kvpair_num(obj);
     for (i = 0; i < num; i++) {
-        item = (KVPairItem *)ht_value(obj->objtab, i);
+        item = kvpair_obj_item(obj, i);
 
         if (!item || !item->name || item->namelen <= 0) continue;
         if (item->valnum <= 0) continue;
@@ -1172,3 +1263,259 @@ int kvpair_encode (void * vobj, void * vbyte, int len)
     return iter;
 }
 
+
+
+void kvpair_view_init (KVPairView * view, char * sepa, char * kvsep, int alloctype, void * mpool)
+{
+    if (!view) return;
+
+    memset(view, 0, sizeof(*view));
+
+    view->alloctype = alloctype;
+    view->mpool = mpool;
+
+    if (sepa) str_ncpy(view->sepa, sepa, sizeof(view->sepa)-1);
+    if (kvsep) str_ncpy(view->kvsep, kvsep, sizeof(view->kvsep)-1);
+
+    view->slice = view->inslice;
+    view->size = KVPAIR_VIEW_INLINE;
+    view->num = 0;
+}
+
+void kvpair_view_clean (KVPairView * view)
+{
+    if (!view) return;
+
+    if (view->slice && view->slice != view->inslice)
+        k_mem_free(view->slice, view->alloctype, view->mpool);
+
+    view->slice = view->inslice;
+    view->size = KVPAIR_VIEW_INLINE;
+    view->num = 0;
+}
+
+/* same as skipQuoteTo, with separators, quotes and backslash prepared in cs.
+   return the offset of the separator found, or len */
+static int kvpair_quote_scan (str_cset_t * cs, uint8 * sep, int seplen, uint8 * p, int len)
+{
+    int     i = 0, j;
+    uint8   ch;
+
+    for ( ; ; ) {
+        i += str_cset_scan(cs, p + i, len - i, 0);
+        if (i >= len) return len;
+
+        ch = p[i];
+
+        if (ch == '\\') {
+            if (i + 1 >= len) return len;
+            i += 2;
+            continue;
+        }
+
+        if ((ch == '"' || ch == '\'') && !memchr(sep, ch, seplen)) {
+            for (j = i + 1; j < len; j++) {
+                if (p[j] == '\\') j++;
+                else if (p[j] == ch) break;
+            }
+            i = j < len ? j + 1 : i + 1;
+            continue;
+        }
+
+        return i;
+    }
+}
+
+static uint8 * kvpair_unquote (uint8 * p, uint8 * pend, int * plen)
+{
+    uint8  * pq = NULL;
+
+    if (p < pend && (*p == '"' || *p == '\'')) {
+        pq = memchr(p + 1, *p, pend - p - 1);
+        *plen = (pq ? pq : pend) - p - 1;
+        return p + 1;
+    }
+
+    *plen = pend - p;
+    return p;
+}
+
+int kvpair_view_decode (KVPairView * view, void * vbyte, int length)
+{
+    uint8       * pbyte = (uint8 *)vbyte;
+    KVPairSlice * slice = NULL;
+    uint8         sepa[32];
+    int           seplen = 0;
+    int           sepalen = 0;
+    int           kvseplen = 0;
+    int           cnt = 0;
+    str_cset_t    csskip;
+    str_cset_t    csname;
+    str_cset_t    csval;
+
+    int           iter = 0;
+    int           colon = 0;
+    int           comma = 0;
+    int           len = 0;
+
+    if (!view) return -1;
+
+    view->num = 0;
+
+    if (!pbyte) return 0;
+    if (length < 0) length = str_len(pbyte);
+    if (length <= 0) return 0;
+
+    kvseplen = str_len(view->kvsep);
+    sepalen = str_len(view->sepa);
+
+    /* every pair but the last one ends at a separator */
+    cnt = str_count(pbyte, length, view->sepa, sepalen) + 1;
+    if (cnt > view->size) {
+        slice = k_mem_alloc(cnt * sizeof(*slice), view->alloctype, view->mpool);
+        if (!slice) return -100;
+
+        if (view->slice != view->inslice)
+            k_mem_free(view->slice, view->alloctype, view->mpool);
+
+        view->slice = slice;
+        view->size = cnt;
+    }
+
+    /* sets prepared once: separators to skip over, then the ends of name
+       and value with quotes and backslash, which are resolved by scan */
+    memcpy(sepa, view->kvsep, kvseplen);
+    memcpy(sepa + kvseplen, view->sepa, sepalen);
+    seplen = kvseplen + sepalen;
+    str_cset_init(&csskip, sepa, seplen);
+
+    memcpy(sepa + seplen, "\"'\\", 3);
+    str_cset_init(&csname, sepa, seplen + 3);
+    str_cset_init(&csval, sepa + kvseplen, sepalen + 3);
+
+    while (iter < length && view->num < view->size) {
+        iter += str_cset_scan(&csskip, pbyte + iter, length - iter, 1);
+        if (iter >= length) break;
+
+        slice = &view->slice[view->num];
+        slice->value = NULL;
+        slice->valuelen = 0;
+
+        colon = iter + kvpair_quote_scan(&csname, sepa, seplen, pbyte + iter, length - iter);
+
+        slice->name = kvpair_unquote(pbyte + iter, pbyte + colon, &len);
+        slice->namelen = len;
+        slice->nameesc = (memchr(slice->name, '%', len) || memchr(slice->name, '+', len)) ? 1 : 0;
+
+        if (colon < length && memchr(view->kvsep, pbyte[colon], kvseplen)) {
+            iter = colon + 1;
+            comma = iter + kvpair_quote_scan(&csval, sepa + kvseplen, sepalen,
+                                             pbyte + iter, length - iter);
+
+            slice->value = kvpair_unquote(pbyte + iter, pbyte + comma, &slice->valuelen);
+            iter = comma;
+        } else {
+            iter = colon;
+        }
+
+        if (slice->namelen > 0) view->num++;
+    }
+
+    return iter;
+}
+
+int kvpair_view_num (KVPairView * view)
+{
+    if (!view) return 0;
+
+    return view->num;
+}
+
+/* names match case-sensitively, the same as kvpair_getP on a decoded KVPairObj */
+static int kvpair_slice_match (KVPairSlice * slice, uint8 * key, int keylen)
+{
+    uint8   name[256];
+    int     len = 0;
+
+    if (slice->namelen == keylen &&
+        slice->name[0] == key[0] &&
+        memcmp(slice->name, key, keylen) == 0)
+        return 1;
+
+    /* decoded name is never longer than the raw one */
+    if (!slice->nameesc || slice->namelen > (int)sizeof(name) || slice->namelen < keylen)
+        return 0;
+
+    len = uri_decode(slice->name, slice->namelen, name, sizeof(name));
+
+    return len == keylen && memcmp(name, key, keylen) == 0;
+}
+
+int kvpair_view_seq (KVPairView * view, int seq, void ** pkey, int * keylen, void ** pval, int * vallen)
+{
+    KVPairSlice * slice = NULL;
+
+    if (pkey) *pkey = NULL;
+    if (keylen) *keylen = 0;
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!view) return -1;
+    if (seq < 0 || seq >= view->num) return -100;
+
+    slice = &view->slice[seq];
+
+    if (pkey) *pkey = slice->name;
+    if (keylen) *keylen = slice->namelen;
+    if (pval) *pval = slice->value;
+    if (vallen) *vallen = slice->valuelen;
+
+    return 1;
+}
+
+int kvpair_view_getP (KVPairView * view, void * key, int keylen, int index, void ** pval, int * vallen)
+{
+    KVPairSlice * slice = NULL;
+    KVPairSlice * found = NULL;
+    int           i, num = 0;
+
+    if (pval) *pval = NULL;
+    if (vallen) *vallen = 0;
+
+    if (!view) return -1;
+
+    if (!key) return -2;
+    if (keylen < 0) keylen = str_len(key);
+    if (keylen <= 0) return -3;
+
+    for (i = 0; i < view->num; i++) {
+        slice = &view->slice[i];
+        if (!kvpair_slice_match(slice, key, keylen)) continue;
+
+        if (index < 0 || num == index) found = slice;
+        num++;
+    }
+
+    if (num == 0) return -100;
+    if (!found) return -200;
+
+    if (pval) *pval = found->value;
+    if (vallen) *vallen = found->valuelen;
+
+    return num;
+}
+
+int kvpair_view_get (KVPairView * view, void * key, int keylen, int index, void * buf, int size)
+{
+    void   * p = NULL;
+    int      len = 0;
+    int      ret = 0;
+
+    ret = kvpair_view_getP(view, key, keylen, index, &p, &len);
+    if (ret < 0) return ret;
+
+    if (!p || len <= 0) return 0;
+
+    return uri_decode(p, len, buf, buf ? size : 0);
+}
+
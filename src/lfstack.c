@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "katomic.h"
+#include "lfstack.h"
+
+#define LFSTACK_BLKNODES  64
+
+typedef struct lfstack_block_s {
+    struct lfstack_block_s * next;
+    lfnode_t                 node[LFSTACK_BLKNODES];
+} LFBlock;
+
+
+#ifdef KATOMIC_HAVE_CAS2
+
+/* push the node chain from first to last onto the list. the fields of list
+   head are loaded separately, a torn value is corrected by the failed CAS */
+static void lfs_list_push (lfstack_t * lfs, volatile ktagptr_t * list, lfnode_t * first, lfnode_t * last)
+{
+    ktagptr_t   old, new;
+
+    old.ptr = katomic_load_relaxed(&list->ptr);
+    old.tag = katomic_load_relaxed(&list->tag);
+
+    for ( ; ; ) {
+        last->next = old.ptr;
+        new.ptr = first;
+        new.tag = old.tag + 1;
+
+        if (katomic_cas2(list, &old, &new))
+            break;
+
+        katomic_add64(&lfs->retry, 1);
+    }
+}
+
+/* nodes are never freed before the stack is released, so reading the next
+   pointer of a node that was popped by others meanwhile is safe */
+static lfnode_t * lfs_list_pop (lfstack_t * lfs, volatile ktagptr_t * list)
+{
+    ktagptr_t   old, new;
+
+    old.ptr = katomic_load_relaxed(&list->ptr);
+    old.tag = katomic_load_relaxed(&list->tag);
+
+    while (old.ptr) {
+        new.ptr = ((lfnode_t *)old.ptr)->next;
+        new.tag = old.tag + 1;
+
+        if (katomic_cas2(list, &old, &new))
+            return old.ptr;
+
+        katomic_add64(&lfs->retry, 1);
+    }
+
+    return NULL;
+}
+
+static lfnode_t * lfs_list_take (lfstack_t * lfs, volatile ktagptr_t * list)
+{
+    ktagptr_t   old, new;
+
+    old.ptr = katomic_load_relaxed(&list->ptr);
+    old.tag = katomic_load_relaxed(&list->tag);
+
+    while (old.ptr) {
+        new.ptr = NULL;
+        new.tag = old.tag + 1;
+
+        if (katomic_cas2(list, &old, &new))
+            return old.ptr;
+
+        katomic_add64(&lfs->retry, 1);
+    }
+
+    return NULL;
+}
+
+#else
+
+static void lfs_list_push (lfstack_t * lfs, volatile ktagptr_t * list, lfnode_t * first, lfnode_t * last)
+{
+    EnterCriticalSection(&lfs->lock);
+    last->next = list->ptr;
+    list->ptr = first;
+    LeaveCriticalSection(&lfs->lock);
+}
+
+static lfnode_t * lfs_list_pop (lfstack_t * lfs, volatile ktagptr_t * list)
+{
+    lfnode_t  * node = NULL;
+
+    EnterCriticalSection(&lfs->lock);
+    node = list->ptr;
+    if (node) list->ptr = node->next;
+    LeaveCriticalSection(&lfs->lock);
+
+    return node;
+}
+
+static lfnode_t * lfs_list_take (lfstack_t * lfs, volatile ktagptr_t * list)
+{
+    lfnode_t  * node = NULL;
+
+    EnterCriticalSection(&lfs->lock);
+    node = list->ptr;
+    list->ptr = NULL;
+    LeaveCriticalSection(&lfs->lock);
+
+    return node;
+}
+
+#endif
+
+
+lfstack_t * lfstack_new ()
+{
+    lfstack_t * lfs = NULL;
+
+    lfs = koszmalloc(sizeof(*lfs));
+    if (!lfs) return NULL;
+
+    if (((ulong)lfs & 15) != 0) {
+        kosfree(lfs);
+        return NULL;
+    }
+
+#ifndef KATOMIC_HAVE_CAS2
+    InitializeCriticalSection(&lfs->lock);
+#endif
+
+    return lfs;
+}
+
+void lfstack_free (lfstack_t * lfs)
+{
+    LFBlock * blk = NULL;
+
+    if (!lfs) return;
+
+    while ((blk = lfs->blklist) != NULL) {
+        lfs->blklist = blk->next;
+        kosfree(blk);
+    }
+
+#ifndef KATOMIC_HAVE_CAS2
+    DeleteCriticalSection(&lfs->lock);
+#endif
+
+    kosfree(lfs);
+}
+
+static lfnode_t * lfs_node_get (lfstack_t * lfs)
+{
+    LFBlock   * blk = NULL;
+    lfnode_t  * node = NULL;
+    int         i;
+
+    node = lfs_list_pop(lfs, &lfs->idle);
+    if (node) return node;
+
+    /* no idle node, allocate a block of nodes. the first one is returned and
+       the others are pushed into idle list in one go */
+    blk = koszmalloc(sizeof(*blk));
+    if (!blk) return NULL;
+
+    for (i = 1; i < LFSTACK_BLKNODES - 1; i++)
+        blk->node[i].next = &blk->node[i + 1];
+
+    blk->next = katomic_load_relaxed((LFBlock **)&lfs->blklist);
+    while (!katomic_cas((LFBlock **)&lfs->blklist, &blk->next, blk));
+
+    katomic_add_relaxed(&lfs->nodenum, LFSTACK_BLKNODES);
+
+    lfs_list_push(lfs, &lfs->idle, &blk->node[1], &blk->node[LFSTACK_BLKNODES - 1]);
+
+    return &blk->node[0];
+}
+
+int lfstack_push (lfstack_t * lfs, void * value)
+{
+    lfnode_t  * node = NULL;
+
+    if (!lfs) return -1;
+
+    node = lfs_node_get(lfs);
+    if (!node) return -2;
+
+    node->value = value;
+    lfs_list_push(lfs, &lfs->head, node, node);
+
+    katomic_add_relaxed(&lfs->num, 1);
+
+    return 0;
+}
+
+void * lfstack_pop (lfstack_t * lfs)
+{
+    lfnode_t  * node = NULL;
+    void      * value = NULL;
+
+    if (!lfs) return NULL;
+
+    node = lfs_list_pop(lfs, &lfs->head);
+    if (!node) return NULL;
+
+    katomic_add_relaxed(&lfs->num, -1);
+
+    value = node->value;
+    lfs_list_push(lfs, &lfs->idle, node, node);
+
+    return value;
+}
+
+int lfstack_num (lfstack_t * lfs)
+{
+    int  num = 0;
+
+    if (!lfs) return 0;
+
+    num = katomic_load_relaxed(&lfs->num);
+
+    return num > 0 ? num : 0;
+}
+
+lfnode_t * lfstack_detach (lfstack_t * lfs)
+{
+    lfnode_t  * chain = NULL;
+    lfnode_t  * node = NULL;
+    int         num = 0;
+
+    if (!lfs) return NULL;
+
+    chain = lfs_list_take(lfs, &lfs->head);
+
+    for (node = chain; node; node = node->next) num++;
+    if (num > 0) katomic_add_relaxed(&lfs->num, -num);
+
+    return chain;
+}
+
+void lfstack_attach (lfstack_t * lfs, lfnode_t * chain)
+{
+    lfnode_t  * last = NULL;
+    int         num = 0;
+
+    if (!lfs || !chain) return;
+
+    for (last = chain, num = 1; last->next; last = last->next) num++;
+
+    lfs_list_push(lfs, &lfs->head, chain, last);
+
+    katomic_add_relaxed(&lfs->num, num);
+}
+
@@ -31,6 +31,11 @@
 #include <string.h>
 
 #include "memblock.h"
+#include "memory.h"
+#include "mthread.h"
+#include "bitarr.h"
+#include "poolstat.h"
+#include "trace.h"
 
 
 typedef struct MemBlock_ {
@@ -569,3 +574,448 @@ void mem_block_print (void * psb, FILE * fp)
 
     fprintf(fp, "\n----------------------------------------------------------------------------------------------------\n");
 }
+
+
+
+typedef struct mem_slab_s {
+    struct mem_slab_s       * prev;
+    struct mem_slab_s       * next;
+
+    struct mem_slab_cache_s * cache;
+    uint8                     listtype; //0-idle list 1-partial list 2-full list
+
+    int                       inuse;    //units handed out
+    int                       freetop;  //number of indexes in free-index stack
+    int                       color;    //offset in bytes of the first unit
+
+    uint8                   * storage;
+    bitarr_t                * bitar;    //bit value 1 indicates the unit is idle
+
+    int                       freeind[1];
+} MemSlab;
+
+typedef struct mem_slab_cache_s {
+    CRITICAL_SECTION   slabCS;
+
+    int                unitsize;
+    int                slabsize;   //power of 2, slab is aligned to this size
+    int                unitnum;    //units number of one slab
+    int                hdrsize;    //slab header size including free-index stack and bit array
+    int                bitarsize;
+
+    int                colorstep;  //color offset increment, equal to cache line size
+    int                colormax;   //maximal color offset
+    int                colornext;  //color offset of next new slab
+
+    SlabUnitCtor     * ctor;
+    SlabUnitDtor     * dtor;
+
+    MemSlab          * idle;       //slabs without any unit handed out
+    MemSlab          * partial;
+    MemSlab          * full;
+
+    int                slabnum;
+    int                idlenum;
+    int                inuse;
+
+    PoolStat           stat;
+} MemSlabCache;
+
+
+static void mem_slab_list_del (MemSlabCache * cache, MemSlab * slab)
+{
+    MemSlab ** phead = NULL;
+
+    if (slab->listtype == 0) phead = &cache->idle;
+    else if (slab->listtype == 1) phead = &cache->partial;
+    else phead = &cache->full;
+
+    if (slab->prev) slab->prev->next = slab->next;
+    else *phead = slab->next;
+
+    if (slab->next) slab->next->prev = slab->prev;
+
+    slab->prev = slab->next = NULL;
+
+    if (slab->listtype == 0) cache->idlenum--;
+}
+
+static void mem_slab_list_add (MemSlabCache * cache, MemSlab * slab, int listtype)
+{
+    MemSlab ** phead = NULL;
+
+    if (listtype == 0) phead = &cache->idle;
+    else if (listtype == 1) phead = &cache->partial;
+    else phead = &cache->full;
+
+    slab->listtype = listtype;
+    slab->prev = NULL;
+    slab->next = *phead;
+    if (*phead) (*phead)->prev = slab;
+    *phead = slab;
+
+    if (listtype == 0) cache->idlenum++;
+}
+
+static void * mem_slab_os_alloc (int size)
+{
+    void * p = NULL;
+
+#if defined(_WIN32) || defined(_WIN64)
+    p = _aligned_malloc(size, size);
+#else
+    if (posix_memalign(&p, size, size) != 0)
+        p = NULL;
+#endif
+    return p;
+}
+
+static void mem_slab_os_free (void * p)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static MemSlab * mem_slab_create (MemSlabCache * cache)
+{
+    MemSlab * slab = NULL;
+    uint8   * punit = NULL;
+    int       i;
+
+    slab = mem_slab_os_alloc(cache->slabsize);
+    if (!slab) return NULL;
+
+    memset(slab, 0, cache->hdrsize);
+
+    slab->cache = cache;
+    slab->inuse = 0;
+
+    slab->color = cache->colornext;
+    cache->colornext += cache->colorstep;
+    if (cache->colornext > cache->colormax) cache->colornext = 0;
+
+    slab->storage = (uint8 *)slab + cache->hdrsize + slab->color;
+    slab->bitar = bitarr_from_fixmem((uint8 *)slab + cache->hdrsize - cache->bitarsize,
+                                     cache->bitarsize, cache->unitnum, NULL);
+    bitarr_fill(slab->bitar);
+
+    /* the lower unit indexes are popped out first */
+    for (i = 0; i < cache->unitnum; i++)
+        slab->freeind[i] = cache->unitnum - 1 - i;
+    slab->freetop = cache->unitnum;
+
+    if (cache->ctor) {
+        for (i = 0; i < cache->unitnum; i++) {
+            punit = slab->storage + i * cache->unitsize;
+            (*cache->ctor)(punit);
+        }
+    }
+
+    cache->slabnum++;
+
+    return slab;
+}
+
+static void mem_slab_destroy (MemSlabCache * cache, MemSlab * slab)
+{
+    int  i;
+
+    if (slab->inuse > 0)
+        tolog(1, "Panic: %d units not freed when slab %p unitsize=%d unitnum=%d destroyed\n",
+              slab->inuse, slab, cache->unitsize, cache->unitnum);
+
+    if (cache->dtor) {
+        for (i = 0; i < cache->unitnum; i++)
+            (*cache->dtor)(slab->storage + i * cache->unitsize);
+    }
+
+    cache->slabnum--;
+
+    mem_slab_os_free(slab);
+}
+
+static int mem_slab_cache_stat_snap (void * vcache, PoolSnap * snap)
+{
+    MemSlabCache * cache = (MemSlabCache *)vcache;
+
+    if (!cache || !snap) return -1;
+
+    snap->unitsize = cache->unitsize;
+    snap->allocated = (long)cache->slabnum * cache->unitnum;
+    snap->consumed = cache->inuse;
+    snap->remaining = snap->allocated - cache->inuse;
+    snap->reserved = (long)cache->slabnum * cache->slabsize + sizeof(*cache);
+    snap->peak = cache->stat.peak;
+    snap->blknum = cache->slabnum;
+
+    snap->fetchnum = cache->stat.fetchnum;
+    snap->recyclenum = cache->stat.recyclenum;
+    snap->contention = cache->stat.contention;
+
+    return 0;
+}
+
+
+/* the largest slab, a unit must fit in it along with the slab header */
+#define MEM_SLAB_MAXSIZE  (1024 * 1024)
+
+slabcache_t * mem_slab_cache_new (int unitsize, int align, void * ctor, void * dtor)
+{
+    MemSlabCache * cache = NULL;
+    int            slabsize = 4096;
+    int            hdrsize = 0;
+    int            bitarsize = 0;
+    int            unitnum = 0;
+
+    if (unitsize <= 0 || unitsize > MEM_SLAB_MAXSIZE) return NULL;
+
+    if (align <= 0) align = ADF_ALIGNMENT;
+    if ((align & (align - 1)) != 0 || align > MEM_SLAB_MAXSIZE) return NULL;
+
+    unitsize = align_size(unitsize, align);
+
+    bitarr_from_fixmem(NULL, 0, 1, &bitarsize);
+    hdrsize = align_size(sizeof(MemSlab) + bitarsize, ADF_CACHELINE);
+    if (unitsize > MEM_SLAB_MAXSIZE - hdrsize) return NULL;
+
+    /* a slab holds at least 16 units. the header consists of MemSlab,
+       free-index stack and bit array, and the storage is aligned to the
+       cache line. */
+    for ( ; ; slabsize <<= 1) {
+        unitnum = (slabsize - sizeof(MemSlab)) / (unitsize + sizeof(int));
+        if (unitnum < 1) {
+            if (slabsize >= MEM_SLAB_MAXSIZE) break;
+            continue;
+        }
+
+        bitarr_from_fixmem(NULL, 0, unitnum, &bitarsize);
+        hdrsize = align_size(sizeof(MemSlab) + (unitnum - 1) * sizeof(int) + bitarsize, ADF_CACHELINE);
+
+        while (unitnum > 0 && hdrsize + unitnum * unitsize > slabsize) {
+            unitnum--;
+            bitarr_from_fixmem(NULL, 0, unitnum, &bitarsize);
+            hdrsize = align_size(sizeof(MemSlab) + (unitnum - 1) * sizeof(int) + bitarsize, ADF_CACHELINE);
+        }
+
+        if (unitnum >= 16 || slabsize >= MEM_SLAB_MAXSIZE) break;
+    }
+    if (unitnum < 1) return NULL;
+
+    cache = kzalloc(sizeof(*cache));
+    if (!cache) return NULL;
+
+    InitializeCriticalSection(&cache->slabCS);
+
+    cache->unitsize = unitsize;
+    cache->slabsize = slabsize;
+    cache->unitnum = unitnum;
+    cache->hdrsize = hdrsize;
+    cache->bitarsize = bitarsize;
+
+    cache->colorstep = ADF_CACHELINE;
+    cache->colormax = slabsize - hdrsize - unitnum * unitsize;
+    cache->colormax -= cache->colormax % ADF_CACHELINE;
+    cache->colornext = 0;
+
+    cache->ctor = (SlabUnitCtor *)ctor;
+    cache->dtor = (SlabUnitDtor *)dtor;
+
+    poolstat_register(cache, POOL_TYPE_SLAB, mem_slab_cache_stat_snap);
+
+    return cache;
+}
+
+int mem_slab_cache_free (slabcache_t * cache)
+{
+    MemSlab * slab = NULL;
+
+    if (!cache) return -1;
+
+    poolstat_unregister(cache);
+
+    EnterCriticalSection(&cache->slabCS);
+
+    while ((slab = cache->full)) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_destroy(cache, slab);
+    }
+    while ((slab = cache->partial)) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_destroy(cache, slab);
+    }
+    while ((slab = cache->idle)) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_destroy(cache, slab);
+    }
+
+    LeaveCriticalSection(&cache->slabCS);
+
+    DeleteCriticalSection(&cache->slabCS);
+
+    kfree(cache);
+
+    return 0;
+}
+
+void * mem_slab_alloc (slabcache_t * cache)
+{
+    MemSlab * slab = NULL;
+    uint8   * pmem = NULL;
+    int       ind = 0;
+
+    if (!cache) return NULL;
+
+    poolstat_lock(&cache->slabCS, &cache->stat);
+
+    if ((slab = cache->partial) == NULL) {
+        if ((slab = cache->idle) != NULL) {
+            mem_slab_list_del(cache, slab);
+        } else if ((slab = mem_slab_create(cache)) == NULL) {
+            LeaveCriticalSection(&cache->slabCS);
+            return NULL;
+        }
+        mem_slab_list_add(cache, slab, 1);
+    }
+
+    ind = slab->freeind[--slab->freetop];
+    bitarr_unset(slab->bitar, ind);
+    slab->inuse++;
+
+    if (slab->freetop == 0) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_list_add(cache, slab, 2);
+    }
+
+    cache->inuse++;
+    poolstat_fetch(&cache->stat, cache->inuse);
+
+    LeaveCriticalSection(&cache->slabCS);
+
+    pmem = slab->storage + ind * cache->unitsize;
+    if (!cache->ctor) memset(pmem, 0, cache->unitsize);
+
+    return pmem;
+}
+
+int mem_slab_free (slabcache_t * cache, void * pmem)
+{
+    MemSlab * slab = NULL;
+    long      offset = 0;
+    int       ind = 0;
+
+    if (!cache) return -1;
+    if (!pmem) return -2;
+
+    /* slab is aligned to slabsize, its header is located by address mask */
+    slab = (MemSlab *)((uintptr_t)pmem & ~((uintptr_t)cache->slabsize - 1));
+    if (slab->cache != cache) return -100;
+
+    offset = (uint8 *)pmem - slab->storage;
+    if (offset < 0) return -101;
+    if (offset % cache->unitsize != 0) return -102;
+
+    ind = offset / cache->unitsize;
+    if (ind >= cache->unitnum) return -103;
+
+    poolstat_lock(&cache->slabCS, &cache->stat);
+
+    if (bitarr_get(slab->bitar, ind) == 1) {
+        LeaveCriticalSection(&cache->slabCS);
+        return -200;
+    }
+
+    bitarr_set(slab->bitar, ind);
+    slab->freeind[slab->freetop++] = ind;
+    slab->inuse--;
+
+    if (slab->inuse == 0) {
+        mem_slab_list_del(cache, slab);
+
+        /* keep one idle slab to avoid thrashing on the boundary */
+        if (cache->idlenum > 0) {
+            mem_slab_destroy(cache, slab);
+        } else {
+            mem_slab_list_add(cache, slab, 0);
+        }
+
+    } else if (slab->listtype == 2) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_list_add(cache, slab, 1);
+    }
+
+    cache->inuse--;
+    poolstat_recycle(&cache->stat);
+
+    LeaveCriticalSection(&cache->slabCS);
+
+    return 0;
+}
+
+int mem_slab_cache_shrink (slabcache_t * cache, int keepnum)
+{
+    MemSlab * slab = NULL;
+    int       num = 0;
+
+    if (!cache) return -1;
+
+    if (keepnum < 0) keepnum = 0;
+
+    EnterCriticalSection(&cache->slabCS);
+
+    while (cache->idlenum > keepnum && (slab = cache->idle)) {
+        mem_slab_list_del(cache, slab);
+        mem_slab_destroy(cache, slab);
+        num++;
+    }
+
+    LeaveCriticalSection(&cache->slabCS);
+
+    return num;
+}
+
+int mem_slab_cache_status (slabcache_t * cache, int * slabnum, int * unitnum,
+                           int * inuse, int * slabsize)
+{
+    if (!cache) return -1;
+
+    if (slabnum) *slabnum = cache->slabnum;
+    if (unitnum) *unitnum = cache->unitnum;
+    if (inuse) *inuse = cache->inuse;
+    if (slabsize) *slabsize = cache->slabsize;
+
+    return 0;
+}
+
+void mem_slab_cache_print (slabcache_t * cache, FILE * fp)
+{
+    MemSlab * slab = NULL;
+    MemSlab * list[3];
+    char    * listname[3] = { "Idle", "Partial", "Full" };
+    int       i, j;
+
+    if (!cache) return;
+    if (!fp) fp = stdout;
+
+    EnterCriticalSection(&cache->slabCS);
+
+    fprintf(fp, "Slab Cache: unitsize=%d slabsize=%d unitnum=%d hdrsize=%d colormax=%d "
+                "slabnum=%d idlenum=%d inuse=%d\n",
+            cache->unitsize, cache->slabsize, cache->unitnum, cache->hdrsize,
+            cache->colormax, cache->slabnum, cache->idlenum, cache->inuse);
+
+    list[0] = cache->idle;
+    list[1] = cache->partial;
+    list[2] = cache->full;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0, slab = list[i]; slab; slab = slab->next, j++) {
+            fprintf(fp, "    %s Slab %d: %p color=%d inuse=%d free=%d storage=%p\n",
+                    listname[i], j, slab, slab->color, slab->inuse, slab->freetop, slab->storage);
+        }
+    }
+
+    LeaveCriticalSection(&cache->slabCS);
+}
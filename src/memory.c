@@ -33,6 +33,10 @@
 #include "trace.h"
 #include "kemalloc.h"
 
+#ifdef UNIX
+#include <sys/mman.h>
+#endif
+
 void * g_kmempool = NULL;
 uint8  g_kmempool_init = 0;
 
@@ -433,3 +437,184 @@ void kfreeit (void * ptr)
     kfree(ptr);
 }
 
+
+static long kmem_page_size ()
+{
+    static long pagesize = 0;
+
+    if (pagesize <= 0) {
+#if defined(_WIN32) || defined(_WIN64)
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        pagesize = si.dwPageSize;
+#else
+        pagesize = sysconf(_SC_PAGESIZE);
+#endif
+        if (pagesize <= 0) pagesize = 4096;
+    }
+
+    return pagesize;
+}
+
+typedef struct kmem_fault_s {
+    void   ** pmem;
+    long    * size;
+    int       num;
+    long      pgbgn;   //global index of the first page to be faulted by this thread
+    long      pgend;
+    long      faulted;
+} KmemFault;
+
+static void * kmem_prefault_range (void * arg)
+{
+    KmemFault * kf = (KmemFault *)arg;
+    long        pgsize = kmem_page_size();
+    long        pgnum = 0;
+    long        pgidx = 0;
+    long        bgn, end;
+    uint8     * p = NULL;
+    uint8     * pend = NULL;
+    int         i;
+
+    kf->faulted = 0;
+
+    for (i = 0; i < kf->num && pgidx < kf->pgend; i++) {
+        p = align_ptr(kf->pmem[i], pgsize);
+        pend = (uint8 *)kf->pmem[i] + kf->size[i];
+        if (p >= pend) continue;
+
+        pgnum = (pend - p + pgsize - 1) / pgsize;
+
+        bgn = max(kf->pgbgn, pgidx) - pgidx;
+        end = min(kf->pgend, pgidx + pgnum) - pgidx;
+        pgidx += pgnum;
+        if (bgn >= end) continue;
+
+        p += bgn * pgsize;
+        if (p + (end - bgn) * pgsize < pend)
+            pend = p + (end - bgn) * pgsize;
+
+#if defined(MADV_POPULATE_WRITE)
+        if (madvise(p, pend - p, MADV_POPULATE_WRITE) == 0) {
+            kf->faulted += pend - p;
+            continue;
+        }
+#endif
+        /* reading and writing back the same byte gets the page mapped
+           with private frame, and keeps the content unchanged */
+        for ( ; p < pend; p += pgsize) {
+            *(volatile uint8 *)p = *(volatile uint8 *)p;
+            kf->faulted += min(pgsize, pend - p);
+        }
+    }
+
+    return NULL;
+}
+
+long kmem_prefault (void ** pmem, long * size, int num, int threads)
+{
+    KmemFault   kf[32];
+    long        pgsize = kmem_page_size();
+    long        total = 0;
+    long        faulted = 0;
+    long        step = 0;
+    uint8     * p = NULL;
+    int         i;
+#ifdef UNIX
+    pthread_t   tid[32];
+    uint8       started[32] = {0};
+#endif
+
+    if (!pmem || !size || num <= 0) return 0;
+
+    for (i = 0; i < num; i++) {
+        if (!pmem[i] || size[i] <= 0) continue;
+        p = align_ptr(pmem[i], pgsize);
+        if (p >= (uint8 *)pmem[i] + size[i]) continue;
+        total += ((uint8 *)pmem[i] + size[i] - p + pgsize - 1) / pgsize;
+    }
+    if (total <= 0) return 0;
+
+    if (threads < 1) threads = 1;
+    if (threads > 32) threads = 32;
+    if (threads > total) threads = total;
+
+    step = (total + threads - 1) / threads;
+
+    for (i = 0; i < threads; i++) {
+        kf[i].pmem = pmem;
+        kf[i].size = size;
+        kf[i].num = num;
+        kf[i].pgbgn = i * step;
+        kf[i].pgend = min(total, (i + 1) * step);
+        kf[i].faulted = 0;
+    }
+
+#ifdef UNIX
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tid[i], NULL, kmem_prefault_range, &kf[i]) == 0)
+            started[i] = 1;
+        else
+            kmem_prefault_range(&kf[i]);
+    }
+
+    kmem_prefault_range(&kf[0]);
+
+    for (i = 1; i < threads; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+    }
+#else
+    for (i = 0; i < threads; i++)
+        kmem_prefault_range(&kf[i]);
+#endif
+
+    for (i = 0; i < threads; i++)
+        faulted += kf[i].faulted;
+
+    return faulted;
+}
+
+int kmem_mlock (void * pmem, long size)
+{
+    if (!pmem || size <= 0) return -1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    return VirtualLock(pmem, size) ? 0 : -100;
+#else
+    return mlock(pmem, size) == 0 ? 0 : -100;
+#endif
+}
+
+int kmem_munlock (void * pmem, long size)
+{
+    if (!pmem || size <= 0) return -1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    return VirtualUnlock(pmem, size) ? 0 : -100;
+#else
+    return munlock(pmem, size) == 0 ? 0 : -100;
+#endif
+}
+
+long kmem_trim (void * pmem, long size)
+{
+    long    pgsize = kmem_page_size();
+    uint8 * pbgn = NULL;
+    uint8 * pend = NULL;
+
+    if (!pmem || size <= 0) return 0;
+
+    pbgn = align_ptr(pmem, pgsize);
+    pend = (uint8 *)((uintptr_t)((uint8 *)pmem + size) & ~((uintptr_t)pgsize - 1));
+    if (pbgn >= pend) return 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+    /* MEM_RESET keeps the content undefined instead of zero, it is not used here */
+    return 0;
+#else
+    if (madvise(pbgn, pend - pbgn, MADV_DONTNEED) != 0)
+        return 0;
+
+    return pend - pbgn;
+#endif
+}
@@ -32,9 +32,37 @@
 #include "memory.h"
 #include "hashtab.h"
 #include "strutil.h"
+#include "phash.h"
 #include "mimetype.h"
 
 
+/* the built-in table is indexed by a minimal perfect hash for each lookup key,
+   built once in mime_type_init. items added at runtime go to the hashtabs */
+
+#define MIME_KEY_EXT    0
+#define MIME_KEY_ID     1
+#define MIME_KEY_MIME   2
+
+typedef struct mime_slot_s {
+    void       * key;
+    int          len;
+    MimeItem   * item;
+} MimeSlot;
+
+typedef struct mime_phtab_s {
+    phash_t    * ph;
+    MimeSlot   * slot;
+} MimePHTab;
+
+/* the most requested extensions, packed into one word each, sit in a small
+   table where one multiplier sends every one of them to its own slot */
+#define MIME_HOT_BITS   7
+
+typedef struct mime_hot_s {
+    uint64       key;
+    MimeItem   * item;
+} MimeHot;
+
 typedef struct MimeMgmt_ {
 
     //CRITICAL_SECTION   mimeCS;
@@ -43,6 +71,13 @@ typedef struct MimeMgmt_ {
     hashtab_t          * mimetype_tab;  //key is mime type
     arr_t              * mime_list;
 
+    MimePHTab            ext_ph;        //built-in items by extname
+    MimePHTab            id_ph;         //built-in items by mimeid
+    MimePHTab            mime_ph;       //built-in items by mime type
+
+    uint64               hotmul;
+    MimeHot              hot[1 << MIME_HOT_BITS];
+
 } MimeMgmt;
 
 MimeMgmt * g_mimemgmt = NULL;
@@ -1214,6 +1249,226 @@ static ulong mimeid_hash_func (void * key)
 }
 
 
+static char * g_mime_hot[] = {
+    ".html", ".htm", ".css", ".js", ".json", ".xml", ".txt", ".csv",
+    ".png", ".jpg", ".jpeg", ".gif", ".svg", ".ico", ".webp", ".woff",
+    ".ttf", ".otf", ".eot", ".pdf", ".zip", ".gz", ".tar", ".mp4",
+    ".webm", ".mp3", ".m3u8", ".ts", ".avi", ".mov", ".wav", ".bin"
+};
+
+typedef struct mime_cand_s {
+    uint64       hash;
+    int          seq;
+} MimeCand;
+
+static int mime_cand_cmp (const void * a, const void * b)
+{
+    MimeCand * ca = (MimeCand *)a;
+    MimeCand * cb = (MimeCand *)b;
+
+    if (ca->hash != cb->hash) return ca->hash < cb->hash ? -1 : 1;
+    return ca->seq - cb->seq;
+}
+
+static int mime_item_key (MimeItem * item, int kind, void ** pkey)
+{
+    switch (kind) {
+    case MIME_KEY_EXT:
+        *pkey = item->extname;
+        return str_len(item->extname);
+    case MIME_KEY_MIME:
+        *pkey = item->mime;
+        return str_len(item->mime);
+    default:
+        *pkey = &item->mimeid;
+        return sizeof(item->mimeid);
+    }
+}
+
+static uint64 mime_key_hash (void * key, int len, int kind)
+{
+    uint64  h;
+
+    if (kind != MIME_KEY_ID)
+        return phash_hash(key, len, 1);
+
+    /* one multiply spreads a mimeid well enough for the perfect hash */
+    h = (*(uint32 *)key + PHASH_SEED) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+static void mime_phtab_free (MimePHTab * tab)
+{
+    if (tab->ph) { phash_free(tab->ph); tab->ph = NULL; }
+    if (tab->slot) { kfree(tab->slot); tab->slot = NULL; }
+}
+
+/* the first item of a repeated key wins, as with ht_set */
+static int mime_phtab_build (MimePHTab * tab, MimeItem * items, int num, int kind)
+{
+    MimeCand  * cand = NULL;
+    uint64    * hv = NULL;
+    MimeSlot  * slot = NULL;
+    void      * key = NULL;
+    void      * prev = NULL;
+    int         nocase = (kind != MIME_KEY_ID);
+    int         i, j, len, prevlen = 0;
+    int         ret = -100;
+
+    cand = kalloc(num * sizeof(*cand));
+    hv = kalloc(num * sizeof(*hv));
+    if (!cand || !hv) goto end;
+
+    for (i = 0; i < num; i++) {
+        len = mime_item_key(&items[i], kind, &key);
+        cand[i].hash = mime_key_hash(key, len, kind);
+        cand[i].seq = i;
+    }
+
+    qsort(cand, num, sizeof(*cand), mime_cand_cmp);
+
+    for (i = 0, j = 0; i < num; i++) {
+        len = mime_item_key(&items[cand[i].seq], kind, &key);
+
+        if (j > 0 && cand[j-1].hash == cand[i].hash) {
+            if (len == prevlen && phash_equal(key, prev, len, nocase))
+                continue;
+            goto end;   //two keys of one hash value
+        }
+
+        cand[j] = cand[i];
+        hv[j++] = cand[i].hash;
+        prev = key;
+        prevlen = len;
+    }
+
+    tab->ph = phash_build(hv, j);
+    tab->slot = kzalloc(j * sizeof(MimeSlot));
+    if (!tab->ph || !tab->slot) {
+        mime_phtab_free(tab);
+        goto end;
+    }
+
+    for (i = 0; i < j; i++) {
+        slot = &tab->slot[phash_slot(tab->ph, hv[i])];
+        slot->item = &items[cand[i].seq];
+        slot->len = mime_item_key(slot->item, kind, &slot->key);
+    }
+
+    ret = 0;
+
+end:
+    if (cand) kfree(cand);
+    if (hv) kfree(hv);
+    return ret;
+}
+
+static MimeItem * mime_phtab_find (MimePHTab * tab, void * key, int len, int kind)
+{
+    MimeSlot  * slot = NULL;
+
+    if (!tab->ph || len <= 0) return NULL;
+
+    slot = &tab->slot[phash_slot(tab->ph, mime_key_hash(key, len, kind))];
+
+    if (kind == MIME_KEY_ID)
+        return slot->item->mimeid == *(uint32 *)key ? slot->item : NULL;
+
+    if (slot->len != len || !phash_equal(slot->key, key, len, 1))
+        return NULL;
+
+    return slot->item;
+}
+
+#define MIME_HOT_SLOT(mgmt, w)  (((w) * (mgmt)->hotmul) >> (64 - MIME_HOT_BITS))
+
+static void mime_hot_build (MimeMgmt * mgmt)
+{
+    uint64     key[sizeof(g_mime_hot)/sizeof(g_mime_hot[0])];
+    MimeItem * item[sizeof(g_mime_hot)/sizeof(g_mime_hot[0])];
+    uint8      used[1 << MIME_HOT_BITS];
+    uint64     mul = 0;
+    int        i, num = 0, len, try;
+
+    for (i = 0; i < sizeof(g_mime_hot)/sizeof(g_mime_hot[0]); i++) {
+        len = str_len(g_mime_hot[i]);
+        if (len > 8) continue;
+
+        item[num] = mime_phtab_find(&mgmt->ext_ph, g_mime_hot[i], len, MIME_KEY_EXT);
+        if (!item[num]) continue;
+
+        key[num++] = phash_word(g_mime_hot[i], len, 1);
+    }
+    if (num == 0) return;
+
+    /* odd multipliers are tried until no two hot keys share a slot */
+    for (try = 0; try < 100000; try++) {
+        mul = (0x9E3779B97F4A7C15ULL + 2ULL * try * 0x632BE59BD9B4E019ULL) | 1;
+        memset(used, 0, sizeof(used));
+
+        for (i = 0; i < num; i++) {
+            if (used[(key[i] * mul) >> (64 - MIME_HOT_BITS)]++) break;
+        }
+        if (i == num) break;
+    }
+    if (try >= 100000) return;
+
+    mgmt->hotmul = mul;
+    for (i = 0; i < num; i++) {
+        mgmt->hot[MIME_HOT_SLOT(mgmt, key[i])].key = key[i];
+        mgmt->hot[MIME_HOT_SLOT(mgmt, key[i])].item = item[i];
+    }
+}
+
+static MimeItem * mime_find_ext (MimeMgmt * mgmt, char * ext, int len)
+{
+    MimeItem * item = NULL;
+    MimeHot  * hot = NULL;
+    uint64     w;
+
+    if (len <= 8 && mgmt->hotmul) {
+        w = phash_word(ext, len, 1);
+        hot = &mgmt->hot[MIME_HOT_SLOT(mgmt, w)];
+        if (hot->key == w) return hot->item;
+    }
+
+    item = mime_phtab_find(&mgmt->ext_ph, ext, len, MIME_KEY_EXT);
+    if (!item && ht_num(mgmt->mime_tab) > 0)
+        item = ht_get(mgmt->mime_tab, ext);
+
+    return item;
+}
+
+static MimeItem * mime_find_mime (MimeMgmt * mgmt, char * mime, int len)
+{
+    MimeItem * item = NULL;
+    char       mimebuf[128];
+
+    item = mime_phtab_find(&mgmt->mime_ph, mime, len, MIME_KEY_MIME);
+
+    if (!item && ht_num(mgmt->mimetype_tab) > 0) {
+        if (len > sizeof(mimebuf)-1) len = sizeof(mimebuf)-1;
+        memcpy(mimebuf, mime, len);
+        mimebuf[len] = '\0';
+
+        item = ht_get(mgmt->mimetype_tab, mimebuf);
+    }
+
+    return item;
+}
+
+static MimeItem * mime_find_id (MimeMgmt * mgmt, uint32 mimeid)
+{
+    MimeItem * item = NULL;
+
+    item = mime_phtab_find(&mgmt->id_ph, &mimeid, sizeof(mimeid), MIME_KEY_ID);
+    if (!item && ht_num(mgmt->mimeid_tab) > 0)
+        item = ht_get(mgmt->mimeid_tab, &mimeid);
+
+    return item;
+}
+
+
 void * mime_type_init ()
 {
     MimeMgmt * mgmt = NULL;
@@ -1236,15 +1491,25 @@ void * mime_type_init ()
 
     mgmt->mimetype_tab = ht_only_new(1200, mime_item_cmp_mimetype);
 
+    mgmt->mime_list = arr_new(4);
+
+    mime_phtab_build(&mgmt->ext_ph, g_mime, MIMENUM, MIME_KEY_EXT);
+    mime_phtab_build(&mgmt->id_ph, g_mime, MIMENUM, MIME_KEY_ID);
+    mime_phtab_build(&mgmt->mime_ph, g_mime, MIMENUM, MIME_KEY_MIME);
+
+    mime_hot_build(mgmt);
+
+    /* the hashtabs take the built-in items only if a perfect hash failed */
     for (i = 0; i < MIMENUM; i++) {
         item = &g_mime[i];
 
-        if (ht_get(mgmt->mime_tab, item->extname) == NULL)
+        if (!mgmt->ext_ph.ph && ht_get(mgmt->mime_tab, item->extname) == NULL)
             ht_set(mgmt->mime_tab, item->extname, item);
 
-        ht_set(mgmt->mimeid_tab, &item->mimeid, item);
+        if (!mgmt->id_ph.ph)
+            ht_set(mgmt->mimeid_tab, &item->mimeid, item);
 
-        if (ht_get(mgmt->mimetype_tab, item->mime) == NULL)
+        if (!mgmt->mime_ph.ph && ht_get(mgmt->mimetype_tab, item->mime) == NULL)
             ht_set(mgmt->mimetype_tab, item->mime, item);
     }
 
@@ -1252,6 +1517,32 @@ void * mime_type_init ()
 }
 
 
+static void mime_type_release (MimeMgmt * mgmt)
+{
+    MimeItem * item = NULL;
+    int        i, num;
+
+    num = arr_num(mgmt->mime_list);
+
+    for (i = 0; i < num; i++) {
+        item = arr_value(mgmt->mime_list, i);
+        if (!item) continue;
+
+        kfree(item);
+    }
+    arr_free(mgmt->mime_list);
+
+    mime_phtab_free(&mgmt->ext_ph);
+    mime_phtab_free(&mgmt->id_ph);
+    mime_phtab_free(&mgmt->mime_ph);
+
+    ht_free(mgmt->mimetype_tab);
+    ht_free(mgmt->mime_tab);
+    ht_free(mgmt->mimeid_tab);
+
+    kfree(mgmt);
+}
+
 int mime_type_clean (void * vmgmt)
 {
     MimeMgmt * mgmt = (MimeMgmt *)vmgmt;
@@ -1263,11 +1554,7 @@ int mime_type_clean (void * vmgmt)
         g_mimemgmt_init = 0;
     }
 
-    ht_free(mgmt->mime_tab);
-    ht_free(mgmt->mimeid_tab);
-    ht_free(mgmt->mimetype_tab);
-
-    kfree(mgmt);
+    mime_type_release(mgmt);
     return 0;
 }
  
@@ -1295,26 +1582,10 @@ void * mime_type_alloc (int tabsize)
 void mime_type_free (void * vmgmt)
 {
     MimeMgmt * mgmt = (MimeMgmt *)vmgmt;
-    MimeItem * item = NULL;
-    int        i, num;
 
     if (!mgmt) return;
 
-    num = arr_num(mgmt->mime_list);
-
-    for (i = 0; i < num; i++) {
-        item = arr_value(mgmt->mime_list, i);
-        if (!item) continue;
-
-        kfree(item);
-    }
-    arr_free(mgmt->mime_list);
-
-    ht_free(mgmt->mimetype_tab);
-    ht_free(mgmt->mime_tab);
-    ht_free(mgmt->mimeid_tab);
-
-    kfree(mgmt);
+    mime_type_release(mgmt);
 }
 
 int mime_type_add (void * vmgmt, char * mime, char * ext, uint32 mimeid, uint32 appid)
@@ -1336,17 +1607,17 @@ int mime_type_add (void * vmgmt, char * mime, char * ext, uint32 mimeid, uint32
     item->mimeid = mimeid;
     item->appid = appid;
     
-    if (ht_get(mgmt->mimetype_tab, mime) == NULL) {
+    if (mime_find_mime(mgmt, item->mime, str_len(item->mime)) == NULL) {
         ht_set(mgmt->mimetype_tab, item->mime, item);
         setflag |= 0x01;
     }
 
-    if (ht_get(mgmt->mime_tab, ext) == NULL) {
+    if (mime_find_ext(mgmt, item->extname, str_len(item->extname)) == NULL) {
         ht_set(mgmt->mime_tab, item->extname, item);
         setflag |= 0x02;
     }
 
-    if (mimeid > 0 && ht_get(mgmt->mimeid_tab, &mimeid) == NULL) {
+    if (mimeid > 0 && mime_find_id(mgmt, mimeid) == NULL) {
         ht_set(mgmt->mimeid_tab, &mimeid, item);
         setflag |= 0x04;
     }
@@ -1365,7 +1636,8 @@ int mime_type_get_by_extname (void * vmgmt, char * ext, char ** pmime, uint32 *
     MimeMgmt * mgmt = (MimeMgmt *)vmgmt;
     static char * default_mime = "application/octet-stream";
     MimeItem * item = NULL;
-    char    * p = NULL;
+    char     * p = NULL;
+    int        len = 0;
 
     if (pmime) *pmime = default_mime;
     if (mimeid) *mimeid = 0;
@@ -1374,9 +1646,13 @@ int mime_type_get_by_extname (void * vmgmt, char * ext, char ** pmime, uint32 *
     if (!mgmt) return -1;
     if (!ext) return -2;
 
+    len = str_len(ext);
+    if (len <= 0) return -100;
+
+    /* the extension from the last '.', a single char needs no scanner setup */
     p = ext;
-    if (*p != '.') p = rskipTo(p+str_len(ext)-1, str_len(ext), ".", 1);
-    if (*p == '.') item = ht_get(mgmt->mime_tab, p);
+    if (*p != '.') for (p = ext + len - 1; p > ext && *p != '.'; p--);
+    if (*p == '.') item = mime_find_ext(mgmt, p, ext + len - p);
     if (!item) return -100;
     
     if (pmime) *pmime = item->mime;
@@ -1399,7 +1675,7 @@ int mime_type_get_by_mimeid (void * vmgmt, uint32 mimeid, char ** pmime, char **
 
     if (!mgmt) return -1;
 
-    item = ht_get(mgmt->mimeid_tab, &mimeid);
+    item = mime_find_id(mgmt, mimeid);
     if (!item) return -100;
 
     if (pmime) *pmime = item->mime;
@@ -1415,7 +1691,6 @@ int mime_type_get_by_mime (void * vmgmt, char * mime, char ** pext, uint32 * mim
     MimeMgmt * mgmt = (MimeMgmt *)vmgmt;
     MimeItem * item = NULL;
     static char * default_extname = ".bin";
-    char       mimebuf[128];
     char     * p = NULL;
     int        len = 0;
 
@@ -1426,18 +1701,14 @@ int mime_type_get_by_mime (void * vmgmt, char * mime, char ** pext, uint32 * mim
     if (!mgmt) return -1;
     if (!mime) return -2;
 
-    memset(mimebuf, 0, sizeof(mimebuf));
+    while (*mime == ' ' || *mime == '\t' || *mime == '\r' || *mime == '\n') mime++;
 
-    p = mime + str_len(mime);
-    mime = skipOver(mime, p - mime, " \t\r\n", 4);
-    p = skipTo(mime, p - mime, ";, \t\r\n", 6);
-    if (p) {
-        len = p - mime;
-        if (len > sizeof(mimebuf)-1) len = sizeof(mimebuf)-1;
-        memcpy(mimebuf, mime, len);
-    } else strncpy(mimebuf, mime, sizeof(mimebuf)-1);
+    for (p = mime; *p && *p != ';' && *p != ',' && *p != ' ' &&
+                   *p != '\t' && *p != '\r' && *p != '\n'; p++);
+    len = p - mime;
 
-    item = ht_get(mgmt->mimetype_tab, mimebuf);
+    /* the type is matched in place, mime strings are not lowered or copied */
+    item = mime_find_mime(mgmt, mime, len);
     if (!item) return -100;
 
     if (pext) *pext = item->extname;
@@ -1455,9 +1726,9 @@ void * mime_type_get (void * vmgmt, char * mime, uint32 mimeid, char * ext)
 
     if (!mgmt) return NULL;
 
-    if (!item && mime) item = ht_get(mgmt->mimetype_tab, mime);
-    if (!item && mimeid > 0) item = ht_get(mgmt->mimeid_tab, &mimeid);
-    if (!item && ext) item = ht_get(mgmt->mime_tab, ext);
+    if (!item && mime) item = mime_find_mime(mgmt, mime, str_len(mime));
+    if (!item && mimeid > 0) item = mime_find_id(mgmt, mimeid);
+    if (!item && ext) item = mime_find_ext(mgmt, ext, str_len(ext));
 
     return item;
 }
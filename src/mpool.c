@@ -36,6 +36,8 @@
 #include "bitarr.h"
 #include "frame.h"
 #include "trace.h"
+#include "btime.h"
+#include "poolstat.h"
 
 typedef int (MPUnitInit) (void *);
 typedef int (MPUnitFree) (void *);
@@ -45,6 +47,7 @@ typedef int swap_func_t (void * para, void * busyunit, void * idleunit);
 
 typedef struct mem_cache {
     time_t             stamp;
+    time_t             trimstamp; //time of trimming idle pages last time
     long               size;
     int                remaining;
 
@@ -73,6 +76,7 @@ typedef struct mem_pool_s {
     unsigned           osalloc : 1;
 
     time_t             checktime;
+    int                trimtime; //idle seconds after which idle pages of cache are trimmed
 
     MPUnitInit       * initfunc;
     MPUnitFree       * freefunc;
@@ -83,6 +87,8 @@ typedef struct mem_pool_s {
 
     int                fifosize;
     int                bitarsize;
+
+    PoolStat           stat;
 } mpool_t;
 
 
@@ -261,6 +267,8 @@ void * mem_cache_fetch (mpool_t * mp, MemCache * pca)
 
         mp->consumed += 1;
         if (--mp->remaining < 0) mp->remaining = 0;
+
+        poolstat_fetch(&mp->stat, mp->consumed);
     }
 
     return unit;
@@ -297,6 +305,29 @@ int mem_cache_recycle (mpool_t * mp, MemCache * pca, void * unit)
 }
 
 
+static int mpool_stat_snap (void * vmp, PoolSnap * snap)
+{
+    mpool_t * mp = (mpool_t *)vmp;
+
+    if (!mp || !snap) return -1;
+
+    snap->unitsize = mp->unitsize;
+    snap->allocated = mp->allocated;
+    snap->consumed = mp->consumed;
+    snap->remaining = mp->remaining;
+    snap->reserved = (sizeof(MemCache) + mp->allocnum * mp->unitsize + 2*mp->fifosize + mp->bitarsize)
+                     * arr_num(mp->cache_list) + sizeof(*mp);
+    snap->peak = mp->stat.peak;
+    snap->blknum = arr_num(mp->cache_list);
+
+    snap->fetchnum = mp->stat.fetchnum;
+    snap->recyclenum = mp->stat.recyclenum;
+    snap->contention = mp->stat.contention;
+
+    return 0;
+}
+
+
 mpool_t * mpool_alloc ()
 {
     mpool_t * mp = NULL;
@@ -327,6 +358,8 @@ mpool_t * mpool_alloc ()
     mp->fifosize = 0;
     mp->bitarsize = 0;
 
+    poolstat_register(mp, POOL_TYPE_MPOOL, mpool_stat_snap);
+
     return mp;
 }
 
@@ -358,6 +391,8 @@ mpool_t * mpool_osalloc ()
     mp->fifosize = 0;
     mp->bitarsize = 0;
 
+    poolstat_register(mp, POOL_TYPE_MPOOL, mpool_stat_snap);
+
     return mp;
 }
 
@@ -367,6 +402,8 @@ int mpool_free (mpool_t * mp)
 
     if (!mp) return -1;
 
+    poolstat_unregister(mp);
+
     EnterCriticalSection(&mp->mpCS);
 
     while (arr_num(mp->cache_list) > 0) {
@@ -390,6 +427,33 @@ int mpool_free (mpool_t * mp)
     return 0;
 }
 
+/* return the pages covered by consecutive idle units to the OS. the content of
+   idle units is given up, so the caches of pool with freefunc are not trimmed
+   since the recycled units may hold resources to be freed by freefunc. */
+static long mem_cache_trim (mpool_t * mp, MemCache * pca)
+{
+    long   trimmed = 0;
+    int    i, bgn = -1;
+
+    if (!mp || !pca || mp->freefunc) return 0;
+
+    for (i = 0; i <= mp->allocnum; i++) {
+        if (i < mp->allocnum && bitarr_get(pca->bitar, i) == 1) {
+            if (bgn < 0) bgn = i;
+            continue;
+        }
+
+        if (bgn >= 0) {
+            trimmed += kmem_trim(pca->pmem + bgn * mp->unitsize, (long)(i - bgn) * mp->unitsize);
+            bgn = -1;
+        }
+    }
+
+    pca->trimstamp = time(0);
+
+    return trimmed;
+}
+
 int mpool_check (mpool_t * mp)
 {
     MemCache * pca = NULL; 
@@ -427,6 +491,19 @@ int mpool_check (mpool_t * mp)
         }
     }
 
+    if (mp->trimtime > 0 && !mp->freefunc) {
+        num = arr_num(mp->cache_list);
+        for (i = 0; i < num; i++) {
+            pca = arr_value(mp->cache_list, i);
+            if (!pca || pca->remaining <= 0) continue;
+
+            if (curt - pca->stamp < mp->trimtime || pca->trimstamp >= pca->stamp)
+                continue;
+
+            mem_cache_trim(mp, pca);
+        }
+    }
+
     mp->checktime = curt;
 
     LeaveCriticalSection(&mp->mpCS);
@@ -524,7 +601,7 @@ void * mpool_fetch (mpool_t * mp)
     if (!mp) return NULL;
     if (mp->unitsize < 1) return NULL;
  
-    EnterCriticalSection(&mp->mpCS);
+    poolstat_lock(&mp->mpCS, &mp->stat);
 
     num = arr_num(mp->cache_list);
     for (i = 0; i < num; i++) {
@@ -578,7 +655,7 @@ int mpool_recycle (mpool_t * mp, void * unit)
     if (!mp) return -1;
     if (!unit) return -2;
 
-    EnterCriticalSection(&mp->mpCS);
+    poolstat_lock(&mp->mpCS, &mp->stat);
 
     pca = arr_find_by(mp->sort_cache_list, unit, mem_cache_cmp_unit);
     if (!pca || (index = mem_cache_index(mp, pca, unit)) < 0 || bitarr_get(pca->bitar, index) == 1) {
@@ -598,6 +675,8 @@ int mpool_recycle (mpool_t * mp, void * unit)
     mp->remaining += 1;
     mp->consumed -= 1;
 
+    poolstat_recycle(&mp->stat);
+
     LeaveCriticalSection(&mp->mpCS);
 
     if (mp->freefunc && mp->usizefunc && mp->freesize > 0) {
@@ -611,6 +690,99 @@ int mpool_recycle (mpool_t * mp, void * unit)
 }
 
  
+int mpool_warmup (mpool_t * mp, int unitnum, int flags, int threads, long * pms)
+{
+    MemCache * pca = NULL;
+    void    ** pmem = NULL;
+    long     * size = NULL;
+    btime_t    tick;
+    int        i, num = 0, blknum = 0;
+
+    if (pms) *pms = 0;
+
+    if (!mp) return -1;
+    if (mp->unitsize < 1 || mp->allocnum < 1) return -2;
+
+    btime(&tick);
+
+    EnterCriticalSection(&mp->mpCS);
+
+    if (unitnum > mp->remaining)
+        blknum = (unitnum - mp->remaining + mp->allocnum - 1) / mp->allocnum;
+
+    if (blknum > 0) {
+        pmem = kosmalloc(blknum * sizeof(void *));
+        size = kosmalloc(blknum * sizeof(long));
+    }
+
+    for (i = 0; i < blknum && pmem && size; i++) {
+        pca = mem_cache_alloc(mp);
+        if (!pca) break;
+
+        arr_push(mp->cache_list, pca);
+        arr_insert_by(mp->sort_cache_list, pca, mem_cache_cmp_mem_cache);
+
+        pmem[num] = pca->pmem;
+        size[num] = pca->size;
+        num++;
+    }
+
+    /* the new caches are faulted within the lock, since the units handed
+       out by other threads must not be touched meanwhile */
+    if (num > 0 && (flags & KMEM_PREFAULT))
+        kmem_prefault(pmem, size, num, threads);
+
+    if (flags & KMEM_MLOCK) {
+        for (i = 0; i < num; i++)
+            kmem_mlock(pmem[i], size[i]);
+    }
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    if (pmem) kosfree(pmem);
+    if (size) kosfree(size);
+
+    if (pms) *pms = btime_diff_now(&tick);
+
+    return num * mp->allocnum;
+}
+
+long mpool_trim (mpool_t * mp, int idlesec)
+{
+    MemCache * pca = NULL;
+    time_t     curt = 0;
+    long       trimmed = 0;
+    int        i, num;
+
+    if (!mp) return -1;
+
+    curt = time(0);
+
+    EnterCriticalSection(&mp->mpCS);
+
+    num = arr_num(mp->cache_list);
+    for (i = 0; i < num; i++) {
+        pca = arr_value(mp->cache_list, i);
+        if (!pca || pca->remaining <= 0) continue;
+
+        if (curt - pca->stamp < idlesec) continue;
+
+        trimmed += mem_cache_trim(mp, pca);
+    }
+
+    LeaveCriticalSection(&mp->mpCS);
+
+    return trimmed;
+}
+
+int mpool_set_trimtime (mpool_t * mp, int idlesec)
+{
+    if (!mp) return -1;
+
+    mp->trimtime = idlesec;
+    return 0;
+}
+
 int mpool_set_allocnum (mpool_t * mp, int num)
 {
     if (!mp) return -1;
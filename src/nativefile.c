@@ -31,6 +31,7 @@
 #include "memory.h"
 #include "nativefile.h"
 #include "fileop.h"
+#include "asyncio.h"
 
 #ifdef UNIX
 
@@ -375,6 +376,89 @@ int native_file_remove (char * nfile)
     return unlink(nfile);
 }
 
+
+typedef struct native_file_aio_s {
+    NativeFile   * hfile;
+    int64          offset;
+    uint8          iswrite;
+    AsyncIOCB    * cb;
+    void         * cbpara;
+} NFileAIO;
+
+static void native_file_aio_done (void * para, int64 result)
+{
+    NFileAIO   * nfa = (NFileAIO *)para;
+    NativeFile * hfile = nfa->hfile;
+
+    if (result > 0) {
+        EnterCriticalSection(&hfile->fileCS);
+        if (nfa->offset + result > hfile->offset)
+            hfile->offset = nfa->offset + result;
+        if (nfa->iswrite && hfile->offset > hfile->size)
+            hfile->size = hfile->offset;
+        LeaveCriticalSection(&hfile->fileCS);
+    }
+
+    if (nfa->cb) (*nfa->cb)(nfa->cbpara, result);
+
+    kfree(nfa);
+}
+
+static int native_file_aio (NativeFile * hfile, void * pbuf, int size, int iswrite,
+                            void * aio, void * cb, void * cbpara)
+{
+    NFileAIO   * nfa = NULL;
+    int          ret = 0;
+
+    nfa = kzalloc(sizeof(*nfa));
+    if (!nfa) return -5;
+
+    nfa->hfile = hfile;
+    nfa->iswrite = iswrite;
+    nfa->cb = (AsyncIOCB *)cb;
+    nfa->cbpara = cbpara;
+
+    EnterCriticalSection(&hfile->fileCS);
+    nfa->offset = hfile->offset;
+    LeaveCriticalSection(&hfile->fileCS);
+
+    if (iswrite)
+        ret = asyncio_write(aio, hfile->fd, pbuf, size, nfa->offset, native_file_aio_done, nfa);
+    else
+        ret = asyncio_read(aio, hfile->fd, pbuf, size, nfa->offset, native_file_aio_done, nfa);
+
+    if (ret < 0) {
+        kfree(nfa);
+        return -100;
+    }
+
+    return 0;
+}
+
+int native_file_read_async (void * vhfile, void * pbuf, int size, void * aio, void * cb, void * cbpara)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0) return -3;
+    if (!aio) return -4;
+
+    return native_file_aio(hfile, pbuf, size, 0, aio, cb, cbpara);
+}
+
+int native_file_write_async (void * vhfile, void * pbuf, int size, void * aio, void * cb, void * cbpara)
+{
+    NativeFile * hfile = (NativeFile *)vhfile;
+
+    if (!hfile) return -1;
+    if (!pbuf) return -2;
+    if (size < 0) return -3;
+    if (!aio) return -4;
+
+    return native_file_aio(hfile, pbuf, size, 1, aio, cb, cbpara);
+}
+
 #endif
 
 
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "phash.h"
+
+#define PHASH_BUCKET_KEYS  4
+#define PHASH_MAX_DISP     (1 << 24)
+#define PHASH_GOLDEN       0x9E3779B97F4A7C15ULL
+
+/* fold the ASCII upper case letters of 8 bytes to lower case at once */
+static uint64 phash_lower8 (uint64 w)
+{
+    uint64  hept = w & 0x7F7F7F7F7F7F7F7FULL;
+    uint64  ge_a = hept + 0x3F3F3F3F3F3F3F3FULL;     //bit 7 set if >= 'A'
+    uint64  gt_z = hept + 0x2525252525252525ULL;     //bit 7 set if > 'Z'
+    uint64  upper = ~w & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+
+    return w | (upper >> 2);
+}
+
+/* every step leaves all 64 bits mixed, so the high half can pick the bucket */
+#define PHASH_STEP(h, w)  do { (h) = ((h) ^ (w)) * PHASH_GOLDEN; (h) ^= (h) >> 29; } while (0)
+
+uint64 phash_hash_more (uint64 h, void * p, int len, int nocase)
+{
+    uint8  * pbyte = (uint8 *)p;
+    uint64   w = 0;
+    int      i, k;
+
+    if (!pbyte || len <= 0) return h;
+
+    /* 8 bytes a step, the tail is packed into one word with the length */
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, pbyte + i, 8);
+        if (nocase) w = phash_lower8(w);
+        PHASH_STEP(h, w);
+    }
+
+    for (w = 0, k = 0; i < len; i++, k += 8)
+        w |= (uint64)pbyte[i] << k;
+    if (nocase) w = phash_lower8(w);
+
+    w ^= (uint64)len << 56;
+    PHASH_STEP(h, w);
+
+    return h;
+}
+
+uint64 phash_hash (void * p, int len, int nocase)
+{
+    return phash_hash_more(PHASH_SEED, p, len, nocase);
+}
+
+uint64 phash_word (void * p, int len, int nocase)
+{
+    uint8  * pbyte = (uint8 *)p;
+    uint64   w = 0;
+    int      i, k;
+
+    if (!pbyte) return 0;
+    if (len > 8) len = 8;
+
+    for (i = 0, k = 0; i < len; i++, k += 8)
+        w |= (uint64)pbyte[i] << k;
+
+    return nocase ? phash_lower8(w) : w;
+}
+
+int phash_equal (void * a, void * b, int len, int nocase)
+{
+    uint8  * pa = (uint8 *)a;
+    uint8  * pb = (uint8 *)b;
+    uint64   wa = 0, wb = 0;
+    int      i, k;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&wa, pa + i, 8);
+        memcpy(&wb, pb + i, 8);
+        if (wa != wb && (!nocase || phash_lower8(wa) != phash_lower8(wb)))
+            return 0;
+    }
+
+    for (wa = wb = 0, k = 0; i < len; i++, k += 8) {
+        wa |= (uint64)pa[i] << k;
+        wb |= (uint64)pb[i] << k;
+    }
+    if (wa != wb && (!nocase || phash_lower8(wa) != phash_lower8(wb)))
+        return 0;
+
+    return 1;
+}
+
+/* bucket from the high half of the hash, slot from the hash displaced by the
+   bucket and multiplied once more. both are reduced by multiply-shift */
+#define PHASH_BUCKET(h, bnum)  (int)((((h) >> 32) * (uint64)(bnum)) >> 32)
+
+static int phash_place (uint64 h, uint32 d, int num)
+{
+    h = (h ^ ((uint64)d * PHASH_GOLDEN)) * 0xBF58476D1CE4E5B9ULL;
+    return (int)(((h >> 32) * (uint64)num) >> 32);
+}
+
+int phash_slot (phash_t * ph, uint64 h)
+{
+    if (!ph || ph->num <= 0) return 0;
+
+    return phash_place(h, ph->disp[PHASH_BUCKET(h, ph->bnum)], ph->num);
+}
+
+phash_t * phash_build (uint64 * hv, int num)
+{
+    phash_t  * ph = NULL;
+    int      * cnt = NULL;
+    int      * start = NULL;
+    int      * keys = NULL;
+    int      * order = NULL;
+    int      * hist = NULL;
+    int      * slot = NULL;
+    uint8    * used = NULL;
+    int        bnum, maxsize = 0;
+    int        i, j, k, b, n, s;
+    uint32     d;
+    int        ret = -1;
+
+    if (!hv || num <= 0) return NULL;
+
+    bnum = num / PHASH_BUCKET_KEYS + 1;
+
+    ph = kzalloc(sizeof(*ph));
+    cnt = kzalloc((bnum + 1) * sizeof(int));
+    start = kzalloc((bnum + 1) * sizeof(int));
+    keys = kalloc(num * sizeof(int));
+    order = kalloc(bnum * sizeof(int));
+    used = kzalloc(num);
+    if (!ph || !cnt || !start || !keys || !order || !used)
+        goto end;
+
+    ph->num = num;
+    ph->bnum = bnum;
+    ph->disp = kzalloc(bnum * sizeof(uint32));
+    if (!ph->disp) goto end;
+
+    /* group the keys by bucket */
+    for (i = 0; i < num; i++)
+        cnt[PHASH_BUCKET(hv[i], bnum)]++;
+
+    for (b = 0; b < bnum; b++) {
+        start[b + 1] = start[b] + cnt[b];
+        if (cnt[b] > maxsize) maxsize = cnt[b];
+        cnt[b] = 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        b = PHASH_BUCKET(hv[i], bnum);
+        keys[start[b] + cnt[b]++] = i;
+    }
+
+    /* place the biggest buckets first while most slots are still free */
+    hist = kzalloc((maxsize + 2) * sizeof(int));
+    slot = kalloc(maxsize * sizeof(int));
+    if (!hist || !slot) goto end;
+
+    for (b = 0; b < bnum; b++) hist[maxsize - cnt[b] + 1]++;
+    for (s = 1; s <= maxsize + 1; s++) hist[s] += hist[s - 1];
+    for (b = 0; b < bnum; b++) order[hist[maxsize - cnt[b]]++] = b;
+
+    for (i = 0; i < bnum; i++) {
+        b = order[i];
+        n = cnt[b];
+        if (n == 0) break;
+
+        /* equal hash values can never be separated */
+        for (j = 0; j < n; j++) {
+            for (k = j + 1; k < n; k++) {
+                if (hv[keys[start[b] + j]] == hv[keys[start[b] + k]])
+                    goto end;
+            }
+        }
+
+        for (d = 0; d < PHASH_MAX_DISP; d++) {
+            for (j = 0; j < n; j++) {
+                slot[j] = phash_place(hv[keys[start[b] + j]], d, num);
+                if (used[slot[j]]) break;
+
+                for (k = 0; k < j; k++) {
+                    if (slot[k] == slot[j]) break;
+                }
+                if (k < j) break;
+            }
+            if (j == n) break;
+        }
+        if (d >= PHASH_MAX_DISP) goto end;
+
+        ph->disp[b] = d;
+        for (j = 0; j < n; j++) used[slot[j]] = 1;
+    }
+
+    ret = 0;
+
+end:
+    if (cnt) kfree(cnt);
+    if (start) kfree(start);
+    if (keys) kfree(keys);
+    if (order) kfree(order);
+    if (hist) kfree(hist);
+    if (slot) kfree(slot);
+    if (used) kfree(used);
+
+    if (ret < 0) {
+        phash_free(ph);
+        return NULL;
+    }
+
+    return ph;
+}
+
+void phash_free (phash_t * ph)
+{
+    if (!ph) return;
+
+    if (ph->disp) kfree(ph->disp);
+    kfree(ph);
+}
+
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */
+
+#include "btype.h"
+#include "memory.h"
+#include "mthread.h"
+#include "dynarr.h"
+#include "hashtab.h"
+#include "btime.h"
+#include "frame.h"
+#include "json.h"
+#include "poolstat.h"
+
+#ifdef UNIX
+#include <arpa/inet.h>
+#endif
+
+typedef struct pool_stat_entry_s {
+    void            * pool;
+    int               pooltype;
+    PoolSnapFunc    * snapfunc;
+
+    char              name[32];
+
+    /* counters of previous snapshot, used to calculate rates */
+    btime_t           lasttick;
+    uint64            lastfetch;
+    uint64            lastrecycle;
+} PoolStatEntry;
+
+
+#ifdef UNIX
+static INIT_STATIC_CS(g_poolstat_CS);
+#define poolstat_cs_init()
+#else
+static CRITICAL_SECTION g_poolstat_CS;
+static uint8    g_poolstat_csinit = 0;
+#define poolstat_cs_init() do {                           \
+        if (!g_poolstat_csinit) {                         \
+            g_poolstat_csinit = 1;                        \
+            InitializeCriticalSection(&g_poolstat_CS);    \
+        }                                                 \
+    } while (0)
+#endif
+static uint8    g_poolstat_init = 0;
+static arr_t  * g_poolstat_list = NULL;
+
+
+static int pool_stat_entry_cmp_pool (void * a, void * b)
+{
+    PoolStatEntry * ent = (PoolStatEntry *)a;
+    uint8         * pool = (uint8 *)b;
+
+    if (!ent) return -1;
+    if (!pool) return 1;
+
+    if ((uint8 *)ent->pool > pool) return 1;
+    if ((uint8 *)ent->pool < pool) return -1;
+    return 0;
+}
+
+static int pool_stat_entry_cmp_entry (void * a, void * b)
+{
+    PoolStatEntry * enta = (PoolStatEntry *)a;
+    PoolStatEntry * entb = (PoolStatEntry *)b;
+
+    if (!enta) return -1;
+    if (!entb) return 1;
+
+    if ((uint8 *)enta->pool > (uint8 *)entb->pool) return 1;
+    if ((uint8 *)enta->pool < (uint8 *)entb->pool) return -1;
+    return 0;
+}
+
+static char * pool_type_name (int pooltype)
+{
+    switch (pooltype) {
+    case POOL_TYPE_MPOOL:   return "mpool";
+    case POOL_TYPE_BPOOL:   return "bpool";
+    case POOL_TYPE_KEMPOOL: return "kempool";
+    case POOL_TYPE_SLAB:    return "slab";
+    case POOL_TYPE_FRAME:   return "frmpool";
+    }
+    return "unknown";
+}
+
+static void poolstat_init ()
+{
+    if (g_poolstat_init) return;
+
+    /* pools are registered from kmem_alloc_init before the global KemPool works,
+       so the registry itself must use os-specific malloc/free */
+    g_poolstat_list = arr_osalloc(32);
+    g_poolstat_init = 1;
+}
+
+
+int poolstat_register (void * pool, int pooltype, void * snapfunc)
+{
+    PoolStatEntry * ent = NULL;
+
+    if (!pool) return -1;
+    if (!snapfunc) return -2;
+
+    ent = koszmalloc(sizeof(*ent));
+    if (!ent) return -100;
+
+    ent->pool = pool;
+    ent->pooltype = pooltype;
+    ent->snapfunc = (PoolSnapFunc *)snapfunc;
+    snprintf(ent->name, sizeof(ent->name), "%s-%p", pool_type_name(pooltype), pool);
+    btime(&ent->lasttick);
+
+    poolstat_cs_init();
+    EnterCriticalSection(&g_poolstat_CS);
+
+    poolstat_init();
+
+    if (arr_find_by(g_poolstat_list, pool, pool_stat_entry_cmp_pool)) {
+        LeaveCriticalSection(&g_poolstat_CS);
+        kosfree(ent);
+        return 0;
+    }
+
+    arr_insert_by(g_poolstat_list, ent, pool_stat_entry_cmp_entry);
+
+    LeaveCriticalSection(&g_poolstat_CS);
+
+    return 0;
+}
+
+int poolstat_unregister (void * pool)
+{
+    PoolStatEntry * ent = NULL;
+
+    if (!pool) return -1;
+
+    poolstat_cs_init();
+    EnterCriticalSection(&g_poolstat_CS);
+
+    if (g_poolstat_init)
+        ent = arr_delete_by(g_poolstat_list, pool, pool_stat_entry_cmp_pool);
+
+    LeaveCriticalSection(&g_poolstat_CS);
+
+    if (!ent) return -100;
+
+    kosfree(ent);
+    return 0;
+}
+
+int poolstat_set_name (void * pool, char * name)
+{
+    PoolStatEntry * ent = NULL;
+
+    if (!pool) return -1;
+    if (!name) return -2;
+
+    poolstat_cs_init();
+    EnterCriticalSection(&g_poolstat_CS);
+
+    if (g_poolstat_init)
+        ent = arr_find_by(g_poolstat_list, pool, pool_stat_entry_cmp_pool);
+    if (ent)
+        strncpy(ent->name, name, sizeof(ent->name)-1);
+
+    LeaveCriticalSection(&g_poolstat_CS);
+
+    return ent ? 0 : -100;
+}
+
+int poolstat_num ()
+{
+    int  num = 0;
+
+    poolstat_cs_init();
+    EnterCriticalSection(&g_poolstat_CS);
+    if (g_poolstat_init)
+        num = arr_num(g_poolstat_list);
+    LeaveCriticalSection(&g_poolstat_CS);
+
+    return num;
+}
+
+int poolstat_snapshot (PoolSnap * snap, int num)
+{
+    PoolStatEntry * ent = NULL;
+    PoolSnap      * psnap = NULL;
+    btime_t         curt;
+    long            ms = 0;
+    int             i, count, iter = 0;
+
+    if (!snap || num <= 0) return 0;
+
+    btime(&curt);
+
+    poolstat_cs_init();
+    EnterCriticalSection(&g_poolstat_CS);
+
+    count = g_poolstat_init ? arr_num(g_poolstat_list) : 0;
+
+    for (i = 0; i < count && iter < num; i++) {
+        ent = arr_value(g_poolstat_list, i);
+        if (!ent) continue;
+
+        psnap = &snap[iter];
+        memset(psnap, 0, sizeof(*psnap));
+
+        /* the snapshot callbacks read the counters of pools without taking
+           their locks, values may be a little stale but always consistent
+           enough for monitoring */
+        if ((*ent->snapfunc)(ent->pool, psnap) < 0)
+            continue;
+
+        psnap->pooltype = ent->pooltype;
+        memcpy(psnap->name, ent->name, sizeof(psnap->name));
+
+        ms = btime_diff_ms(&ent->lasttick, &curt);
+        if (ms > 0) {
+            psnap->fetchrate = (double)(psnap->fetchnum - ent->lastfetch) * 1000.0 / ms;
+            psnap->recyclerate = (double)(psnap->recyclenum - ent->lastrecycle) * 1000.0 / ms;
+        }
+
+        ent->lasttick = curt;
+        ent->lastfetch = psnap->fetchnum;
+        ent->lastrecycle = psnap->recyclenum;
+
+        iter++;
+    }
+
+    LeaveCriticalSection(&g_poolstat_CS);
+
+    return iter;
+}
+
+static int poolstat_snapshot_all (PoolSnap ** psnap)
+{
+    PoolSnap * snap = NULL;
+    int        num = 0;
+
+    *psnap = NULL;
+
+    /* allocate some more slots in case pools are created meanwhile */
+    num = poolstat_num() + 8;
+
+    snap = kosmalloc(num * sizeof(*snap));
+    if (!snap) return -100;
+
+    num = poolstat_snapshot(snap, num);
+
+    *psnap = snap;
+    return num;
+}
+
+int poolstat_snapshot_json (frame_p frm)
+{
+    PoolSnap * snap = NULL;
+    void     * jobj = NULL;
+    void     * subobj = NULL;
+    int        i, num;
+    int        len = 0;
+
+    if (!frm) return -1;
+
+    num = poolstat_snapshot_all(&snap);
+    if (num < 0) return num;
+
+    jobj = json_init(0, 0, 0);
+    json_add_int64(jobj, "time", -1, (int64)time(0), 0);
+    json_add_int(jobj, "poolnum", -1, num, 0);
+
+    for (i = 0; i < num; i++) {
+        subobj = json_add_obj(jobj, "pools", -1, 1);
+        if (!subobj) continue;
+
+        json_add_str(subobj, "name", -1, snap[i].name, -1, 0);
+        json_add_str(subobj, "type", -1, pool_type_name(snap[i].pooltype), -1, 0);
+        json_add_long(subobj, "unitsize", -1, snap[i].unitsize, 0);
+        json_add_long(subobj, "allocated", -1, snap[i].allocated, 0);
+        json_add_long(subobj, "consumed", -1, snap[i].consumed, 0);
+        json_add_long(subobj, "remaining", -1, snap[i].remaining, 0);
+        json_add_long(subobj, "reserved", -1, snap[i].reserved, 0);
+        json_add_long(subobj, "peak", -1, snap[i].peak, 0);
+        json_add_int(subobj, "blknum", -1, snap[i].blknum, 0);
+        json_add_uint64(subobj, "fetchnum", -1, snap[i].fetchnum, 0);
+        json_add_uint64(subobj, "recyclenum", -1, snap[i].recyclenum, 0);
+        json_add_uint64(subobj, "contention", -1, snap[i].contention, 0);
+        json_add_double(subobj, "fetchrate", -1, snap[i].fetchrate, 0);
+        json_add_double(subobj, "recyclerate", -1, snap[i].recyclerate, 0);
+    }
+
+    kosfree(snap);
+
+    len = json_encode2(jobj, frm);
+
+    json_clean(jobj);
+
+    return len;
+}
+
+static void frame_put_u16 (frame_p frm, uint16 val)
+{
+    val = htons(val);
+    frame_put_nlast(frm, &val, 2);
+}
+
+static void frame_put_u32 (frame_p frm, uint32 val)
+{
+    val = htonl(val);
+    frame_put_nlast(frm, &val, 4);
+}
+
+static void frame_put_u64 (frame_p frm, uint64 val)
+{
+    val = htonll(val);
+    frame_put_nlast(frm, &val, 8);
+}
+
+int poolstat_snapshot_bin (frame_p frm)
+{
+    PoolSnap * snap = NULL;
+    int        i, num;
+    int        len = 0;
+    int        namelen = 0;
+
+    if (!frm) return -1;
+
+    num = poolstat_snapshot_all(&snap);
+    if (num < 0) return num;
+
+    len = frameL(frm);
+
+    frame_put_nlast(frm, "PSTA", 4);
+    frame_put_u16(frm, 1);
+    frame_put_u16(frm, (uint16)num);
+    frame_put_u64(frm, (uint64)time(0));
+
+    for (i = 0; i < num; i++) {
+        namelen = strlen(snap[i].name);
+
+        frame_put_last(frm, snap[i].pooltype);
+        frame_put_last(frm, namelen);
+        frame_put_nlast(frm, snap[i].name, namelen);
+
+        frame_put_u64(frm, (uint64)snap[i].unitsize);
+        frame_put_u64(frm, (uint64)snap[i].allocated);
+        frame_put_u64(frm, (uint64)snap[i].consumed);
+        frame_put_u64(frm, (uint64)snap[i].remaining);
+        frame_put_u64(frm, (uint64)snap[i].reserved);
+        frame_put_u64(frm, (uint64)snap[i].peak);
+        frame_put_u32(frm, (uint32)snap[i].blknum);
+        frame_put_u64(frm, snap[i].fetchnum);
+        frame_put_u64(frm, snap[i].recyclenum);
+        frame_put_u64(frm, snap[i].contention);
+        frame_put_u32(frm, (uint32)snap[i].fetchrate);
+        frame_put_u32(frm, (uint32)snap[i].recyclerate);
+    }
+
+    kosfree(snap);
+
+    return frameL(frm) - len;
+}
+
@@ -664,6 +664,82 @@ int ssl_tcp_writev (void * vssltcp, void * piov, int iovcnt, int * num, int * pe
 }
 
 
+int ssl_ctx_set_ktls (void * vctx, int enable)
+{
+    SSL_CTX  * ctx = (SSL_CTX *)vctx;
+
+    if (!ctx) return -1;
+
+#if defined(SSL_OP_ENABLE_KTLS) && defined(_LINUX_)
+    if (enable)
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    else
+        SSL_CTX_clear_options(ctx, SSL_OP_ENABLE_KTLS);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int ssl_tcp_ktls (void * vssltcp)
+{
+    ssl_tcp_t  * ssltcp = (ssl_tcp_t *)vssltcp;
+    int          flag = 0;
+
+    if (!ssltcp || !ssltcp->ssllink || !ssltcp->ssl) return 0;
+
+#if defined(SSL_OP_ENABLE_KTLS) && defined(_LINUX_)
+    if (BIO_get_ktls_send(SSL_get_wbio(ssltcp->ssl)))
+        flag |= 0x01;
+    if (BIO_get_ktls_recv(SSL_get_rbio(ssltcp->ssl)))
+        flag |= 0x02;
+#endif
+
+    return flag;
+}
+
+#if defined(SSL_OP_ENABLE_KTLS) && defined(_LINUX_)
+
+/* the kernel encrypts the records, file pages go to socket directly without mapping */
+static int ssl_tcp_ktls_sendfile (ssl_tcp_t * ssltcp, int filefd, int64 pos, int64 size, int * num, int * perr)
+{
+    ossl_ssize_t   ret = 0;
+    int64          wlen = 0;
+    int            sslerr = 0;
+
+    for (wlen = 0; wlen < size; ) {
+        ret = SSL_sendfile(ssltcp->ssl, filefd, pos + wlen, min(size - wlen, 1073741824), 0);
+        if (ret > 0) {
+            wlen += ret;
+            continue;
+        }
+
+        if (num) *num = wlen;
+
+        sslerr = SSL_get_error(ssltcp->ssl, ret);
+
+        if (sslerr == SSL_ERROR_WANT_WRITE || sslerr == SSL_ERROR_WANT_READ) {
+            if (perr) *perr = EAGAIN;
+            return wlen;
+        }
+
+        if (sslerr == SSL_ERROR_SYSCALL) {
+            if (perr) *perr = errno;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return wlen;
+        } else {
+            if (perr) *perr = EPROTO;
+        }
+
+        return -30;
+    }
+
+    if (num) *num = wlen;
+
+    return wlen;
+}
+
+#endif
+
 int ssl_tcp_sendfile (void * vssltcp, int filefd, int64 pos, int64 size, int * num, int * perr)
 {
     ssl_tcp_t    * ssltcp = (ssl_tcp_t *)vssltcp;
@@ -693,6 +769,11 @@ int ssl_tcp_sendfile (void * vssltcp, int filefd, int64 pos, int64 size, int * n
         return tcp_sendfile(ssltcp->fd, filefd, pos, size, num, perr);
     }
 
+#if defined(SSL_OP_ENABLE_KTLS) && defined(_LINUX_)
+    if (BIO_get_ktls_send(SSL_get_wbio(ssltcp->ssl)))
+        return ssl_tcp_ktls_sendfile(ssltcp, filefd, pos, size, num, perr);
+#endif
+
     for (wlen = 0; pos + wlen < size; ) {
         onelen = size - wlen;
         if (onelen > mmapsize) onelen = mmapsize;
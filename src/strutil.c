@@ -34,6 +34,7 @@
 #include "patmat.h"
 #include "btime.h"
 #include "frame.h"
+#include "numconv.h"
 
 #ifdef UNIX
 #include <iconv.h>
@@ -609,18 +610,15 @@ int str_atoi (void * p, int len, int * pval)
     uint8  * pbyte = (uint8 *)p;
     int      valsign = 1;
     int      i = 0, val = 0;
+    uint64   uval = 0;
 
     if (!p || len <= 0) return 0;
 
     if (pbyte[i] == '-') { valsign = -1; i++; }
     else if (pbyte[i] == '+') { valsign = 1; i++; }
 
-    for (val = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i += num_atou64(pbyte + i, len - i, &uval);
+    val = (int)uval;
 
     val *= valsign;
 
@@ -634,18 +632,15 @@ int str_atol (void * p, int len, long * pval)
     int      valsign = 1;
     int      i = 0;
     long     val = 0;
+    uint64   uval = 0;
 
     if (!p || len <= 0) return 0;
 
     if (pbyte[i] == '-') { valsign = -1; i++; }
     else if (pbyte[i] == '+') { valsign = 1; i++; }
 
-    for (val = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i += num_atou64(pbyte + i, len - i, &uval);
+    val = (long)uval;
 
     val *= valsign;
 
@@ -659,18 +654,15 @@ int str_atoll (void * p, int len, int64 * pval)
     int      valsign = 1;
     int      i = 0;
     int64    val = 0;
+    uint64   uval = 0;
 
     if (!p || len <= 0) return 0;
 
     if (pbyte[i] == '-') { valsign = -1; i++; }
     else if (pbyte[i] == '+') { valsign = 1; i++; }
 
-    for (val = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i += num_atou64(pbyte + i, len - i, &uval);
+    val = (int64)uval;
 
     val *= valsign;
 
@@ -683,15 +675,12 @@ int str_atou (void * p, int len, uint32 * pval)
     uint8  * pbyte = (uint8 *)p;
     int      i;
     uint32   val = 0;
+    uint64   uval = 0;
 
     if (!p || len <= 0) return 0;
 
-    for (val = 0, i = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i = num_atou64(pbyte, len, &uval);
+    val = (uint32)uval;
 
     if (pval) *pval = val;
     return i;
@@ -702,15 +691,12 @@ int str_atoul (void * p, int len, ulong * pval)
     uint8  * pbyte = (uint8 *)p;
     int      i;
     ulong    val = 0;
+    uint64   uval = 0;
 
     if (!p || len <= 0) return 0;
 
-    for (val = 0, i = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i = num_atou64(pbyte, len, &uval);
+    val = (ulong)uval;
 
     if (pval) *pval = val;
     return i;
@@ -724,12 +710,7 @@ int str_atoull (void * p, int len, uint64 * pval)
 
     if (!p || len <= 0) return 0;
 
-    for (val = 0, i = 0; i < len; i++) {
-        if (pbyte[i] >= '0' && pbyte[i] <= '9')
-            val = val * 10 + (pbyte[i] - '0');
-        else
-            break;
-    }
+    i = num_atou64(pbyte, len, &val);
 
     if (pval) *pval = val;
     return i;
@@ -780,9 +761,9 @@ int str_hextou (void * p, int len, uint32 * pval)
         if (ch >= '0' && ch <= '9')
             val = val * 16 + (ch - '0');
         else if (ch >= 'a' && ch <= 'f')
-            val = val * 16 + (ch - 'a');
+            val = val * 16 + (ch - 'a' + 10);
         else if (ch >= 'A' && ch <= 'F')
-            val = val * 16 + (ch - 'A');
+            val = val * 16 + (ch - 'A' + 10);
         else break; 
     }
 
@@ -1447,6 +1428,221 @@ int bin_to_base64 (void * psrc, int binlen, void * pdst, int * asclen)
 }
 
 
+/* SIMD character-class scanning for the skip family. A set whose bytes fall in no
+   more than 8 distinct high nibbles becomes a pair of PSHUFB nibble tables (AVX2),
+   a set of at most 16 bytes otherwise becomes a PCMPESTRI operand (SSE4.2). CPU
+   features are probed once at run time, short input and other platforms keep
+   the scalar loop. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_STR_SIMD)
+#define STR_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define STR_SIMD_MIN  32
+
+static int str_simd_cpu = -1;   //0-scalar 1-SSE4.2 2-AVX2, probed once
+static int str_simd_use = -1;   //level in use, lowered by str_simd()
+
+int str_simd (int level)
+{
+    int  cpu = 0;
+
+    if (str_simd_cpu < 0) {
+#ifdef STR_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) cpu = 1;
+        if (cpu && __builtin_cpu_supports("avx2")) cpu = 2;
+#endif
+        str_simd_cpu = cpu;
+        if (str_simd_use < 0) str_simd_use = cpu;
+    }
+
+    if (level >= 0)
+        str_simd_use = level < str_simd_cpu ? level : str_simd_cpu;
+
+    return str_simd_use;
+}
+
+#define CSET_HAS(cs, c) ((cs)->map[(c) >> 3] & (1 << ((c) & 7)))
+
+void str_cset_init (str_cset_t * cs, void * vchs, int num)
+{
+    uint8 * chs = (uint8 *)vchs;
+    uint8  hibit[16] = {0};
+    int    level = str_simd_use;
+    int    i, h, nh = 0;
+
+    memset(cs, 0, sizeof(*cs));
+
+    for (i = 0; i < num; i++)
+        cs->map[chs[i] >> 3] |= 1 << (chs[i] & 7);
+
+    if (level < 0) level = str_simd(-1);
+
+    if (level >= 2) {
+        for (i = 0; i < num; i++) {
+            h = chs[i] >> 4;
+            if (!hibit[h]) {
+                if (nh >= 8) break;
+                hibit[h] = (uint8)(1 << nh++);
+            }
+            cs->hi[h] = hibit[h];
+            cs->lo[chs[i] & 0x0F] |= hibit[h];
+        }
+        if (i >= num) {
+            cs->level = 2;
+            return;
+        }
+    }
+
+    if (level >= 1 && num <= 16) {
+        memcpy(cs->set, chs, num);
+        cs->num = num;
+        cs->level = 1;
+        return;
+    }
+
+    cs->level = 0;
+}
+
+#ifdef STR_SIMD
+
+__attribute__((target("avx2")))
+static uint32 str_avx2_mask (str_cset_t * cs, uint8 * p)
+{
+    __m256i  vlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)cs->lo));
+    __m256i  vhi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)cs->hi));
+    __m256i  nib = _mm256_set1_epi8(0x0F);
+    __m256i  v, m;
+
+    v = _mm256_loadu_si256((__m256i *)p);
+    m = _mm256_and_si256(_mm256_shuffle_epi8(vlo, _mm256_and_si256(v, nib)),
+                         _mm256_shuffle_epi8(vhi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+
+    /* bit set for each byte out of the set */
+    return (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2")))
+static int str_avx2_scan (str_cset_t * cs, uint8 * p, int len, int neg)
+{
+    uint32   bits;
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        bits = str_avx2_mask(cs, p + i);
+        if (!neg) bits = ~bits;
+        if (bits) return i + __builtin_ctz(bits);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int str_avx2_rscan (str_cset_t * cs, uint8 * p, int len, int neg)
+{
+    uint32   bits;
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        bits = str_avx2_mask(cs, p - i - 31);
+        if (!neg) bits = ~bits;
+        if (bits) return i + __builtin_clz(bits);
+    }
+
+    return i;
+}
+
+#define SIDD_ANY (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY)
+
+__attribute__((target("sse4.2")))
+static int str_sse42_scan (str_cset_t * cs, uint8 * p, int len, int neg)
+{
+    __m128i  vs = _mm_loadu_si128((__m128i *)cs->set);
+    __m128i  v;
+    int      i, idx;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((__m128i *)(p + i));
+        if (neg)
+            idx = _mm_cmpestri(vs, cs->num, v, 16, SIDD_ANY | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        else
+            idx = _mm_cmpestri(vs, cs->num, v, 16, SIDD_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) return i + idx;
+    }
+
+    return i;
+}
+
+__attribute__((target("sse4.2")))
+static int str_sse42_rscan (str_cset_t * cs, uint8 * p, int len, int neg)
+{
+    __m128i  vs = _mm_loadu_si128((__m128i *)cs->set);
+    __m128i  v;
+    int      i, idx;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((__m128i *)(p - i - 15));
+        if (neg)
+            idx = _mm_cmpestri(vs, cs->num, v, 16, SIDD_ANY | _SIDD_NEGATIVE_POLARITY | _SIDD_MOST_SIGNIFICANT);
+        else
+            idx = _mm_cmpestri(vs, cs->num, v, 16, SIDD_ANY | _SIDD_MOST_SIGNIFICANT);
+        if (idx < 16) return i + 15 - idx;
+    }
+
+    return i;
+}
+
+#endif
+
+/* return the offset of the first byte in the set, or out of it if neg is set.
+   len is returned if not found */
+int str_cset_scan (str_cset_t * cs, void * vp, int len, int neg)
+{
+    uint8 * p = (uint8 *)vp;
+    int     i = 0;
+
+#ifdef STR_SIMD
+    /* the vector loops stop at the last whole block when nothing is hit */
+    if (cs->level == 2) {
+        i = str_avx2_scan(cs, p, len, neg);
+        if (i < (len & ~31)) return i;
+    } else if (cs->level == 1) {
+        i = str_sse42_scan(cs, p, len, neg);
+        if (i < (len & ~15)) return i;
+    }
+#endif
+
+    for ( ; i < len; i++) {
+        if ((CSET_HAS(cs, p[i]) ? 0 : 1) == neg) return i;
+    }
+
+    return len;
+}
+
+/* reversely scan from p towards p - len + 1, return the distance back from p */
+static int str_cset_rscan (str_cset_t * cs, uint8 * p, int len, int neg)
+{
+    int  i = 0;
+
+#ifdef STR_SIMD
+    if (cs->level == 2) {
+        i = str_avx2_rscan(cs, p, len, neg);
+        if (i < (len & ~31)) return i;
+    } else if (cs->level == 1) {
+        i = str_sse42_rscan(cs, p, len, neg);
+        if (i < (len & ~15)) return i;
+    }
+#endif
+
+    for ( ; i < len; i++) {
+        if ((CSET_HAS(cs, *(p - i)) ? 0 : 1) == neg) return i;
+    }
+
+    return len;
+}
+
 static int QuotedStrlen (void * p, int len, int start)
 {
     uint8 * poct = (uint8 *)p;
@@ -1469,6 +1665,60 @@ static int QuotedStrlen (void * p, int len, int start)
 }       
         
 
+/* same as QuotedStrlen, jumping from escape to escape by vector scanning */
+static int str_quoted_len (str_cset_t * qcs, uint8 * poct, int len, int start)
+{
+    int     i = 0;
+
+    for (i = start + 1; i < len; i += 2) {
+        i += str_cset_scan(qcs, poct + i, len - i, 0);
+        if (i >= len) break;
+        if (poct[i] != '\\') return i - start + 1;
+    }
+
+    return 1; //only one quote
+}
+
+static void * skipQuoteToSimd (uint8 * pbyte, int len, uint8 * tochars, int num)
+{
+    uint8       chs[256];
+    str_cset_t  cs, dqcs, sqcs;
+    int         i = 0, j = 0;
+    uint8       ch = 0;
+
+    memcpy(chs, tochars, num);
+    chs[num] = '\\'; chs[num+1] = '"'; chs[num+2] = '\'';
+    str_cset_init(&cs, chs, num + 3);
+
+    chs[0] = '\\'; chs[1] = '"';
+    str_cset_init(&dqcs, chs, 2);
+    chs[1] = '\'';
+    str_cset_init(&sqcs, chs, 2);
+
+    for (i = 0; i < len; ) {
+        i += str_cset_scan(&cs, pbyte + i, len - i, 0);
+        if (i >= len) break;
+
+        ch = pbyte[i];
+        if (ch == '\\' && i + 1 < len) {
+            i += 2;
+            continue;
+        }
+
+        for (j = 0; j < num; j++) {
+            if (tochars[j] == ch) return &pbyte[i];
+        }
+
+        if (ch == '"' || ch == '\'') {
+            i += str_quoted_len(ch == '"' ? &dqcs : &sqcs, pbyte, len, i);
+            continue;
+        }
+        i++;
+    }
+
+    return &pbyte[i];
+}
+
 void * skipQuoteTo (void * p, int len, void * toch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
@@ -1480,6 +1730,9 @@ void * skipQuoteTo (void * p, int len, void * toch, int num)
     if (len <= 0) return pbyte;
     if (!tochars || num <= 0) return pbyte;
 
+    if (len >= STR_SIMD_MIN && num < 253)
+        return skipQuoteToSimd(pbyte, len, tochars, num);
+
     for (i = 0; i < len; ) {
         if (pbyte[i] == '\\' && i + 1 < len) {
             i += 2;
@@ -1534,11 +1787,17 @@ void * skipTo (void * p, int len, void * toch, int num)
     uint8 * pbyte = (uint8 *)p;
     uint8 * tochars = (uint8 *)toch;
     int     i = 0, j = 0;
+    str_cset_t cs;
         
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
     if (!tochars || num <= 0) return pbyte;
     
+    if (len >= STR_SIMD_MIN) {
+        str_cset_init(&cs, tochars, num);
+        return pbyte + str_cset_scan(&cs, pbyte, len, 0);
+    }
+
     for (i = 0; i < len; ) {
         for (j = 0; j < num; j++) {
             if (tochars[j] == pbyte[i]) return &pbyte[i]; 
@@ -1554,11 +1813,27 @@ void * skipEscTo (void * p, int len, void * toch, int num)
     uint8 * pbyte = (uint8 *)p;
     uint8 * tochars = (uint8 *)toch;
     int  i = 0, j = 0;
+    uint8   chs[256];
+    str_cset_t cs;
  
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
     if (!tochars || num <= 0) return pbyte;
  
+    if (len >= STR_SIMD_MIN && num < 256) {
+        memcpy(chs, tochars, num);
+        chs[num] = '\\';
+        str_cset_init(&cs, chs, num + 1);
+
+        /* stop at the characters or escape, skip escaped one and go on */
+        for (i = 0; i < len; i += 2) {
+            i += str_cset_scan(&cs, pbyte + i, len - i, 0);
+            if (i >= len) break;
+            if (pbyte[i] != '\\') return &pbyte[i];
+        }
+        return &pbyte[i];
+    }
+
     for (i = 0; i < len; i++) {
         if (pbyte[i] == '\\') { i++; continue; }
 
@@ -1575,11 +1850,17 @@ void * rskipTo (void * p, int len, void * toch, int num)
     uint8 * pbyte = (uint8 *)p;
     uint8 * tochars = (uint8 *)toch;
     int     i = 0, j = 0;
+    str_cset_t cs;
 
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
     if (!tochars || num <= 0) return pbyte;
 
+    if (len >= STR_SIMD_MIN) {
+        str_cset_init(&cs, tochars, num);
+        return pbyte - str_cset_rscan(&cs, pbyte, len, 0);
+    }
+
     for (i = 0; i < len; i++) {
         for (j = 0; j < num; j++) {
             if (tochars[j] == *(pbyte-i)) return pbyte-i;
@@ -1594,11 +1875,17 @@ void * skipOver (void * p, int len, void * skipch, int num)
     uint8 * pbyte = (uint8 *)p;
     uint8 * skippedchs = (uint8 *)skipch;
     int     i = 0, j = 0;
+    str_cset_t cs;
 
     if (!pbyte) return NULL;
     if (len <= 0) return pbyte;
     if (!skippedchs || num <= 0) return pbyte;
 
+    if (len >= STR_SIMD_MIN) {
+        str_cset_init(&cs, skippedchs, num);
+        return pbyte + str_cset_scan(&cs, pbyte, len, 1);
+    }
+
     for (i = 0; i < len; i++) {
         for (j = 0; j < num; j++) {
             if (skippedchs[j] == pbyte[i]) break;
@@ -1609,16 +1896,79 @@ void * skipOver (void * p, int len, void * skipch, int num)
     return &pbyte[i];
 }
 
+#ifdef STR_SIMD
+
+__attribute__((target("avx2,popcnt")))
+static int str_avx2_count (str_cset_t * cs, uint8 * p, int len, int * pnum)
+{
+    int  i, num = 0;
+
+    for (i = 0; i + 32 <= len; i += 32)
+        num += __builtin_popcount(~str_avx2_mask(cs, p + i));
+
+    *pnum = num;
+    return i;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int str_sse42_count (str_cset_t * cs, uint8 * p, int len, int * pnum)
+{
+    __m128i  vs = _mm_loadu_si128((__m128i *)cs->set);
+    __m128i  v;
+    int      i, num = 0;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((__m128i *)(p + i));
+        num += __builtin_popcount(_mm_cvtsi128_si32(_mm_cmpestrm(vs, cs->num, v, 16, SIDD_ANY | _SIDD_BIT_MASK)));
+    }
+
+    *pnum = num;
+    return i;
+}
+
+#endif
+
+int str_count (void * p, int len, void * chs, int num)
+{
+    uint8    * pbyte = (uint8 *)p;
+    str_cset_t cs;
+    int        i = 0, cnt = 0;
+
+    if (!pbyte || len <= 0) return 0;
+    if (!chs || num <= 0) return 0;
+
+    str_cset_init(&cs, chs, num);
+
+#ifdef STR_SIMD
+    if (len >= STR_SIMD_MIN) {
+        if (cs.level == 2) i = str_avx2_count(&cs, pbyte, len, &cnt);
+        else if (cs.level == 1) i = str_sse42_count(&cs, pbyte, len, &cnt);
+    }
+#endif
+
+    for ( ; i < len; i++) {
+        if (CSET_HAS(&cs, pbyte[i])) cnt++;
+    }
+
+    return cnt;
+}
+
 void * rskipOver (void * p, int rlen, void * skipch, int num)
 {
     uint8 * pbyte = (uint8 *)p;
     uint8 * skippedchs = (uint8 *)skipch;
     int     i = 0, j = 0;
+    str_cset_t cs;
 
     if (!pbyte) return NULL;
     if (rlen <= 0) return pbyte;
     if (!skippedchs || num <= 0) return pbyte;
 
+    if (rlen >= STR_SIMD_MIN) {
+        str_cset_init(&cs, skippedchs, num);
+        return pbyte - str_cset_rscan(&cs, pbyte, rlen, 1);
+    }
+
     for (i = 0; i < rlen; i++) {
         for (j = 0; j < num; j++) {
             if (skippedchs[j] == *(pbyte - i)) break;
@@ -1944,18 +2294,92 @@ void * string_strip_dup (void * p, int bytelen, void * pat, int chlen)
     return pdup;
 }
 
+#ifdef STR_SIMD
+
+#define JSON_ESC_MASK(cmpeq, or, max, v, q, b, c) \
+    or(or(cmpeq(v, q), cmpeq(v, b)), cmpeq(max(v, c), c))
+
+__attribute__((target("avx2")))
+static int json_esc_avx2 (uint8 * p, int len)
+{
+    __m256i  q = _mm256_set1_epi8('"');
+    __m256i  b = _mm256_set1_epi8('\\');
+    __m256i  c = _mm256_set1_epi8(0x1F);
+    __m256i  v;
+    uint32   bits;
+    int      i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((__m256i *)(p + i));
+        bits = (uint32)_mm256_movemask_epi8(JSON_ESC_MASK(_mm256_cmpeq_epi8, _mm256_or_si256,
+                                                          _mm256_max_epu8, v, q, b, c));
+        if (bits) return i + __builtin_ctz(bits);
+    }
+
+    return i;
+}
+
+__attribute__((target("sse4.2")))
+static int json_esc_sse (uint8 * p, int len)
+{
+    __m128i  q = _mm_set1_epi8('"');
+    __m128i  b = _mm_set1_epi8('\\');
+    __m128i  c = _mm_set1_epi8(0x1F);
+    __m128i  v;
+    uint32   bits;
+    int      i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((__m128i *)(p + i));
+        bits = (uint32)_mm_movemask_epi8(JSON_ESC_MASK(_mm_cmpeq_epi8, _mm_or_si128,
+                                                       _mm_max_epu8, v, q, b, c));
+        if (bits) return i + __builtin_ctz(bits);
+    }
+
+    return i;
+}
+
+#endif
+
+/* number of leading bytes that json_escape leaves as they are */
+static int json_escape_run (uint8 * p, int len)
+{
+    int  level = str_simd_use;
+    int  i = 0;
+
+    if (level < 0) level = str_simd(-1);
+
+#ifdef STR_SIMD
+    if (len >= STR_SIMD_MIN) {
+        if (level == 2) i = json_esc_avx2(p, len);
+        else if (level == 1) i = json_esc_sse(p, len);
+    }
+#endif
+
+    for ( ; i < len; i++) {
+        if (p[i] <= 0x1f || p[i] == '"' || p[i] == '\\') break;
+    }
+
+    return i;
+}
+
 int json_escape (void * psrc, int size, void * pdst, int dstlen)
 {
     uint8   * dst = (uint8 *)pdst;
     uint8   * src = (uint8 *)psrc;
     uint8     ch;
     int       len = 0;
+    int       run = 0;
  
     if (!src || size <= 0)
         return 0;
 
     if (dst == NULL) {
         while (size) {
+            run = json_escape_run(src, size);
+            len += run; src += run; size -= run;
+            if (size <= 0) break;
+
             ch = *src++;
  
             if (ch == '\\' || ch == '"') {
@@ -1981,6 +2405,14 @@ int json_escape (void * psrc, int size, void * pdst, int dstlen)
     }
  
     while (size > 0 && len < dstlen) {
+        run = json_escape_run(src, min(size, dstlen - len));
+        if (run > 0) {
+            memcpy(dst, src, run);
+            dst += run; src += run;
+            size -= run; len += run;
+            continue;
+        }
+
         ch = *src++;
         size--;
  
@@ -3007,15 +3439,18 @@ int conv_charset (void * srcst, void * dstst,
     W        The frame_t * argument is printed as string.
  */
 
+/* copy at most dstlen bytes without terminating them, kvsnprintf puts the
+   NUL once at the end */
 int fmt_mem_cpy (uint8 * pdst, int dstlen, uint8 * psrc, int srclen, int width, int leftalg)
 {
-    int i, ret = 0;
+    int i, len, ret = 0;
 
-    if (!pdst) return 0;
+    if (!pdst || dstlen <= 0) return 0;
     if (!psrc || srclen <= 0) return 0;
 
     if (leftalg) {
-        ret += str_secpy(pdst, dstlen, psrc, srclen);
+        ret = min(srclen, dstlen);
+        memcpy(pdst, psrc, ret);
         for (i = srclen; ret < dstlen && i < width; i++) {
             pdst[ret++] = ' ';
         }
@@ -3023,8 +3458,11 @@ int fmt_mem_cpy (uint8 * pdst, int dstlen, uint8 * psrc, int srclen, int width,
         for (i = 0; ret < dstlen && i < width - srclen; i++) {
             pdst[ret++] = ' ';
         }
-        if (ret < dstlen)
-            ret += str_secpy(pdst + ret, dstlen - ret, psrc, srclen);
+        if (ret < dstlen) {
+            len = min(srclen, dstlen - ret);
+            memcpy(pdst + ret, psrc, len);
+            ret += len;
+        }
     }
 
     return ret;
@@ -3085,9 +3523,8 @@ int fmt_conv_numval (uint8 * buf, int len, uint64 val, uint8 dectype, uint8 ** p
         } while(val >>= 4);
 
     } else { //decimal
-        do {
-            *--p = (uint8)((val % 10) + '0'); num++;
-        } while(val /= 10);
+        p = num_u64toa_r(val, p);
+        num = buf + len - 1 - p;
     }
 
     if (ppval) *ppval = p;
@@ -3124,15 +3561,20 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
 
     int       wmlen = 0;
     int       fplen = 0;
+    int       bufsize = 0;
 
     if (dstlen < 0) dstlen = 1024*1024*1024;
     if (!fmt) return -1;
 
+    /* one byte of the buffer is kept for the terminating NUL */
+    bufsize = dstlen;
+    if (pdst) dstlen = dstlen > 0 ? dstlen - 1 : 0;
+
     while (*fmt) {
-        if (pdst && !fp && dstlen >= wmlen) break;
+        if (pdst && !fp && wmlen >= dstlen) break;
 
         if (*fmt != '%') {
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, fmt, 1, 1, 0);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, fmt, 1, 1, 0);
             fplen += fmt_file_cpy(fp, fmt, 1, 1, 0);
 
             fmt++;
@@ -3192,13 +3634,13 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             frm = va_arg(ap, frame_p);
             if (!frm) continue;
 
-            slen = wlen = frm->len;
+            slen = frm->len;
             ptr = (uint8 *)frameP(frm);
 
             if (prec > 0) slen = min(prec, slen);
-            if (width > 0) wlen = max(width, wlen);
+            wlen = max(width, slen);
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, wlen, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, wlen, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, wlen, flag == 2);
             continue;
 
@@ -3207,13 +3649,13 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             cks = va_arg(ap, ckstr_t *);
             if (!cks) continue;
 
-            slen = wlen = cks->len;
+            slen = cks->len;
             ptr = (uint8 *)cks->p;
 
             if (prec > 0) slen = min(prec, slen);
-            if (width > 0) wlen = max(width, wlen);
+            wlen = max(width, slen);
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, wlen, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, wlen, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, wlen, flag == 2);
             continue;
 
@@ -3229,7 +3671,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             }
             wlen = max(width, slen);
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, wlen, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, wlen, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, wlen, flag == 2);
             continue;
 
@@ -3241,7 +3683,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             wlen = slen = 1;
             if (width > 0) wlen = max(width, 1);
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, wlen, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, wlen, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, wlen, flag == 2);
             fmt++;
             continue;
@@ -3272,7 +3714,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             if (lval < 0) { *--ptr = '-'; slen++; }
             else if (flag == 3) { *--ptr = '+';  slen++; } //flag is +
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, width, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             continue;
 
@@ -3307,7 +3749,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
                 else if (dectype == 3) { *--ptr = 'X'; *--ptr = '0'; slen += 2; }
             }
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, width, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             continue;
 
@@ -3329,7 +3771,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             if (flag == 3) { *--ptr = '+';  slen++; } //flag is +
             else if (flag == 5) { *--ptr = ' ';  slen++; } //flag is ' '
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, width, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             continue;
 
@@ -3373,7 +3815,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             if (nega) { *--ptr = '-'; slen++; }
             else if (flag == 3) { *--ptr = '+';  slen++; } //flag is +
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, width, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             continue;
 
@@ -3443,7 +3885,7 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
             if (nega) { *--ptr = '-'; slen++; }
             else if (flag == 3) { *--ptr = '+';  slen++; } //flag is +
 
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, ptr, slen, width, flag == 2);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
             fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             fmt++;
             continue;
@@ -3451,19 +3893,40 @@ int kvsnprintf (void * vdst, int dstlen, FILE * fp, void * vfmt, va_list ap)
         case 'g':
         case 'G':
             fval = va_arg(ap, double);
-            if (prec < 0) prec = 6;
+            ptr = buf + 1;
+
+            if (prec < 0) { //shortest digits reading back to the same value
+                slen = num_dtoa(fval, ptr);
+                if (*fmt == 'G') {
+                    for (ival = 0; ival < slen; ival++) ptr[ival] = toupper(ptr[ival]);
+                }
+            } else {
+                slen = snprintf((char *)ptr, sizeof(buf) - 1, *fmt == 'g' ? "%.*g" : "%.*G", prec, fval);
+                if (slen < 0) slen = 0;
+                if (slen > (int)sizeof(buf) - 2) slen = sizeof(buf) - 2;
+            }
+
+            if (*ptr != '-') {
+                if (flag == 3) { *--ptr = '+';  slen++; } //flag is +
+                else if (flag == 5) { *--ptr = ' ';  slen++; } //flag is ' '
+            }
+
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, ptr, slen, width, flag == 2);
+            fplen += fmt_file_cpy(fp, ptr, slen, width, flag == 2);
             fmt++;
-            break;
+            continue;
 
         case '%':
         default:
-            wmlen += fmt_mem_cpy(pdst, dstlen - wmlen, fmt, 1, 1, 0);
+            wmlen += fmt_mem_cpy(pdst ? pdst + wmlen : NULL, dstlen - wmlen, fmt, 1, 1, 0);
             fplen += fmt_file_cpy(fp, fmt, 1, 1, 0);
             fmt++;
             continue;
         }
     }
 
+    if (pdst && bufsize > 0) pdst[wmlen] = '\0';
+
     if (fp) return fplen;
     return wmlen;
 }
@@ -28,26 +28,108 @@
  */ 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <time.h>
  
 #include "btype.h"
 #include "memory.h"
 #include "fileop.h"
 #include "strutil.h"
+#include "frame.h"
+#include "trace.h"
  
 #ifdef UNIX
 #include "mthread.h"
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
 #endif
 
+#define TRLOG_LINE_MAX   16384      //longer lines are truncated in async mode
+#define TRLOG_BATCH      (256*1024) //bytes gathered for one write by the writer
+#define TRLOG_TLS_NUM    8          //logs one thread keeps its rings for
+
+/* record header in ring, followed by len bytes padded to 8 */
+typedef struct trlog_rec_s {
+    uint32             len;
+    uint32             type;        //0-formatted text
+} trlog_rec_t;
+
+/* single-producer ring owned by one thread and drained by the writer thread */
+typedef struct trlog_ring_s {
+    struct trlog_ring_s * next;
+
+    uint8            * buf;
+    uint32             size;        //power of 2
+    volatile uint64    head;        //advanced by producer
+    volatile uint64    tail;        //advanced by writer
+
+    uint64             dropped;
+    int                owners;      //producer thread and log, freed by the last one
+    volatile int       closed;      //producer thread exited
+} trlog_ring_t;
+
 typedef struct trace_log_ {
     char               logfile[128];
     FILE             * logfp;
     int                logline;
     CRITICAL_SECTION   logCS;
+
+    uint32             logid;
+
+    /* timestamp text cached per second, two slots indexed by the second parity */
+    volatile time_t    tssec[2];
+    char               tsstr[2][24];
+
+    /* async mode: per-thread rings drained by a writer thread */
+    uint8              async;
+    int                ringsize;
+    int                waitus;      //how long a producer waits for room before dropping
+    int                flushms;
+    trlog_ring_t     * rings;
+    CRITICAL_SECTION   ringCS;
+
+    uint64             lines;       //lines written by writer
+    uint64             dropped;     //dropped by released rings
+    uint64             bytes;
+    int                rollreq;     //rollover lines requested, done by writer
+    uint8            * batch;
+    int                batchlen;
+    uint8            * scratch;     //binary record unwrapped from ring
+
+#ifdef UNIX
+    int                wrrun;
+    int                wrsleep;
+    pthread_t          wrthread;
+    pthread_mutex_t    wrmutex;
+    pthread_cond_t     wrcond;
+#endif
 } trlog_t;
 
 void * g_trace_log = NULL;
 
+static uint32 g_trlog_id = 0;
+
+#ifdef UNIX
+typedef struct trlog_tls_s {
+    int                num;
+    struct {
+        trlog_t      * hlog;
+        uint32         logid;
+        trlog_ring_t * ring;
+    } ent[TRLOG_TLS_NUM];
+} trlog_tls_t;
+
+static pthread_once_t  g_trlog_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   g_trlog_key;
+
+static void trlog_ring_release (trlog_ring_t * ring);
+static void trlog_tls_free (void * arg);
+static void trlog_async_stop (trlog_t * hlog);
+#endif
+
+static int trlog_render (trlog_t * hlog, uint8 * rec, int reclen, char * dst, int size);
+
 
 void * trlog_init (char * logfile, int calcline)
 {
@@ -68,6 +150,15 @@ void * trlog_init (char * logfile, int calcline)
         hlog->logline = 0;
 
     InitializeCriticalSection(&hlog->logCS);
+    InitializeCriticalSection(&hlog->ringCS);
+
+#ifdef UNIX
+    hlog->logid = __sync_add_and_fetch(&g_trlog_id, 1);
+    pthread_mutex_init(&hlog->wrmutex, NULL);
+    pthread_cond_init(&hlog->wrcond, NULL);
+#else
+    hlog->logid = ++g_trlog_id;
+#endif
 
     strncpy(hlog->logfile, logfile, sizeof(hlog->logfile)-1);
     hlog->logfp = fopen(hlog->logfile, "a+");
@@ -86,6 +177,13 @@ void trlog_clean (void * vlog)
     if (g_trace_log == hlog)
         g_trace_log = NULL;
 
+#ifdef UNIX
+    trlog_async_stop(hlog);
+    pthread_mutex_destroy(&hlog->wrmutex);
+    pthread_cond_destroy(&hlog->wrcond);
+#endif
+
+    DeleteCriticalSection(&hlog->ringCS);
     DeleteCriticalSection(&hlog->logCS);
 
     if (hlog->logfp) {
@@ -105,13 +203,10 @@ int trlog_line (void * vlog)
     return hlog->logline;
 }
 
-void trlog_rollover (void * vlog, int line)
+static void trlog_do_rollover (trlog_t * hlog, int line)
 {
-    trlog_t   * hlog = (trlog_t *)vlog;
     int         ret;
 
-    EnterCriticalSection(&hlog->logCS);
-
     if (hlog->logfp) fclose(hlog->logfp);
  
     ret = file_rollover(hlog->logfile, line);
@@ -119,34 +214,541 @@ void trlog_rollover (void * vlog, int line)
     if (hlog->logline < 0) hlog->logline = 0;
  
     hlog->logfp = fopen(hlog->logfile, "a+");
+}
 
+void trlog_rollover (void * vlog, int line)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+
+    if (!hlog) return;
+
+#ifdef UNIX
+    /* the writer thread owns the file in async mode, hand the rollover over */
+    if (hlog->async) {
+        pthread_mutex_lock(&hlog->wrmutex);
+        if (hlog->rollreq <= 0) hlog->rollreq = line;
+        pthread_cond_signal(&hlog->wrcond);
+        pthread_mutex_unlock(&hlog->wrmutex);
+        return;
+    }
+#endif
+
+    EnterCriticalSection(&hlog->logCS);
+    trlog_do_rollover(hlog, line);
     LeaveCriticalSection(&hlog->logCS);
 }
 
+/* format "YYYY-MM-DD HH:MM:SS " into buf, localtime is called once per second */
+static int trlog_timefmt (trlog_t * hlog, time_t curt, char * buf)
+{
+    struct tm   st;
+    int         slot;
+
+    slot = (int)(curt & 1);
+
+    if (hlog->tssec[slot] == curt) {
+        memcpy(buf, hlog->tsstr[slot], 20);
+#ifdef UNIX
+        __sync_synchronize();
+#endif
+        /* the slot is rewritten two seconds later at the earliest */
+        if (hlog->tssec[slot] == curt) return 20;
+    }
+
+#ifdef UNIX
+    localtime_r(&curt, &st);
+#else
+    st = *localtime(&curt);
+#endif
+    sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d ",
+            st.tm_year+1900, st.tm_mon+1, st.tm_mday, st.tm_hour, st.tm_min, st.tm_sec);
+
+    hlog->tssec[slot] = 0;
+#ifdef UNIX
+    __sync_synchronize();
+#endif
+    memcpy(hlog->tsstr[slot], buf, 20);
+#ifdef UNIX
+    __sync_synchronize();
+#endif
+    hlog->tssec[slot] = curt;
+
+    return 20;
+}
+
+static int trlog_timestamp (trlog_t * hlog, char * buf)
+{
+    return trlog_timefmt(hlog, time(NULL), buf);
+}
 
-void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...)
+#ifdef UNIX
+
+static void trlog_tls_init ()
+{
+    pthread_key_create(&g_trlog_key, trlog_tls_free);
+}
+
+static void trlog_tls_free (void * arg)
+{
+    trlog_tls_t * tls = (trlog_tls_t *)arg;
+    int           i;
+
+    if (!tls) return;
+
+    /* rings of exited thread are freed by writer once drained */
+    for (i = 0; i < tls->num; i++) {
+        if (!tls->ent[i].ring) continue;
+        tls->ent[i].ring->closed = 1;
+        trlog_ring_release(tls->ent[i].ring);
+    }
+
+    kosfree(tls);
+}
+
+static void trlog_ring_release (trlog_ring_t * ring)
+{
+    if (__sync_sub_and_fetch(&ring->owners, 1) > 0)
+        return;
+
+    if (ring->buf) kosfree(ring->buf);
+    kosfree(ring);
+}
+
+/* return the ring of current thread for the log, allocate it at first use */
+static trlog_ring_t * trlog_ring_get (trlog_t * hlog)
+{
+    trlog_tls_t  * tls = NULL;
+    trlog_ring_t * ring = NULL;
+    int            i, slot = -1;
+
+    pthread_once(&g_trlog_once, trlog_tls_init);
+
+    tls = pthread_getspecific(g_trlog_key);
+    if (!tls) {
+        tls = koszmalloc(sizeof(*tls));
+        if (!tls) return NULL;
+        pthread_setspecific(g_trlog_key, tls);
+    }
+
+    for (i = 0; i < tls->num; i++) {
+        ring = tls->ent[i].ring;
+
+        /* the log is cleaned or its async mode stopped, drop our reference */
+        if (ring && ring->owners == 1) {
+            trlog_ring_release(ring);
+            tls->ent[i].ring = ring = NULL;
+            tls->ent[i].hlog = NULL;
+        }
+
+        if (!ring) {
+            if (slot < 0) slot = i;
+            continue;
+        }
+
+        if (tls->ent[i].hlog == hlog && tls->ent[i].logid == hlog->logid)
+            return ring;
+    }
+    if (slot < 0) {
+        if (tls->num >= TRLOG_TLS_NUM) return NULL;
+        slot = tls->num++;
+    }
+
+    ring = koszmalloc(sizeof(*ring));
+    if (!ring) return NULL;
+
+    ring->size = hlog->ringsize;
+    ring->buf = kosmalloc(ring->size);
+    if (!ring->buf) {
+        kosfree(ring);
+        return NULL;
+    }
+    ring->owners = 2;
+
+    tls->ent[slot].hlog = hlog;
+    tls->ent[slot].logid = hlog->logid;
+    tls->ent[slot].ring = ring;
+
+    EnterCriticalSection(&hlog->ringCS);
+    ring->next = hlog->rings;
+    hlog->rings = ring;
+    LeaveCriticalSection(&hlog->ringCS);
+
+    return ring;
+}
+
+static void trlog_wake_writer (trlog_t * hlog)
+{
+    if (!hlog->wrsleep) return;
+
+    pthread_mutex_lock(&hlog->wrmutex);
+    pthread_cond_signal(&hlog->wrcond);
+    pthread_mutex_unlock(&hlog->wrmutex);
+}
+
+/* copy one record into ring, waiting up to waitus for room. return -1 if dropped */
+static int trlog_ring_put (trlog_t * hlog, trlog_ring_t * ring, int type, void * data, int len)
+{
+    trlog_rec_t  * rec = NULL;
+    uint64         head = ring->head;
+    uint32         need = (sizeof(*rec) + len + 7) & ~7;
+    uint32         pos, n;
+    int            waited = 0;
+
+    while (ring->size - (uint32)(head - ring->tail) < need) {
+        if (waited >= hlog->waitus || !hlog->wrrun) {
+            ring->dropped++;
+            return -1;
+        }
+        trlog_wake_writer(hlog);
+        if (waited < 100) sched_yield();
+        else usleep(50);
+        waited += waited < 100 ? 10 : 50;
+    }
+
+    /* header never wraps since records are 8 aligned and size is power of 2 */
+    pos = (uint32)(head & (ring->size - 1));
+    rec = (trlog_rec_t *)(ring->buf + pos);
+    rec->len = len;
+    rec->type = type;
+
+    pos += sizeof(*rec);
+    if (pos >= ring->size) pos = 0;
+
+    n = ring->size - pos;
+    if (n >= (uint32)len) {
+        memcpy(ring->buf + pos, data, len);
+    } else {
+        memcpy(ring->buf + pos, data, n);
+        memcpy(ring->buf, (uint8 *)data + n, len - n);
+    }
+
+    __sync_synchronize();
+    ring->head = head + need;
+
+    if ((uint32)(ring->head - ring->tail) > ring->size / 2)
+        trlog_wake_writer(hlog);
+
+    return 0;
+}
+
+static void trlog_batch_flush (trlog_t * hlog)
+{
+    int   fd, wlen, ret;
+
+    if (hlog->batchlen <= 0) return;
+
+    EnterCriticalSection(&hlog->logCS);
+    fd = hlog->logfp ? fileno(hlog->logfp) : -1;
+    for (wlen = 0; fd >= 0 && wlen < hlog->batchlen; ) {
+        ret = write(fd, hlog->batch + wlen, hlog->batchlen - wlen);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        wlen += ret;
+    }
+    LeaveCriticalSection(&hlog->logCS);
+
+    hlog->bytes += hlog->batchlen;
+    hlog->batchlen = 0;
+}
+
+/* move the records of one ring into batch buffer, return the records drained */
+static int trlog_ring_drain (trlog_t * hlog, trlog_ring_t * ring)
+{
+    trlog_rec_t  * rec = NULL;
+    uint8        * dst = NULL;
+    uint64         head, tail;
+    uint32         pos, n;
+    int            num = 0;
+
+    head = ring->head;
+    __sync_synchronize();
+    tail = ring->tail;
+
+    while (tail < head) {
+        pos = (uint32)(tail & (ring->size - 1));
+        rec = (trlog_rec_t *)(ring->buf + pos);
+
+        /* binary record is rendered to at most TRLOG_LINE_MAX bytes */
+        if (hlog->batchlen + (int)(rec->type == 1 ? TRLOG_LINE_MAX : rec->len) > TRLOG_BATCH)
+            trlog_batch_flush(hlog);
+
+        pos += sizeof(*rec);
+        if (pos >= ring->size) pos = 0;
+
+        dst = rec->type == 1 ? hlog->scratch : hlog->batch + hlog->batchlen;
+
+        n = ring->size - pos;
+        if (n >= rec->len) {
+            memcpy(dst, ring->buf + pos, rec->len);
+        } else {
+            memcpy(dst, ring->buf + pos, n);
+            memcpy(dst + n, ring->buf, rec->len - n);
+        }
+
+        if (rec->type == 1)
+            hlog->batchlen += trlog_render(hlog, hlog->scratch, rec->len,
+                                           (char *)hlog->batch + hlog->batchlen, TRLOG_LINE_MAX);
+        else
+            hlog->batchlen += rec->len;
+
+        tail += (sizeof(*rec) + rec->len + 7) & ~7;
+        num++;
+    }
+
+    __sync_synchronize();
+    ring->tail = tail;
+
+    return num;
+}
+
+static int trlog_drain_all (trlog_t * hlog)
+{
+    trlog_ring_t * ring = NULL, * prev = NULL, * next = NULL;
+    int            num = 0;
+
+    EnterCriticalSection(&hlog->ringCS);
+    for (ring = hlog->rings; ring; ring = next) {
+        next = ring->next;
+
+        num += trlog_ring_drain(hlog, ring);
+
+        /* the producer thread is gone and everything is written */
+        if (ring->closed && ring->tail == ring->head) {
+            if (prev) prev->next = next;
+            else hlog->rings = next;
+            hlog->dropped += ring->dropped;
+            trlog_ring_release(ring);
+            continue;
+        }
+        prev = ring;
+    }
+    LeaveCriticalSection(&hlog->ringCS);
+
+    trlog_batch_flush(hlog);
+
+    hlog->lines += num;
+    hlog->logline += num;
+
+    return num;
+}
+
+static void * trlog_writer (void * arg)
+{
+    trlog_t         * hlog = (trlog_t *)arg;
+    struct timespec   ts;
+    int               rollreq = 0;
+
+    while (hlog->wrrun) {
+        if (trlog_drain_all(hlog) > 0) continue;
+
+        pthread_mutex_lock(&hlog->wrmutex);
+        rollreq = hlog->rollreq;
+        hlog->rollreq = 0;
+        if (rollreq <= 0 && hlog->wrrun) {
+            hlog->wrsleep = 1;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (long)hlog->flushms * 1000000;
+            ts.tv_sec += ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&hlog->wrcond, &hlog->wrmutex, &ts);
+            hlog->wrsleep = 0;
+        }
+        pthread_mutex_unlock(&hlog->wrmutex);
+
+        if (rollreq > 0) {
+            trlog_drain_all(hlog);
+            EnterCriticalSection(&hlog->logCS);
+            trlog_do_rollover(hlog, rollreq);
+            LeaveCriticalSection(&hlog->logCS);
+        }
+    }
+
+    trlog_drain_all(hlog);
+
+    return NULL;
+}
+
+static void trlog_async_stop (trlog_t * hlog)
+{
+    trlog_ring_t * ring = NULL;
+
+    if (!hlog->async) return;
+
+    hlog->async = 0;
+
+    pthread_mutex_lock(&hlog->wrmutex);
+    hlog->wrrun = 0;
+    pthread_cond_signal(&hlog->wrcond);
+    pthread_mutex_unlock(&hlog->wrmutex);
+
+    pthread_join(hlog->wrthread, NULL);
+
+    /* rings still referenced by producer threads are freed by their TLS */
+    EnterCriticalSection(&hlog->ringCS);
+    while ((ring = hlog->rings) != NULL) {
+        hlog->rings = ring->next;
+        hlog->dropped += ring->dropped;
+        trlog_ring_release(ring);
+    }
+    LeaveCriticalSection(&hlog->ringCS);
+
+    if (hlog->batch) {
+        kosfree(hlog->batch);
+        hlog->batch = NULL;
+    }
+    if (hlog->scratch) {
+        kosfree(hlog->scratch);
+        hlog->scratch = NULL;
+    }
+}
+
+#endif
+
+int trlog_async (void * vlog, int ringsize, int flushms, int waitus)
 {
     trlog_t   * hlog = (trlog_t *)vlog;
-    va_list     args;
-    time_t      curt = 0;
-    struct tm   st;
- 
-    if (!hlog) return;
+#ifdef UNIX
+    int         size = 4096;
+#endif
+
+    if (!hlog) return -1;
+
+#ifdef UNIX
+    trlog_async_stop(hlog);
+    if (ringsize <= 0) return 0;
+
+    while (size < ringsize && size < (64 << 20)) size <<= 1;
+    hlog->ringsize = size;
+
+    hlog->flushms = flushms > 0 ? flushms : 100;
+    hlog->waitus = waitus > 0 ? waitus : 0;
+
+    hlog->batch = kosmalloc(TRLOG_BATCH);
+    if (!hlog->batch) return -2;
+    hlog->batchlen = 0;
+
+    hlog->scratch = kosmalloc(TRLOG_LINE_MAX);
+    if (!hlog->scratch) {
+        kosfree(hlog->batch);
+        hlog->batch = NULL;
+        return -2;
+    }
+
+    if (hlog->logfp) fflush(hlog->logfp);
+
+    hlog->wrrun = 1;
+    if (pthread_create(&hlog->wrthread, NULL, trlog_writer, hlog) != 0) {
+        hlog->wrrun = 0;
+        kosfree(hlog->batch);
+        hlog->batch = NULL;
+        kosfree(hlog->scratch);
+        hlog->scratch = NULL;
+        return -100;
+    }
+    hlog->async = 1;
+
+    return 0;
+#else
+    return -100;
+#endif
+}
+
+int trlog_stat (void * vlog, uint64 * lines, uint64 * dropped, uint64 * bytes)
+{
+    trlog_t      * hlog = (trlog_t *)vlog;
+    trlog_ring_t * ring = NULL;
+    uint64         drop = 0;
+
+    if (!hlog) return -1;
+
+    EnterCriticalSection(&hlog->ringCS);
+    drop = hlog->dropped;
+    for (ring = hlog->rings; ring; ring = ring->next)
+        drop += ring->dropped;
+    LeaveCriticalSection(&hlog->ringCS);
+
+    if (lines) *lines = hlog->lines;
+    if (dropped) *dropped = drop;
+    if (bytes) *bytes = hlog->bytes;
+
+    return hlog->async;
+}
+
+#ifdef UNIX
+
+static int trlog_async_line (trlog_t * hlog, int rectime, char * file, int line, char * fmt, va_list args)
+{
+    trlog_ring_t * ring = NULL;
+    char           buf[2048];
+    char         * pbuf = buf;
+    int            len = 0, ret, size = sizeof(buf);
+    int            maxlen = 0;
+    va_list        args2;
+
+    ring = trlog_ring_get(hlog);
+    if (!ring) return -1;
+
+    maxlen = ring->size / 2 - sizeof(trlog_rec_t);
+    if (maxlen > TRLOG_LINE_MAX) maxlen = TRLOG_LINE_MAX;
+
+    if (rectime) {
+        len = trlog_timestamp(hlog, buf);
+        if (file) len += snprintf(buf + len, size - len, "%s:%d ", file, line);
+    }
+
+    va_copy(args2, args);
+    ret = vsnprintf(buf + len, size - len, fmt, args);
+
+    if (ret >= 0 && len + ret >= size) {
+        /* too long for stack buffer, format again into heap buffer */
+        size = len + ret + 1;
+        if (size > maxlen) size = maxlen;
+        pbuf = kosmalloc(size);
+        if (pbuf) {
+            memcpy(pbuf, buf, len);
+            vsnprintf(pbuf + len, size - len, fmt, args2);
+        }
+        ret = size - 1 - len;
+    }
+    va_end(args2);
+
+    if (ret < 0 || !pbuf) return 0;
+
+    if (len + ret > maxlen) ret = maxlen - len;
+
+    ret = trlog_ring_put(hlog, ring, 0, pbuf, len + ret);
+
+    if (pbuf != buf) kosfree(pbuf);
+
+    return 0;
+}
+
+#endif
+
+static void trlog_vline (trlog_t * hlog, int rectime, char * file, int line, char * fmt, va_list args)
+{
+    char        tsbuf[32];
+#ifdef UNIX
+    va_list     args2;
+    int         ret = 0;
  
+    if (hlog->async) {
+        va_copy(args2, args);
+        ret = trlog_async_line(hlog, rectime, file, line, fmt, args2);
+        va_end(args2);
+        if (ret >= 0) return;
+    }
+#endif
+
     EnterCriticalSection(&hlog->logCS);
  
     if (rectime) {
-        time(&curt);
-        st = *localtime(&curt);
- 
-        fprintf(hlog->logfp, "%04d-%02d-%02d %02d:%02d:%02d ",
-                st.tm_year+1900, st.tm_mon+1, st.tm_mday, st.tm_hour, st.tm_min, st.tm_sec);
+        trlog_timestamp(hlog, tsbuf);
+        fwrite(tsbuf, 1, 20, hlog->logfp);
         if (file) fprintf(hlog->logfp, "%s:%d ", file, line);
     }
  
-    va_start(args, fmt);
     vfprintf(hlog->logfp, fmt, args);
-    va_end(args);
  
     hlog->logline++;
     fflush(hlog->logfp);
@@ -154,6 +756,419 @@ void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...
     LeaveCriticalSection(&hlog->logCS);
 }
 
+void trlogfile (void * vlog, int rectime, char * file, int line, char * fmt, ...)
+{
+    trlog_t   * hlog = (trlog_t *)vlog;
+    va_list     args;
+ 
+    if (!hlog) return;
+ 
+    va_start(args, fmt);
+    trlog_vline(hlog, rectime, file, line, fmt, args);
+    va_end(args);
+}
+
+/* binary log: formats are registered once per call site and parsed into the list
+   of argument classes, the hot path copies raw arguments only */
+
+#define TRLOG_FMT_MAX    8192
+#define TRLOG_ARG_MAX    32
+
+#define TRA_INT     1   //int-sized integer or char
+#define TRA_LONG    2   //long
+#define TRA_LLONG   3   //long long, int64
+#define TRA_PTR     4
+#define TRA_DBL     5   //double
+#define TRA_LDBL    6   //long double, stored as double
+#define TRA_STR     7   //char *, bytes copied
+#define TRA_FRAME   8   //frame_p of kvsnprintf %W, bytes copied
+#define TRA_CKSTR   9   //ckstr_t * of kvsnprintf %V, bytes copied
+#define TRA_SIZE    10  //size_t of %z, stored and rendered as long long
+#define TRA_IMAX    11  //intmax_t of %j, same as above
+#define TRA_PDIFF   12  //ptrdiff_t of %t, same as above
+
+typedef struct trlog_fmt_s {
+    char             * file;
+    int                line;
+    char             * fmt;
+    int                argnum;
+    uint8              args[TRLOG_ARG_MAX];
+} trlog_fmt_t;
+
+/* payload header of binary record, followed by arguments */
+typedef struct trlog_brec_s {
+    uint32             fid;
+    uint32             rectime;
+    int64              sec;
+} trlog_brec_t;
+
+static trlog_fmt_t   * g_trlog_fmt[TRLOG_FMT_MAX];
+static int             g_trlog_fmtnum = 0;
+#ifdef UNIX
+static INIT_STATIC_CS(g_trlog_fmtCS);
+#else
+static CRITICAL_SECTION g_trlog_fmtCS;
+static uint8           g_trlog_fmtinit = 0;
+#endif
+
+/* walk one conversion spec of kvsnprintf syntax starting after '%'.
+   return the bytes of spec, fill the argument classes consumed by it.
+   argnum is set to -1 for a conversion whose arguments are unknown */
+static int trlog_fmt_spec (char * fmt, uint8 * args, int * argnum, char * conv, int * lenfld)
+{
+    char  * p = fmt;
+    int     num = 0;
+
+    while (*p == '0' || *p == '-' || *p == '+' || *p == '#' || *p == ' ' || *p == '\'') p++;
+
+    if (*p == '*') { args[num++] = TRA_INT; p++; }
+    else while (*p >= '0' && *p <= '9') p++;
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') { args[num++] = TRA_INT; p++; }
+        else while (*p >= '0' && *p <= '9') p++;
+    }
+
+    /* 1-h 2-l 3-ll 4-L 5-hh 6-z 7-j 8-t */
+    *lenfld = 0;
+    if (*p == 'h') {
+        *lenfld = 1; p++;
+        if (*p == 'h') { *lenfld = 5; p++; }
+    } else if (*p == 'l') {
+        *lenfld = 2; p++;
+        if (*p == 'l') { *lenfld = 3; p++; }
+    } else if (*p == 'L') { *lenfld = 4; p++; }
+    else if (*p == 'z') { *lenfld = 6; p++; }
+    else if (*p == 'j') { *lenfld = 7; p++; }
+    else if (*p == 't') { *lenfld = 8; p++; }
+
+    *conv = *p;
+
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        if (*lenfld == 2) args[num++] = TRA_LONG;
+        else if (*lenfld == 3) args[num++] = TRA_LLONG;
+        else if (*lenfld == 6) args[num++] = TRA_SIZE;
+        else if (*lenfld == 7) args[num++] = TRA_IMAX;
+        else if (*lenfld == 8) args[num++] = TRA_PDIFF;
+        else if (*lenfld == 4) num = -1;
+        else args[num++] = TRA_INT;
+        break;
+    case 'c':
+        if (*lenfld == 0) args[num++] = TRA_INT;
+        else num = -1;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        if (*lenfld == 4) args[num++] = TRA_LDBL;
+        else if (*lenfld == 0 || *lenfld == 2) args[num++] = TRA_DBL;
+        else num = -1;
+        break;
+    case 'p': case 's': case 'W': case 'V':
+        if (*lenfld != 0) { num = -1; break; }
+        if (*p == 'p') args[num++] = TRA_PTR;
+        else if (*p == 's') args[num++] = TRA_STR;
+        else if (*p == 'W') args[num++] = TRA_FRAME;
+        else args[num++] = TRA_CKSTR;
+        break;
+    case '%':
+        if (num != 0 || *lenfld != 0) num = -1;
+        break;
+    case '\0':
+        *argnum = 0;
+        return (int)(p - fmt);
+    default:
+        num = -1;
+        break;
+    }
+
+    *argnum = num;
+    return (int)(p - fmt) + 1;
+}
+
+int trlog_fmt_register (char * file, int line, char * fmt)
+{
+    trlog_fmt_t * tf = NULL;
+    char        * p = NULL;
+    uint8         args[4];
+    int           i, num, fid = -1;
+    int           lenfld = 0;
+    char          conv = 0;
+
+    if (!fmt) return -1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    if (!g_trlog_fmtinit) {
+        InitializeCriticalSection(&g_trlog_fmtCS);
+        g_trlog_fmtinit = 1;
+    }
+#endif
+
+    EnterCriticalSection(&g_trlog_fmtCS);
+
+    for (i = 0; i < g_trlog_fmtnum; i++) {
+        tf = g_trlog_fmt[i];
+        if (tf->fmt == fmt && tf->line == line && tf->file == file) {
+            fid = i + 1;
+            goto done;
+        }
+    }
+
+    if (g_trlog_fmtnum >= TRLOG_FMT_MAX) goto done;
+
+    tf = kosmalloc(sizeof(*tf));
+    if (!tf) goto done;
+    memset(tf, 0, sizeof(*tf));
+
+    tf->file = file;
+    tf->line = line;
+    tf->fmt = fmt;
+
+    for (p = fmt; *p; ) {
+        if (*p++ != '%') continue;
+
+        p += trlog_fmt_spec(p, args, &num, &conv, &lenfld);
+
+        /* conversions like %n or %ls are left to the text path */
+        if (num < 0 || tf->argnum + num > TRLOG_ARG_MAX) {
+            kosfree(tf);
+            goto done;
+        }
+        for (i = 0; i < num; i++) tf->args[tf->argnum++] = args[i];
+    }
+
+    g_trlog_fmt[g_trlog_fmtnum++] = tf;
+    fid = g_trlog_fmtnum;
+
+done:
+    LeaveCriticalSection(&g_trlog_fmtCS);
+    return fid;
+}
+
+/* copy the arguments as raw bytes, strings are truncated to fit in buffer */
+static int trlog_args_pack (trlog_fmt_t * tf, uint8 * buf, int size, va_list args)
+{
+    int         i, len = 0, slen;
+    int64       lval;
+    double      fval;
+    void      * ptr;
+    uint8     * pstr;
+    frame_p     frm;
+    ckstr_t   * cks;
+
+    for (i = 0; i < tf->argnum; i++) {
+        pstr = NULL; slen = -1;
+
+        switch (tf->args[i]) {
+        case TRA_INT:   lval = va_arg(args, int);       memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_LONG:  lval = va_arg(args, long);      memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_LLONG: lval = va_arg(args, int64);     memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_SIZE:  lval = (int64)va_arg(args, size_t);    memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_IMAX:  lval = (int64)va_arg(args, intmax_t);  memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_PDIFF: lval = (int64)va_arg(args, ptrdiff_t); memcpy(buf + len, &lval, 8); len += 8; continue;
+        case TRA_PTR:   ptr = va_arg(args, void *);     memcpy(buf + len, &ptr, sizeof(ptr)); len += 8; continue;
+        case TRA_DBL:   fval = va_arg(args, double);    memcpy(buf + len, &fval, 8); len += 8; continue;
+        case TRA_LDBL:  fval = (double)va_arg(args, long double); memcpy(buf + len, &fval, 8); len += 8; continue;
+
+        case TRA_STR:
+            pstr = va_arg(args, uint8 *);
+            if (pstr) slen = str_len(pstr);
+            break;
+        case TRA_FRAME:
+            frm = va_arg(args, frame_p);
+            if (frm) { pstr = frameP(frm); slen = frameL(frm); }
+            break;
+        case TRA_CKSTR:
+            cks = va_arg(args, ckstr_t *);
+            if (cks) { pstr = (uint8 *)cks->p; slen = cks->len; }
+            break;
+        }
+
+        /* keep 8 bytes for each argument left */
+        if (slen > size - len - 4 - 8 * (tf->argnum - i))
+            slen = size - len - 4 - 8 * (tf->argnum - i);
+        if (pstr && slen < 0) slen = 0;
+
+        memcpy(buf + len, &slen, 4); len += 4;
+        if (slen > 0) {
+            memcpy(buf + len, pstr, slen);
+            len += slen;
+        }
+    }
+
+    return len;
+}
+
+/* render the text of one binary record by the registered format, integers and
+   floats go through snprintf, strings and the kvsnprintf extensions through it */
+static int trlog_render (trlog_t * hlog, uint8 * rec, int reclen, char * dst, int size)
+{
+    trlog_brec_t * brec = (trlog_brec_t *)rec;
+    trlog_fmt_t  * tf = NULL;
+    uint8        * parg = rec + sizeof(*brec);
+    uint8        * pend = rec + reclen;
+    char         * p = NULL;
+    char           spec[64];
+    uint8          args[4];
+    int            num, lenfld, speclen;
+    int            i, len = 0, ret, ind = 0;
+    int64          ival[3];
+    double         fval;
+    void         * ptr;
+    int            slen;
+    ckstr_t        cks;
+    char           conv = 0;
+
+    if (brec->fid == 0 || brec->fid > (uint32)g_trlog_fmtnum) return 0;
+    tf = g_trlog_fmt[brec->fid - 1];
+
+    if (brec->rectime) {
+        len = trlog_timefmt(hlog, (time_t)brec->sec, dst);
+        if (tf->file) len += snprintf(dst + len, size - len, "%s:%d ", tf->file, tf->line);
+    }
+
+    for (p = tf->fmt; *p && len < size - 1; ) {
+        if (*p != '%') {
+            dst[len++] = *p++;
+            continue;
+        }
+
+        speclen = trlog_fmt_spec(p + 1, args, &num, &conv, &lenfld) + 1;
+        if (speclen >= (int)sizeof(spec) - 1) speclen = sizeof(spec) - 2;
+        memcpy(spec, p, speclen);
+        spec[speclen] = '\0';
+        p += speclen;
+
+        if (num <= 0) {
+            ret = snprintf(dst + len, size - len, "%s", conv == '%' ? "%" : spec);
+            len += ret < size - len ? ret : size - len - 1;
+            continue;
+        }
+
+        /* star arguments come first, then the value */
+        for (i = 0; i < num - 1 && parg + 8 <= pend; i++, parg += 8)
+            memcpy(&ival[i], parg, 8);
+        ind = i;
+
+        ret = 0;
+        switch (args[num - 1]) {
+        case TRA_SIZE: case TRA_IMAX: case TRA_PDIFF:
+            /* z, j or t before the conversion becomes ll */
+            memmove(spec + speclen, spec + speclen - 1, 2);
+            spec[speclen - 2] = spec[speclen - 1] = 'l';
+            speclen++;
+            args[num - 1] = TRA_LLONG;
+            /* fall through */
+
+        case TRA_INT: case TRA_LONG: case TRA_LLONG: case TRA_PTR:
+            if (parg + 8 > pend) return len;
+            memcpy(&ival[ind], parg, 8); parg += 8;
+
+            if (args[num - 1] == TRA_PTR) {
+                memcpy(&ptr, &ival[ind], sizeof(ptr));
+                if (ind == 0) ret = snprintf(dst + len, size - len, spec, ptr);
+                else if (ind == 1) ret = snprintf(dst + len, size - len, spec, (int)ival[0], ptr);
+                else ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], ptr);
+            } else if (args[num - 1] == TRA_INT) {
+                if (ind == 0) ret = snprintf(dst + len, size - len, spec, (int)ival[0]);
+                else if (ind == 1) ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1]);
+                else ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], (int)ival[2]);
+            } else if (args[num - 1] == TRA_LONG) {
+                if (ind == 0) ret = snprintf(dst + len, size - len, spec, (long)ival[0]);
+                else if (ind == 1) ret = snprintf(dst + len, size - len, spec, (int)ival[0], (long)ival[1]);
+                else ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], (long)ival[2]);
+            } else {
+                if (ind == 0) ret = snprintf(dst + len, size - len, spec, (long long)ival[0]);
+                else if (ind == 1) ret = snprintf(dst + len, size - len, spec, (int)ival[0], (long long)ival[1]);
+                else ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], (long long)ival[2]);
+            }
+            break;
+
+        case TRA_DBL: case TRA_LDBL:
+            if (parg + 8 > pend) return len;
+            memcpy(&fval, parg, 8); parg += 8;
+
+            /* long double was narrowed when packed */
+            if (args[num - 1] == TRA_LDBL) {
+                memmove(spec + speclen - 2, spec + speclen - 1, 2);
+                speclen--;
+            }
+            if (ind == 0) ret = snprintf(dst + len, size - len, spec, fval);
+            else if (ind == 1) ret = snprintf(dst + len, size - len, spec, (int)ival[0], fval);
+            else ret = snprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], fval);
+            break;
+
+        case TRA_STR: case TRA_FRAME: case TRA_CKSTR:
+            if (parg + 4 > pend) return len;
+            memcpy(&slen, parg, 4); parg += 4;
+            if (slen < 0) break;   //NULL is printed as nothing, as kvsnprintf does
+            if (parg + slen > pend) return len;
+
+            cks.p = (char *)parg;
+            cks.len = slen;
+            parg += slen;
+
+            /* all of them are rendered as ckstr_t by kvsnprintf */
+            spec[speclen - 1] = 'V';
+            if (ind == 0) ret = ksnprintf(dst + len, size - len, spec, &cks);
+            else if (ind == 1) ret = ksnprintf(dst + len, size - len, spec, (int)ival[0], &cks);
+            else ret = ksnprintf(dst + len, size - len, spec, (int)ival[0], (int)ival[1], &cks);
+            break;
+        }
+
+        if (ret > 0) len += ret < size - len ? ret : size - len - 1;
+    }
+
+    return len;
+}
+
+void trlog_binary (void * vlog, int rectime, int fid, char * fmt, ...)
+{
+    trlog_t      * hlog = (trlog_t *)vlog;
+    trlog_fmt_t  * tf = NULL;
+    trlog_brec_t * brec = NULL;
+    va_list        args;
+    uint8          buf[4096];
+    char           text[8192];
+    int            len = 0;
+#ifdef UNIX
+    trlog_ring_t * ring = NULL;
+#endif
+
+    if (!hlog) return;
+
+    if (fid <= 0 || fid > g_trlog_fmtnum || (tf = g_trlog_fmt[fid - 1]) == NULL) {
+        va_start(args, fmt);
+        trlog_vline(hlog, rectime, NULL, 0, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    brec = (trlog_brec_t *)buf;
+    brec->fid = fid;
+    brec->rectime = rectime;
+    brec->sec = rectime ? (int64)time(NULL) : 0;
+
+    va_start(args, fmt);
+    len = sizeof(*brec) + trlog_args_pack(tf, buf + sizeof(*brec), sizeof(buf) - sizeof(*brec), args);
+    va_end(args);
+
+#ifdef UNIX
+    if (hlog->async && (ring = trlog_ring_get(hlog)) != NULL) {
+        trlog_ring_put(hlog, ring, 1, buf, len);
+        return;
+    }
+#endif
+
+    len = trlog_render(hlog, buf, len, text, sizeof(text));
+
+    EnterCriticalSection(&hlog->logCS);
+    fwrite(text, 1, len, hlog->logfp);
+    hlog->logline++;
+    fflush(hlog->logfp);
+    LeaveCriticalSection(&hlog->logCS);
+}
+
  
 void printOctet (FILE * fp, void * data, int start, int count, int margin)
 {
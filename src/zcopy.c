@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2003-2024 Ke Hengzhong <kehengzhong@hotmail.com>
+ * All rights reserved. See MIT LICENSE for redistribution.
+ *
+ * #####################################################
+ * #                       _oo0oo_                     #
+ * #                      o8888888o                    #
+ * #                      88" . "88                    #
+ * #                      (| -_- |)                    #
+ * #                      0\  =  /0                    #
+ * #                    ___/`---'\___                  #
+ * #                  .' \\|     |// '.                #
+ * #                 / \\|||  :  |||// \               #
+ * #                / _||||| -:- |||||- \              #
+ * #               |   | \\\  -  /// |   |             #
+ * #               | \_|  ''\---/''  |_/ |             #
+ * #               \  .-\__  '-'  ___/-. /             #
+ * #             ___'. .'  /--.--\  `. .'___           #
+ * #          ."" '<  `.___\_<|>_/___.'  >' "" .       #
+ * #         | | :  `- \`.;`\ _ /`;.`/ -`  : | |       #
+ * #         \  \ `_.   \_ __\ /__ _/   .-` /  /       #
+ * #     =====`-.____`.___ \_____/___.-`___.-'=====    #
+ * #                       `=---='                     #
+ * #     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~   #
+ * #               佛力加持      佛光普照              #
+ * #  Buddha's power blessing, Buddha's light shining  #
+ * #####################################################
+ */ 
+
+#include "btype.h"
+#include "memory.h"
+#include "trace.h"
+#include "zcopy.h"
+
+#ifdef _LINUX_
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+#if defined(_LINUX_) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#endif
+
+/* sequence a was issued before sequence b, 32-bit wrap around is considered */
+#define zc_before(a, b)  ((int32)((uint32)(a) - (uint32)(b)) < 0)
+
+
+void * zcopy_new (SOCKET fd, int threshold)
+{
+#ifdef HAVE_ZEROCOPY
+    zcopy_t * zc = NULL;
+    int       one = 1;
+
+    if (fd == INVALID_SOCKET) return NULL;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+        return NULL;
+
+    zc = kzalloc(sizeof(*zc));
+    if (!zc) return NULL;
+
+    zc->fd = fd;
+    zc->threshold = threshold > 0 ? threshold : 16384;
+
+    return zc;
+#else
+    return NULL;
+#endif
+}
+
+static void zcopy_release (zcopy_t * zc, int all)
+{
+    ZCHold * hold = NULL;
+
+    while (zc->holdnum > 0) {
+        hold = &zc->holds[zc->holdbgn];
+
+        if (!all && zc_before(zc->doneseq, hold->seq))
+            break;
+
+        if (hold->freefunc)
+            (*hold->freefunc)(hold->porig);
+
+        zc->holdbgn = (zc->holdbgn + 1) % zc->holdsize;
+        zc->holdnum--;
+        zc->released++;
+    }
+}
+
+void zcopy_free (void * vzc)
+{
+    zcopy_t * zc = (zcopy_t *)vzc;
+
+    if (!zc) return;
+
+    zcopy_release(zc, 1);
+
+    if (zc->holds) kfree(zc->holds);
+
+    kfree(zc);
+}
+
+int zcopy_threshold (void * vzc)
+{
+    zcopy_t * zc = (zcopy_t *)vzc;
+
+    if (!zc) return 0;
+
+    return zc->threshold;
+}
+
+int zcopy_sendv (void * vzc, struct iovec * iov, int iovcnt, int * perr)
+{
+#ifdef HAVE_ZEROCOPY
+    zcopy_t       * zc = (zcopy_t *)vzc;
+    struct msghdr   msg;
+    int             ret = 0;
+
+    if (perr) *perr = 0;
+
+    if (!zc) return -1;
+    if (!iov || iovcnt <= 0) return 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    for ( ; ; ) {
+        ret = sendmsg(zc->fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (ret >= 0) break;
+
+        if (errno == EINTR) continue;
+
+        if (perr) *perr = errno;
+
+        /* ENOBUFS: the locked page quota of the socket is used up */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            return 0;
+
+        return -30;
+    }
+
+    /* each successful call consumes one notification sequence */
+    if (ret > 0) {
+        zc->nextseq++;
+        zc->sendnum++;
+        zc->sendbytes += ret;
+    }
+
+    return ret;
+#else
+    if (perr) *perr = ENOTSUP;
+    return -100;
+#endif
+}
+
+int zcopy_hold (void * vzc, void * porig, void * freefunc)
+{
+    zcopy_t * zc = (zcopy_t *)vzc;
+    ZCHold  * holds = NULL;
+    int       i, size;
+
+    if (!zc) return -1;
+
+    if (zc->doneseq == zc->nextseq) {
+        zcopy_release(zc, 0);
+
+        if (freefunc) (*(ZCFree *)freefunc)(porig);
+        zc->released++;
+        return 0;
+    }
+
+    if (zc->holdnum >= zc->holdsize) {
+        size = zc->holdsize > 0 ? zc->holdsize * 2 : 32;
+
+        holds = kalloc(sizeof(*holds) * size);
+        if (!holds) {
+            tolog(1, "Panic: zcopy_hold failed to allocate %d entries\n", size);
+            return -2;
+        }
+
+        for (i = 0; i < zc->holdnum; i++)
+            holds[i] = zc->holds[(zc->holdbgn + i) % zc->holdsize];
+
+        if (zc->holds) kfree(zc->holds);
+
+        zc->holds = holds;
+        zc->holdsize = size;
+        zc->holdbgn = 0;
+    }
+
+    holds = &zc->holds[(zc->holdbgn + zc->holdnum) % zc->holdsize];
+    holds->porig = porig;
+    holds->freefunc = (ZCFree *)freefunc;
+    holds->seq = zc->nextseq;
+    zc->holdnum++;
+
+    return 1;
+}
+
+int zcopy_reap (void * vzc)
+{
+#ifdef HAVE_ZEROCOPY
+    zcopy_t                  * zc = (zcopy_t *)vzc;
+    struct msghdr              msg;
+    struct cmsghdr           * cm = NULL;
+    struct sock_extended_err * serr = NULL;
+    uint8                      control[128];
+    uint64                     released = 0;
+    int                        ret = 0;
+
+    if (!zc) return -1;
+
+    released = zc->released;
+
+    while (zc->doneseq != zc->nextseq) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ret = recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* TCP reports the completed range [ee_info, ee_data] in order */
+            if (!zc_before(serr->ee_data, zc->doneseq))
+                zc->doneseq = serr->ee_data + 1;
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->copied++;
+        }
+    }
+
+    zcopy_release(zc, 0);
+
+    return (int)(zc->released - released);
+#else
+    return 0;
+#endif
+}
+
+int zcopy_inflight (void * vzc)
+{
+    zcopy_t * zc = (zcopy_t *)vzc;
+
+    if (!zc) return 0;
+
+    return (int)(zc->nextseq - zc->doneseq);
+}
+
+int zcopy_holdnum (void * vzc)
+{
+    zcopy_t * zc = (zcopy_t *)vzc;
+
+    if (!zc) return 0;
+
+    return zc->holdnum;
+}
+